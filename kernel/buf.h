@@ -3,17 +3,21 @@
 #include "sleeplock.h"
 #include "types.h"
 
-#define BSIZE 1024  // block size
+#ifndef BSIZE
+#define BSIZE 1024  // block size: 512, 1024, 2048 or 4096
+#endif
+#define BPP   (PGSIZE / BSIZE)  // blocks per page
 
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int vq;      // the virtio queue it went on, while disk is 1
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // LRU list of the hash bucket
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes, carved out of a kalloc page
 };
 
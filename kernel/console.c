@@ -27,19 +27,35 @@
 
 extern struct devsw devsw[];
 
+extern volatile int panicking;  // from printf.c
+
 //
-// send one character to the uart.
+// send n characters to the uart.
 // called by printf(), and to echo input characters,
-// but not from write().
+// but not from write(). they are buffered, and panic()'s
+// go out at once.
 //
+void
+consputs(char *s, int n)
+{
+  if(panicking){
+    for(; n > 0; n--)
+      uartputc_sync(*s++);
+  } else {
+    uartputs(s, n);
+  }
+}
+
 void
 consputc(int c)
 {
+  char ch = c;
+
   if(c == BACKSPACE){
     // if the user typed backspace, overwrite with a space.
-    uartputc_sync('\b'); uartputc_sync(' '); uartputc_sync('\b');
+    consputs("\b \b", 3);
   } else {
-    uartputc_sync(c);
+    consputs(&ch, 1);
   }
 }
 
@@ -55,18 +71,20 @@ struct {
 } cons;
 
 //
-// user write()s to the console go here.
+// user write()s to the console go here,
+// copied in a chunk at a time.
 //
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
+  char buf[128];
+  int i, m;
 
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    uartwrite(buf, m);
   }
 
   return i;
@@ -79,7 +97,7 @@ consolewrite(int user_src, uint64 src, int n)
 // or kernel address.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, uint off)
 {
   uint target;
   int c;
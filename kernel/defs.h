@@ -7,17 +7,27 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct lockstat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct super_block;
+struct ucursor;
+struct vma;
+struct vdso;
+
+// bio.c
+int             bshrink(void);
+void            bprint(void);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
+void            consputs(char*, int);
 
 // exec.c
 int             exec(char*, char**);
@@ -25,13 +35,49 @@ int             exec(char*, char**);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kallocn(int);
+void*           kzalloc(void);
+int             kzero(void);
+void            kdup(void *);
+int             krefs(void *);
 void            kinit(void);
+uint64          kfreecount(void);
+void            kprint(void);
+
+// ring.c
+uint64          ringsetup(void);
+void            ringfree(struct proc*);
+int             ringenter(int);
+
+// mmap.c
+uint64          mmap(struct file*, uint64, int, int, uint);
+int             munmap(uint64, uint64);
+uint64          mmapbase(struct proc*);
+void            mmapexit(struct proc*);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapimage(struct proc*, struct vma*, int);
+uint64          vmfault(pagetable_t, uint64, int);
+
+// pagecache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint, int);
+int             pcread(struct inode*, int, uint64, uint, uint);
+int             pcwrite(struct inode*, int, uint64, uint, uint);
+void            pcreadahead(struct inode*, uint, uint);
+void            pcdirty(struct inode*, uint, char*);
+void            pcupdate(struct inode*, uint, char*, uint);
+int             pcfetch(struct inode*, uint, char*, uint);
+void            pcdrop(struct inode*);
+void            pcsync(uint);
+int             pcpending(uint);
+int             pcshrink(void);
+void            pcprint(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -54,9 +100,11 @@ struct cpu*     getmycpu(void);
 struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
+int             quantum(void);
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+int             kthread(char*, void (*)(void));
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -74,13 +122,43 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+struct lockstat* lockclass(char*, int);
+void            lockacquired(struct lockstat*, uint64);
+void            lockreleased(struct lockstat*, uint64);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             slabshrink(void);
+void            slabprint(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquireshared(struct sleeplock*);
+void            releaseshared(struct sleeplock*);
+int             holdingshared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// trace.c
+void            traceinit(void);
+void            tracerec(int, uint64, uint64);
+uint64          tracename(char*);
+
+// klog.c
+void            kloginit(void);
+
+// stats.c
+void            statsinit(void);
+void            statinc(int);
+void            statadd(int, uint64);
+uint64          statsum(int);
+int             statsread(int, uint64, int, uint);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -104,16 +182,22 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            timerarm(uint64);
+void            timerkick(int);
+int             sleepticks(int);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+void            uartwrite(char*, int);
+void            uartputs(char*, int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
 // vm.c
+extern struct vdso *vdsopage;
 void            kvminit(void);
+void            vdsoinit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
@@ -122,14 +206,20 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+uint64          uvmcow(pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int);
+uint64          uvmlazy(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+void            ucinit(struct ucursor*, pagetable_t);
+int             copyoutc(struct ucursor*, uint64, char *, uint64);
+int             copyinc(struct ucursor*, char *, uint64, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -140,7 +230,11 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_submitv(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_intr(int);
+int             virtio_disk_present(uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
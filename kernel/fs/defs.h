@@ -3,8 +3,11 @@
 #include "types.h"
 
 struct stat;
+struct proc;
 struct file;
 struct inode;
+struct dentry;
+struct iovec;
 
 // bio.c
 void            binit(void);
@@ -16,24 +19,59 @@ void            bunpin(struct buf*);
 
 // file.c
 struct file* filealloc(void);
+void               filefree(struct file*);
 void               fileclose(struct file*);
 struct file* filedup(struct file*);
+struct file*       fdget(struct proc*, int);
+int                fdgrow(struct proc*, int);
+int                fdalloc(struct file*);
+struct file*       fdremove(struct proc*, int);
+void               fdcopy(struct proc*, struct proc*);
+void               fdreset(struct proc*);
 void               fileinit(void);
 int                fileread(struct file*, uint64, int n);
+int                filereadv(struct file*, struct iovec*, int);
+int                filepread(struct file*, uint64, int, int);
 int                filestat(struct file*, uint64 addr);
+int                filesync(struct file*);
+int                filegetdents(struct file*, uint64, int);
 int                filewrite(struct file*, uint64, int n);
+int                filewritev(struct file*, struct iovec*, int);
+int                filepwrite(struct file*, uint64, int, int);
+int                filelseek(struct file*, int, int);
+int                filesendfile(struct file*, struct file*, int);
+
+// sysfile.c
+int                 openpath(char*, int);
+int                 fdclose(int);
 
 // fs.c
 void                fsinit(int);
+int                 diskdev(const char*);
+int                 fsmount(char*, char*);
+void                begin_op(void);
+void                end_op(void);
 int                 dirlink(struct inode*, char*, uint);
-struct inode* dirlookup(struct inode*, char*, uint*);
+struct inode* dirlookup(struct inode*, char*);
+void                dinvalidate(struct inode*, char*);
+void                dset(struct inode*, char*, uint);
+void                renamelock(void);
+void                renameunlock(void);
+int                 subdir(struct inode*, struct inode*);
+int                 ismountpoint(struct inode*);
+void                dirmoved(void);
+struct dentry*      dgetblank(void);
+void                dfree(struct dentry*);
+void                cwdchain(struct inode*);
 struct inode* ialloc(uint, short);
 struct inode* idup(struct inode*);
 void                iinit();
 void                ilock(struct inode*);
+void                ilockshared(struct inode*);
 void                iput(struct inode*);
 void                iunlock(struct inode*);
 void                iunlockput(struct inode*);
+void                iunlockshared(struct inode*);
 void                iupdate(struct inode*);
 struct inode*       iget(uint dev, uint inum);
 int                 namecmp(const char*, const char*);
@@ -43,6 +81,3 @@ int                 readi(struct inode*, int, uint64, uint, uint);
 void                stati(struct inode*, struct stat*);
 int                 writei(struct inode*, int, uint64, uint, uint);
 void                itrunc(struct inode*);
-
-// #define REF
-// #define LINK
\ No newline at end of file
@@ -6,9 +6,13 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "buf.h"
 #include "kernel/fs/defs.h"
 #include "kernel/defs.h"
 #include "kernel/fs/vfs.h"
+#include "xv6_fcntl.h"
+
+#define NSEG 4   // most segments mapped lazily
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -22,23 +26,54 @@ int flags2perm(int flags)
     return perm;
 }
 
+// The segments of the program are mapped lazily, as image
+// regions (see mmap.c), if there are at most NSEG of them,
+// each starts on a page of the file and a page of its own,
+// and they are in address order. Otherwise exec() reads them
+// all in now.
+static int
+lazysegs(struct inode *ip, struct elfhdr *elf)
+{
+  struct proghdr ph;
+  uint64 end;
+  int i, off, n;
+
+  end = 0;
+  n = 0;
+  for(i=0, off=elf->phoff; i<elf->phnum; i++, off+=sizeof(ph)){
+    if(ip->op->read(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
+      return 0;
+    if(ph.type != ELF_PROG_LOAD)
+      continue;
+    if(++n > NSEG || ph.off % PGSIZE != 0 || ph.vaddr < end)
+      return 0;
+    end = PGROUNDUP(ph.vaddr + ph.memsz);
+  }
+  return 1;
+}
+
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, lazy, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma seg[NSEG], *v;
+  struct file *f;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
   // printf("exec: %s\n", path);
+  begin_op();
+
   if((ip = namei(path)) == 0){
     // printf("exec: fail\n");
+    end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   // Check ELF header
   if(ip->op->read(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -51,6 +86,7 @@ exec(char *path, char **argv)
     goto bad;
 
   // Load program into memory.
+  lazy = lazysegs(ip, &elf);
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(ip->op->read(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -62,6 +98,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(lazy){
+      v = &seg[nseg++];
+      memset(v, 0, sizeof(*v));
+      v->addr = ph.vaddr;
+      v->len = PGROUNDUP(ph.vaddr + ph.memsz) - ph.vaddr;
+      v->prot = PROT_READ;
+      if(ph.flags & ELF_PROG_FLAG_WRITE)
+        v->prot |= PROT_WRITE;
+      if(ph.flags & ELF_PROG_FLAG_EXEC)
+        v->prot |= PROT_EXEC;
+      v->flags = MAP_PRIVATE;
+      v->off = ph.off;
+      v->flen = ph.filesz;
+      v->image = 1;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -69,7 +122,20 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  if(nseg > 0){
+    // the regions share one open file, which holds
+    // its own reference to ip.
+    if((f = ip->op->open(idup(ip), O_RDONLY)) == 0){
+      iput(ip);
+      goto bad;
+    }
+    f->op = ip->op;
+    for(i = 0; i < nseg; i++)
+      seg[i].f = i == 0 ? f : filedup(f);
+  }
+  iunlockshared(ip);
+  iput(ip);
+  end_op();
   ip = 0;
 
   p = myproc();
@@ -121,6 +187,8 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  mmapimage(p, seg, nseg);
+  ringfree(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
@@ -134,8 +202,13 @@ exec(char *path, char **argv)
   if(pagetable)
     proc_freepagetable(pagetable, sz);
   if(ip){
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
+    end_op();
   }
+  for(i = 0; i < nseg; i++)
+    if(seg[i].f)
+      fileclose(seg[i].f);
   return -1;
 }
 
@@ -148,6 +221,11 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
 {
   uint i, n;
   uint64 pa;
+  struct file_ra_state ra;
+
+  // the segment is read front to back.
+  memset(&ra, 0, sizeof(ra));
+  ra.next = offset / BSIZE;
 
   for(i = 0; i < sz; i += PGSIZE){
     pa = walkaddr(pagetable, va + i);
@@ -157,6 +235,8 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
       n = sz - i;
     else
       n = PGSIZE;
+    if(ip->op->readahead)
+      ip->op->readahead(ip, &ra, offset+i, n);
     if(ip->op->read(ip, 0, (uint64)pa, offset+i, n) != n)
       return -1;
   }
@@ -15,54 +15,186 @@
 #include "fs/xv6fs/defs.h"
 #include "stat.h"
 #include "proc.h"
+#include "xv6_fcntl.h"
 
 struct devsw devsw[NDEV];
 
 
+// Open files come from a slab cache, so there is no table
+// to search and no limit but memory. ftable.lock protects
+// their reference counts.
 struct {
-  struct file file[NFILE];
+  struct spinlock lock;
+  struct kmem_cache *cache;
 } ftable;
 
 
 void
 fileinit(void)
-{ // initialization of the file table
-  for(int i = 0; i < NFILE; i++){
-    ftable.file[i].private = 0;
-    ftable.file[i].ref = 0;
-  }
+{
+  initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
-// Allocate a file structure.
+// Allocate a file structure, with one reference.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      return f;
-    }
-  }
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
+}
+
+// Give back f, which filealloc() returned and nobody else
+// has seen.
+void
+filefree(struct file *f)
+{
+  kmem_cache_free(ftable.cache, f);
 }
 
 // Increment ref count for file f.
 struct file*
 filedup(struct file *f)
 {
+  acquire(&ftable.lock);
   if(f->ref < 1)
     panic("filedup");
   f->ref++;
+  release(&ftable.lock);
   return f;
 }
 
 // Close file f.  (Decrement ref count, close when reaches 0.)
+// A file without an inode is one end of a pipe, which no
+// filesystem knows about.
 void
 fileclose(struct file *f)
 {
-  f->op->close(f); // todo: Just this?
+  acquire(&ftable.lock);
+  if(f->ref < 1)
+    panic("fileclose");
+  if(--f->ref > 0){
+    release(&ftable.lock);
+    return;
+  }
+  release(&ftable.lock);
+
+  if(f->inode == 0)
+    pipeclose(f->private, f->writable);
+  else
+    f->op->close(f);
+  filefree(f);
+}
+
+// File descriptors.
+//
+// A process starts with room for NOFILE descriptors in the
+// proc itself, and the first fdalloc() past them moves its
+// table to a page, which holds MAXOFILE. p->fdmap has a bit
+// for each descriptor in use, so the lowest free one is found
+// a word at a time. The table is private to the process, so
+// no lock is needed.
+
+// The file that descriptor fd of p refers to, or 0.
+struct file*
+fdget(struct proc *p, int fd)
+{
+  if(fd < 0 || fd >= p->nofile)
+    return 0;
+  return p->ofile[fd];
+}
+
+// Make room for n descriptors in p's table.
+// Returns 0, or -1 if out of memory or n is too many.
+int
+fdgrow(struct proc *p, int n)
+{
+  struct file **t;
+
+  if(n <= p->nofile)
+    return 0;
+  if(n > MAXOFILE || (t = kalloc()) == 0)
+    return -1;
+  memset(t, 0, PGSIZE);
+  memmove(t, p->ofile, p->nofile * sizeof(t[0]));
+  p->ofile = t;
+  p->nofile = MAXOFILE;
+  return 0;
+}
+
+// Allocate the lowest free file descriptor of the current
+// process for f. Takes over the caller's reference to f on
+// success. Returns the descriptor, or -1.
+int
+fdalloc(struct file *f)
+{
+  struct proc *p = myproc();
+  uint64 w;
+  int i, fd;
+
+  for(i = 0; i < MAXOFILE/64 && p->fdmap[i] == ~0UL; i++)
+    ;
+  if(i == MAXOFILE/64)
+    return -1;
+  w = ~p->fdmap[i];
+  for(fd = i * 64; (w & 0xff) == 0; fd += 8)
+    w >>= 8;
+  for(; (w & 1) == 0; fd++)
+    w >>= 1;
+  if(fdgrow(p, fd + 1) < 0)
+    return -1;
+  p->ofile[fd] = f;
+  p->fdmap[fd/64] |= 1UL << (fd%64);
+  return fd;
+}
+
+// Take file descriptor fd out of p's table, returning the
+// file it referred to, whose reference the caller now has,
+// or 0.
+struct file*
+fdremove(struct proc *p, int fd)
+{
+  struct file *f;
+
+  if((f = fdget(p, fd)) == 0)
+    return 0;
+  p->ofile[fd] = 0;
+  p->fdmap[fd/64] &= ~(1UL << (fd%64));
+  return f;
+}
+
+// Give child np a copy of p's descriptors. np's table must
+// have room for them; see fdgrow().
+void
+fdcopy(struct proc *p, struct proc *np)
+{
+  int fd;
+
+  if(np->nofile < p->nofile)
+    panic("fdcopy");
+  for(fd = 0; fd < p->nofile; fd++)
+    if(p->ofile[fd])
+      np->ofile[fd] = filedup(p->ofile[fd]);
+  memmove(np->fdmap, p->fdmap, sizeof(p->fdmap));
+}
+
+// Give p back an empty table of NOFILE descriptors, freeing
+// the page of the one it had, if any. The descriptors must be
+// closed.
+void
+fdreset(struct proc *p)
+{
+  if(p->ofile && p->ofile != p->ofile0)
+    kfree(p->ofile);
+  memset(p->ofile0, 0, sizeof(p->ofile0));
+  memset(p->fdmap, 0, sizeof(p->fdmap));
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
 }
 
 // Get metadata about file f.
@@ -73,54 +205,228 @@ filestat(struct file *f, uint64 addr)
   struct proc *p = myproc();
   struct stat st;
   
-  ilock(f->inode);
+  if(f->inode == 0)
+    return -1;
+  ilockshared(f->inode);
   stati(f->inode, &st);
-  iunlock(f->inode);
+  iunlockshared(f->inode);
   if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
     return -1;
   return 0;
 }
 
+// Write file f's modified data to disk.
+int
+filesync(struct file *f)
+{
+  if(f->inode == 0 || f->inode->op->fsync == 0)
+    return -1;
+  return f->inode->op->fsync(f->inode);
+}
+
+// Read the entries of directory f into struct dirents
+// at user address addr. A buffer too small for one entry is
+// an error, not the end of the directory.
+int
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  struct inode *ip = f->inode;
+  uint off;
+  int r;
+
+  if(ip == 0 || ip->op->getdents == 0 || f->readable == 0)
+    return -1;
+  if(n < (int)sizeof(struct dirent))
+    return -1;
+  ilock(ip);
+  if(ip->type != T_DIR){
+    iunlock(ip);
+    return -1;
+  }
+  off = f->off;
+  r = ip->op->getdents(ip, &off, addr, n);
+  f->off = off;
+  iunlock(ip);
+  return r;
+}
+
+// Does iov[0..cnt) have a negative length?
+static int
+iovbad(struct iovec *iov, int cnt)
+{
+  int i;
+
+  for(i = 0; i < cnt; i++)
+    if(iov[i].iov_len < 0)
+      return 1;
+  return 0;
+}
+
+// Read from inode file f into the user buffers iov[0..cnt)
+// at *off, advancing *off, under one ilock(). *off may be
+// f->off, which the inode lock then protects, like f->ra.
+// If no other process has f, nobody else uses those, and
+// the lock is taken shared, so that readers of the file
+// through other open files go on at the same time.
+static int
+readiov(struct file *f, struct iovec *iov, int cnt, int *off)
+{
+  struct inode *ip = f->inode;
+  int i, r, tot, shared;
+
+  if(iovbad(iov, cnt))
+    return -1;
+  tot = 0;
+  shared = f->ref == 1;
+  if(shared)
+    ilockshared(ip);
+  else
+    ilock(ip);
+  for(i = 0; i < cnt; i++){
+    if(ip->op->readahead)
+      ip->op->readahead(ip, &f->ra, *off, iov[i].iov_len);
+    r = ip->op->read(ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len);
+    if(r < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    *off += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  if(shared)
+    iunlockshared(ip);
+  else
+    iunlock(ip);
+  return tot;
+}
+
+// Write the buffers iov[0..cnt), at user virtual addresses
+// if user_src is set, to inode file f at *off, advancing
+// *off. Writes a few blocks at a time to avoid exceeding the
+// maximum log transaction size, including i-node, indirect
+// block, allocation blocks, and 2 blocks of slop for
+// non-aligned writes; small buffers share a transaction and
+// an ilock(). *off may be f->off, which the
+// inode lock then protects; if f was opened O_APPEND, each
+// transaction then starts at the end of the file, so
+// appenders never overwrite each other's data.
+static int
+writeiov(struct file *f, int user_src, struct iovec *iov, int cnt, int *off)
+{
+  struct inode *ip = f->inode;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i, r, n1, m, tot, err;
+  uint64 base;
+  int left;
+
+  if(iovbad(iov, cnt))
+    return -1;
+  tot = 0;
+  err = 0;
+  i = 0;
+  base = cnt > 0 ? (uint64)iov[0].iov_base : 0;
+  left = cnt > 0 ? iov[0].iov_len : 0;
+  while(i < cnt && !err){
+    begin_op();
+    ilock(ip);
+    if(f->append && off == &f->off)
+      *off = ip->size;
+    for(m = 0; i < cnt && m < max; ){
+      n1 = left < max - m ? left : max - m;
+      if(n1 > 0){
+        if((r = ip->op->write(ip, user_src, base, *off, n1)) > 0){
+          *off += r;
+          m += r;
+          base += r;
+          left -= r;
+        }
+        if(r != n1){
+          // error from writei
+          err = 1;
+          break;
+        }
+      }
+      if(left == 0 && ++i < cnt){
+        base = (uint64)iov[i].iov_base;
+        left = iov[i].iov_len;
+      }
+    }
+    iupdate(ip);
+    iunlock(ip);
+    end_op();
+    tot += m;
+  }
+  return err ? -1 : tot;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1);
+}
+
+// Read from file f into the user buffers iov[0..cnt),
+// which the caller has copied in.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
 {
   // printf("entering fileread\n");
-  int r = 0;
+  int i, r, tot;
 
   if(f->readable == 0)
     return -1;
 
-  // if(f->type == FD_PIPE){
-  //   r = piperead(f->pipe, addr, n);
-  // } else if(f->type == FD_DEVICE){
-  //   if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-  //     return -1;
-  //   r = devsw[f->major].read(1, addr, n);
-  // if(f->inode->type == FD_INODE){
-  //   ilock(f->ip);
-  //   if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-  //     f->off += r;
-  //   iunlock(f->ip);
-  // } else {
-  //   panic("fileread");
-  // }
-  // to consider 
-  // printf("to consider\n");
+  if(f->inode == 0){
+    if(iovbad(iov, cnt))
+      return -1;
+    for(i = tot = 0; i < cnt; i++){
+      if((r = piperead(f->private, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
   if (f->inode->type == FD_DEVICE) {
     // printf("Yixing Chen\n");
-    r = devsw[CONSOLE].read(1, addr, n);
-  } else {
-    ilock(f->inode);
-    // printf("all parameters: %d %d %d %d\n", 1, addr, f->off, n);
-    if((r = f->inode->op->read(f->inode, 1, addr, f->off, n)) > 0)
+    if(iovbad(iov, cnt))
+      return -1;
+    for(i = tot = 0; i < cnt; i++){
+      if(devsw[f->major].read == 0 ||
+         (r = devsw[f->major].read(1, (uint64)iov[i].iov_base, iov[i].iov_len, f->off)) < 0)
+        return tot > 0 ? tot : -1;
       f->off += r;
-    iunlock(f->inode);
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
   }
+  return readiov(f, iov, cnt, &f->off);
+}
 
-  // printf("exiting fileread\n");
-  return r;
+// Read from file f at offset off, without using or
+// moving the file's offset. Not for devices.
+int
+filepread(struct file *f, uint64 addr, int n, int off)
+{
+  struct iovec iov;
+
+  if(f->readable == 0 || f->inode == 0 || f->inode->type == FD_DEVICE)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return readiov(f, &iov, 1, &off);
 }
 
 // Write to file f.
@@ -128,41 +434,164 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1);
+}
+
+// Write the user buffers iov[0..cnt), which the caller
+// has copied in, to file f.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
 
   if(f->writable == 0)
     return -1;
   
+  if(f->inode == 0){
+    if(iovbad(iov, cnt))
+      return -1;
+    for(i = tot = 0; i < cnt; i++){
+      if((r = pipewrite(f->private, 1, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
   if (f->inode->type == FD_DEVICE) {
-    ret = devsw[CONSOLE].write(1, addr, n);
-  } else {
-    // printf("##filewrite\n");
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      ilock(f->inode);
-      if ((r = f->inode->op->write(f->inode, 1, addr + i, f->off, n1)) > 0) {
-        f->off += r;
-        // printf("acturally wrote %d bytes\n", r);
-      }
-      iunlock(f->inode);
+    if(iovbad(iov, cnt))
+      return -1;
+    for(i = tot = 0; i < cnt; i++){
+      if(devsw[f->major].write == 0 ||
+         (r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+        return -1;
+      tot += r;
+    }
+    return tot;
+  }
+  return writeiov(f, 1, iov, cnt, &f->off);
+}
 
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
+// Write to file f at offset off, without using or
+// moving the file's offset, even if f is O_APPEND.
+// Not for devices.
+int
+filepwrite(struct file *f, uint64 addr, int n, int off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->inode == 0 || f->inode->type == FD_DEVICE)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return writeiov(f, 1, &iov, 1, &off);
+}
+
+// Write n bytes at kernel address src to file out.
+static int
+sendpage(struct file *out, char *src, int n)
+{
+  struct iovec iov;
+
+  if(out->inode == 0)
+    return pipewrite(out->private, 0, (uint64)src, n);
+  if(out->inode->type == FD_DEVICE)
+    return devsw[out->major].write ? devsw[out->major].write(0, (uint64)src, n) : -1;
+  iov.iov_base = src;
+  iov.iov_len = n;
+  return writeiov(out, 0, &iov, 1, &out->off);
+}
+
+// Copy up to n bytes of inode file in, from its offset, to
+// file out, a pipe, a device or another file, advancing both
+// offsets. The data goes from in's pages in the page cache
+// straight to out, and never through user space.
+// Returns the number of bytes copied, or -1.
+int
+filesendfile(struct file *out, struct file *in, int n)
+{
+  struct inode *ip = in->inode;
+  uint off, m;
+  int r, tot;
+  char *pg;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(ip == 0)
+    return -1;
+  ilock(ip);
+  if(ip->type != T_FILE){
+    iunlock(ip);
+    return -1;
+  }
+  off = in->off;
+  iunlock(ip);
+
+  tot = 0;
+  while(tot < n){
+    ilock(ip);
+    if(off >= ip->size){
+      iunlock(ip);
+      break;
+    }
+    if(ip->op->readahead)
+      ip->op->readahead(ip, &in->ra, off, n - tot);
+    m = PGSIZE - off % PGSIZE;
+    if(m > n - tot)
+      m = n - tot;
+    if(m > ip->size - off)
+      m = ip->size - off;
+    pg = pcget(ip, off / PGSIZE, 1);
+    iunlock(ip);
+    if(pg == 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    // in's lock is not held, so that out may be in, and a
+    // reader of a full pipe does not wait for it.
+    r = sendpage(out, pg + off % PGSIZE, m);
+    kfree(pg);
+    if(r > 0){
+      off += r;
+      tot += r;
+    }
+    if(r != m){
+      if(tot == 0)
+        tot = -1;
+      break;
     }
-    ret = (i == n ? n : -1);
   }
-  // } else {
-  //   panic("filewrite");
-  // }
 
-  return ret;
+  ilock(ip);
+  in->off = off;
+  iunlock(ip);
+  return tot;
 }
 
+// Move the offset of file f and return the new one,
+// or -1 if it would be negative or f is a device.
+int
+filelseek(struct file *f, int off, int whence)
+{
+  struct inode *ip = f->inode;
+
+  if(ip == 0 || ip->type == FD_DEVICE)
+    return -1;
+  ilock(ip);
+  if(whence == SEEK_CUR)
+    off += f->off;
+  else if(whence == SEEK_END)
+    off += ip->size;
+  else if(whence != SEEK_SET)
+    off = -1;
+  if(off >= 0)
+    f->off = off;
+  iunlock(ip);
+  return off < 0 ? -1 : off;
+}
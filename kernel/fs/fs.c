@@ -22,25 +22,198 @@
 #include "sleeplock.h"
 #include "fs/vfs.h"
 #include "buf.h"
+#include "stats.h"
+#include "klog.h"
+#include "trace.h"
 
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct super_block root;
-extern struct filesystem_type xv6fs;
+
+// Mounts.
+//
+// Each disk holds one file system with its own super block,
+// and each tmpfs mount is one more; a fs type's mount op
+// takes the sources it knows. root is the one on ROOTDEV, and root->mounts[0..nmount)
+// lists every mounted file system, root first. A mounted fs
+// covers a directory, its mountpoint, which it holds a
+// reference to; namex() steps from the mountpoint to the
+// fs's root, and from that root's ".." back to the
+// mountpoint's parent.
+//
+// Mounts are never undone, so the table only grows.
+// fsmount() appends under mountlock and bumps nmount after
+// the entry is in place; readers take no lock.
+struct super_block *root;
+static struct sleeplock mountlock;
+static int nmount;
+extern struct filesystem_type xv6fs, tmpfs;
+// the file system types, in the order fsmount() tries them.
+static struct filesystem_type *fstypes[] = { &xv6fs, &tmpfs };
+#define NFSTYPE (sizeof(fstypes) / sizeof(fstypes[0]))
+static struct kmem_cache *inode_cache;  // itable entries; see iget()
+static uint inode_size;
+
+// A rename that moves an entry to another directory holds
+// rename_lock: see sys_rename(). dirmoves counts the moves of
+// directories, which make every cwd chain suspect.
+static struct sleeplock rename_lock;
+static uint dirmoves;
 
 // Init fs
 void
 fsinit(int dev) {
-  // printf("entering fsinit\n");
-  
-  // struct filesystem_type fs_type = xv6fs; // suppose we've made one
-  xv6fs.op->init();
-  root.type = &xv6fs;
-  root.op = xv6fs.op;
-  root.op->mount("yuy");
-  // printf("fsinit done\n");
+  char source[] = "disk0";
+  int i;
+
+  // an itable entry must hold any fs's inode.
+  for(i = 0; i < NFSTYPE; i++)
+    if(fstypes[i]->inode_size > inode_size)
+      inode_size = fstypes[i]->inode_size;
+  inode_cache = kmem_cache_create("inode", inode_size);
+  initsleeplock(&mountlock, "mount");
+  initsleeplock(&rename_lock, "rename");
+  for(i = 0; i < NFSTYPE; i++)
+    fstypes[i]->op->init();
+  source[4] += dev;
+  if((root = xv6fs.op->mount(source)) == 0)
+    panic("fsinit: cannot mount root");
+  root->mounts[0] = root;
+  nmount = 1;
+}
+
+// The device number of disk name source, "diskN", or -1.
+int
+diskdev(const char *source)
+{
+  int dev;
+
+  if(strncmp(source, "disk", 4) != 0 || source[4] == 0)
+    return -1;
+  dev = 0;
+  for(source += 4; *source; source++){
+    if(*source < '0' || *source > '9' || dev > NDISK)
+      return -1;
+    dev = dev*10 + *source - '0';
+  }
+  return dev;
+}
+
+// The mounted fs on device dev, or 0.
+static struct super_block*
+devsb(uint dev)
+{
+  int i, n = nmount;
+
+  __sync_synchronize();
+  for(i = 0; i < n; i++)
+    if(root->mounts[i]->dev == dev)
+      return root->mounts[i];
+  return 0;
+}
+
+// The fs mounted on directory (dev, inum), or 0.
+static struct super_block*
+mountedon(uint dev, uint inum)
+{
+  struct super_block *s;
+  int i, n = nmount;
+
+  __sync_synchronize();
+  for(i = 1; i < n; i++){
+    s = root->mounts[i];
+    if(s->mountpoint->dev == dev && s->mountpoint->inum == inum)
+      return s;
+  }
+  return 0;
+}
+
+// Is a file system mounted on ip? A directory entry names
+// the covered directory, not the mounted root, so unlink()
+// and rename() use this to leave the entry alone.
+int
+ismountpoint(struct inode *ip)
+{
+  return nmount > 1 && mountedon(ip->dev, ip->inum) != 0;
+}
+
+// Mark the start of a system call that may write
+// to the file system; see begin_op in vfs.h.
+// The call may reach any mounted fs, so it starts an
+// operation on each, always in mount order. It records
+// how many it started for end_op(), since a mount may
+// come in between.
+void
+begin_op(void)
+{
+  struct super_block *s;
+  int i, n = nmount;
+
+  __sync_synchronize();
+  for(i = 0; i < n; i++){
+    s = root->mounts[i];
+    if(s->op->begin_op)
+      s->op->begin_op(s);
+  }
+  myproc()->opmounts = n;
+}
+
+// Mark the end of such a system call.
+void
+end_op(void)
+{
+  struct super_block *s;
+  int i;
+
+  for(i = myproc()->opmounts - 1; i >= 0; i--){
+    s = root->mounts[i];
+    if(s->op->end_op)
+      s->op->end_op(s);
+  }
+}
+
+// Mount the file system named by source, a disk "diskN" or
+// "tmpfs", on the directory target. Returns 0, or -1.
+int
+fsmount(char *source, char *target)
+{
+  struct super_block *s;
+  struct inode *ip;
+  int i;
+
+  begin_op();
+  if((ip = namei(target)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR || ip->inum == ROOTINO){
+    // not a directory, or the root of a mounted fs.
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  end_op();
+
+  acquiresleep(&mountlock);
+  s = 0;
+  if(nmount < MAXMNT && mountedon(ip->dev, ip->inum) == 0)
+    for(i = 0; i < NFSTYPE && s == 0; i++)
+      s = fstypes[i]->op->mount(source);
+  if(s == 0){
+    releasesleep(&mountlock);
+    begin_op();
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  s->mountpoint = ip;
+  s->parent = ip->sb;
+  root->mounts[nmount] = s;
+  __sync_synchronize();
+  nmount++;
+  releasesleep(&mountlock);
+  return 0;
 }
 
 // Inodes.
@@ -83,7 +256,10 @@ fsinit(int dev) {
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode. Code that only reads may
+//   lock it shared with ilockshared() instead, so that
+//   lookups in one directory, or reads of one file, run
+//   at once.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -111,13 +287,66 @@ fsinit(int dev) {
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// itable is hashed on (dev, inum). Entries come from a slab
+// cache, so the table grows with the number of inodes in use.
+// An entry is the fs's inode_size bytes, a struct inode
+// followed by fs data. An entry whose ref falls to zero stays
+// valid and goes on an LRU list, so that a later iget() revives it
+// without reading the disk. While the table holds more than
+// itable.max entries, iget() recycles the least recently used
+// idle entry; an entry that falls idle then is freed instead.
+// Recycling an entry drops its cached pages, so an entry
+// with dirty pages is kept until the log commits them.
+
+#define NIHASH 31
 
 struct {
-  struct inode inode[NINODE];
+  struct spinlock lock;
+  struct inode *hash[NIHASH];
+  struct inode lru;    // idle entries, most recently used first
+  int n;               // entries allocated
+  int max;             // entries kept; NINODE, more with memory
 } itable;
 
+
+// Dentry cache.
+//
+// dtable caches the results of directory lookups, so that
+// namex() can resolve a warm path without reading directory
+// blocks. An entry is keyed by (dev, parent inode number, name)
+// and records the inode number the name refers to, or 0 for a
+// name known not to exist. Entries hold no inode references.
+//
+// Lookups and changes of a directory's entries happen with the
+// directory locked, so a miss can scan the directory and fill
+// in the cache without racing with link or unlink. link and
+// unlink drop the entry for the name they change; freeing a
+// directory inode drops the entries of its children.
+//
+// The fs allocates the dentries its dirlookup returns from
+// dtable with dgetblank(). A dentry that is not in use is
+// recycled from the least recently used end of the cache.
+//
+// dtable.lock protects the hash chains, the LRU list and
+// the ref and cached fields of every entry.
+//
+// namex() first tries dwalk(), which follows the hash chains
+// without dtable.lock and without locking or referencing the
+// directories on the way. dtable.seq is a sequence count:
+// it is odd while the chains are being changed, and changes
+// whenever an entry is added or removed. dwalk() gives up,
+// and namex() takes the locked path, if it finds seq odd or
+// changed, or misses in the cache.
+
+#define NDHASH 61
+
 struct {
+  struct spinlock lock;
   struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  struct dentry lru;
+  uint seq;
 } dtable;
 
 void
@@ -125,85 +354,422 @@ iinit()
 {
   // printf("entering iinit\n");
   
-  int i = 0;
-  
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  initlock(&itable.lock, "itable");
+  itable.max = NINODE + kfreecount() / INODEFRAC;
+  itable.lru.prev = &itable.lru;
+  itable.lru.next = &itable.lru;
+
+  initlock(&dtable.lock, "dcache");
+  dtable.lru.prev = &dtable.lru;
+  dtable.lru.next = &dtable.lru;
   // printf("iinit done\n");
 }
 
+static uint
+dhash(uint dev, uint pinum, const char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + pinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Read dtable.seq, ordered with the reads around it.
+static uint
+dseq(void)
+{
+  uint seq;
+
+  __sync_synchronize();
+  seq = *(volatile uint*)&dtable.seq;
+  __sync_synchronize();
+  return seq;
+}
+
+// Bracket a change to the hash chains, so that
+// dwalk() notices. Caller must hold dtable.lock.
+static void
+dchange_begin(void)
+{
+  dtable.seq++;
+  __sync_synchronize();
+}
+
+static void
+dchange_end(void)
+{
+  __sync_synchronize();
+  dtable.seq++;
+}
+
+// Remove de from the hash table and the LRU list.
+// Caller must hold dtable.lock.
+static void
+dunhash(struct dentry *de)
+{
+  struct dentry **pp;
+
+  dchange_begin();
+  for(pp = &dtable.hash[dhash(de->dev, de->pinum, de->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == de){
+      *pp = de->hnext;
+      break;
+    }
+  }
+  de->hnext = 0;
+  de->prev->next = de->next;
+  de->next->prev = de->prev;
+  de->prev = de->next = 0;
+  de->cached = 0;
+  dchange_end();
+}
+
+// Cached entry for name in directory (dev, pinum), or 0.
+// Caller must hold dtable.lock.
+static struct dentry*
+dfind(uint dev, uint pinum, const char *name)
+{
+  struct dentry *de;
+
+  for(de = dtable.hash[dhash(dev, pinum, name)]; de; de = de->hnext){
+    if(de->dev == dev && de->pinum == pinum && namecmp(de->name, name) == 0)
+      return de;
+  }
+  return 0;
+}
+
+// Reset everything in de except ref and the cache fields.
+static void
+dclear(struct dentry *de)
+{
+  de->inode = 0;
+  de->parent = 0;
+  de->op = 0;
+  memset(de->name, 0, DIRSIZ);
+  de->ismount = 0;
+  de->deleted = 0;
+  de->private = 0;
+}
+
+// Allocate a dentry with ref 1: an unused one if there is
+// one, else the least recently used cached one.
+// Returns 0 if every dentry is in use.
 struct dentry*
 dgetblank()
 {
   // printf("entering dgetblank\n");
   
+  struct dentry *de;
   int i = 0;
+
+  acquire(&dtable.lock);
   for(i = 0; i < NDENTRY; i++) {
-    if (dtable.dentry[i].ref == 0) {
-      dtable.dentry[i].ref = 1;
+    de = &dtable.dentry[i];
+    if (de->ref == 0 && !de->cached) {
+      de->ref = 1;
+      release(&dtable.lock);
       // printf("dgetblank done\n");
-      return &dtable.dentry[i];
+      return de;
     }
   }
+  for(de = dtable.lru.prev; de != &dtable.lru; de = de->prev){
+    if(de->ref == 0){
+      dunhash(de);
+      de->ref = 1;
+      release(&dtable.lock);
+      if(de->op && de->op->release_dentry)
+        de->op->release_dentry(de);
+      dclear(de);
+      return de;
+    }
+  }
+  release(&dtable.lock);
   // printf("dgetblank done\n");
   return 0;
 }
 
+// Return a dentry that is not cached to dtable.
 void
 dfree(struct dentry *de)
 {
   // printf("entering dfree\n");
   
+  dclear(de);
+  acquire(&dtable.lock);
   de->ref = 0;
-  de->inode = 0;
-  de->parent = 0;
-  de->op = 0;
-  memset(de->name, 0, DIRSIZ);
-  de->ismount = 0;
-  de->deleted = 0;
-  de->private = 0;
+  release(&dtable.lock);
   // printf("dfree done\n");
 }
 
+// Look up name in directory dp, through the dentry cache.
+// Returns a referenced (but unlocked) inode, or 0 if
+// there is no such entry.
+// Caller must hold dp->lock, shared or not.
+struct inode*
+dirlookup(struct inode *dp, char *name)
+{
+  struct dentry *de;
+  struct inode *ip;
+  uint inum, h;
+
+  statinc(ST_DLOOKUP);
+  acquire(&dtable.lock);
+  if((de = dfind(dp->dev, dp->inum, name)) != 0){
+    statinc(ST_DCACHEHIT);
+    // move to the front of the LRU list.
+    de->prev->next = de->next;
+    de->next->prev = de->prev;
+    de->next = dtable.lru.next;
+    de->prev = &dtable.lru;
+    dtable.lru.next->prev = de;
+    dtable.lru.next = de;
+    inum = de->inum;
+    release(&dtable.lock);
+    if(inum == 0)
+      return 0;
+    ip = dp->op->geti(dp->dev, inum, 1);
+    ip->op = dp->op;
+    return ip;
+  }
+  release(&dtable.lock);
+
+  // Miss: scan the directory.
+  ip = 0;
+  if((de = dp->op->dirlookup(dp, name)) != 0){
+    ip = de->inode;
+    de->inode = 0;
+  } else if((de = dgetblank()) == 0){
+    return 0;    // cannot cache a negative entry
+  }
+
+  // Cache the result in de.
+  de->op = dp->op;
+  de->parent = 0;
+  strncpy(de->name, name, DIRSIZ);
+  de->dev = dp->dev;
+  de->pinum = dp->inum;
+  de->inum = ip ? ip->inum : 0;
+
+  acquire(&dtable.lock);
+  if(dfind(de->dev, de->pinum, de->name) != 0){
+    // another lookup with dp locked shared got there first.
+    release(&dtable.lock);
+    dfree(de);
+    return ip;
+  }
+  de->ref = 0;
+  h = dhash(de->dev, de->pinum, de->name);
+  dchange_begin();
+  de->hnext = dtable.hash[h];
+  dtable.hash[h] = de;
+  dchange_end();
+  de->next = dtable.lru.next;
+  de->prev = &dtable.lru;
+  dtable.lru.next->prev = de;
+  dtable.lru.next = de;
+  de->cached = 1;
+  release(&dtable.lock);
+
+  return ip;
+}
+
+// Forget what the cache knows about name in directory dp.
+// Called after the entry for name has been changed.
+// Caller must hold dp->lock.
+void
+dinvalidate(struct inode *dp, char *name)
+{
+  struct dentry *de;
+
+  acquire(&dtable.lock);
+  if((de = dfind(dp->dev, dp->inum, name)) != 0){
+    dunhash(de);
+    dclear(de);
+  }
+  release(&dtable.lock);
+}
+
+// Record in the cache that name in directory dp is now
+// inode inum, or that there is no such entry if inum is 0,
+// if the cache knows the name. Called after the entry has
+// been changed. Caller must hold dp->lock.
+void
+dset(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *de;
+
+  acquire(&dtable.lock);
+  if((de = dfind(dp->dev, dp->inum, name)) != 0){
+    dchange_begin();
+    de->inum = inum;
+    dchange_end();
+  }
+  release(&dtable.lock);
+}
+
+void
+renamelock(void)
+{
+  acquiresleep(&rename_lock);
+}
+
+void
+renameunlock(void)
+{
+  releasesleep(&rename_lock);
+}
+
+// Is directory dp ip, or below it? Follows ".." from dp up to
+// the root of its fs. Caller must hold no inode locks, and
+// rename_lock, so that no directory moves meanwhile. Must be
+// called inside a transaction.
+int
+subdir(struct inode *dp, struct inode *ip)
+{
+  struct inode *next;
+  int below;
+
+  dp = idup(dp);
+  while(dp != ip && dp->inum != ROOTINO){
+    ilockshared(dp);
+    next = dirlookup(dp, "..");
+    iunlockshared(dp);
+    iput(dp);
+    if((dp = next) == 0)
+      return 0;
+  }
+  below = dp == ip;
+  iput(dp);
+  return below;
+}
+
+// A directory is about to move to another parent.
+void
+dirmoved(void)
+{
+  __sync_fetch_and_add(&dirmoves, 1);
+}
+
+// Forget every entry in directory (dev, inum), which
+// is being freed and may come back as a different one.
+static void
+dpurge(uint dev, uint inum)
+{
+  struct dentry *de;
+
+  acquire(&dtable.lock);
+  for(de = dtable.dentry; de < dtable.dentry + NDENTRY; de++){
+    if(de->cached && de->dev == dev && de->pinum == inum){
+      dunhash(de);
+      dclear(de);
+    }
+  }
+  release(&dtable.lock);
+}
+
+static uint
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIHASH;
+}
+
+// Remove ip from the hash table.
+// Caller must hold itable.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[ihash(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
+  ip->hnext = 0;
+}
+
+// Take ip off the LRU list.
+// Caller must hold itable.lock.
+static void
+ilru_remove(struct inode *ip)
+{
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+  ip->prev = ip->next = 0;
+}
+
+// The least recently used idle entry that may be recycled,
+// or 0. An entry with dirty pages waits for them to be
+// written, since the pages need it; see pagecache.c.
+// Caller must hold itable.lock.
+static struct inode*
+ilru_victim(void)
+{
+  struct inode *ip;
+
+  for(ip = itable.lru.prev; ip != &itable.lru; ip = ip->prev)
+    if(ip->ndirty == 0)
+      return ip;
+  return 0;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 struct inode*
 iget(uint dev, uint inum)
 {
-  // printf("entering iget\n");
-  
-  struct inode *ip, *empty;
+  struct inode *ip;
+
+  statinc(ST_IGET);
+  acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      #ifdef LINK
-        printf("&node %d, ref++ in iget: %d\n", ip->inum, ip->ref);
-      #endif
-      // printf("iget done\n");
+  for(ip = itable.hash[ihash(dev, inum)]; ip; ip = ip->hnext){
+    statinc(ST_IGETSCAN);
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilru_remove(ip);   // revive an idle entry
+      klog(KS_VFS, KL_DEBUG, "iget: inode %d ref %d", ip->inum, ip->ref);
+      release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate an entry, or recycle the least recently used
+  // idle one if the table is full or memory is short.
+  ip = 0;
+  if(itable.n < itable.max || ilru_victim() == 0){
+    if((ip = kmem_cache_alloc(inode_cache)) != 0){
+      memset(ip, 0, inode_size);
+      initsleeplock(&ip->lock, "inode");
+      initlock(&ip->cachelock, "icache");
+      itable.n++;
+    }
+  }
+  if(ip == 0){
+    if((ip = ilru_victim()) == 0)
+      panic("iget: no inodes");
+    ilru_remove(ip);
+    iunhash(ip);
+    if(ip->valid && ip->op)
+      ip->op->release_inode(ip);
+    pcdrop(ip);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
+  ip->sb = devsb(dev);
   ip->ref = 1;
-  ip->private = 0;
-  #ifdef LINK
-    printf("&node %d, ref=1 in iget: %d\n", ip->inum, ip->ref);
-  #endif
-  // printf("iget done\n");
+  ip->valid = 0;
+  ip->hnext = itable.hash[ihash(dev, inum)];
+  itable.hash[ihash(dev, inum)] = ip;
+  klog(KS_VFS, KL_DEBUG, "iget: inode %d ref %d, new", ip->inum, ip->ref);
+  release(&itable.lock);
   return ip;
 }
 
@@ -212,14 +778,10 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  #ifdef DEBUG
-    printf("entering idup\n");
-  #endif
+  acquire(&itable.lock);
   ip->ref++;
-  #ifdef LINK
-    printf("&node %d, ref++ in idup: %d\n", ip->inum, ip->ref);
-    printf("idup done\n");
-  #endif
+  release(&itable.lock);
+  klog(KS_VFS, KL_DEBUG, "idup: inode %d ref %d", ip->inum, ip->ref);
   return ip;
 }
 
@@ -228,33 +790,67 @@ idup(struct inode *ip)
 void
 ilock(struct inode *ip)
 {
-  #ifdef LINK
-    printf("entering ilock for node %d\n", ip->inum);
-    printf("ref cnt for node %d: %d\n", ip->inum, ip->ref);
-  #endif
-  #ifdef LINK
-    printf("entering ilock for node %d\n", ip->inum);
-    printf("ref cnt for node %d: %d\n", ip->inum, ip->ref);
-  #endif
+  uint64 t0;
+
   if(ip == 0 || ip->ref < 1) {
     panic("ilock");
   }
 
-  acquiresleep(&ip->lock);
-  // printf("ip->op: %p\n", ip->op);
-  if (ip->private == 0) {
+  if(tracing(TR_ILOCK) && ip->lock.locked){
+    // somebody else has it: time the wait.
+    t0 = r_time();
+    acquiresleep(&ip->lock);
+    trace(TR_ILOCK, (uint64)ip->dev << 32 | ip->inum, r_time() - t0);
+  } else {
+    acquiresleep(&ip->lock);
+  }
+  if (!ip->valid) {
     ip->op->update_lock(ip);
   }
   // printf("ilock done\n");
 }
 
+// Lock the given inode shared, for code that only reads it
+// and its content: readers of the same inode then run at
+// once. Whatever they keep in the inode as a cache (see
+// pcslot() and bmap_lookup()) has a lock of its own.
+void
+ilockshared(struct inode *ip)
+{
+  uint64 t0;
+
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  // reading the inode from disk changes it: do that with
+  // the lock held exclusive. It stays valid while we hold
+  // our reference.
+  if(!ip->valid){
+    ilock(ip);
+    iunlock(ip);
+  }
+  if(tracing(TR_ILOCK) && ip->lock.locked == SL_EXCL){
+    t0 = r_time();
+    acquireshared(&ip->lock);
+    trace(TR_ILOCK, (uint64)ip->dev << 32 | ip->inum, r_time() - t0);
+  } else {
+    acquireshared(&ip->lock);
+  }
+}
+
+// Unlock an inode locked by ilockshared().
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || !holdingshared(&ip->lock) || ip->ref < 1)
+    panic("iunlockshared");
+  releaseshared(&ip->lock);
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
 {
-  #ifdef LINK
-    printf("entering iunlock for node %d\n", ip->inum);
-  #endif
 
   if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1) {
     if (ip == 0) {
@@ -273,8 +869,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry goes
+// on the LRU list, from which it can be revived or recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -283,42 +879,71 @@ void
 iput(struct inode *ip)
 {
   // printf("entering iput\n");
-  if (ip->private == 0) return;
-  
-  if(ip->ref == 1  && ip->nlink == 0) {
-    // inode has no links and no other references: truncate and free.
+  acquire(&itable.lock);
+
+  if(ip->valid && ip->ref == 1 && (ip->nlink == 0 || ip->dirty)){
+    // no other references: free an inode that has no links,
+    // or have the fs do that later, and write back a changed
+    // one before its entry can be recycled.
 
     // ip->ref == 1 means no other process can have ip locked,
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    ip->type = 0;
-    
-    ip->op->trunc(ip);
-    ip->op->write_inode(ip);
+    release(&itable.lock);
 
-    ip->op->free_inode(ip);
+    if(ip->nlink == 0){
+      dpurge(ip->dev, ip->inum);
+      if(ip->op->orphan == 0 || ip->op->orphan(ip) == 0){
+        ip->type = 0;
+        ip->op->trunc(ip);
+        ip->op->write_inode(ip);
 
-    releasesleep(&ip->lock);
-  }
-
-  
-  if (ip->ref == 1 && ip->nlink > 0) {
-    acquiresleep(&ip->lock);
-    ip->op->write_inode(ip);
-
-    ip->op->release_inode(ip);
+        ip->op->free_inode(ip);
+      }
+    } else {
+      ip->op->write_inode(ip);
+    }
 
     releasesleep(&ip->lock);
+
+    acquire(&itable.lock);
   }
 
-  ip->ref--;
-  #ifdef LINK
-    printf("&node %d, ref-- in iput: %d\n", ip->inum, ip->ref);
-  #endif
+  if(--ip->ref == 0){
+    if(!ip->valid || (itable.n > itable.max && ip->ndirty == 0)){
+      // freed on disk, or the table is over its size:
+      // drop the entry instead of caching it.
+      iunhash(ip);
+      itable.n--;
+      release(&itable.lock);
+      if(ip->valid)
+        ip->op->release_inode(ip);
+      pcdrop(ip);
+      kmem_cache_free(inode_cache, ip);
+      return;
+    }
+    ip->next = itable.lru.next;
+    ip->prev = &itable.lru;
+    itable.lru.next->prev = ip;
+    itable.lru.next = ip;
+  }
+  klog(KS_VFS, KL_DEBUG, "iput: inode %d ref %d", ip->inum, ip->ref);
+  release(&itable.lock);
   // printf("iput done\n");
 }
 
+// Have the fs write ip to disk if it has changed since it
+// was last written. A writer calls it once at the end of its
+// transaction, rather than the fs once per write.
+// Caller must hold ip->lock, in a transaction.
+void
+iupdate(struct inode *ip)
+{
+  if(ip->dirty)
+    ip->op->write_inode(ip);
+}
+
 // Common idiom: unlock, then put.
 void
 iunlockput(struct inode *ip)
@@ -342,11 +967,8 @@ stati(struct inode *ip, struct stat *st)
   st->type = ip->type;
   st->nlink = ip->nlink;
   st->size = ip->size;
-  struct xv6fs_inode *xv6fs_ip = (struct xv6fs_inode *)ip->private;
-  printf("stat for inode %p: dev %d, ino %d, type %d, nlink %d, size %d\n", ip->inum, st->dev, st->ino, st->type, st->nlink, st->size);
-  // print addr for xv6fs_inode
-  printf("xv6fs_inode addr: %p\n", xv6fs_ip);
-  // printf("stati done\n");
+  klog(KS_VFS, KL_DEBUG, "stati: dev %d inode %d type %d nlink %d size %d",
+       st->dev, st->ino, st->type, st->nlink, st->size);
 }
 
 // Directories
@@ -404,6 +1026,137 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Record in myproc()->cwdup the directories above ip, which
+// is becoming the process's cwd, up to the root or NCWDUP of
+// them. namex() then resolves the ".." elements at the start
+// of a relative path without a lookup. Directories cannot be
+// linked, so the chain stays right for as long as ip is the
+// cwd, unless some directory is moved by rename(): cwdskip()
+// ignores a chain made before the last such move. Must be
+// called inside a transaction.
+void
+cwdchain(struct inode *ip)
+{
+  struct proc *p = myproc();
+  struct inode *dp, *next;
+  int n;
+
+  p->cwdgen = dirmoves;
+  __sync_synchronize();
+  dp = idup(ip);
+  for(n = 0; n < NCWDUP && dp->inum != ROOTINO; n++){
+    ilockshared(dp);
+    next = dirlookup(dp, "..");
+    iunlockshared(dp);
+    iput(dp);
+    if((dp = next) == 0)
+      break;
+    p->cwdup[n] = dp->inum;
+  }
+  if(dp)
+    iput(dp);
+  p->ncwdup = n;
+}
+
+// Skip the ".." elements at the start of relative path that
+// the cwd chain answers, but not the last element if
+// nameiparent. Sets *inum to the directory the rest of path
+// is relative to, and returns the rest.
+static char*
+cwdskip(char *path, int nameiparent, uint *inum)
+{
+  struct proc *p = myproc();
+  char name[DIRSIZ], *rest;
+  int n;
+
+  *inum = p->cwd->inum;
+  for(n = 0; n < p->ncwdup && p->cwdgen == *(volatile uint*)&dirmoves; n++){
+    if((rest = skipelem(path, name)) == 0 || namecmp(name, "..") != 0)
+      break;
+    if(nameiparent && *rest == '\0')
+      break;
+    *inum = p->cwdup[n];
+    path = rest;
+  }
+  return path;
+}
+
+// Resolve path as namex() does, but from the dentry cache
+// alone: no directory is locked or referenced on the way,
+// and only the inode returned gets a reference. Returns 1
+// and sets *ipp (0 if some element does not exist) if the
+// cache answered; returns 0 if namex() must walk the path
+// itself, because of a miss or a concurrent change.
+static int
+dwalk(char *path, int nameiparent, char *name, struct inode **ipp)
+{
+  struct dentry *de;
+  struct inode *ip;
+  struct super_block *s;
+  uint seq, dev, inum;
+  int n;
+
+  seq = dseq();
+  if(seq & 1)
+    return 0;
+  if(*path == '/'){
+    dev = root->dev;
+    inum = ROOTINO;
+  } else {
+    dev = myproc()->cwd->dev;
+    path = cwdskip(path, nameiparent, &inum);
+  }
+
+  while((path = skipelem(path, name)) != 0){
+    trace(TR_NAMEI, (uint64)dev << 32 | inum, tracename(name));
+    if(nameiparent && *path == '\0')
+      break;
+    if(inum == ROOTINO && dev != root->dev && namecmp(name, "..") == 0)
+      return 0;   // leaves a mounted fs; namex() knows how
+    // bound the chain walk: a change can link the chains
+    // oddly while we follow them.
+    de = dtable.hash[dhash(dev, inum, name)];
+    for(n = 0; de && n < NDENTRY; n++, de = de->hnext){
+      if(de->dev == dev && de->pinum == inum && namecmp(de->name, name) == 0)
+        break;
+    }
+    if(de == 0 || n == NDENTRY)
+      return 0;
+    if((inum = de->inum) == 0)
+      break;    // negative entry: no such file
+    if(nmount > 1 && (s = mountedon(dev, inum)) != 0){
+      dev = s->dev;
+      inum = ROOTINO;
+    }
+  }
+  if(dseq() != seq)
+    return 0;
+  if(inum == 0 || (path == 0 && nameiparent)){
+    *ipp = 0;
+    return 1;
+  }
+
+  // the entry may have gone since it was read; if so,
+  // seq has changed by the time the reference is taken.
+  ip = iget(dev, inum);
+  ip->op = ip->sb->op;
+  if(dseq() != seq){
+    iput(ip);
+    return 0;
+  }
+  if(nameiparent){
+    ilock(ip);
+    if(ip->type != T_DIR){
+      iunlockput(ip);
+      ip = 0;
+    } else {
+      iunlock(ip);
+    }
+  }
+  *ipp = ip;
+  return 1;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
@@ -414,18 +1167,33 @@ namex(char *path, int nameiparent, char *name)
   // printf("entering namex\n");
   // printf("path: %s\n", path);
   
-  struct inode *ip, *next;
+  struct inode *ip, *next, *cwd;
+  struct super_block *s;
+  uint inum;
+
+  if(dwalk(path, nameiparent, name, &ip))
+    return ip;
 
   if(*path == '/') {
-    ip = iget(ROOTDEV, ROOTINO);
+    ip = idup(root->root);
+  }
+  else {
+    path = cwdskip(path, nameiparent, &inum);
+    cwd = myproc()->cwd;
+    if(inum == cwd->inum)
+      ip = idup(cwd);
+    else {
+      ip = iget(cwd->dev, inum);
+      ip->op = cwd->op;
+    }
   }
-  else
-    ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    trace(TR_NAMEI, (uint64)ip->dev << 32 | ip->inum, tracename(name));
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     // printf("path: %s\n", path);
@@ -433,15 +1201,28 @@ namex(char *path, int nameiparent, char *name)
     if(nameiparent && *path == '\0'){
       // Stop one level early.
       // printf("has mother\n");
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    struct dentry *de = ip->op->dirlookup(ip, name);
-    if (de == 0 || (next = de->inode) == 0) {
-      iunlockput(ip);
+    if(ip->inum == ROOTINO && ip->sb && ip->sb->mountpoint &&
+       namecmp(name, "..") == 0){
+      // ".." of a mounted fs's root: that of its mountpoint.
+      next = idup(ip->sb->mountpoint);
+      iunlockshared(ip);
+      iput(ip);
+      ip = next;
+      ilockshared(ip);
+    }
+    next = dirlookup(ip, name);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
+    if(nmount > 1 && (s = mountedon(next->dev, next->inum)) != 0){
+      // step from the mountpoint onto the mounted fs.
+      iput(next);
+      next = idup(s->root);
     }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -0,0 +1,369 @@
+//
+// Memory-mapped files.
+//
+// mmap() records a region (struct vma) in the process and
+// maps nothing. The first access to a page faults, and
+// vmfault() maps the file's page from the page cache, so
+// that every process that maps the file, and read() and
+// write(), see the same page. A page of a MAP_SHARED region
+// that was stored to is marked dirty in the page cache by
+// munmap() and exit(), which writes it back with the next
+// log commit. Pages are mapped read-only until the first
+// store to them, so that a page that was only read is never
+// written back, and a MAP_PRIVATE region gets its own copy
+// of a page then. munmap() and exit() must not be called in
+// a transaction, since vmadirty() starts one.
+//
+// Regions are placed top-down under the RING page, and the
+// heap may not grow into them.
+//
+// exec() maps the program's segments as "image" regions, so
+// that text pages are read in only when they are touched and
+// are shared by every process running the program. Image
+// regions lie below p->sz, and their pages belong to the
+// address space like the heap's: uvmcopy() and uvmunmap()
+// handle them, and munmap() refuses to.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "kernel/defs.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "buf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "stat.h"
+#include "vfs.h"
+#include "xv6_fcntl.h"
+#include "klog.h"
+
+// The region of p that contains va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NVMA; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// The lowest address that a region of p uses,
+// or RING if there are none.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base;
+
+  base = RING;
+  for(v = p->vma; v < p->vma + NVMA; v++)
+    if(v->len && !v->image && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map len bytes of file f, starting at offset off, into the
+// current process. Returns the address, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *fv;
+  uint64 addr;
+
+  if(len == 0 || off % PGSIZE != 0 || f->inode == 0 || f->inode->type != T_FILE)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if((prot & PROT_READ) && !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable)
+    return -1;
+
+  len = PGROUNDUP(len);
+  addr = mmapbase(p);
+  if(addr - PGROUNDUP(p->sz) < len)
+    return -1;
+  addr -= len;
+
+  fv = 0;
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->len == 0){
+      fv = v;
+      break;
+    }
+  }
+  if(fv == 0)
+    return -1;
+  fv->addr = addr;
+  fv->len = len;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->off = off;
+  fv->flen = len;
+  fv->image = 0;
+  fv->f = filedup(f);
+  return addr;
+}
+
+// Replace p's regions with the n image regions in img,
+// which exec() made for the new program.
+void
+mmapimage(struct proc *p, struct vma *img, int n)
+{
+  mmapexit(p);
+  memmove(p->vma, img, n * sizeof(struct vma));
+}
+
+// Page va of shared region v, at kernel address pa, was
+// stored to: have the page cache write it back, if it is
+// still the file's page. The page may lie over a hole of a
+// sparse file, whose blocks are allocated now.
+static void
+vmadirty(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->f->inode;
+  uint idx = (v->off + (va - v->addr)) / PGSIZE;
+
+  begin_op();
+  ilock(ip);
+  if(ip->op->allocpage && ip->op->allocpage(ip, idx) < 0)
+    klog(KS_VFS, KL_WARN, "mmap: no blocks for page %d of inode %d",
+         idx, ip->inum);
+  pcdirty(ip, idx, (char*)pa);
+  iunlock(ip);
+  end_op();
+}
+
+// Remove the pages of p's region v in [va, va+len), writing
+// back the pages of a shared region that were stored to if
+// writeback is set. len is a multiple of PGSIZE.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len, int writeback)
+{
+  uint64 a, pa;
+  pte_t *pte;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    if(writeback && v->flags == MAP_SHARED && (*pte & PTE_W))
+      vmadirty(v, a, pa);
+    kfree((void*)pa);
+    *pte = 0;
+  }
+}
+
+// Unmap [addr, addr+len), which must be the start, the end
+// or the whole of one region. Returns 0, or -1.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  len = PGROUNDUP(len);
+  if(addr % PGSIZE != 0 || len == 0 || (v = vmafind(p, addr)) == 0)
+    return -1;
+  if(v->image)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;     // would leave a hole
+  if(addr + len > v->addr + v->len)
+    return -1;
+
+  vmaunmap(p, v, addr, len, 1);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Unmap every region of p, as exit() and exec() do.
+void
+mmapexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->len == 0)
+      continue;
+    if(!v->image)
+      vmaunmap(p, v, v->addr, v->len, 1);
+    fileclose(v->f);
+    v->f = 0;
+    v->len = 0;
+  }
+}
+
+// Give child np a copy of p's regions and map the pages of
+// them that p has faulted in. Both share the pages of shared
+// regions, and the pages of private ones, which vmfault()
+// copies on a store, or uvmcow() if they were stored to.
+// Returns 0, or -1.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  uint64 a, pa;
+  pte_t *pte;
+
+  for(v = p->vma, nv = np->vma; v < p->vma + NVMA; v++, nv++){
+    *nv = *v;
+    if(v->len == 0)
+      continue;
+    nv->f = filedup(v->f);
+    if(v->image)
+      continue;   // uvmcopy() did the pages
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(v->flags == MAP_PRIVATE && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      kdup((void*)pa);
+      if(mappages(np->pagetable, a, PGSIZE, pa, PTE_FLAGS(*pte)) != 0){
+        kfree((void*)pa);
+        goto err;
+      }
+    }
+  }
+  return 0;
+
+ err:
+  // nv is the region being copied; the ones after it are not set.
+  for(nv++; nv < np->vma + NVMA; nv++)
+    nv->len = 0;
+  for(nv = np->vma; nv < np->vma + NVMA; nv++){
+    if(nv->len == 0)
+      continue;
+    if(!nv->image)
+      vmaunmap(np, nv, nv->addr, nv->len, 0);
+    fileclose(nv->f);
+    nv->f = 0;
+    nv->len = 0;
+  }
+  return -1;
+}
+
+// Page pa for a store to a private region: pa itself if
+// nobody else uses it, otherwise a copy, for which the
+// caller's reference to pa is dropped. Returns 0, keeping
+// the reference, if out of memory.
+static uint64
+privpage(uint64 pa)
+{
+  char *mem;
+
+  if(krefs((void*)pa) == 1)
+    return pa;
+  if((mem = kalloc()) == 0)
+    return 0;
+  memmove(mem, (char*)pa, PGSIZE);
+  kfree((void*)pa);
+  return (uint64)mem;
+}
+
+// Handle a fault at user address va of pagetable for an
+// access of kind prot (PROT_READ, PROT_WRITE or PROT_EXEC):
+// map the page if va is in a region of the current process
+// that allows the access, or in its heap. Also called by copyin() and
+// copyout() for pages that are not mapped yet. Returns the
+// physical address of the page, or 0.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int prot)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  uint64 pa, r;
+  char *mem;
+  uint off;
+  int locked, write, perm;
+
+  if(p == 0 || pagetable != p->pagetable || va >= MAXVA)
+    return 0;
+  va = PGROUNDDOWN(va);
+  if((v = vmafind(p, va)) == 0){
+    // the heap, which sbrk() grows without mapping it.
+    if(va < p->sz && prot != PROT_EXEC)
+      return uvmlazy(pagetable, va);
+    return 0;
+  }
+  if((v->prot & prot) == 0)
+    return 0;
+  write = prot == PROT_WRITE;
+
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    // present: a store to a page that was only read.
+    pa = PTE2PA(*pte);
+    if(write && v->flags == MAP_PRIVATE){
+      if((pa = privpage(pa)) == 0)
+        return 0;   // still maps the old page
+      *pte = PA2PTE(pa) | PTE_FLAGS(*pte);
+    }
+    if(write)
+      *pte |= PTE_W;
+    return pa;
+  }
+
+  ip = v->f->inode;
+  r = va - v->addr;
+  off = v->off + r;
+  pa = 0;
+  // copyout() from a read() of this file holds ip->lock,
+  // shared or not.
+  if((locked = holdingsleep(&ip->lock) || holdingshared(&ip->lock)) == 0)
+    ilock(ip);
+  if(r < v->flen && off < ip->size){
+    pa = (uint64)pcget(ip, off / PGSIZE, 1);
+    if(pa && r + PGSIZE > v->flen){
+      // a segment that ends inside the page: what follows
+      // it in the file must not show.
+      if((mem = kalloc()) != 0){
+        memmove(mem, (char*)pa, v->flen - r);
+        memset(mem + (v->flen - r), 0, PGSIZE - (v->flen - r));
+      }
+      kfree((void*)pa);
+      pa = (uint64)mem;
+    }
+  } else if((mem = kzalloc()) != 0){
+    // past the end of the file: a page of zeros of our own.
+    pa = (uint64)mem;
+  }
+  if(!locked)
+    iunlock(ip);
+  if(pa == 0)
+    return 0;
+
+  if(write && v->flags == MAP_PRIVATE){
+    if((mem = (char*)privpage(pa)) == 0){
+      kfree((void*)pa);
+      return 0;
+    }
+    pa = (uint64)mem;
+  }
+  perm = PTE_U | PTE_R;
+  if(write)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(mappages(pagetable, va, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  return pa;
+}
@@ -0,0 +1,690 @@
+//
+// Page cache.
+//
+// File data is cached a page at a time, in pages from
+// kalloc(), instead of in the buffer cache, which keeps only
+// metadata: inodes, bitmaps, indirect blocks and directories.
+// Each inode has its own cache, a radix tree of its pages
+// keyed by page number: PCFAN slots per node, and as many
+// levels (ip->pheight) as the largest page number needs.
+// A missing page is filled with one read of its BPP blocks,
+// which the driver merges into one request when they are
+// contiguous on disk. mmap() maps the cached pages
+// themselves, so a page is shared by every process that
+// maps the file and by read() and write().
+//
+// Writes only change the cached page and mark it dirty; the
+// page remembers the blocks it goes to. The log does not
+// carry file data. pcsync() writes the dirty pages when the
+// log commits, before its commit record, so the metadata that
+// points to newly allocated blocks is never on the disk
+// before their data is. A crash may lose recent writes, but
+// never shows a file another file's old data.
+//
+// A page's kalloc() reference count says who uses it: the
+// cache holds one reference, and mappings and readers copying
+// out of it one each. When kalloc() runs out of memory,
+// pcshrink() frees the least recently used clean pages that
+// only the cache holds. The tree's nodes go away with the
+// inode: when the file is truncated, or when its inode table
+// entry is recycled. iget() does not recycle an entry that
+// still has dirty pages.
+//
+// Locking: ip->lock must be held to use ip's cache, and held
+// exclusive to change or drop its pages. Readers holding it
+// shared may fill the same page at once; the first to finish
+// wins. pcache.lock protects the slots, the shape of the
+// trees, the lists, and the dirty counts, so that pcshrink()
+// and pcsync() need no inode locks.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "kernel/defs.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "buf.h"
+#include "stat.h"
+#include "vfs.h"
+#include "stats.h"
+
+#define PCSHIFT  6
+#define PCFAN    (1 << PCSHIFT)  // slots per tree node
+#define PCBATCH  (RAMAX / BPP)   // pages read or written at once
+#define PCSHRINK 32              // most pages pcshrink() frees
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct pcnode {
+  void *slot[PCFAN];   // pcnodes, or pages at the bottom level
+};
+
+// Buffers for the disk requests of one page; only the
+// fields that virtio_disk.c uses are set.
+struct pageio {
+  struct buf b[BPP];
+};
+
+struct page {
+  struct inode *ip;
+  uint idx;            // page number in the file
+  char *data;          // the page
+  int dirty;
+  uint blocks[BPP];    // where pcsync() writes it
+  void **slot;         // its slot in ip's tree
+  struct pageio *io;   // read in progress, in pcreadahead()
+  struct page *prev;   // in pcache.lru or pcache.dirty
+  struct page *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct page lru;     // clean pages, most recently used first
+  struct page dirty;   // dirty pages, oldest first
+  int n;               // pages cached
+  int ndirty;
+} pcache;
+
+static struct kmem_cache *page_cache;
+static struct kmem_cache *pcnode_cache;
+static struct kmem_cache *pageio_cache;
+
+// What pcsync() writes with, a page at a time, when it can't
+// allocate a pageio, so that a commit makes progress however
+// low memory is.
+static struct {
+  struct sleeplock lock;
+  struct pageio io;
+} spare;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.lru.prev = pcache.lru.next = &pcache.lru;
+  pcache.dirty.prev = pcache.dirty.next = &pcache.dirty;
+  page_cache = kmem_cache_create("page", sizeof(struct page));
+  pcnode_cache = kmem_cache_create("pcnode", sizeof(struct pcnode));
+  pageio_cache = kmem_cache_create("pageio", sizeof(struct pageio));
+  initsleeplock(&spare.lock, "pcspare");
+}
+
+static void
+page_remove(struct page *pg)
+{
+  pg->prev->next = pg->next;
+  pg->next->prev = pg->prev;
+}
+
+// Insert pg at the front of list head.
+static void
+page_push(struct page *head, struct page *pg)
+{
+  pg->next = head->next;
+  pg->prev = head;
+  head->next->prev = pg;
+  head->next = pg;
+}
+
+// Insert pg at the back of list head.
+static void
+page_append(struct page *head, struct page *pg)
+{
+  page_push(head->prev, pg);
+}
+
+// Walk ip's tree to the bottom-level slot for page idx. If
+// np is not 0, *np is a node to add where the tree needs one;
+// the walk takes it and sets *np to 0. Returns 0 if there is
+// no such slot, or it takes another node.
+// Caller holds pcache.lock.
+static void**
+pcwalk(struct inode *ip, uint idx, struct pcnode **np)
+{
+  void **slot;
+  int h;
+
+  while(ip->pheight == 0 || (idx >> (PCSHIFT * ip->pheight)) != 0){
+    if(np == 0 || *np == 0)
+      return 0;
+    // the old root becomes slot 0; the nodes below it keep
+    // their addresses, so no page's slot moves.
+    (*np)->slot[0] = ip->pages;
+    ip->pages = *np;
+    ip->pheight++;
+    *np = 0;
+  }
+
+  slot = &ip->pages;
+  for(h = ip->pheight - 1; ; h--){
+    if(*slot == 0){
+      if(np == 0 || *np == 0)
+        return 0;
+      *slot = *np;
+      *np = 0;
+    }
+    slot = &((struct pcnode*)*slot)->slot[(idx >> (PCSHIFT * h)) & (PCFAN-1)];
+    if(h == 0)
+      return slot;
+  }
+}
+
+// The bottom-level slot for page idx in ip's tree. If alloc
+// is set, grows the tree and adds the nodes on the way.
+// Returns 0 if there is no such slot or no memory.
+// Caller must hold ip->lock. Holders of it shared may grow
+// the tree at once, so its shape also changes only under
+// pcache.lock; a slot stays where it is until pcdrop().
+static void**
+pcslot(struct inode *ip, uint idx, int alloc)
+{
+  struct pcnode *n;
+  void **slot;
+
+  n = 0;
+  acquire(&pcache.lock);
+  while((slot = pcwalk(ip, idx, alloc ? &n : 0)) == 0 && alloc){
+    // kmem_cache_alloc() may shrink the cache.
+    release(&pcache.lock);
+    if((n = kmem_cache_alloc(pcnode_cache)) == 0)
+      return 0;
+    memset(n, 0, sizeof(*n));
+    acquire(&pcache.lock);
+  }
+  release(&pcache.lock);
+  if(n)
+    kmem_cache_free(pcnode_cache, n);
+  return slot;
+}
+
+// Return the data of the page in *slot with a reference
+// for the caller, or 0 if the slot is empty.
+static char*
+pclookup(void **slot)
+{
+  struct page *pg;
+  char *data;
+
+  acquire(&pcache.lock);
+  if((pg = *slot) == 0){
+    statinc(ST_PCMISS);
+    release(&pcache.lock);
+    return 0;
+  }
+  statinc(ST_PCHIT);
+  if(!pg->dirty){
+    page_remove(pg);
+    page_push(&pcache.lru, pg);
+  }
+  data = pg->data;
+  kdup(data);
+  release(&pcache.lock);
+  return data;
+}
+
+// Start the disk requests that read (write == 0) or write
+// data from or to blocks, one request per contiguous run.
+// Zero blocks are skipped.
+static void
+pcio(struct pageio *io, uint dev, uint *blocks, char *data, int write)
+{
+  struct buf *run[BPP];
+  int i, n;
+
+  memset(io, 0, sizeof(*io));
+  for(i = 0; i < BPP; ){
+    for(n = 0; i + n < BPP && blocks[i+n] &&
+               (n == 0 || blocks[i+n] == blocks[i] + n); n++){
+      io->b[i+n].dev = dev;
+      io->b[i+n].blockno = blocks[i+n];
+      io->b[i+n].data = (uchar*)data + (i+n)*BSIZE;
+      run[n] = &io->b[i+n];
+    }
+    if(n == 0){
+      i++;
+      continue;
+    }
+    virtio_disk_submitv(run, n, write);
+    i += n;
+  }
+}
+
+// Wait for the requests that pcio() started. Zero blocks
+// were never submitted and have no device to wait on.
+static void
+pcwait(struct pageio *io)
+{
+  int i;
+
+  for(i = 0; i < BPP; i++)
+    if(io->b[i].blockno)
+      virtio_disk_wait(&io->b[i]);
+}
+
+// Make a page for page idx of ip and, if fill is set, have
+// the fs fill it or start reading it from disk; otherwise it
+// is all zeros.
+// Returns 0 if out of memory.
+static struct page*
+pcstart(struct inode *ip, uint idx, int fill)
+{
+  struct page *pg;
+
+  // keep memory for processes; see BRESERVE in bio.c.
+  if(kfreecount() < BRESERVE)
+    pcshrink();
+  if((pg = kmem_cache_alloc(page_cache)) == 0)
+    return 0;
+  memset(pg, 0, sizeof(*pg));
+  if((pg->data = kalloc()) == 0){
+    kmem_cache_free(page_cache, pg);
+    return 0;
+  }
+  memset(pg->data, 0, PGSIZE);
+  pg->ip = ip;
+  pg->idx = idx;
+  if(!fill || (uint64)idx * PGSIZE >= ip->size)
+    return pg;
+  if(ip->op->fillpage && ip->op->fillpage(ip, idx, pg->data))
+    return pg;
+  if(ip->op->mappage){
+    if((pg->io = kmem_cache_alloc(pageio_cache)) == 0){
+      kfree(pg->data);
+      kmem_cache_free(page_cache, pg);
+      return 0;
+    }
+    ip->op->mappage(ip, idx, pg->blocks);
+    pcio(pg->io, ip->dev, pg->blocks, pg->data, 0);
+  }
+  return pg;
+}
+
+// Wait for pg's read, if any, and put pg in slot. Returns
+// its data, with a reference for the caller. If another
+// holder of ip->lock shared filled the slot meanwhile, pg
+// is dropped and the data is that page's.
+static char*
+pcfinish(struct inode *ip, struct page *pg, void **slot)
+{
+  struct page *old;
+  char *data;
+  uint end;
+
+  if(pg->io){
+    pcwait(pg->io);
+    kmem_cache_free(pageio_cache, pg->io);
+    pg->io = 0;
+    // the blocks may hold junk past the end of the file.
+    end = ip->size - pg->idx * PGSIZE;
+    if(end < PGSIZE)
+      memset(pg->data + end, 0, PGSIZE - end);
+  }
+  acquire(&pcache.lock);
+  if((old = *slot) != 0){
+    if(!old->dirty){
+      page_remove(old);
+      page_push(&pcache.lru, old);
+    }
+    data = old->data;
+    kdup(data);
+    release(&pcache.lock);
+    kfree(pg->data);
+    kmem_cache_free(page_cache, pg);
+    return data;
+  }
+  pg->slot = slot;
+  *slot = pg;
+  page_push(&pcache.lru, pg);
+  pcache.n++;
+  kdup(pg->data);
+  release(&pcache.lock);
+  return pg->data;
+}
+
+// Return the data of page idx of ip, with a reference that
+// the caller drops with kfree(). A page that is not cached
+// is read from disk if fill is set, and is all zeros if not.
+// Returns 0 if out of memory.
+// Caller must hold ip->lock, shared or not.
+char*
+pcget(struct inode *ip, uint idx, int fill)
+{
+  struct page *pg;
+  void **slot;
+  char *data;
+
+  if(!holdingsleep(&ip->lock) && !holdingshared(&ip->lock))
+    panic("pcget");
+  if((slot = pcslot(ip, idx, 1)) == 0)
+    return 0;
+  if((data = pclookup(slot)) != 0)
+    return data;
+  if((pg = pcstart(ip, idx, fill)) == 0)
+    return 0;
+  return pcfinish(ip, pg, slot);
+}
+
+// Read pages first..last-1 of ip into the cache, if they are
+// not there. The reads of up to PCBATCH pages go to the disk
+// together. Caller must hold ip->lock, shared or not.
+void
+pcreadahead(struct inode *ip, uint first, uint last)
+{
+  struct page *pg[PCBATCH];
+  void **slot[PCBATCH];
+  int i, n;
+
+  n = 0;
+  for(; first < last && n < PCBATCH; first++){
+    if((slot[n] = pcslot(ip, first, 1)) == 0)
+      break;
+    acquire(&pcache.lock);
+    pg[n] = *slot[n];
+    release(&pcache.lock);
+    if(pg[n])
+      continue;
+    if((pg[n] = pcstart(ip, first, 1)) == 0)
+      break;
+    n++;
+  }
+  for(i = 0; i < n; i++)
+    kfree(pcfinish(ip, pg[i], slot[i]));
+}
+
+// Copy n bytes of ip's data at off to dst, a user virtual
+// address if user_dst is set. Returns the number of bytes
+// copied, or -1 if dst was bad.
+// Caller must hold ip->lock, shared or not, and have checked
+// off and n.
+int
+pcread(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  struct ucursor uc;
+  uint tot, m;
+  char *data;
+  int r;
+
+  ucinit(&uc, user_dst ? myproc()->pagetable : 0);
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    if((data = pcget(ip, off / PGSIZE, 1)) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    r = copyoutc(&uc, dst, data + off % PGSIZE, m);
+    kfree(data);
+    if(r == -1)
+      return -1;
+  }
+  return tot;
+}
+
+// Mark page idx of ip dirty, if it is cached and, when data
+// is not 0, still holds data. Records the blocks the page
+// goes to now, since pcsync() cannot look them up.
+// Caller must hold ip->lock.
+static void
+pcsetdirty(struct inode *ip, uint idx, char *data)
+{
+  uint blocks[BPP];
+  struct page *pg;
+  void **slot;
+
+  if((slot = pcslot(ip, idx, 0)) == 0)
+    return;
+  memset(blocks, 0, sizeof(blocks));
+  if(ip->op->mappage)
+    ip->op->mappage(ip, idx, blocks);
+  acquire(&pcache.lock);
+  if((pg = *slot) != 0 && (data == 0 || pg->data == data)){
+    memmove(pg->blocks, blocks, sizeof(blocks));
+    if(!pg->dirty){
+      pg->dirty = 1;
+      page_remove(pg);
+      page_append(&pcache.dirty, pg);
+      ip->ndirty++;
+      pcache.ndirty++;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Copy n bytes from src, a user virtual address if user_src
+// is set, to ip's data at off. The caller has allocated the
+// blocks, and updates ip->size. Returns the number of bytes
+// copied.
+// Caller must hold ip->lock.
+int
+pcwrite(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  struct ucursor uc;
+  uint tot, m, idx;
+  char *data;
+  int r;
+
+  ucinit(&uc, user_src ? myproc()->pagetable : 0);
+  for(tot = 0; tot < n; tot += m, off += m, src += m){
+    idx = off / PGSIZE;
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    // no need to read what is overwritten or past the end.
+    if((data = pcget(ip, idx, m < PGSIZE && (uint64)idx * PGSIZE < ip->size)) == 0)
+      break;
+    r = copyinc(&uc, data + off % PGSIZE, src, m);
+    pcsetdirty(ip, idx, data);
+    kfree(data);
+    if(r == -1)
+      break;
+  }
+  return tot;
+}
+
+// Copy n bytes at data to ip's cached page at off, if it is
+// cached, for a file system whose write() put them somewhere
+// other than the page cache; see fillpage. The bytes must lie
+// in one page. Caller must hold ip->lock.
+void
+pcupdate(struct inode *ip, uint off, char *data, uint n)
+{
+  struct page *pg;
+  void **slot;
+
+  if((slot = pcslot(ip, off / PGSIZE, 0)) == 0)
+    return;
+  acquire(&pcache.lock);
+  if((pg = *slot) != 0)
+    memmove(pg->data + off % PGSIZE, data, n);
+  release(&pcache.lock);
+}
+
+// Copy n bytes at off of ip's cached page, if it is cached,
+// to data; the reverse of pcupdate(), for a file system whose
+// own copy of the bytes a store through mmap() may have left
+// behind. Returns 1 if the page was cached, or 0. The bytes
+// must lie in one page. Caller must hold ip->lock.
+int
+pcfetch(struct inode *ip, uint off, char *data, uint n)
+{
+  struct page *pg;
+  void **slot;
+
+  if((slot = pcslot(ip, off / PGSIZE, 0)) == 0)
+    return 0;
+  acquire(&pcache.lock);
+  if((pg = *slot) != 0)
+    memmove(data, pg->data + off % PGSIZE, n);
+  release(&pcache.lock);
+  return pg != 0;
+}
+
+// Page data, mapped at page idx of ip, has been stored to;
+// see vmaunmap(). Caller must hold ip->lock.
+void
+pcdirty(struct inode *ip, uint idx, char *data)
+{
+  pcsetdirty(ip, idx, data);
+}
+
+// Free the tree below node n of height h, and its pages.
+// Caller holds pcache.lock.
+static void
+pcfree(struct inode *ip, struct pcnode *n, int h)
+{
+  struct page *pg;
+  int i;
+
+  for(i = 0; i < PCFAN; i++){
+    if(n->slot[i] == 0)
+      continue;
+    if(h > 1){
+      pcfree(ip, n->slot[i], h - 1);
+      continue;
+    }
+    pg = n->slot[i];
+    page_remove(pg);
+    if(pg->dirty){
+      ip->ndirty--;
+      pcache.ndirty--;
+    }
+    pcache.n--;
+    // a mapping may keep the data.
+    kfree(pg->data);
+    kmem_cache_free(page_cache, pg);
+  }
+  kmem_cache_free(pcnode_cache, n);
+}
+
+// Drop every cached page of ip, dirty or not, when its data
+// is truncated or its inode table entry is recycled. Caller
+// must hold ip->lock, or be the only user of ip.
+void
+pcdrop(struct inode *ip)
+{
+  acquire(&pcache.lock);
+  if(ip->pages)
+    pcfree(ip, ip->pages, ip->pheight);
+  ip->pages = 0;
+  ip->pheight = 0;
+  release(&pcache.lock);
+}
+
+// Write the dirty pages of device dev to disk, PCBATCH at a
+// time, or one at a time if memory is short, until none is
+// left. Called by the file system's commit, with no system
+// call running that could dirty a page by write().
+void
+pcsync(uint dev)
+{
+  struct pageio *io[PCBATCH];
+  uint blocks[PCBATCH][BPP];
+  char *data[PCBATCH];
+  struct page *pg, *next;
+  int i, n, nio, usespare;
+
+  for(;;){
+    for(nio = 0; nio < PCBATCH; nio++)
+      if((io[nio] = kmem_cache_alloc(pageio_cache)) == 0)
+        break;
+    usespare = nio == 0;
+    if(usespare){
+      acquiresleep(&spare.lock);
+      io[nio++] = &spare.io;
+    }
+
+    n = 0;
+    acquire(&pcache.lock);
+    for(pg = pcache.dirty.next; pg != &pcache.dirty && n < nio; pg = next){
+      next = pg->next;
+      if(pg->ip->dev != dev)
+        continue;
+      // clean from now on: a store after this point
+      // dirties it again.
+      pg->dirty = 0;
+      page_remove(pg);
+      page_push(&pcache.lru, pg);
+      pg->ip->ndirty--;
+      pcache.ndirty--;
+      memmove(blocks[n], pg->blocks, sizeof(blocks[n]));
+      data[n] = pg->data;
+      kdup(data[n]);
+      n++;
+    }
+    release(&pcache.lock);
+
+    // the driver may sleep, so start the writes only
+    // after letting go of pcache.lock.
+    for(i = 0; i < n; i++)
+      pcio(io[i], dev, blocks[i], data[i], 1);
+    for(i = 0; i < n; i++){
+      pcwait(io[i]);
+      kfree(data[i]);
+    }
+    if(usespare)
+      releasesleep(&spare.lock);
+    else
+      for(i = 0; i < nio; i++)
+        kmem_cache_free(pageio_cache, io[i]);
+    if(n == 0)
+      break;
+  }
+}
+
+// Does device dev have dirty pages?
+int
+pcpending(uint dev)
+{
+  struct page *pg;
+  int r;
+
+  r = 0;
+  acquire(&pcache.lock);
+  for(pg = pcache.dirty.next; pg != &pcache.dirty; pg = pg->next){
+    if(pg->ip->dev == dev){
+      r = 1;
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return r;
+}
+
+// Free up to PCSHRINK of the least recently used clean pages
+// that nobody but the cache uses. Called by kalloc() when it
+// runs out of pages. Returns the number of pages freed.
+int
+pcshrink(void)
+{
+  struct page *pg, *prev, *freed;
+  int n;
+
+  n = 0;
+  freed = 0;
+  acquire(&pcache.lock);
+  for(pg = pcache.lru.prev; pg != &pcache.lru && n < PCSHRINK; pg = prev){
+    prev = pg->prev;
+    if(krefs(pg->data) > 1)
+      continue;
+    *pg->slot = 0;
+    page_remove(pg);
+    pcache.n--;
+    pg->next = freed;
+    freed = pg;
+    n++;
+  }
+  release(&pcache.lock);
+
+  for(pg = freed; pg; pg = freed){
+    freed = pg->next;
+    kfree(pg->data);
+    kmem_cache_free(page_cache, pg);
+  }
+  return n;
+}
+
+// Print the cache's size and hit rate; see procdump().
+void
+pcprint(void)
+{
+  printf("pcache: %d pages, %d dirty, %d hits, %d misses\n",
+         pcache.n, pcache.ndirty, (int)statsum(ST_PCHIT), (int)statsum(ST_PCMISS));
+}
@@ -11,21 +11,48 @@
 #include "vfs.h"
 #include "../defs.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of PIPEPAGES pages. Readers and
+// writers copy whole spans of it, and do so without holding
+// pi->lock, since copyin() and copyout() may fault a page in
+// and sleep. That is safe because a writer only fills the
+// free part of the ring and a reader only empties the full
+// part, and the writing and reading flags let one writer and
+// one reader in at a time. Each side wakes the other only when
+// the pipe was empty or full, the only times the other may be
+// asleep. The flags are not sleeplocks so that a process
+// waiting its turn, like one waiting for data or space, can
+// be killed.
+
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  int reading;              // a reader is in piperead()
+  int writing;              // a writer is in pipewrite()
+  char *page[PIPEPAGES];    // the ring buffer
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+// Free pi and its buffer.
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  kfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
+  int i;
 
   pi = 0;
   *f0 = *f1 = 0;
@@ -33,28 +60,35 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
   initlock(&pi->lock, "pipe");
-  (*f0)->inode->type = FD_PIPE;
+  // a file without an inode is a pipe; see fileclose().
+  (*f0)->inode = 0;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->append = 0;
   (*f0)->private = pi; // note: we use private to point to pipe
-  (*f1)->inode->type = FD_PIPE;
+  (*f1)->inode = 0;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->append = 0;
   (*f1)->private = pi;
   return 0;
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
-    fileclose(*f0);
+    filefree(*f0);
   if(*f1)
-    fileclose(*f1);
+    filefree(*f1);
   return -1;
 }
 
@@ -71,35 +105,57 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes at src, a user virtual address if user_src
+// is set, to pipe pi.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 src, int n)
 {
-  int i = 0;
   struct proc *pr = myproc();
+  uint w, m;
+  int i, r;
 
   acquire(&pi->lock);
-  while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
+  while(pi->writing){
+    if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
+    sleep(&pi->writing, &pi->lock);
+  }
+  pi->writing = 1;
+  for(i = 0; i < n; i += m){
+    if(pi->readopen == 0 || killed(pr)){
+      i = -1;
+      break;
+    }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      m = 0;
+      continue;
     }
+    w = pi->nwrite;
+    m = pi->nread + PIPESIZE - w;
+    if(m > PGSIZE - w % PGSIZE)
+      m = PGSIZE - w % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    release(&pi->lock);
+    r = either_copyin(pi->page[w % PIPESIZE / PGSIZE] + w % PGSIZE,
+                      user_src, src + i, m);
+    acquire(&pi->lock);
+    if(r == -1)
+      break;
+    if(pi->nread == pi->nwrite)
+      wakeup(&pi->nread);
+    pi->nwrite += m;
   }
-  wakeup(&pi->nread);
+  pi->writing = 0;
+  wakeup(&pi->writing);
   release(&pi->lock);
 
   return i;
@@ -108,26 +164,48 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
   struct proc *pr = myproc();
-  char ch;
+  uint rd, m;
+  int i, r;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->reading){
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
+    sleep(&pi->reading, &pi->lock);
+  }
+  pi->reading = 1;
+  i = 0;
+  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+    if(killed(pr)){
+      i = -1;
+      goto out;
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
+    rd = pi->nread;
+    if((m = pi->nwrite - rd) == 0)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    if(m > PGSIZE - rd % PGSIZE)
+      m = PGSIZE - rd % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    release(&pi->lock);
+    r = copyout(pr->pagetable, addr + i,
+                pi->page[rd % PIPESIZE / PGSIZE] + rd % PGSIZE, m);
+    acquire(&pi->lock);
+    if(r == -1)
       break;
+    if(pi->nwrite == pi->nread + PIPESIZE)  //DOC: piperead-wakeup
+      wakeup(&pi->nwrite);
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+ out:
+  pi->reading = 0;
+  wakeup(&pi->reading);
   release(&pi->lock);
   return i;
 }
@@ -0,0 +1,165 @@
+//
+// Submission rings.
+//
+// ringsetup() maps a page holding a struct ring (ring.h) at
+// RING in the process, and the kernel reaches the same page
+// through p->ring. The process queues file system operations
+// in it without entering the kernel, and one ringenter() runs
+// as many of them as it asks for, in order, posting a
+// completion for each, so that a program that opens, reads
+// or stats hundreds of files pays for one trap instead of
+// hundreds. The operations complete before ringenter()
+// returns.
+//
+// Nothing in the ring is trusted: the process may change it
+// at any time. Each submission is copied before it is looked
+// at, and its addresses are user addresses that copyin() and
+// copyout() check.
+//
+// The ring belongs to one process: fork() does not copy it,
+// and exec() and exit() unmap it.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "kernel/defs.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "stat.h"
+#include "vfs.h"
+#include "ring.h"
+
+// Map a ring into the current process, if it has none.
+// Returns its address, or -1.
+uint64
+ringsetup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+
+  if(p->ring)
+    return RING;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(p->pagetable, RING, PGSIZE, (uint64)mem, PTE_U | PTE_R | PTE_W) != 0){
+    kfree(mem);
+    return -1;
+  }
+  p->ring = (struct ring*)mem;
+  return RING;
+}
+
+// Unmap p's ring, if it has one.
+void
+ringfree(struct proc *p)
+{
+  if(p->ring == 0)
+    return;
+  uvmunmap(p->pagetable, RING, 1, 1);
+  p->ring = 0;
+}
+
+// The file that fd names, or 0.
+static struct file*
+ringfd(int fd)
+{
+  return fdget(myproc(), fd);
+}
+
+// stat() without opening the file.
+static int
+ringstat(uint64 upath, uint64 addr)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  struct stat st;
+
+  if(fetchstr(upath, path, MAXPATH) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilockshared(ip);
+  stati(ip, &st);
+  iunlockshared(ip);
+  iput(ip);
+  end_op();
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
+}
+
+// Run submission e, as the system call would.
+static int
+ringop(struct ringsqe *e)
+{
+  char path[MAXPATH];
+  struct file *f;
+
+  switch(e->op){
+  case RING_NOP:
+    return 0;
+  case RING_READ:
+    if((f = ringfd(e->fd)) == 0 || e->n < 0)
+      return -1;
+    return e->off < 0 ? fileread(f, e->addr, e->n) : filepread(f, e->addr, e->n, e->off);
+  case RING_WRITE:
+    if((f = ringfd(e->fd)) == 0 || e->n < 0)
+      return -1;
+    return e->off < 0 ? filewrite(f, e->addr, e->n) : filepwrite(f, e->addr, e->n, e->off);
+  case RING_OPEN:
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return openpath(path, e->n);
+  case RING_CLOSE:
+    return fdclose(e->fd);
+  case RING_FSTAT:
+    if((f = ringfd(e->fd)) == 0)
+      return -1;
+    return filestat(f, e->addr);
+  case RING_STAT:
+    return ringstat(e->addr, e->addr2);
+  }
+  return -1;
+}
+
+// Run up to n of the current process's queued submissions,
+// as long as there is room for their completions. Returns
+// the number run, or -1 if there is no ring or its indices
+// make no sense.
+int
+ringenter(int n)
+{
+  struct proc *p = myproc();
+  struct ring *r = p->ring;
+  struct ringsqe e;
+  uint head, tail;
+  int i, res;
+
+  if(r == 0)
+    return -1;
+  head = r->sqhead;
+  tail = r->sqtail;
+  if(tail - head > NRING || r->cqtail - r->cqhead > NRING)
+    return -1;
+  for(i = 0; i < n && head != tail; i++, head++){
+    if(r->cqtail - r->cqhead >= NRING)
+      break;      // the process must take completions first
+    __sync_synchronize();
+    e = r->sq[head % NRING];
+    res = ringop(&e);
+    r->cq[r->cqtail % NRING].data = e.data;
+    r->cq[r->cqtail % NRING].res = res;
+    __sync_synchronize();
+    r->cqtail++;
+    r->sqhead = head + 1;
+    if(killed(p))
+      break;
+  }
+  return i;
+}
@@ -15,6 +15,7 @@
 #include "xv6fs/file.h"
 #include "defs.h"
 #include "xv6_fcntl.h"
+#include "klog.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -25,7 +26,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdget(myproc(), fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -34,23 +35,6 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-  struct proc *p = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 uint64
 sys_dup(void)
 {
@@ -102,24 +86,176 @@ sys_write(void)
 }
 
 uint64
-sys_close(void)
+sys_pread(void)
 {
-  #ifdef LINK
-  printf("entering sys_close\n");
-  #endif
-  int fd;
   struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filelseek(f, off, whence);
+}
+
+uint64
+sys_mmap(void)
+{
+  struct file *f;
+  uint64 addr;
+  int len, prot, flags, off;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(addr != 0 || len <= 0 || off < 0 || argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
 
-  if(argfd(0, &fd, &f) < 0)
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Fetch the iovec array for readv/writev from user space.
+static int
+argiov(int n, struct iovec *iov, int *cnt)
+{
+  uint64 p;
+
+  argaddr(n, &p);
+  argint(n+1, cnt);
+  if(*cnt < 0 || *cnt > NIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, p, *cnt * sizeof(struct iovec)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+uint64
+sys_ringsetup(void)
+{
+  return ringsetup();
+}
+
+uint64
+sys_ringenter(void)
+{
+  int n;
+
+  argint(0, &n);
+  return ringenter(n);
+}
+
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0)
+    return -1;
+  return filesendfile(out, in, n);
+}
+
+uint64
+sys_mount(void)
+{
+  char source[DEVSIZ], target[MAXPATH];
+
+  if(argstr(0, source, DEVSIZ) < 0 || argstr(1, target, MAXPATH) < 0)
+    return -1;
+  return fsmount(source, target);
+}
+
+// Close file descriptor fd, for close() and RING_CLOSE.
+// Returns 0, or -1.
+int
+fdclose(int fd)
+{
+  struct file *f;
+
+  if((f = fdremove(myproc(), fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
-  #ifdef LINK
-  printf("exiting sys_close\n");
-  #endif
   return 0;
 }
 
+uint64
+sys_close(void)
+{
+  int fd;
+
+  argint(0, &fd);
+  return fdclose(fd);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -135,26 +271,50 @@ sys_fstat(void)
   return ret;
 }
 
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  int n;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filegetdents(f, p, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
 {
-  #ifdef LINK
-    printf("entering sys_link\n");
-  #endif
   char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
+  begin_op();
   if((ip = namei(old)) == 0){
+    end_op();
     return -1;
   }
 
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
 
@@ -167,45 +327,37 @@ sys_link(void)
     goto bad;
   }
   ilock(dp);
-  struct dentry *de = kalloc();
-  de->parent = dp;
-  de->inode = ip;
-  strncpy(de->name, name, DIRSIZ);
-  if(dp->dev != ip->dev || dp->op->link(de) < 0){
+  struct dentry de;
+  memset(&de, 0, sizeof(de));
+  de.parent = dp;
+  de.inode = ip;
+  strncpy(de.name, name, DIRSIZ);
+  if(dp->dev != ip->dev || dp->op->link(&de) < 0){
     iunlockput(dp);
-    kfree(de);
     // printf("go to bad from line 172\n");
     goto bad;
   }
-  kfree(de);
-  #ifdef LINK
-    printf("link success\n");
-  #endif
+  dinvalidate(dp, name);
   iunlockput(dp);
   iput(ip);
 
-#ifdef LINK
-  printf("exiting sys_link\n");
-#endif
+  end_op();
+
   return 0;
 
 bad:
-#ifdef LINK
-  printf("this is bad\n");
-#endif
+  klog(KS_SYSFILE, KL_DEBUG, "link: %s failed", new);
   ilock(ip);
   ip->nlink--;
   ip->op->write_inode(ip);
   iunlockput(ip);
+  end_op();
   return -1;
 }
 
 uint64
 sys_unlink(void)
 {
-  #ifdef LINK
-    printf("entering sys_unlink\n");
-  #endif
   struct inode *ip, *dp;
   char name[DIRSIZ], path[MAXPATH];
   // uint off = 0;
@@ -213,7 +365,9 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
+  begin_op();
   if((dp = nameiparent(path, name)) == 0){
+    end_op();
     return -1;
   }
 
@@ -223,18 +377,16 @@ sys_unlink(void)
   if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
     goto bad;
 
-  struct dentry *d = dp->op->dirlookup(dp, name);
-  if (d == 0 || (ip = d->inode) == 0) 
+  if((ip = dirlookup(dp, name)) == 0)
     goto bad;
   ilock(ip);
 
-  #ifdef LINK
-    printf("ref: %d, nlink: %d\n", ip->ref, ip->nlink);
-  #endif
+  klog(KS_SYSFILE, KL_DEBUG, "unlink: %s inode %d ref %d nlink %d",
+       path, ip->inum, ip->ref, ip->nlink);
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !dp->op->isdirempty(ip)){
+  if(ismountpoint(ip) || (ip->type == T_DIR && !dp->op->isdirempty(ip))){
     iunlockput(ip);
     goto bad;
   }
@@ -242,12 +394,13 @@ sys_unlink(void)
   // memset(&de, 0, sizeof(de));
   // if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
   //   panic("unlink: writei");
-  struct dentry *de = kalloc();
-  de->parent = dp;
-  de->inode = ip;
-  strncpy(de->name, name, DIRSIZ);
-  dp->op->unlink(de);
-  kfree(de);
+  struct dentry de;
+  memset(&de, 0, sizeof(de));
+  de.parent = dp;
+  de.inode = ip;
+  strncpy(de.name, name, DIRSIZ);
+  dp->op->unlink(&de);
+  dinvalidate(dp, name);
 
   if(ip->type == T_DIR){
     dp->nlink--;
@@ -258,19 +411,181 @@ sys_unlink(void)
   ip->nlink--;
   ip->op->write_inode(ip);
   iunlockput(ip);
-#ifdef LINK
-  printf("exiting sys_unlink\n");
-#endif
+
+  end_op();
   return 0;
 
 bad:
   iunlockput(dp);
-  #ifdef LINK
-    printf("exiting sys_unlink\n");
-  #endif
+  end_op();
   return -1;
 }
 
+// Lock the directories odp and ndp of a rename, an ancestor
+// before what lies below it; directories that are neither are
+// only ever locked together under rename_lock, which the
+// caller holds for them.
+static void
+renamelockdirs(struct inode *odp, struct inode *ndp)
+{
+  if(odp == ndp){
+    ilock(odp);
+  } else if(subdir(ndp, odp)){
+    ilock(odp);
+    ilock(ndp);
+  } else {
+    ilock(ndp);
+    ilock(odp);
+  }
+}
+
+// Look name up in dp, locking dp only for the lookup.
+static struct inode*
+lookupin(struct inode *dp, char *name)
+{
+  struct inode *ip;
+
+  ilockshared(dp);
+  ip = dirlookup(dp, name);
+  iunlockshared(dp);
+  return ip;
+}
+
+// Rename old to new, replacing new if it exists, in one
+// transaction. A directory may replace only an empty
+// directory, and a file only a file, and a directory cannot
+// move below itself. Neither old nor new may be a mountpoint.
+// The entries are looked up and checked
+// with nothing locked, since subdir() must walk up the tree;
+// once the directories are locked, a change to either entry
+// meanwhile starts it over.
+uint64
+sys_rename(void)
+{
+  char oname[DIRSIZ], nname[DIRSIZ], old[MAXPATH], new[MAXPATH];
+  struct inode *odp, *ndp, *ip, *tp, *ip2, *tp2;
+  struct dentry ode, nde;
+  int moved, r;
+
+  if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
+    return -1;
+
+  begin_op();
+  odp = nameiparent(old, oname);
+  ndp = nameiparent(new, nname);
+  r = -1;
+  if(odp == 0 || ndp == 0 || odp->dev != ndp->dev || odp->op->rename == 0)
+    goto out;
+  if(namecmp(oname, ".") == 0 || namecmp(oname, "..") == 0 ||
+     namecmp(nname, ".") == 0 || namecmp(nname, "..") == 0)
+    goto out;
+  moved = odp != ndp;
+  if(moved)
+    renamelock();
+
+again:
+  ip = lookupin(odp, oname);
+  tp = lookupin(ndp, nname);
+  if(ip == 0 || ip == tp){
+    r = ip ? 0 : -1;   // two links to one file: nothing to do
+    goto put;
+  }
+  // a mountpoint stays where it is, and stays covered.
+  if(ismountpoint(ip) || (tp && ismountpoint(tp)))
+    goto put;
+  // a directory into itself, or over one of its ancestors,
+  // which is not empty.
+  if(moved && (subdir(ndp, ip) || (tp && subdir(odp, tp))))
+    goto put;
+
+  renamelockdirs(odp, ndp);
+  ip2 = dirlookup(odp, oname);
+  tp2 = dirlookup(ndp, nname);
+  if(ip2 != ip || tp2 != tp){
+    if(ip2)
+      iput(ip2);
+    if(tp2)
+      iput(tp2);
+    iunlock(odp);
+    if(moved)
+      iunlock(ndp);
+    iput(ip);
+    if(tp)
+      iput(tp);
+    goto again;
+  }
+  iput(ip2);
+  if(tp2)
+    iput(tp2);
+
+  ilock(ip);
+  if(tp){
+    ilock(tp);
+    if(ip->type == T_DIR && tp->type != T_DIR)
+      goto unlock;
+    if(ip->type != T_DIR && tp->type == T_DIR)
+      goto unlock;
+    if(tp->type == T_DIR && !tp->op->isdirempty(tp))
+      goto unlock;
+  }
+
+  memset(&ode, 0, sizeof(ode));
+  ode.parent = odp;
+  ode.inode = ip;
+  strncpy(ode.name, oname, DIRSIZ);
+  memset(&nde, 0, sizeof(nde));
+  nde.parent = ndp;
+  nde.inode = tp;
+  strncpy(nde.name, nname, DIRSIZ);
+  if(ip->type == T_DIR && moved)
+    dirmoved();
+  if(odp->op->rename(&ode, &nde) < 0)
+    goto unlock;
+  dset(odp, oname, 0);
+  dset(ndp, nname, ip->inum);
+  r = 0;
+
+  if(tp){
+    if(tp->type == T_DIR){
+      ndp->nlink--;   // tp's ".."
+      ndp->op->write_inode(ndp);
+    }
+    tp->nlink--;
+    tp->op->write_inode(tp);
+  }
+  if(ip->type == T_DIR && moved){
+    dinvalidate(ip, "..");
+    odp->nlink--;
+    odp->op->write_inode(odp);
+    ndp->nlink++;
+    ndp->op->write_inode(ndp);
+  }
+
+unlock:
+  if(tp)
+    iunlock(tp);
+  iunlock(ip);
+  iunlock(odp);
+  if(moved)
+    iunlock(ndp);
+put:
+  if(ip)
+    iput(ip);
+  if(tp)
+    iput(tp);
+  if(moved)
+    renameunlock();
+out:
+  if(odp)
+    iput(odp);
+  if(ndp)
+    iput(ndp);
+  end_op();
+  if(r < 0)
+    klog(KS_SYSFILE, KL_DEBUG, "rename: %s to %s failed", old, new);
+  return r;
+}
+
 static struct inode*
 create(char *path, short type, short major, short minor)
 {
@@ -286,9 +601,7 @@ create(char *path, short type, short major, short minor)
 
   // printf("gogogo\n");
 
-  struct dentry *d = dp->op->dirlookup(dp, name);
-  // printf("d = %p\n", d);
-  if(d != 0 && (ip = d->inode) != 0) {
+  if((ip = dirlookup(dp, name)) != 0) {
     // printf("create: file already exists\n");
     iunlockput(dp);
     ilock(ip);
@@ -298,7 +611,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = dp->op->alloc_inode(root)) == 0) {
+  if((ip = dp->op->alloc_inode(dp->sb, dp)) == 0) {
     // printf("create: alloc_inode failed\n");
     iunlockput(dp);
     return 0;
@@ -307,56 +620,40 @@ create(char *path, short type, short major, short minor)
   ilock(ip);
   ip->nlink = 1;
   ip->type = type;
-  #ifdef REF
-    printf("create inode: %d\n", ip->inum);
-    printf("create: type = %d\n", type);
-  #endif
+  klog(KS_SYSFILE, KL_DEBUG, "create: %s inode %d type %d", path, ip->inum, type);
   ip->op->write_inode(ip);
 
   if (type == T_DIR) {
-    #ifdef REF
-      printf("create: type is T_DIR\n");
-    #endif
-    struct dentry *cur_dir = kalloc();
-    cur_dir->parent = ip;
-    cur_dir->inode = ip;
-    strncpy(cur_dir->name, ".", DIRSIZ);
-    if (ip->op->link(cur_dir) < 0) {
-      kfree(cur_dir);
+    struct dentry cur_dir;
+    memset(&cur_dir, 0, sizeof(cur_dir));
+    cur_dir.parent = ip;
+    cur_dir.inode = ip;
+    strncpy(cur_dir.name, ".", DIRSIZ);
+    if (ip->op->link(&cur_dir) < 0) {
       goto fail;
     }
-    #ifdef REF
-      printf("link success in \".\"\n");
-    #endif
-    struct dentry *parent_dir = kalloc();
-    parent_dir->parent = ip;
-    parent_dir->inode = dp;
-    strncpy(parent_dir->name, "..", DIRSIZ);
-    if (ip->op->link(parent_dir) < 0) {
-      kfree(parent_dir);
+    struct dentry parent_dir;
+    memset(&parent_dir, 0, sizeof(parent_dir));
+    parent_dir.parent = ip;
+    parent_dir.inode = dp;
+    strncpy(parent_dir.name, "..", DIRSIZ);
+    if (ip->op->link(&parent_dir) < 0) {
       goto fail;
     }
-    #ifdef REF
-      printf("link success in \"..\"\n");
-    #endif
   }
 
-  struct dentry *de = kalloc();
-  de->inode = ip;
-  de->parent = dp;
-  strncpy(de->name, name, DIRSIZ);
-  if (dp->op->link(de) < 0) {
-    kfree(de);
+  struct dentry de;
+  memset(&de, 0, sizeof(de));
+  de.inode = ip;
+  de.parent = dp;
+  strncpy(de.name, name, DIRSIZ);
+  if (dp->op->link(&de) < 0) {
     goto fail;
   }
-  #ifdef REF
-      printf("link success in myself\n");
-    #endif
-  if (dp->op->create(dp, de, type, major, minor) < 0) {
-    kfree(de);
+  dinvalidate(dp, name);
+  if (dp->op->create(dp, &de, type, major, minor) < 0) {
     goto fail;
   }
-  kfree(de);
 
   if(type == T_DIR){
     // printf("create: type is T_DIR, now success\n");
@@ -380,46 +677,49 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for open() and RING_OPEN.
+// Returns the new file descriptor, or -1.
+int
+openpath(char *path, int omode)
 {
-  #ifdef LINK
-  printf("entering sys_open\n");
-  #endif
-  char path[MAXPATH];
-  int fd = 0, omode;
+  int fd = 0;
   struct file *f;
   struct inode *ip;
-  int n;
 
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
-
-  // printf("sys_open: path = %s\n", path);
-  // printf("sys_open: omode = %d\n", omode);
+  begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
+      end_op();
       return -1;
     }
   } else {
     if((ip = namei(path)) == 0){
+      end_op();
       return -1;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
+      end_op();
       return -1;
     }
   }
 
   if ((f = ip->op->open(ip, omode)) == 0 || (fd = fdalloc(f)) < 0) {
     if (f) {
+      // closing f drops the reference to ip, and
+      // starts a transaction of its own.
+      f->inode = ip;
+      f->op = ip->op;
+      iunlock(ip);
+      end_op();
       fileclose(f);
+    } else {
+      iunlockput(ip);
+      end_op();
     }
-    iunlockput(ip);
     return -1;
   }
 
@@ -432,6 +732,7 @@ sys_open(void)
   f->op = ip->op;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->append = (omode & O_APPEND) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     // printf("%truncating file\n");
@@ -439,12 +740,22 @@ sys_open(void)
   }
 
   iunlock(ip);
-#ifdef LINK
-  printf("exiting sys_open\n");
-#endif
+  end_op();
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -452,10 +763,13 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
+  begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+    end_op();
     return -1;
   }
   iunlockput(ip);
+  end_op();
   // printf("exiting sys_mkdir\n");
   return 0;
 }
@@ -468,13 +782,16 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
+  begin_op();
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
      (ip = create(path, T_DEVICE, major, minor)) == 0){
+    end_op();
     return -1;
   }
   iunlockput(ip);
+  end_op();
   // printf("exiting sys_mknod\n");
   return 0;
 }
@@ -487,16 +804,21 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
+  begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
+    end_op();
     return -1;
   }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
+  cwdchain(ip);
   iput(p->cwd);
+  end_op();
   p->cwd = ip;
   // printf("exiting sys_chdir\n");
   return 0;
@@ -565,15 +887,15 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdremove(p, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdremove(p, fd0);
+    fdremove(p, fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -0,0 +1,543 @@
+// tmpfs: a file system that lives in memory.
+//
+// "mount tmpfs dir" makes an empty tmpfs on dir. Nothing of
+// it is on a disk: a file's data, and a directory's entries,
+// are the file's pages in the page cache (see pagecache.c),
+// which has no blocks to read them from, so a page that was
+// never written is all zeros. Written pages are dirty, and
+// since no log commit ever writes back a tmpfs device they
+// stay dirty, which keeps pcshrink() away from them, until
+// the file is truncated or freed.
+//
+// The inodes live only in the inode table. The fs holds a
+// reference to every inode that has links, so that iget()
+// never recycles one; tmpfs_iupdate() takes and drops it as
+// the VFS changes nlink. An inode without links goes when its
+// last user lets go, as on a disk.
+//
+// A directory is an array of struct dirent, the format that
+// getdents() returns, with inum 0 for a free entry.
+//
+// There is no log: a tmpfs has no begin_op() or end_op(),
+// and a system call's changes are protected by the inode
+// locks alone. Each mount is device TMPFSDEV(n), so that the
+// inode table and the dentry cache keep the mounts apart.
+
+#include "types.h"
+#include "riscv.h"
+#include "kernel/defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "../xv6fs/fs.h"
+#include "../xv6fs/file.h"
+#include "../vfs.h"
+#include "../defs.h"
+#include "xv6_fcntl.h"
+#include "stats.h"
+
+// A mounted tmpfs: the VFS super block, followed by the
+// bitmap of the inode numbers in use.
+struct tmpfs_sb {
+  struct super_block vfs;   // must be first
+  struct spinlock lock;     // protects imap and cursor
+  uchar *imap;              // TMPNINODE bits, in whole pages
+  uint cursor;              // where the last allocation ended
+};
+
+static struct spinlock devlock;   // protects tmpdev[]
+static struct tmpfs_sb *tmpdev[NTMPFS];
+
+struct filesystem_type tmpfs;
+static struct filesystem_operations tmpfs_ops;
+static struct inode *tmpfs_geti(uint dev, uint inum, int inc_ref);
+static int tmpfs_link(struct dentry *target);
+static void tmpfs_iupdate(struct inode *ino);
+
+// The mounted tmpfs on device dev.
+static struct tmpfs_sb*
+fsof(uint dev)
+{
+  uint n = dev - TMPFSDEV(0);
+
+  if(n >= NTMPFS || tmpdev[n] == 0)
+    panic("tmpfs: device not mounted");
+  return tmpdev[n];
+}
+
+// Make an empty tmpfs, if source is "tmpfs": a root directory
+// with "." and "..". Returns 0 if source names something
+// else, or there is no free mount or memory.
+static struct super_block*
+tmpfs_mount(const char *source)
+{
+  struct tmpfs_sb *fs;
+  struct super_block *s;
+  struct dentry de;
+  struct inode *ip;
+  int n;
+
+  if(strncmp(source, "tmpfs", DEVSIZ) != 0)
+    return 0;
+  if(sizeof(*fs) > PGSIZE || (fs = kalloc()) == 0)
+    return 0;
+  memset(fs, 0, sizeof(*fs));
+  if((fs->imap = kallocn(TMPNINODE / 8 / PGSIZE)) == 0){
+    kfree(fs);
+    return 0;
+  }
+  memset(fs->imap, 0, TMPNINODE / 8);
+
+  acquire(&devlock);
+  for(n = 0; n < NTMPFS && tmpdev[n]; n++)
+    ;
+  if(n < NTMPFS)
+    tmpdev[n] = fs;
+  release(&devlock);
+  if(n == NTMPFS){
+    kfree(fs->imap);
+    kfree(fs->imap + PGSIZE);
+    kfree(fs);
+    return 0;
+  }
+
+  initlock(&fs->lock, "tmpfs");
+  fs->imap[0] = 1 << ROOTINO | 1;   // inode 0 means a free entry
+  fs->cursor = ROOTINO + 1;
+  s = &fs->vfs;
+  s->type = &tmpfs;
+  s->op = &tmpfs_ops;
+  s->dev = TMPFSDEV(n);
+  safestrcpy(s->device, source, DEVSIZ);
+  s->private = fs;
+
+  ip = tmpfs_geti(s->dev, ROOTINO, 1);
+  ip->valid = 1;
+  ilock(ip);
+  ip->type = T_DIR;
+  ip->nlink = 1;
+  tmpfs_iupdate(ip);
+  memset(&de, 0, sizeof(de));
+  de.parent = ip;
+  de.inode = ip;
+  strncpy(de.name, ".", DIRSIZ);
+  if(tmpfs_link(&de) < 0)
+    panic("tmpfs_mount: .");
+  strncpy(de.name, "..", DIRSIZ);
+  if(tmpfs_link(&de) < 0)
+    panic("tmpfs_mount: ..");
+  iunlock(ip);
+  s->root = ip;
+  return s;
+}
+
+static int
+tmpfs_umount(struct super_block *sb)
+{
+  // not supported: the fs stays mounted until shutdown.
+  return -1;
+}
+
+static void
+tmpfs_init(void)
+{
+  initlock(&devlock, "tmpdev");
+}
+
+// Allocate an inode in s. Returns an unlocked but allocated
+// and referenced inode, or 0 if s has no free inode number.
+static struct inode*
+tmpfs_ialloc(struct super_block *s, struct inode *dir)
+{
+  struct tmpfs_sb *fs = s->private;
+  struct inode *ip;
+  uint i, inum;
+
+  statinc(ST_IALLOC);
+  acquire(&fs->lock);
+  for(i = 0; i < TMPNINODE; i++){
+    inum = (fs->cursor + i) % TMPNINODE;
+    if((fs->imap[inum/8] & (1 << (inum % 8))) == 0)
+      break;
+  }
+  statadd(ST_IALLOCSCAN, i < TMPNINODE ? i + 1 : i);
+  if(i == TMPNINODE){
+    release(&fs->lock);
+    printf("tmpfs_ialloc: no inodes\n");
+    return 0;
+  }
+  fs->imap[inum/8] |= 1 << (inum % 8);
+  fs->cursor = inum + 1;
+  release(&fs->lock);
+
+  ip = tmpfs_geti(s->dev, inum, 1);
+  ip->type = 0;
+  ip->nlink = 0;
+  ip->size = 0;
+  TMPFS_I(ip)->major = 0;
+  TMPFS_I(ip)->minor = 0;
+  TMPFS_I(ip)->pinned = 0;
+  ip->valid = 1;
+  return ip;
+}
+
+// The VFS changed an inode; all that matters here is whether
+// it has links. While it does, the fs holds a reference to it.
+// Caller must hold ip->lock, and a reference of its own.
+static void
+tmpfs_iupdate(struct inode *ino)
+{
+  struct tmpfs_inode *ip = TMPFS_I(ino);
+
+  if(ino->nlink > 0 && !ip->pinned){
+    ip->pinned = 1;
+    idup(ino);
+  } else if(ino->nlink == 0 && ip->pinned){
+    ip->pinned = 0;
+    iput(ino);   // not the last reference: the caller's is left
+  }
+}
+
+static void
+tmpfs_release_inode(struct inode *ino)
+{
+  ino->valid = 0;
+  ino->type = 0;
+}
+
+static void
+tmpfs_free_inode(struct inode *ino)
+{
+  struct tmpfs_sb *fs = fsof(ino->dev);
+
+  acquire(&fs->lock);
+  fs->imap[ino->inum/8] &= ~(1 << (ino->inum % 8));
+  release(&fs->lock);
+  ino->valid = 0;
+  ino->type = 0;
+}
+
+// Drop the file's data. Caller must hold ino->lock.
+static void
+tmpfs_itrunc(struct inode *ino)
+{
+  pcdrop(ino);
+  ino->size = 0;
+}
+
+static struct file*
+tmpfs_open(struct inode *ino, uint mode)
+{
+  struct tmpfs_inode *ip = TMPFS_I(ino);
+  struct file *f;
+
+  if(ino->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV))
+    return 0;
+  if((f = filealloc()) == 0)
+    return 0;
+  f->off = 0;
+  f->major = ip->major;
+  f->inode = ino;
+  f->private = 0;
+  f->readable = !(mode & O_WRONLY);
+  f->writable = (mode & O_WRONLY) || (mode & O_RDWR);
+  f->append = (mode & O_APPEND) != 0;
+  return f;
+}
+
+static void
+tmpfs_close(struct file *f)
+{
+  iput(f->inode);
+}
+
+// Read data from inode. Caller must hold ip->lock.
+static int
+tmpfs_readi(struct inode *ino, int user_dst, uint64 dst, uint off, uint n)
+{
+  if(off > ino->size || off + n < off)
+    return 0;
+  if(off + n > ino->size)
+    n = ino->size - off;
+  return pcread(ino, user_dst, dst, off, n);
+}
+
+// Write data to inode. Caller must hold ip->lock.
+// Returns the number of bytes written; fewer than n if
+// memory ran out.
+static int
+tmpfs_writei(struct inode *ino, int user_src, uint64 src, uint off, uint n)
+{
+  int r;
+
+  // past the end, the pages in between are left out, and
+  // read as zeros.
+  if(off + n < off)
+    return -1;
+  // the pages stay until the file goes, so growing a file
+  // must leave memory for processes; see BRESERVE in bio.c.
+  if(off + n > ino->size && kfreecount() < BRESERVE)
+    return -1;
+  r = pcwrite(ino, user_src, src, off, n);
+  if(off + r > ino->size)
+    ino->size = off + r;
+  return r;
+}
+
+#define DF_NAME 0   // dirfind(): the entry called name
+#define DF_FREE 1   // a free entry
+#define DF_USED 2   // any used entry
+
+// Find an entry of directory dp, of the kind how, at or after
+// off; copy it to *dep if dep is not 0. Returns its offset,
+// or -1. Directory pages are scanned in place.
+// Caller must hold dp->lock.
+static int
+dirfind(struct inode *dp, int how, const char *name, uint off, struct dirent *dep)
+{
+  struct dirent *de;
+  char *pg;
+  int r, n;
+
+  r = -1;
+  pg = 0;
+  n = 0;
+  for(; off < dp->size; off += sizeof(*de)){
+    n++;
+    if(pg == 0 || off % PGSIZE == 0){
+      if(pg)
+        kfree(pg);
+      if((pg = pcget(dp, off / PGSIZE, 1)) == 0)
+        return -1;
+    }
+    de = (struct dirent*)(pg + off % PGSIZE);
+    if(how == DF_FREE ? de->inum == 0 :
+       de->inum != 0 && (how == DF_USED || namecmp(de->name, name) == 0)){
+      if(dep)
+        *dep = *de;
+      r = off;
+      break;
+    }
+  }
+  if(pg)
+    kfree(pg);
+  statadd(ST_DIRSCAN, n);
+  return r;
+}
+
+// Copy the used entries of dp from *off on to user
+// address dst, while they fit in n bytes.
+static int
+tmpfs_getdents(struct inode *dp, uint *off, uint64 dst, int n)
+{
+  struct dirent d;
+  int tot, r;
+
+  tot = 0;
+  while(tot + sizeof(d) <= n){
+    if((r = dirfind(dp, DF_USED, 0, *off, &d)) < 0){
+      *off = dp->size;
+      break;
+    }
+    if(either_copyout(1, dst + tot, &d, sizeof(d)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    *off = r + sizeof(d);
+    tot += sizeof(d);
+  }
+  return tot;
+}
+
+static int
+tmpfs_isdirempty(struct inode *dir)
+{
+  return dirfind(dir, DF_USED, 0, 2*sizeof(struct dirent), 0) < 0;
+}
+
+// Look for a directory entry in a directory.
+// If found, return a dentry from dgetblank() whose inode
+// is referenced; the VFS dentry cache takes it over.
+static struct dentry*
+tmpfs_dirlookup(struct inode *dp, const char *name)
+{
+  struct dentry *dentry;
+  struct dirent de;
+
+  if(dirfind(dp, DF_NAME, name, 0, &de) < 0)
+    return 0;
+  if((dentry = dgetblank()) == 0)
+    panic("dirlookup: no dentries");
+  dentry->op = dp->op;
+  dentry->inode = tmpfs_geti(dp->dev, de.inum, 1);
+  dentry->parent = dp;
+  strncpy(dentry->name, name, DIRSIZ);
+  return dentry;
+}
+
+// Add an entry for target->inode called target->name to
+// directory target->parent. Returns 0, or -1 if the name
+// exists or memory ran out.
+static int
+tmpfs_link(struct dentry *target)
+{
+  struct inode *dp = target->parent;
+  struct dirent de;
+  int off;
+
+  if(dirfind(dp, DF_NAME, target->name, 0, 0) >= 0)
+    return -1;
+  if((off = dirfind(dp, DF_FREE, 0, 0, 0)) < 0)
+    off = dp->size;
+  memset(&de, 0, sizeof(de));
+  strncpy(de.name, target->name, DIRSIZ);
+  de.inum = target->inode->inum;
+  if(tmpfs_writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    return -1;
+  return 0;
+}
+
+// Remove the entry d->name from directory d->parent.
+static int
+tmpfs_unlink(struct dentry *d)
+{
+  struct inode *dp = d->parent;
+  struct dirent de;
+  int off;
+
+  if((off = dirfind(dp, DF_NAME, d->name, 0, 0)) < 0)
+    return 0;
+  memset(&de, 0, sizeof(de));
+  if(pcwrite(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("tmpfs_unlink");
+  return 0;
+}
+
+// Rename: see rename in vfs.h. The entry is renamed in place
+// in its own directory, takes over the entry it replaces, or
+// is added as tmpfs_link() does before the old one is cleared.
+static int
+tmpfs_rename(struct dentry *old, struct dentry *new)
+{
+  struct inode *odp = old->parent, *ndp = new->parent;
+  struct inode *ip = old->inode;
+  struct dirent de;
+  struct dentry link;
+  int off, noff;
+
+  if((off = dirfind(odp, DF_NAME, old->name, 0, &de)) < 0 || de.inum != ip->inum)
+    return -1;
+  if(new->inode){
+    if((noff = dirfind(ndp, DF_NAME, new->name, 0, &de)) < 0)
+      return -1;
+    de.inum = ip->inum;
+    if(pcwrite(ndp, 0, (uint64)&de, noff, sizeof(de)) != sizeof(de))
+      panic("tmpfs_rename");
+  } else if(odp == ndp){
+    memset(de.name, 0, DIRSIZ);
+    strncpy(de.name, new->name, DIRSIZ);
+    if(pcwrite(odp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("tmpfs_rename");
+    return 0;
+  } else {
+    link = *new;
+    link.inode = ip;
+    if(tmpfs_link(&link) < 0)
+      return -1;
+  }
+
+  memset(&de, 0, sizeof(de));
+  if(pcwrite(odp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("tmpfs_rename");
+
+  if(ip->type == T_DIR && odp != ndp){
+    if((off = dirfind(ip, DF_NAME, "..", 0, &de)) < 0)
+      panic("tmpfs_rename: no ..");
+    de.inum = ndp->inum;
+    if(pcwrite(ip, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("tmpfs_rename");
+  }
+  return 0;
+}
+
+static int
+tmpfs_create(struct inode *dir, struct dentry *target, short type, short major, short minor)
+{
+  struct tmpfs_inode *ip = TMPFS_I(target->inode);
+
+  ip->major = major;
+  ip->minor = minor;
+  return 0;
+}
+
+static void
+tmpfs_release_dentry(struct dentry *de)
+{
+}
+
+static struct inode*
+tmpfs_geti(uint dev, uint inum, int inc_ref)
+{
+  struct inode *ino = iget(dev, inum);
+
+  ino->sb = &fsof(dev)->vfs;
+  ino->op = &tmpfs_ops;
+  if(!inc_ref)
+    ino->ref--;
+  return ino;
+}
+
+// ilock() of an entry that iget() just made: every tmpfs
+// inode with links is in the table already, so this one has
+// none, and is free; it goes again with its last reference.
+static void
+tmpfs_update_lock(struct inode *ino)
+{
+  ino->type = 0;
+  ino->nlink = 0;
+  ino->size = 0;
+  ino->valid = 1;
+}
+
+// Nothing is ever written back.
+static int
+tmpfs_fsync(struct inode *ip)
+{
+  return 0;
+}
+
+static struct filesystem_operations tmpfs_ops = {
+  .mount = tmpfs_mount,
+  .umount = tmpfs_umount,
+  .alloc_inode = tmpfs_ialloc,
+  .write_inode = tmpfs_iupdate,
+  .release_inode = tmpfs_release_inode,
+  .free_inode = tmpfs_free_inode,
+  .trunc = tmpfs_itrunc,
+  .open = tmpfs_open,
+  .close = tmpfs_close,
+  .read = tmpfs_readi,
+  .write = tmpfs_writei,
+  .create = tmpfs_create,
+  .link = tmpfs_link,
+  .unlink = tmpfs_unlink,
+  .rename = tmpfs_rename,
+  .dirlookup = tmpfs_dirlookup,
+  .release_dentry = tmpfs_release_dentry,
+  .isdirempty = tmpfs_isdirempty,
+  .init = tmpfs_init,
+  .geti = tmpfs_geti,
+  .update_lock = tmpfs_update_lock,
+  .getdents = tmpfs_getdents,
+  .fsync = tmpfs_fsync,
+};
+
+struct filesystem_type tmpfs = {
+  .type = "tmpfs",
+  .op = &tmpfs_ops,
+  .inode_size = sizeof(struct tmpfs_inode),
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "types.h"
+#include "fs/vfs.h"
+
+// tmpfs: a file system that lives in memory; see fs.c.
+
+// in-memory inode: the VFS inode, followed by the fields
+// only tmpfs uses. iget() allocates an entry big enough for
+// the largest fs's inode, so this is one allocation.
+struct tmpfs_inode {
+  struct inode vfs;   // must be first
+  short major;        // T_DEVICE only
+  short minor;
+  char pinned;        // the fs holds a reference; see tmpfs_iupdate()
+};
+
+// The tmpfs_inode that contains VFS inode ino.
+#define TMPFS_I(ino) ((struct tmpfs_inode*)(ino))
+
+#define TMPNINODE 65536   // inodes per tmpfs; dirent.inum is a ushort
+
+// device number of tmpfs mount n.
+#define TMPFSDEV(n) (NDISK + 1 + (n))
@@ -7,6 +7,10 @@
 struct filesystem_type {
   const char *type;
   struct filesystem_operations *op;
+  // Size of the fs's in-memory inode, which begins with
+  // a struct inode; iget() allocates this much.
+  // Linux: super_operations->alloc_inode and container_of
+  uint inode_size;
 };
 
 #define DEVSIZ 32
@@ -18,13 +22,18 @@ struct filesystem_type {
 struct super_block {
   struct filesystem_type *type;
   struct filesystem_operations *op;
+  // The fs that mountpoint is in, or 0 for the root fs.
   struct super_block *parent;
   struct inode *root;
-  struct dentry *mountpoint;
-  // Ignored at this stage.
+  // The directory this fs is mounted on, or 0 for the root fs.
+  // The mount holds a reference to it.
+  struct inode *mountpoint;
+  // Device number of the disk the fs is on.
+  uint dev;
   // This field records the mount device, i.e.,
-  // the "/dev/sda" part in "mount /dev/sda".
+  // the "disk2" part in "mount disk2 /mnt".
   char device[DEVSIZ];
+  // In the root fs: every mounted fs, the root first.
   struct super_block *mounts[MAXMNT];
   // FS-specific data for the mounted filesystem.
   // Usually we allocate a buffer and point sb->private to it.
@@ -32,6 +41,14 @@ struct super_block {
   void *private;
 };
 
+// Sequential readahead state of an open file.
+// Linux: struct file_ra_state
+struct file_ra_state {
+  uint next;  // block a sequential read would start at
+  uint size;  // readahead window, in blocks
+  uint end;   // blocks before this one have been requested
+};
+
 struct file {
   struct filesystem_operations *op;
   // Reference count
@@ -40,7 +57,12 @@ struct file {
   int off;
   char readable;
   char writable;
+  // O_APPEND: every write goes to the end of the file
+  char append;
+  // T_DEVICE: major device number, an index into devsw[]
+  short major;
   struct inode *inode;
+  struct file_ra_state ra;
   void *private;
 };
 
@@ -54,11 +76,30 @@ struct inode {
   int ref;
   // protects everything below here
   struct sleeplock lock;
+  // for what the fs caches in the inode while reading it,
+  // which holders of lock shared may do at once
+  struct spinlock cachelock;
+  // Has the fs read the inode from disk?
+  int valid;
   short type;
   uint dev;
   uint size;
   short nlink;
+  // Has the fs changed fields of the inode that live on
+  // disk since it last wrote it? See iupdate().
+  int dirty;
   void *private;
+  // In the inode table's hash chain, and in its LRU list
+  // while ref is 0; protected by the table's lock.
+  struct inode *hnext;
+  struct inode *prev, *next;
+  // The file's cached pages, a radix tree of height pheight
+  // keyed by page number, and how many are dirty; see
+  // pagecache.c. Only changed with lock held, and the page
+  // cache's lock, which also protects ndirty.
+  void *pages;
+  int pheight;
+  int ndirty;
 };
 
 #define DIRSIZ 14
@@ -77,11 +118,21 @@ struct dentry {
   // Reference count
   int ref;
   void *private;
+
+  // Dentry cache bookkeeping, protected by the dcache lock.
+  // A cached entry maps (dev, pinum, name) to inum, or to 0
+  // if the name does not exist (a negative entry).
+  char cached;
+  uint dev;
+  uint pinum;
+  uint inum;
+  struct dentry *hnext;        // hash chain
+  struct dentry *prev, *next;  // LRU list, most recent first
 };
 
 struct filesystem_operations {
-  // Mount a filesystem.
-  // Only used for the root mount at this stage.
+  // Mount the filesystem on the disk named by source, such
+  // as "disk2". Returns its super block with root set, or 0.
   // Linux: file_system_type->mount
   struct super_block *(*mount) (const char *source);
   // Unmount a filesystem.
@@ -89,8 +140,10 @@ struct filesystem_operations {
   // Linux: super_operations->umount_begin
   int (*umount) (struct super_block *sb);
   // Allocate an inode in the inode table on disk.
-  // Linux: super_operations->alloc_inode
-  struct inode *(*alloc_inode) (struct super_block *sb);
+  // dir, if not 0, is the directory it will live in; the
+  // filesystem may place the inode near it.
+  // Linux: super_operations->alloc_inode (placement as in ext2_new_inode)
+  struct inode *(*alloc_inode) (struct super_block *sb, struct inode *dir);
   // Write (update) an existing inode.
   // Linux: super_operations->write_inode
   void (*write_inode) (struct inode *ino);
@@ -103,17 +156,48 @@ struct filesystem_operations {
   // Truncate the file corresponding to inode.
   // Linux: (none)
   void (*trunc) (struct inode *ino);
+  // Take an unlinked inode that iput() would truncate and
+  // free, to free its blocks later instead. Returns 1 if it
+  // did, or 0 to have iput() go ahead. Optional. Caller must
+  // be in a transaction and hold ino->lock.
+  // Linux: (none; ext4 keeps an orphan list)
+  int (*orphan) (struct inode *ino);
   // Opens (returns a file instance) of the inode.
   // Linux: inode_operations->atomic_open
   struct file *(*open) (struct inode *ino, uint mode);
-  // Closes an open file.
-  // Linux: file_operations->flush
+  // Closes an open file, when its last reference is dropped;
+  // fileclose() frees the struct file afterwards.
+  // Linux: file_operations->release
   void (*close) (struct file *f);
   // Reads from the file.
   // If dst_is_user==1, then dst is a user virtual address;
   // otherwise, dst is a kernel address.
   // Linux: file_operations->read
   int (*read) (struct inode *ino, int dst_is_user, uint64 dst, uint off, uint n);
+  // Called before reading n bytes at off; may start reading
+  // ahead if ra shows the reads are sequential.
+  // Caller must hold ino->lock.
+  // Linux: address_space_operations->readahead
+  void (*readahead) (struct inode *ino, struct file_ra_state *ra, uint off, uint n);
+  // Set blocks[0..PGSIZE/BSIZE) to the disk blocks that hold
+  // page idx of the file, 0 where none is allocated, so that
+  // the page cache can read and write the page itself.
+  // Caller must hold ino->lock.
+  // Linux: address_space_operations->bmap
+  void (*mappage) (struct inode *ino, uint idx, uint *blocks);
+  // Copy page idx of the file into data, which is zeros, if
+  // the fs keeps it somewhere other than the blocks that
+  // mappage() names, such as in the inode. Returns 1 if it
+  // did, or 0 to have the page read from the blocks. Optional.
+  // Caller must hold ino->lock, shared or not.
+  // Linux: address_space_operations->read_folio
+  int (*fillpage) (struct inode *ino, uint idx, char *data);
+  // Allocate the blocks of page idx that lie inside the file
+  // and are not allocated yet, so that a page stored to through
+  // mmap() has somewhere to go. Returns 0, or -1 if the disk
+  // is full. Caller must be in a transaction and hold ino->lock.
+  // Linux: vm_operations_struct->page_mkwrite
+  int (*allocpage) (struct inode *ino, uint idx);
   // Writes to the file.
   // Linux: file_operations->write
   int (*write) (struct inode *ino, int src_is_user, uint64 src, uint off, uint n);
@@ -128,6 +212,16 @@ struct filesystem_operations {
   // Removes a link, and deletes a file if it is the last link.
   // Linux: inode_operations->unlink
   int (*unlink) (struct dentry *d);
+  // Moves the entry old->name, which is old->inode, from
+  // directory old->parent to new->name in new->parent,
+  // replacing the entry there if new->inode is not 0. Points
+  // the ".." of a directory that changes parents at its new
+  // one. Only rewrites entries: sys_rename() has checked the
+  // move and adjusts nlink. Returns 0, or -1 with nothing
+  // changed if out of space. Caller must be in a transaction
+  // and hold the locks of both directories and both inodes.
+  // Linux: inode_operations->rename
+  int (*rename) (struct dentry *old, struct dentry *new);
   // look for a file in the directory.
   // Linux: inode_operations->lookup
   struct dentry *(*dirlookup) (struct inode *dir, const char *name);
@@ -144,4 +238,18 @@ struct filesystem_operations {
   struct inode *(*geti) (uint dev, uint inum, int inc_ref);
   // update lock
   void (*update_lock) (struct inode *ino);
+  // Copy the used entries of directory dp, starting at
+  // byte *off, to dst as struct dirent until n bytes are
+  // filled or the directory ends; advance *off past the
+  // entries read. Returns the number of bytes copied.
+  // Linux: file_operations->iterate_shared
+  int (*getdents) (struct inode *dp, uint *off, uint64 dst, int n);
+  // Write the file's dirty data and metadata to disk.
+  // Linux: file_operations->fsync
+  int (*fsync) (struct inode *ino);
+  // Start and end a system call that may modify the file system.
+  // Updates between the two reach the disk atomically.
+  // Linux: (none)
+  void (*begin_op) (struct super_block *sb);
+  void (*end_op) (struct super_block *sb);
 };
@@ -1,10 +1,30 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Each (dev, blockno) hashes to one of NBUCKET buckets. A bucket
+// is a linked list with its own spin-lock, so lookups and releases
+// of blocks in different buckets do not contend. A buffer lives on
+// exactly one bucket list; when a bucket has no free buffer on a
+// miss, bget() steals the least recently used free buffer from
+// another bucket.
+//
+// Buffer data lives in pages from kalloc(), BPP buffers per page.
+// The cache starts with NBUFINIT buffers and grows a page at a
+// time, while kalloc() has more than BRESERVE pages free, up to
+// 1/BCACHEFRAC of the memory that was free at boot; binit()
+// sizes the buffer headers for that many. When kalloc() runs
+// dry it calls bshrink() to take back a page whose buffers
+// are all unused.
+//
+// The file system changes blocks only through the log, which
+// pins a changed buffer in the cache until its commit has
+// installed it; see log_write(). So a free buffer is always
+// clean, and can be recycled without writing it first.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -23,34 +43,256 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "stats.h"
+#include "trace.h"
 
-struct {
+#define BHASH(dev, blockno) ((((dev) << 16) ^ (blockno)) % NBUCKET)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+};
+
+struct {
+  // Serializes buffer recycling, growing and shrinking, so
+  // that two processes missing on the same block cannot both
+  // install it. Lookups and releases only take the bucket lock.
+  struct spinlock lock;
+  struct buf *buf;   // maxbuf headers, from binit()
+  int maxbuf;
+  int npage;         // maxbuf / BPP
+
+  // page[i] holds the data of buf[i*BPP .. i*BPP+BPP-1],
+  // or is 0 if those buffers are not in use.
+  char **page;
+  int nbuf;          // buffers backed by a page
+
+  // Buffers that have a page but have never held a block.
+  // Protected by bcache.lock.
+  struct buf empty;
+
+  uint64 ahead;      // blocks read by breadahead()
+
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Insert b at the most-recently-used end of the list at head.
+// Caller must hold the lock protecting that list.
+static void
+bucket_push(struct buf *head, struct buf *b)
+{
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+static void
+bucket_remove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Give one more page worth of buffers to the cache.
+// Must be called without any bcache lock held, since
+// kalloc() may call back into bshrink().
+// Returns 0 on success, -1 if the cache is at maxbuf
+// or there is no memory.
+static int
+bgrow(void)
+{
+  char *pa;
+  int i, pg;
+  struct buf *b;
+
+  if(bcache.nbuf >= bcache.maxbuf)
+    return -1;
+  if((pa = kalloc()) == 0)
+    return -1;
+
+  acquire(&bcache.lock);
+  for(pg = 0; pg < bcache.npage; pg++){
+    if(bcache.page[pg] == 0)
+      break;
+  }
+  if(pg == bcache.npage){
+    // someone else grew the cache to its limit meanwhile.
+    release(&bcache.lock);
+    kfree(pa);
+    return -1;
+  }
+  bcache.page[pg] = pa;
+  for(i = 0; i < BPP; i++){
+    b = &bcache.buf[pg*BPP + i];
+    b->data = (uchar*)pa + i*BSIZE;
+    b->dev = 0;
+    b->blockno = 0;
+    b->valid = 0;
+    b->refcnt = 0;
+    bucket_push(&bcache.empty, b);
+  }
+  bcache.nbuf += BPP;
+  release(&bcache.lock);
+  return 0;
+}
+
+// Return a page of unused buffers to kalloc().
+// Called by kalloc() when it is out of memory.
+// Returns the number of pages freed.
+int
+bshrink(void)
+{
+  int i, pg;
+  char *pa;
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(i = 0; i < NBUCKET; i++)
+    acquire(&bcache.bucket[i].lock);
+
+  pa = 0;
+  for(pg = bcache.npage-1; pg >= 0 && bcache.nbuf - BPP >= NBUFINIT; pg--){
+    if(bcache.page[pg] == 0)
+      continue;
+    for(i = 0; i < BPP; i++){
+      b = &bcache.buf[pg*BPP + i];
+      if(b->refcnt != 0 || b->disk)
+        break;
+    }
+    if(i < BPP)
+      continue;
+    for(i = 0; i < BPP; i++){
+      b = &bcache.buf[pg*BPP + i];
+      bucket_remove(b);
+      b->data = 0;
+      b->valid = 0;
+    }
+    pa = bcache.page[pg];
+    bcache.page[pg] = 0;
+    bcache.nbuf -= BPP;
+    break;
+  }
+
+  for(i = NBUCKET-1; i >= 0; i--)
+    release(&bcache.bucket[i].lock);
+  release(&bcache.lock);
+
+  if(pa == 0)
+    return 0;
+  kfree(pa);
+  return 1;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
+  uint64 n, sz;
 
   initlock(&bcache.lock, "bcache");
+  bcache.empty.prev = &bcache.empty;
+  bcache.empty.next = &bcache.empty;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  // headers for up to 1/BCACHEFRAC of memory, and the
+  // page array after them.
+  n = kfreecount() / BCACHEFRAC;
+  if(n < NBUFINIT / BPP + 1)
+    n = NBUFINIT / BPP + 1;
+  bcache.npage = n;
+  bcache.maxbuf = n * BPP;
+  sz = bcache.maxbuf * sizeof(struct buf) + n * sizeof(char*);
+  if((bcache.buf = kallocn((sz + PGSIZE - 1) / PGSIZE)) == 0)
+    panic("binit: headers");
+  memset(bcache.buf, 0, sz);
+  bcache.page = (char**)(bcache.buf + bcache.maxbuf);
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(b = bcache.buf; b < bcache.buf+bcache.maxbuf; b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+
+  while(bcache.nbuf < NBUFINIT){
+    if(bgrow() < 0)
+      panic("binit");
+  }
+}
+
+// Look for block blockno on device dev in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bucket_find(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Least recently used free buffer in bucket bk, or 0.
+// A buffer being read ahead is not free until its read is done.
+// Caller must hold bk->lock.
+static struct buf*
+bucket_lru(struct bucket *bk)
+{
+  struct buf *b;
+
+  for(b = bk->head.prev; b != &bk->head; b = b->prev){
+    if(b->refcnt == 0 && !b->disk)
+      return b;
   }
+  return 0;
+}
+
+// Find a buffer to hold a block that hashes to bk: a never-used
+// buffer, else the LRU free buffer of bk, else one stolen from
+// another bucket. Returns 0 if every buffer is in use.
+// Caller must hold bcache.lock and bk->lock.
+static struct buf*
+brecycle(struct bucket *bk)
+{
+  struct buf *b;
+  struct bucket *victim;
+
+  if((b = bcache.empty.next) != &bcache.empty){
+    bucket_remove(b);
+    bucket_push(&bk->head, b);
+    return b;
+  }
+
+  if((b = bucket_lru(bk)) != 0){
+    statinc(ST_BEVICT);
+    return b;
+  }
+
+  // Holding bcache.lock makes it safe to hold two bucket
+  // locks at once, since nobody else ever does.
+  for(victim = bcache.bucket; victim < bcache.bucket+NBUCKET; victim++){
+    if(victim == bk)
+      continue;
+    acquire(&victim->lock);
+    if((b = bucket_lru(victim)) != 0){
+      bucket_remove(b);
+      release(&victim->lock);
+      bucket_push(&bk->head, b);
+      statinc(ST_BEVICT);
+      return b;
+    }
+    release(&victim->lock);
+  }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -60,33 +302,57 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  trace(TR_BGET, dev, blockno);
+  bk = &bcache.bucket[BHASH(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+  acquire(&bk->lock);
+  if((b = bucket_find(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  for(;;){
+    // Not cached.
+    // Grow into free memory rather than evict a useful block.
+    if(bcache.nbuf < bcache.maxbuf && kfreecount() > BRESERVE)
+      bgrow();
+
+    // Only one process at a time may recycle buffers.
+    acquire(&bcache.lock);
+    acquire(&bk->lock);
+
+    // Someone may have cached the block while we held no lock.
+    if((b = bucket_find(bk, dev, blockno)) != 0){
       b->refcnt++;
+      release(&bk->lock);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
-  }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
+    if((b = brecycle(bk)) != 0){
       b->dev = dev;
       b->blockno = blockno;
       b->valid = 0;
       b->refcnt = 1;
+      release(&bk->lock);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
+    release(&bk->lock);
+    release(&bcache.lock);
+
+    // Every buffer is in use: dip into the memory reserve.
+    if(bgrow() < 0)
+      panic("bget: no buffers");
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -96,13 +362,84 @@ bread(uint dev, uint blockno)
   struct buf *b;
 
   b = bget(dev, blockno);
+  if(b->disk)  // being read ahead
+    virtio_disk_wait(b);
   if(!b->valid) {
+    statinc(ST_BMISS);
+    trace(TR_BMISS, dev, blockno);
     virtio_disk_rw(b, 0);
     b->valid = 1;
+  } else {
+    statinc(ST_BHIT);
   }
   return b;
 }
 
+// Return a locked buf for the indicated block without
+// reading it, for a caller that will overwrite all of it.
+// b->valid says whether b->data holds the block; the
+// caller sets it once b->data is filled in.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->disk)  // being read ahead
+    virtio_disk_wait(b);
+  return b;
+}
+
+// Length of the run of consecutive blocks at the start of bufs.
+static int
+brun(struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 1; i < n; i++){
+    if(bufs[i]->dev != bufs[0]->dev ||
+       bufs[i]->blockno != bufs[0]->blockno + i)
+      break;
+  }
+  return i;
+}
+
+// Start reading the n blocks in blocknos into the cache,
+// without waiting for them. A buffer under a read keeps
+// b->disk set; bread() waits for it, and it is not recycled
+// until the read completes.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  int i, j, m;
+  struct buf *b, *bufs[RAMAX];
+
+  while(n > 0){
+    m = 0;
+    for(i = 0; i < n && m < RAMAX; i++){
+      b = bget(dev, blocknos[i]);
+      if(b->valid || b->disk){
+        brelse(b);
+        continue;
+      }
+      // valid once the read completes; everyone
+      // waits for b->disk before looking at data.
+      b->valid = 1;
+      bufs[m++] = b;
+    }
+    blocknos += i;
+    n -= i;
+
+    __sync_fetch_and_add(&bcache.ahead, m);
+    for(i = 0; i < m; i += j){
+      j = brun(bufs+i, m-i);
+      virtio_disk_submitv(bufs+i, j, 0);
+    }
+    for(i = 0; i < m; i++)
+      brelse(bufs[i]);
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,43 +449,76 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the contents of n locked buffers to disk.
+// All the writes are queued before waiting for any, and
+// each run of bufs holding consecutive blocks goes to the
+// disk as one request.
+void
+bwritev(struct buf **bufs, int n)
+{
+  int i, m;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+  }
+  for(i = 0; i < n; i += m){
+    m = brun(bufs+i, n-i);
+    virtio_disk_submitv(bufs+i, m, 1);
+  }
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bufs[i]);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of its bucket's most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b->dev and b->blockno cannot change while we hold a reference.
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bucket_remove(b);
+    bucket_push(&bk->head, b);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
-
+// Print cache size and hit rate, so one can tell
+// whether BCACHEFRAC and BRESERVE suit the workload.
+void
+bprint(void)
+{
+  printf("bcache: %d buffers (max %d), %d hits, %d misses, %d read ahead\n",
+         bcache.nbuf, bcache.maxbuf, (int)statsum(ST_BHIT), (int)statsum(ST_BMISS),
+         (int)bcache.ahead);
+}
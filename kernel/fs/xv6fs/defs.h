@@ -11,11 +11,23 @@ struct inode;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint*, int);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
+// log.c
+struct xv6fs_super_block;
+void            initlog(int, struct xv6fs_super_block*);
+void            log_write(struct buf*);
+int             log_force(int);
+void            logflushd(void);
+void            xv6fs_begin_op(struct super_block*);
+void            xv6fs_end_op(struct super_block*);
+
 // file.c
 struct xv6fs_file* xv6fs_filealloc(void);
 void               xv6fs_fileclose(struct xv6fs_file*);
@@ -29,7 +41,7 @@ int                xv6fs_filewrite(struct xv6fs_file*, uint64, int n);
 void                xv6fs_fsinit(void);
 int                 xv6fs_dirlink(struct xv6fs_inode*, char*, uint);
 struct dentry* xv6fs_dirlookup(struct inode*, const char*);
-struct inode* xv6fs_ialloc(struct super_block *);
+struct inode* xv6fs_ialloc(struct super_block *, struct inode *);
 struct xv6fs_inode* xv6fs_idup(struct xv6fs_inode*);
 void                xv6fs_iinit();
 void                xv6fs_ilock(struct xv6fs_inode*);
@@ -40,7 +52,10 @@ void                xv6fs_iupdate(struct inode*);
 int                 xv6fs_namecmp(const char*, const char*);
 struct xv6fs_inode* xv6fs_namei(char*);
 struct xv6fs_inode* xv6fs_nameiparent(char*, char*);
+int                 xv6fs_summary(int, struct xv6fs_super_block*);
+void                xv6fs_commitfree(int);
 int                 xv6fs_readi(struct inode*, int, uint64, uint, uint);
+void                xv6fs_readahead(struct inode*, struct file_ra_state*, uint, uint);
 void                xv6fs_stati(struct xv6fs_inode*, struct stat*);
 int                 xv6fs_writei(struct inode*, int, uint64, uint, uint);
 void                xv6fs_itrunc(struct inode*);
\ No newline at end of file
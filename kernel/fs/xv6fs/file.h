@@ -3,6 +3,7 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "types.h"
+#include "fs/vfs.h"
 
 struct xv6fs_file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
@@ -19,28 +20,36 @@ struct xv6fs_file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
-// in-memory copy of an inode
+// in-memory copy of an inode: the VFS inode, followed by
+// the fields only xv6fs uses. iget() allocates
+// xv6fs.inode_size bytes, so this is one allocation.
 struct xv6fs_inode {
-  uint dev;           // Device number
-  uint inum;          // Inode number
-  int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
-  int valid;          // inode has been read from disk?
-
-  short type;         // copy of disk inode
-  short major;
+  struct inode vfs;   // must be first
+  short major;        // copy of disk inode
   short minor;
-  short nlink;
-  uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  uint dslot;         // last used entry of the double-indirect block
+  uint daddr;         // its block number, or 0; see dindirect()
+  uint rbn;           // blocks rbn..rbn+rlen-1 are at raddr..;
+  uint raddr;         // see bmap_ind()
+  uint rlen;
+  char dx;            // directory: 0 unknown, 1 plain, 2 hashed
 };
 
+// The xv6fs_inode that contains VFS inode ino.
+#define XV6FS_I(ino) ((struct xv6fs_inode*)(ino))
+
 // map major device number to device functions.
+// read() also gets the file offset, which the device may
+// ignore; it is advanced by what each read returns.
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, uint);
   int (*write)(int, uint64, int);
 };
 
-extern struct super_block *root;
+extern struct super_block *root;   // the fs on ROOTDEV; see fs.c
 
 #define CONSOLE 1
+#define STATS   2   // event counters; see stats.c
+#define KLOG    3   // kernel log; see klog.c
+#define TRACE   4   // tracepoints; see trace.c
@@ -24,32 +24,107 @@
 #include "../vfs.h"
 #include "../defs.h"
 #include "xv6_fcntl.h"
+#include "stats.h"
+#include "klog.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct xv6fs_super_block sb; 
+
+#define NORPHAN 32   // unlinked inodes a mount frees in the background
+#define GUNCOUNTED 0xffffffff   // bfreemap.gfree[] of a group not counted yet
+
+// A mounted xv6fs: the VFS super block, followed by the
+// on-disk super block, the in-memory summaries of the
+// free bitmap and the inode table, and the orphan list. xv6fs_mount() allocates
+// it, and fsdev[] finds it by device number.
+struct xv6fs_sb {
+  struct super_block vfs;        // must be first
+  struct xv6fs_super_block sb;
+
+  // bfreemap summarizes the free bitmap in memory: the number
+  // of free blocks on the disk and in each bitmap block
+  // ("group"), and a next-fit cursor. balloc() skips full
+  // groups and full bytes of the bitmap, and starts at a goal
+  // block, usually the one after the file's previous block,
+  // so that files tend to be contiguous on disk. The bitmap
+  // block's sleep-lock serializes updates to its bits;
+  // bfreemap.lock protects the counts. The per-group counts
+  // are sized at mount time from the super block, and a group
+  // is counted (gcount()) when it is first read. nfree comes
+  // from the super block's summary if there is one; until
+  // fsscand has counted every group otherwise, it only covers
+  // the groups counted so far, and known is 0.
+  //
+  // A block freed in the open transaction is still in use on
+  // the disk until the transaction commits, and the commit
+  // writes file data to newly allocated blocks before its
+  // commit record. So such a block is held: its bit is set in
+  // held, a copy of the bitmap, and it is not counted free or
+  // allocated again until xv6fs_commitfree() lets it go.
+  struct {
+    struct spinlock lock;
+    uint nfree;            // free blocks on the disk
+    uint cursor;           // where the last allocation ended
+    uint ngroup;           // number of bitmap blocks
+    uint nleft;            // groups not counted yet
+    int known;             // nfree counts every group
+    uint *gfree;           // free blocks in each bitmap block
+    uint *nheld;           // held blocks in each bitmap block
+    uchar *held;           // a bit per block, BSIZE bytes a group
+  } bfreemap;
+
+  // imap is an in-memory bitmap of the inodes in use, so that
+  // ialloc() finds a free inode without reading the inode
+  // table. An inode block's bits are filled in (icountblk())
+  // when ialloc() or fsscand first reaches it. Bit inum is set
+  // from ialloc() until free_inode(). nifree and known work
+  // like bfreemap's.
+  struct {
+    struct spinlock lock;
+    uchar *map;       // sb.ninodes bits, in whole pages
+    uchar *counted;   // a bit per inode block, after map
+    uint cursor;      // where the last allocation ended
+    uint nifree;      // free inodes
+    uint nleft;       // inode blocks not counted yet
+    int known;        // nifree counts every inode block
+  } imap;
+
+  int scan;           // for fsscand to count; scanlock
+
+  // orphans holds the inodes of the on-disk orphan list,
+  // newest (sb.orphan) first. iput() of an unlinked file with
+  // indirect blocks puts it at the head, and ireclaimd frees
+  // the blocks of the one at the tail, a batch per
+  // transaction, then takes it off. orphanlock protects it
+  // and sb.orphan.
+  struct {
+    uint inum[NORPHAN];
+    int n;
+  } orphans;
+};
+
+static struct xv6fs_sb *fsdev[NDISK+1];
+static struct sleeplock mountlock;  // serializes xv6fs_mount()
+static struct spinlock orphanlock;  // the orphan lists; see above
+static struct spinlock scanlock;    // fsscand sleeps on it for work
+
 struct filesystem_type xv6fs;
 static struct filesystem_operations xv6fs_ops;
+// the private parts of open files.
+static struct kmem_cache *xv6fs_file_cache;
 struct inode *xv6fs_geti(uint dev, uint inum, int inc_ref);
-
-struct super_block *xv6fs_mount(const char *source) {
-  struct super_block *root_block = kalloc();
-  memset(root_block, 0, sizeof(*root_block));
-  root_block->type = &xv6fs;
-  root_block->root = xv6fs_geti(ROOTDEV, ROOTINO, 1);
-  root_block->parent = 0;
-  root_block->mountpoint = 0;
-  root_block->op = &xv6fs_ops;
-  root_block->root->op = &xv6fs_ops;
-  // printf("root op: %p\n", root_block->op);
-  root->private = &sb;
-  return root_block;
-}
-
-int xv6fs_umount(struct super_block *sb) {
-  // ignored at this stage
-  return 0;
+static void bload(struct xv6fs_sb*);
+static void iload(struct xv6fs_sb*);
+static void orphanload(struct xv6fs_sb*);
+static void ireclaimd(void);
+static void fsscand(void);
+
+// The mounted xv6fs on device dev.
+static struct xv6fs_sb*
+fsof(uint dev)
+{
+  if(dev > NDISK || fsdev[dev] == 0)
+    panic("xv6fs: device not mounted");
+  return fsdev[dev];
 }
 
 // Read the super block.
@@ -63,12 +138,150 @@ readsb(int dev, struct xv6fs_super_block *sb)
   brelse(bp);
 }
 
+// Write fs's super block, whose orphan list head changed.
+// Caller must be in a transaction. The commit brings the
+// free space summary in it up to date (xv6fs_summary()).
+static void
+writesb(struct xv6fs_sb *fs)
+{
+  struct buf *bp;
+
+  bp = bread(fs->vfs.dev, 1);
+  acquire(&orphanlock);
+  memmove(bp->data, &fs->sb, sizeof(fs->sb));
+  release(&orphanlock);
+  log_write(bp);
+  brelse(bp);
+}
+
+// Does the super block describe a file system
+// this kernel can use?
+static int
+sbvalid(struct xv6fs_super_block *sb)
+{
+  if(sb->magic != FSMAGIC || sb->bsize != BSIZE)
+    return 0;
+  if(sb->nlog < MAXOPBLOCKS || sb->ninodes < 2)
+    return 0;
+  if(sb->logstart + sb->nlog > sb->inodestart ||
+     sb->inodestart + sb->ninodes / IPB >= sb->bmapstart ||
+     sb->bmapstart + sb->size / BPB >= sb->size)
+    return 0;
+  if(sb->orphan >= sb->ninodes)
+    return 0;
+  return 1;
+}
+
+// Can a mount use the free space summary in sb, instead of
+// counting the free blocks and inodes? Images from an older
+// mkfs have none.
+static int
+sumvalid(struct xv6fs_super_block *sb)
+{
+  return sb->summary == FSSUMMARY &&
+    sb->nfree <= sb->size && sb->nifree < sb->ninodes &&
+    sb->bcursor <= sb->size && sb->icursor <= sb->ninodes;
+}
+
+// Copy fs's free space summary into the super block sb, the
+// contents of block 1, for the log commit on dev, which
+// calls this when no system call is in progress, so that
+// the counts match the bitmap and inode blocks it commits.
+// Returns 1 if that changed sb, and it must be logged too.
+int
+xv6fs_summary(int dev, struct xv6fs_super_block *sb)
+{
+  struct xv6fs_super_block sum;
+  struct xv6fs_sb *fs = fsof(dev);
+
+  sum = *sb;
+  acquire(&fs->bfreemap.lock);
+  sum.nfree = fs->bfreemap.nfree;
+  sum.bcursor = fs->bfreemap.cursor;
+  sum.summary = fs->bfreemap.known;
+  release(&fs->bfreemap.lock);
+  acquire(&fs->imap.lock);
+  sum.nifree = fs->imap.nifree;
+  sum.icursor = fs->imap.cursor;
+  sum.summary = sum.summary && fs->imap.known ? FSSUMMARY : 0;
+  release(&fs->imap.lock);
+  if(memcmp(sb, &sum, sizeof(sum)) == 0)
+    return 0;
+  *sb = sum;
+  return 1;
+}
+
+// Mount the file system on the disk named by source, "diskN"
+// for device N: recover its log, take the free block and
+// inode counts from the super block, or have fsscand count
+// them if it has no summary, and pick up the orphan list
+// that a crash left for ireclaimd to finish. Returns 0 if there is no such disk, it is
+// mounted already, or it does not hold an xv6fs.
+struct super_block *xv6fs_mount(const char *source) {
+  struct xv6fs_sb *fs;
+  struct super_block *s;
+  int dev;
+
+  if((dev = diskdev(source)) < 0 || !virtio_disk_present(dev))
+    return 0;
+  if(sizeof(*fs) > PGSIZE || (fs = kalloc()) == 0)
+    return 0;
+  memset(fs, 0, sizeof(*fs));
+
+  acquiresleep(&mountlock);
+  if(fsdev[dev])
+    goto bad;
+  readsb(dev, &fs->sb);
+  if(!sbvalid(&fs->sb))
+    goto bad;
+  s = &fs->vfs;
+  s->type = &xv6fs;
+  s->op = &xv6fs_ops;
+  s->dev = dev;
+  safestrcpy(s->device, source, DEVSIZ);
+  s->private = fs;
+  fsdev[dev] = fs;
+
+  initlog(dev, &fs->sb);
+  readsb(dev, &fs->sb);   // the log may have held a newer one
+  bload(fs);
+  iload(fs);
+  if(!fs->bfreemap.known || !fs->imap.known){
+    acquire(&scanlock);
+    fs->scan = 1;
+    wakeup(&scanlock);
+    release(&scanlock);
+  }
+  orphanload(fs);
+  s->root = xv6fs_geti(dev, ROOTINO, 1);
+  s->root->op = &xv6fs_ops;
+  releasesleep(&mountlock);
+  return s;
+
+ bad:
+  releasesleep(&mountlock);
+  kfree(fs);
+  return 0;
+}
+
+int xv6fs_umount(struct super_block *sb) {
+  // not supported: the fs stays mounted until shutdown.
+  return -1;
+}
+
 // Init fs
 void
 xv6fs_fsinit() {
-  readsb(ROOTDEV, &sb);
-  if(sb.magic != FSMAGIC)
-    panic("invalid file system");
+  initsleeplock(&mountlock, "xv6fs_mount");
+  initlock(&orphanlock, "orphan");
+  initlock(&scanlock, "fsscan");
+  xv6fs_file_cache = kmem_cache_create("xv6fs_file", sizeof(struct xv6fs_file));
+  if(kthread("logflushd", logflushd) < 0)
+    panic("xv6fs_fsinit: logflushd");
+  if(kthread("ireclaimd", ireclaimd) < 0)
+    panic("xv6fs_fsinit: ireclaimd");
+  if(kthread("fsscand", fsscand) < 0)
+    panic("xv6fs_fsinit: fsscand");
 }
 
 // Zero a block.
@@ -77,56 +290,246 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
-  bwrite(bp);
+  bp->valid = 1;
+  log_write(bp);
   brelse(bp);
 }
 
-// Blocks.
+// Blocks. The allocator state is bfreemap in struct xv6fs_sb.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Set up bfreemap at mount time, from the super block's
+// summary if it has one. The groups are counted later.
+static void
+bload(struct xv6fs_sb *fs)
+{
+  uint g, n;
+
+  initlock(&fs->bfreemap.lock, "bfreemap");
+  fs->bfreemap.ngroup = (fs->sb.size + BPB - 1) / BPB;
+  n = (fs->bfreemap.ngroup * (2*sizeof(uint) + BSIZE) + PGSIZE - 1) / PGSIZE;
+  if((fs->bfreemap.gfree = kallocn(n)) == 0)
+    panic("bload: bitmap too big");
+  memset(fs->bfreemap.gfree, 0, n * PGSIZE);
+  fs->bfreemap.nheld = fs->bfreemap.gfree + fs->bfreemap.ngroup;
+  fs->bfreemap.held = (uchar*)(fs->bfreemap.nheld + fs->bfreemap.ngroup);
+  for(g = 0; g < fs->bfreemap.ngroup; g++)
+    fs->bfreemap.gfree[g] = GUNCOUNTED;
+  fs->bfreemap.nleft = fs->bfreemap.ngroup;
+  if(sumvalid(&fs->sb)){
+    fs->bfreemap.nfree = fs->sb.nfree;
+    fs->bfreemap.cursor = fs->sb.bcursor;
+    fs->bfreemap.known = 1;
+  } else {
+    fs->bfreemap.cursor = fs->sb.bmapstart + fs->bfreemap.ngroup;
+  }
+}
+
+// Count the free blocks of group g in its bitmap block bp,
+// unless that was done already. Caller holds bp, so that
+// nobody allocates or frees in the group meanwhile.
+static void
+gcount(struct xv6fs_sb *fs, uint g, struct buf *bp)
+{
+  uint bi, n;
+
+  if(fs->bfreemap.gfree[g] != GUNCOUNTED)
+    return;
+  n = 0;
+  for(bi = 0; bi < BPB && g*BPB + bi < fs->sb.size; bi++)
+    if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+      n++;
+  acquire(&fs->bfreemap.lock);
+  fs->bfreemap.gfree[g] = n;
+  if(!fs->bfreemap.known)
+    fs->bfreemap.nfree += n;
+  if(--fs->bfreemap.nleft == 0)
+    fs->bfreemap.known = 1;
+  release(&fs->bfreemap.lock);
+}
+
+// Is bit bi of a group's bitmap map, or of its held bits,
+// set?
+#define BUSY(map, held, bi) (((map)[(bi)/8] | (held)[(bi)/8]) & (1 << ((bi) % 8)))
+
+// Find a bit in [lo..hi) that is clear in both map and held,
+// skipping full bytes. Returns its index, or -1.
+static int
+bscan(uchar *map, uchar *held, int lo, int hi)
+{
+  int bi, n;
+
+  for(bi = lo, n = 1; bi < hi; n++){
+    if(bi % 8 == 0 && (map[bi/8] | held[bi/8]) == 0xff){
+      bi += 8;
+      continue;
+    }
+    if(!BUSY(map, held, bi))
+      break;
+    bi++;
+  }
+  statadd(ST_BALLOCSCAN, n);
+  return bi < hi ? bi : -1;
+}
+
+// Allocate a run of up to want contiguous disk blocks, at or
+// after goal if possible; goal 0 means anywhere. The run lies
+// within one bitmap block, so it costs one bitmap update. The
+// blocks are not zeroed. Sets *got to the run's length.
+// returns the run's first block, or 0 if out of disk space
+// or want is 0.
 static uint
-balloc(uint dev)
+balloc_range(uint dev, uint goal, uint want, uint *got)
 {
-  int b, bi, m;
+  struct xv6fs_sb *fs = fsof(dev);
+  uint b, g, g0, i, lo, hi, n;
+  int bi;
   struct buf *bp;
+  uchar *held;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        bwrite(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+  *got = 0;
+  statinc(ST_BALLOC);
+  if(want == 0)
+    return 0;
+  if(fs->bfreemap.known && fs->bfreemap.nfree == 0)
+    goto out;
+  if(goal == 0 || goal >= fs->sb.size)
+    goal = fs->bfreemap.cursor;
+  if(goal >= fs->sb.size)
+    goal = 0;
+
+  // visit every group once, starting with the goal's,
+  // then the part of the goal's group before the goal.
+  g0 = goal / BPB;
+  for(i = 0; i <= fs->bfreemap.ngroup; i++){
+    g = (g0 + i) % fs->bfreemap.ngroup;
+    if(fs->bfreemap.gfree[g] == 0)
+      continue;
+    lo = i == 0 ? goal % BPB : 0;
+    hi = i == fs->bfreemap.ngroup ? goal % BPB : BPB;
+    if(g*BPB + hi > fs->sb.size)
+      hi = fs->sb.size - g*BPB;
+    bp = bread(dev, fs->sb.bmapstart + g);
+    gcount(fs, g, bp);
+    held = fs->bfreemap.held + g*BSIZE;
+    if((bi = bscan(bp->data, held, lo, hi)) >= 0){
+      // Mark the run in use, extending it while the
+      // following blocks are free.
+      for(n = 0; n < want && bi + n < hi; n++){
+        if(BUSY(bp->data, held, bi+n))
+          break;
+        bp->data[(bi+n)/8] |= 1 << ((bi+n) % 8);
       }
+      log_write(bp);
+      brelse(bp);
+      b = g*BPB + bi;
+      acquire(&fs->bfreemap.lock);
+      fs->bfreemap.gfree[g] -= n;
+      fs->bfreemap.nfree -= n;
+      fs->bfreemap.cursor = b + n;
+      release(&fs->bfreemap.lock);
+      *got = n;
+      return b;
     }
     brelse(bp);
   }
+out:
   printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate a zeroed disk block, at or after goal if
+// possible; goal 0 means anywhere.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, got;
+
+  if((b = balloc_range(dev, goal, 1, &got)) != 0)
+    bzero(dev, b);
+  return b;
+}
+
+// bfreev() has cleared n bits of bitmap block bp, for group g,
+// and held them until the transaction commits.
+static void
+bfreedone(struct xv6fs_sb *fs, struct buf *bp, uint g, int n)
+{
+  acquire(&fs->bfreemap.lock);
+  fs->bfreemap.nheld[g] += n;
+  release(&fs->bfreemap.lock);
+  log_write(bp);
+  brelse(bp);
+}
+
+// The transaction that freed the held blocks of dev is
+// committing: count them free, and let balloc() have them.
+// Called by commit(), before xv6fs_summary(), with no system
+// call running that could allocate or free a block.
+void
+xv6fs_commitfree(int dev)
+{
+  struct xv6fs_sb *fs = fsof(dev);
+  uint g;
+
+  if(fs == 0)
+    return;
+  acquire(&fs->bfreemap.lock);
+  for(g = 0; g < fs->bfreemap.ngroup; g++){
+    if(fs->bfreemap.nheld[g] == 0)
+      continue;
+    fs->bfreemap.gfree[g] += fs->bfreemap.nheld[g];
+    fs->bfreemap.nfree += fs->bfreemap.nheld[g];
+    fs->bfreemap.nheld[g] = 0;
+    memset(fs->bfreemap.held + g*BSIZE, 0, BSIZE);
+  }
+  release(&fs->bfreemap.lock);
+}
+
+// Free the disk blocks a[0..n) that are not 0. Blocks next
+// to each other in a share a bitmap block, which is read and
+// logged once for all of them.
+static void
+bfreev(int dev, uint *a, int n)
+{
+  struct xv6fs_sb *fs = fsof(dev);
+  struct buf *bp;
+  uint b, g;
+  int i, bi, m, nfree;
+
+  bp = 0;
+  g = nfree = 0;
+  for(i = 0; i < n; i++){
+    if((b = a[i]) == 0)
+      continue;
+    if(bp == 0 || b / BPB != g){
+      if(bp)
+        bfreedone(fs, bp, g, nfree);
+      g = b / BPB;
+      bp = bread(dev, BBLOCK(b, fs->sb));
+      // a held block is counted when the group is.
+      gcount(fs, g, bp);
+      nfree = 0;
+    }
+    bi = b % BPB;
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0)
+      panic("freeing free block");
+    bp->data[bi/8] &= ~m;
+    fs->bfreemap.held[g*BSIZE + bi/8] |= m;
+    nfree++;
+  }
+  if(bp)
+    bfreedone(fs, bp, g, nfree);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
-  int bi, m;
-
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  bwrite(bp);
-  brelse(bp);
+  bfreev(dev, &b, 1);
 }
 
 // Inodes.
@@ -199,108 +602,213 @@ bfree(int dev, uint b)
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 
-// Allocate an inode on device dev.
+// Set up imap at mount time, from the super block's summary
+// if it has one. The inode blocks are counted later.
+static void
+iload(struct xv6fs_sb *fs)
+{
+  uint n, nblk;
+
+  initlock(&fs->imap.lock, "imap");
+  nblk = (fs->sb.ninodes + IPB - 1) / IPB;
+  n = (fs->sb.ninodes / 8 + 1 + nblk / 8 + 1 + PGSIZE - 1) / PGSIZE;
+  if((fs->imap.map = kallocn(n)) == 0)
+    panic("iload: too many inodes");
+  memset(fs->imap.map, 0, n * PGSIZE);
+  fs->imap.counted = fs->imap.map + fs->sb.ninodes / 8 + 1;
+  fs->imap.map[0] = 1;  // inode 0 is never used
+  fs->imap.nleft = nblk;
+  fs->imap.cursor = 1;
+  if(sumvalid(&fs->sb)){
+    fs->imap.nifree = fs->sb.nifree;
+    if(fs->sb.icursor > 0)
+      fs->imap.cursor = fs->sb.icursor;
+    fs->imap.known = 1;
+  }
+}
+
+// Has inode block blk of fs been counted?
+// Caller holds fs->imap.lock.
+static int
+icounted(struct xv6fs_sb *fs, uint blk)
+{
+  return (fs->imap.counted[blk/8] & (1 << (blk % 8))) != 0;
+}
+
+// Fill in imap for the inodes of inode block blk, bp, unless
+// that was done already. Caller holds bp, so that none of
+// its inodes is allocated or freed meanwhile.
+static void
+icountblk(struct xv6fs_sb *fs, uint blk, struct buf *bp)
+{
+  struct dinode *dip;
+  uint inum, n;
+
+  acquire(&fs->imap.lock);
+  if(!icounted(fs, blk)){
+    n = 0;
+    for(inum = blk * IPB; inum < (blk+1) * IPB && inum < fs->sb.ninodes; inum++){
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(inum == 0 || dip->type != 0)
+        fs->imap.map[inum/8] |= 1 << (inum % 8);
+      else
+        n++;
+    }
+    fs->imap.counted[blk/8] |= 1 << (blk % 8);
+    if(!fs->imap.known)
+      fs->imap.nifree += n;
+    if(--fs->imap.nleft == 0)
+      fs->imap.known = 1;
+  }
+  release(&fs->imap.lock);
+}
+
+// Take a free inode number from fs's imap, looking first
+// at the inode block of dir, if any, then onwards.
+// Returns 0 if there is none.
+static uint
+imap_take(struct xv6fs_sb *fs, struct inode *dir)
+{
+  uint start, i, inum;
+  struct buf *bp;
+
+  statinc(ST_IALLOC);
+  acquire(&fs->imap.lock);
+  if(fs->imap.known && fs->imap.nifree == 0){
+    release(&fs->imap.lock);
+    return 0;
+  }
+  start = dir ? dir->inum / IPB * IPB : fs->imap.cursor;
+  for(i = 0; i < fs->sb.ninodes; i++){
+    inum = (start + i) % fs->sb.ninodes;
+    if(!icounted(fs, inum / IPB)){
+      // learn which of the block's inodes are free first.
+      release(&fs->imap.lock);
+      bp = bread(fs->vfs.dev, IBLOCK(inum, fs->sb));
+      icountblk(fs, inum / IPB, bp);
+      brelse(bp);
+      acquire(&fs->imap.lock);
+    }
+    if(inum % 8 == 0 && fs->imap.map[inum/8] == 0xff && inum + 8 <= fs->sb.ninodes){
+      i += 7;
+      continue;
+    }
+    if((fs->imap.map[inum/8] & (1 << (inum % 8))) == 0){
+      fs->imap.map[inum/8] |= 1 << (inum % 8);
+      fs->imap.cursor = inum + 1;
+      fs->imap.nifree--;
+      release(&fs->imap.lock);
+      statadd(ST_IALLOCSCAN, i + 1);
+      return inum;
+    }
+  }
+  release(&fs->imap.lock);
+  statadd(ST_IALLOCSCAN, i);
+  return 0;
+}
+
+// Allocate an inode in file system s, near dir if possible.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
 // or NULL if there is no free inode.
 struct inode*
-xv6fs_ialloc(struct super_block *root)
+xv6fs_ialloc(struct super_block *s, struct inode *dir)
 {
+  struct xv6fs_sb *fs = s->private;
   int inum;
   struct buf *bp;
   struct dinode *dip;
   struct inode *ip;
-  struct xv6fs_inode *xv6fs_ip;
-
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(ROOTDEV, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = 3; // any problem?
-      bwrite(bp);   // mark it allocated on the disk
-      brelse(bp);
-      ip = xv6fs_geti(ROOTDEV, inum, 1);
-      // same to root, as in xv6 file system
-      ip->op = root->op;
-      // printf("ialloc: ip->op = %p\n", ip->op);
-      ip->sb = root;
-      // ip->nlink = dip->nlink; ??????
-      if (ip->private == 0) { // do we really need it
-        xv6fs_ip = kalloc();
-        memset(xv6fs_ip, 0, sizeof(*xv6fs_ip)); // kalloc returns shit
-        ip->private = xv6fs_ip;
-      }
 
-      return ip;
-    }
-    brelse(bp);
+  if((inum = imap_take(fs, dir)) == 0){
+    printf("ialloc: no inodes\n");
+    return 0;
   }
-  printf("ialloc: no inodes\n");
-  return 0;
+
+  bp = bread(s->dev, IBLOCK(inum, fs->sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: imap out of date");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = 3; // any problem?
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  ip = xv6fs_geti(s->dev, inum, 1);
+  ip->op = s->op;
+  // ip->nlink = dip->nlink; ??????
+
+  return ip;
 }
 
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
-// that lives on disk.
+// that lives on disk; the file data paths instead set
+// inode->dirty and leave it to the VFS iupdate(). Logs the
+// inode block only if the dinode changes.
 // Caller must hold ip->lock.
 void
 xv6fs_iupdate(struct inode *inode)
 {
   struct buf *bp;
-  struct dinode *dip;
-  struct xv6fs_inode *ip = inode->private;
-
-  bp = bread(inode->dev, IBLOCK(inode->inum, sb));
+  struct dinode *dip, di;
+  struct xv6fs_inode *ip = XV6FS_I(inode);
+  struct xv6fs_sb *fs = fsof(inode->dev);
+
+  memset(&di, 0, sizeof(di));
+  di.type = inode->type;
+  di.major = ip->major;
+  di.minor = ip->minor;
+  di.nlink = inode->nlink;
+  di.size = inode->size;
+  memmove(di.addrs, ip->addrs, sizeof(ip->addrs));
+  inode->dirty = 0;
+
+  bp = bread(inode->dev, IBLOCK(inode->inum, fs->sb));
   dip = (struct dinode*)bp->data + inode->inum%IPB;
-  dip->type = inode->type;
-  #ifdef REF
-    printf("dip: %p\n", dip);
-    printf("^iupdate! ino: %d has type %d\n", inode->inum, inode->type);
-    printf("^iupdate! ino: %d has nlink %d\n", inode->inum, inode->nlink);
-    printf("^iupdate! ino: %d has address %p\n", inode->inum, ip->addrs);
-    printf("^iupdate! ino: %d has size: %d\n", inode->inum, inode->size);
-  #endif
-  dip->major = ip->major;
-  dip->minor = ip->minor;
-  dip->nlink = inode->nlink;
-  dip->size = inode->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  bwrite(bp);
+  if(memcmp(dip, &di, sizeof(di)) != 0){
+    klog(KS_XV6FS, KL_DEBUG, "iupdate: inode %d type %d nlink %d size %d",
+         inode->inum, inode->type, inode->nlink, inode->size);
+    if(dip->type != 0 && di.type == 0){
+      // freed. Counted here, with bp held, so that an
+      // icountblk() of the block counts it exactly once.
+      acquire(&fs->imap.lock);
+      if(fs->imap.known || icounted(fs, inode->inum / IPB))
+        fs->imap.nifree++;
+      release(&fs->imap.lock);
+    }
+    *dip = di;
+    log_write(bp);
+    statinc(ST_IWRITE);
+  }
   brelse(bp);
 }
 
 // release inode in the memory
 void xv6fs_release_inode(struct inode *ino) {
-  #ifdef LINK
-    printf("release inode %d\n", ino->inum);
-  #endif
-  if (ino->private != 0) {
-    kfree(ino->private);
-    ino->private = 0;
-    ino->type = 0;
-  }
+  klog(KS_XV6FS, KL_DEBUG, "release: inode %d", ino->inum);
+  ino->valid = 0;
+  ino->type = 0;
 }
 
 // free the inode in both the memory and the disk
 void xv6fs_free_inode(struct inode *ino) {
-  #ifdef LINK
-    printf("free inode %d\n", ino->inum);
-  #endif
-  if (ino->private != 0) {
-    kfree(ino->private);
-    ino->private = 0;
-    ino->type = 0;
-  }
+  struct xv6fs_sb *fs = fsof(ino->dev);
+
+  klog(KS_XV6FS, KL_DEBUG, "free: inode %d", ino->inum);
+  acquire(&fs->imap.lock);
+  fs->imap.map[ino->inum/8] &= ~(1 << (ino->inum % 8));
+  release(&fs->imap.lock);
+  ino->valid = 0;
+  ino->type = 0;
 }
 
 // open a file
 struct file *xv6fs_open(struct inode *ino, uint mode) {
   // printf("entering xv6fs_open()\n");
-  struct xv6fs_inode *ip = ino->private;
+  struct xv6fs_inode *ip = XV6FS_I(ino);
   struct file *f;
-  struct xv6fs_inode *xv6fs_f = 0;
-  if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
+  struct xv6fs_file *xv6fs_f = 0;
+  if(ino->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     return 0;
   }
 
@@ -308,57 +816,35 @@ struct file *xv6fs_open(struct inode *ino, uint mode) {
     return 0;
   }
 
-  xv6fs_f = kalloc();
+  if((xv6fs_f = kmem_cache_alloc(xv6fs_file_cache)) == 0) {
+    filefree(f);
+    return 0;
+  }
   memset(xv6fs_f, 0, sizeof(*xv6fs_f));
 
-  if(ip->type == T_DEVICE){
+  if(ino->type == T_DEVICE){
     xv6fs_f->type = FD_DEVICE;
     xv6fs_f->major = ip->major;
+    f->major = ip->major;
   } else {
     xv6fs_f->type = FD_INODE;
-    f->off = 0;
   }
+  f->off = 0;
   f->inode = ino;
   f->private = xv6fs_f;
   f->readable = !(mode & O_WRONLY);
   f->writable = (mode & O_WRONLY) || (mode & O_RDWR);
+  f->append = (mode & O_APPEND) != 0;
   // printf("leaving xv6fs_open()\n");
   return f;
 }
 
 // close a file
 void xv6fs_close(struct file *f) {
-  if(f->ref < 1)
-    panic("fileclose");
-  if(--f->ref > 0){
-    return;
-  }
-  
-  f->ref = 0;
-
-  if(f->private != 0 && f->inode == 0) { // this is a pipe
-    struct pipe *pp = f->private;
-    pipeclose(pp, f->writable);
-  } else {
-    iput(f->inode);
-    kfree(f->private);
-  }
-
-}
-
-// is this directory empty?
-int xv6fs_isdirempty(struct inode *dir) {
-  int off;
-  struct xv6fs_dentry de;
-
-  for(off=2*sizeof(de); off < dir->size; off+=sizeof(de)){
-    if(xv6fs_readi(dir, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-
+  xv6fs_begin_op(f->inode->sb);
+  iput(f->inode);
+  xv6fs_end_op(f->inode->sb);
+  kmem_cache_free(xv6fs_file_cache, f->private);
 }
 
 // release the dentry
@@ -372,7 +858,115 @@ void xv6fs_release_dentry(struct dentry *dentry) {
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are listed in the indirect blocks that block
+// ip->addrs[NDIRECT+1] lists.
+
+// Return the nth entry of indirect block ind. If it is
+// zero and alloc is set, allocate a block for it; goal
+// is where to look for one if there is no previous entry.
+// If run is not 0, sets *run to the number of contiguous
+// blocks that start with the one returned.
+// Returns 0 if there is no such block or no disk space.
+static uint
+bmap_ind(uint dev, uint ind, uint bn, uint goal, int alloc, uint *run)
+{
+  uint addr, i, *a;
+  struct buf *bp;
+
+  bp = bread(dev, ind);
+  a = (uint*)bp->data;
+  if((addr = a[bn]) == 0 && alloc){
+    if(bn > 0)
+      goal = a[bn-1] ? a[bn-1] + 1 : 0;
+    addr = balloc(dev, goal);
+    if(addr){
+      a[bn] = addr;
+      log_write(bp);
+    }
+  }
+  if(run){
+    for(i = bn + 1; i < NINDIRECT && a[i] == a[i-1] + 1; i++)
+      ;
+    *run = i - bn;
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Block bn of ip if it is in the run that bmap_leaf()
+// remembered, else 0.
+static uint
+bmap_run(struct xv6fs_inode *ip, uint bn)
+{
+  uint addr;
+
+  addr = 0;
+  acquire(&ip->vfs.cachelock);
+  if(bn - ip->rbn < ip->rlen)
+    addr = ip->raddr + (bn - ip->rbn);
+  release(&ip->vfs.cachelock);
+  return addr;
+}
+
+// bmap_ind() for entry i of indirect block ind, which maps
+// file block fb of ip. Remembers the run of contiguous
+// blocks that starts at fb in ip->rbn, ip->raddr and
+// ip->rlen, so that bmap() and bmap_lookup() map the rest
+// of the run without reading ind again. Allocation only
+// fills zero entries, which a run never covers, so the run
+// stays right until itrunc(). Readers holding the inode
+// lock shared share the run, so it is kept under cachelock.
+static uint
+bmap_leaf(struct xv6fs_inode *ip, uint ind, uint fb, uint i, int alloc)
+{
+  uint addr, run;
+
+  if((addr = bmap_ind(ip->vfs.dev, ind, i, ind + 1, alloc, &run)) != 0){
+    acquire(&ip->vfs.cachelock);
+    ip->rbn = fb;
+    ip->raddr = addr;
+    ip->rlen = run;
+    release(&ip->vfs.cachelock);
+  }
+  return addr;
+}
+
+// Return the block number of the indirect block that lists
+// block bn of the double-indirect range of ip, allocating
+// it (and the double-indirect block) if alloc is set.
+// Remembers the last one in ip->daddr, so that a sequential
+// pass does not read the double-indirect block once per
+// data block. Returns 0 if there is no such block.
+static uint
+dindirect(struct xv6fs_inode *ip, uint bn, int alloc)
+{
+  uint addr, slot;
+
+  slot = bn / NINDIRECT;
+  acquire(&ip->vfs.cachelock);
+  addr = ip->daddr && ip->dslot == slot ? ip->daddr : 0;
+  release(&ip->vfs.cachelock);
+  if(addr)
+    return addr;
+
+  if((addr = ip->addrs[NDIRECT+1]) == 0){
+    if(!alloc)
+      return 0;
+    addr = balloc(ip->vfs.dev, ip->addrs[NDIRECT] ? ip->addrs[NDIRECT] + 1 : 0);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+1] = addr;
+    ip->vfs.dirty = 1;
+  }
+  if((addr = bmap_ind(ip->vfs.dev, addr, slot, addr + 1, alloc, 0)) != 0){
+    acquire(&ip->vfs.cachelock);
+    ip->dslot = slot;
+    ip->daddr = addr;
+    release(&ip->vfs.cachelock);
+  }
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -380,107 +974,541 @@ void xv6fs_release_dentry(struct dentry *dentry) {
 static uint
 bmap(struct xv6fs_inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, fb;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->vfs.dev, bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : 0);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
+      ip->vfs.dirty = 1;
     }
     return addr;
   }
+  if((addr = bmap_run(ip, bn)) != 0)
+    return addr;
+  fb = bn;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->vfs.dev, ip->addrs[NDIRECT-1] ? ip->addrs[NDIRECT-1] + 1 : 0);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
+      ip->vfs.dirty = 1;
     }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        bwrite(bp);
-      }
-    }
-    brelse(bp);
-    return addr;
+    return bmap_leaf(ip, addr, fb, bn, 1);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    if((addr = dindirect(ip, bn, 1)) == 0)
+      return 0;
+    return bmap_leaf(ip, addr, fb, bn % NINDIRECT, 1);
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-xv6fs_itrunc(struct inode *ino)
+// Like bmap, but never allocates: returns 0 if the
+// nth block of ip has not been allocated.
+static uint
+bmap_lookup(struct xv6fs_inode *ip, uint bn)
 {
-  #ifdef REF
-    printf("inode %d is truncated\n", ino->inum);
-    printf("inode device number: %d\n", ino->dev);
-  #endif
-  struct xv6fs_inode *ip = ino->private;
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  uint addr, fb;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ino->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  if((addr = bmap_run(ip, bn)) != 0)
+    return addr;
+  fb = bn;
+  bn -= NDIRECT;
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ino->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ino->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ino->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+  if(bn < NINDIRECT){
+    if((addr = ip->addrs[NDIRECT]) == 0)
+      return 0;
+    return bmap_leaf(ip, addr, fb, bn, 0);
   }
+  bn -= NINDIRECT;
 
-  ino->size = 0;
-  xv6fs_iupdate(ino);
+  if(bn < NDINDIRECT){
+    if((addr = dindirect(ip, bn, 0)) == 0)
+      return 0;
+    return bmap_leaf(ip, addr, fb, bn % NINDIRECT, 0);
+  }
+  return 0;
 }
 
+// Fill the zero entries of a[0..n) with new blocks, a
+// contiguous run at a time. prev is the block before a[0],
+// or 0. The new blocks are zeroed except for those in
+// a[zlo..zhi), which the caller will overwrite entirely.
+// Adds the number of blocks allocated to *tot.
+// Returns -1 if the disk filled up, 0 otherwise.
+static int
+bfill(uint dev, uint *a, uint n, uint prev, int zlo, int zhi, uint *tot)
+{
+  uint i, j, b, got;
 
+  for(i = 0; i < n; ){
+    if(a[i]){
+      prev = a[i++];
+      continue;
+    }
+    for(j = i; j < n && a[j] == 0; j++)
+      ;
+    if((b = balloc_range(dev, prev ? prev + 1 : 0, j - i, &got)) == 0)
+      return -1;
+    *tot += got;
+    for(; got > 0; got--, i++, b++){
+      if((int)i < zlo || (int)i >= zhi)
+        bzero(dev, b);
+      a[i] = b;
+    }
+    prev = a[i-1];
+  }
+  return 0;
+}
 
-// Read data from inode.
-// Caller must hold ip->lock.
-// If user_dst==1, then dst is a user virtual address;
-// otherwise, dst is a kernel address.
-int
-xv6fs_readi(struct inode *ino, int user_dst, uint64 dst, uint off, uint n)
+// bfill() entries lo..hi-1 of indirect block ind.
+static int
+bfill_ind(uint dev, uint ind, uint lo, uint hi, int zlo, int zhi)
 {
-  uint tot, m;
+  uint *a, tot;
   struct buf *bp;
+  int r;
+
+  bp = bread(dev, ind);
+  a = (uint*)bp->data;
+  tot = 0;
+  r = bfill(dev, a + lo, hi - lo, lo > 0 ? a[lo-1] : ind,
+            zlo - (int)lo, zhi - (int)lo, &tot);
+  if(tot > 0)
+    log_write(bp);
+  brelse(bp);
+  return r;
+}
 
-  if(off > ino->size || off + n < off) {
-    printf("fuck yourself\n");
-    return 0;
-  }
-  if(off + n > ino->size)
-    n = ino->size - off;
+// Allocate the missing blocks among blocks bn..bn+n-1 of
+// ip in contiguous runs, so that a large write takes a few
+// bitmap updates instead of one per block. New blocks in
+// zlo..zhi-1 are left unzeroed, since the caller is about
+// to overwrite them entirely. Stops quietly if the disk
+// fills up; bmap() then reports it.
+static void
+bmap_range(struct xv6fs_inode *ip, uint bn, uint n, int zlo, int zhi)
+{
+  uint end, m, base, addr, tot;
+  int r;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ino->private, off/BSIZE);
-    if(addr == 0)
+  tot = 0;
+  end = bn + n;
+  if(end > MAXFILE)
+    end = MAXFILE;
+  if(bn < NDIRECT){
+    m = min(end, NDIRECT);
+    r = bfill(ip->vfs.dev, ip->addrs + bn, m - bn, bn > 0 ? ip->addrs[bn-1] : 0,
+              zlo - (int)bn, zhi - (int)bn, &tot);
+    if(tot > 0)
+      ip->vfs.dirty = 1;
+    if(r < 0)
+      return;
+    bn = m;
+  }
+  if(bn >= end)
+    return;
+  bn -= NDIRECT;
+  end -= NDIRECT;
+  zlo -= NDIRECT;
+  zhi -= NDIRECT;
+
+  if(bn < NINDIRECT){
+    if((addr = ip->addrs[NDIRECT]) == 0){
+      addr = balloc(ip->vfs.dev, ip->addrs[NDIRECT-1] ? ip->addrs[NDIRECT-1] + 1 : 0);
+      if(addr == 0)
+        return;
+      ip->addrs[NDIRECT] = addr;
+      ip->vfs.dirty = 1;
+    }
+    m = min(end, NINDIRECT);
+    if(bfill_ind(ip->vfs.dev, addr, bn, m, zlo, zhi) < 0)
+      return;
+    bn = m;
+  }
+  bn -= NINDIRECT;
+  end -= NINDIRECT;
+  zlo -= NINDIRECT;
+  zhi -= NINDIRECT;
+
+  while(bn < end){
+    if((addr = dindirect(ip, bn, 1)) == 0)
+      return;
+    base = bn - bn % NINDIRECT;
+    m = min(end, base + NINDIRECT);
+    if(bfill_ind(ip->vfs.dev, addr, bn - base, m - base,
+                 zlo - (int)base, zhi - (int)base) < 0)
+      return;
+    bn = m;
+  }
+}
+
+// Free the blocks that indirect block ind lists, then ind.
+static void
+bfree_ind(uint dev, uint ind)
+{
+  struct buf *bp;
+
+  bp = bread(dev, ind);
+  bfreev(dev, (uint*)bp->data, NINDIRECT);
+  brelse(bp);
+  bfree(dev, ind);
+}
+
+// Does ip keep its data in ip->addrs[]? See DI_INLINE. Not
+// checked against T_FILE, since iput() clears the type of a
+// file before truncating it.
+static int
+isinline(struct xv6fs_inode *ip)
+{
+  return ip->vfs.type != T_DEVICE && (ip->major & DI_INLINE);
+}
+
+// Free the last indirect block's worth of ip's blocks, or
+// the direct blocks once that is all there is, so that a
+// transaction frees a bounded number. Returns 0 when ip has
+// no blocks left. Caller must hold ip->lock, in a transaction.
+static int
+itrunc_step(struct xv6fs_inode *ip)
+{
+  uint dev = ip->vfs.dev;
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  ip->daddr = 0;
+  ip->rlen = 0;
+  ip->vfs.dirty = 1;
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    for(j = NINDIRECT-1; j >= 0 && a[j] == 0; j--)
+      ;
+    if(j >= 0){
+      bfree_ind(dev, a[j]);
+      a[j] = 0;
+      log_write(bp);
+      brelse(bp);
+      return 1;
+    }
+    brelse(bp);
+    bfree(dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+    return 1;
+  }
+
+  if(ip->addrs[NDIRECT]){
+    bfree_ind(dev, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+    return 1;
+  }
+
+  bfreev(dev, ip->addrs, NDIRECT);
+  memset(ip->addrs, 0, NDIRECT * sizeof(uint));
+  return 0;
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+xv6fs_itrunc(struct inode *ino)
+{
+  klog(KS_XV6FS, KL_DEBUG, "itrunc: dev %d inode %d", ino->dev, ino->inum);
+
+  struct xv6fs_inode *ip = XV6FS_I(ino);
+
+  // no cached page may be written to a freed block.
+  pcdrop(ino);
+
+  if(isinline(ip)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  } else {
+    while(itrunc_step(ip))
+      ;
+    // an empty file starts out inline again.
+    if(ino->type == T_FILE)
+      ip->major |= DI_INLINE;
+  }
+  ino->size = 0;
+  xv6fs_iupdate(ino);
+}
+
+// Put unlinked ino on the orphan list, for ireclaimd to free
+// its blocks and then the inode, unless it has only direct
+// blocks, which are quick to free now, or the list is full.
+// Returns 1 if ino is on the list.
+// Caller must hold ino->lock, in a transaction.
+static int
+xv6fs_orphan(struct inode *ino)
+{
+  struct xv6fs_inode *ip = XV6FS_I(ino);
+  struct xv6fs_sb *fs = fsof(ino->dev);
+  int i;
+
+  acquire(&orphanlock);
+  for(i = 0; i < fs->orphans.n; i++){
+    if(fs->orphans.inum[i] == ino->inum){
+      // ireclaimd's reference, or its predecessor's.
+      release(&orphanlock);
+      return 1;
+    }
+  }
+  if(isinline(ip) || (ip->addrs[NDIRECT] == 0 && ip->addrs[NDIRECT+1] == 0) ||
+     fs->orphans.n == NORPHAN){
+    release(&orphanlock);
+    return 0;
+  }
+  memmove(fs->orphans.inum + 1, fs->orphans.inum, fs->orphans.n * sizeof(uint));
+  fs->orphans.inum[0] = ino->inum;
+  fs->orphans.n++;
+  ino->size = fs->sb.orphan;
+  fs->sb.orphan = ino->inum;
+  release(&orphanlock);
+  klog(KS_XV6FS, KL_DEBUG, "orphan: inode %d next %d", ino->inum, ino->size);
+
+  // no cached page may be written to a freed block.
+  pcdrop(ino);
+  xv6fs_iupdate(ino);
+  writesb(fs);
+  wakeup(&orphanlock);
+  return 1;
+}
+
+// Read the orphan list that fs's super block heads.
+static void
+orphanload(struct xv6fs_sb *fs)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint inum;
+  int n;
+
+  n = 0;
+  inum = fs->sb.orphan;
+  while(inum != 0){
+    if(inum >= fs->sb.ninodes || n == NORPHAN){
+      klog(KS_XV6FS, KL_WARN, "mount: orphan list broken at inode %d", inum);
       break;
-    bp = bread(ino->dev, addr);
+    }
+    bp = bread(fs->vfs.dev, IBLOCK(inum, fs->sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type == 0 || dip->nlink != 0){
+      brelse(bp);
+      klog(KS_XV6FS, KL_WARN, "mount: orphan list broken at inode %d", inum);
+      break;
+    }
+    fs->orphans.inum[n++] = inum;
+    inum = dip->size;
+    brelse(bp);
+  }
+  if(n > 0)
+    klog(KS_XV6FS, KL_INFO, "mount: %d orphans to free", n);
+
+  acquire(&orphanlock);
+  fs->orphans.n = n;
+  release(&orphanlock);
+  wakeup(&orphanlock);
+}
+
+// Free the blocks of orphan inum of fs, a batch per
+// transaction, then take it off the orphan list and free
+// the inode. Only ireclaimd takes inodes off, always the
+// last one, so inum stays last meanwhile.
+static void
+reclaim(struct xv6fs_sb *fs, uint inum)
+{
+  struct super_block *s = &fs->vfs;
+  struct inode *ino, *prev;
+  uint pinum;
+  int more, n;
+
+  ino = xv6fs_geti(s->dev, inum, 1);
+  ino->op = &xv6fs_ops;
+  do {
+    xv6fs_begin_op(s);
+    ilock(ino);
+    more = itrunc_step(XV6FS_I(ino));
+    xv6fs_iupdate(ino);
+    iunlock(ino);
+    xv6fs_end_op(s);
+  } while(more);
+
+  xv6fs_begin_op(s);
+  acquire(&orphanlock);
+  n = --fs->orphans.n;
+  pinum = n > 0 ? fs->orphans.inum[n-1] : 0;
+  if(pinum == 0)
+    fs->sb.orphan = 0;
+  release(&orphanlock);
+  if(pinum){
+    // the inode put on the list after inum points to it.
+    prev = xv6fs_geti(s->dev, pinum, 1);
+    prev->op = &xv6fs_ops;
+    ilock(prev);
+    prev->size = 0;
+    xv6fs_iupdate(prev);
+    iunlockput(prev);
+  } else {
+    writesb(fs);
+  }
+
+  ilock(ino);
+  ino->type = 0;
+  ino->size = 0;
+  xv6fs_iupdate(ino);
+  xv6fs_free_inode(ino);
+  releasesleep(&ino->lock);
+  iput(ino);
+  xv6fs_end_op(s);
+  klog(KS_XV6FS, KL_DEBUG, "reclaim: inode %d freed", inum);
+  statinc(ST_RECLAIM);
+}
+
+// Kernel thread that frees the blocks of the orphans of
+// every mounted xv6fs, oldest first, so that neither unlink()
+// nor close() waits for a large file's blocks to be freed.
+static void
+ireclaimd(void)
+{
+  struct xv6fs_sb *fs;
+  uint inum;
+  int dev;
+
+  for(;;){
+    acquire(&orphanlock);
+    fs = 0;
+    while(fs == 0){
+      for(dev = 1; dev <= NDISK && fs == 0; dev++)
+        if(fsdev[dev] && fsdev[dev]->orphans.n > 0)
+          fs = fsdev[dev];
+      if(fs == 0)
+        sleep(&orphanlock, &orphanlock);
+    }
+    inum = fs->orphans.inum[fs->orphans.n - 1];
+    release(&orphanlock);
+    reclaim(fs, inum);
+  }
+}
+
+// Count the free blocks and inodes of fs, whose super block
+// had no summary, reading each bitmap and inode block that
+// balloc() and ialloc() have not read yet. The counts become
+// known when it is done, and the next commit records them.
+static void
+fsscan(struct xv6fs_sb *fs)
+{
+  struct buf *bp;
+  uint g, blk;
+
+  for(g = 0; g < fs->bfreemap.ngroup; g++){
+    bp = bread(fs->vfs.dev, fs->sb.bmapstart + g);
+    gcount(fs, g, bp);
+    brelse(bp);
+  }
+  for(blk = 0; blk * IPB < fs->sb.ninodes; blk++){
+    bp = bread(fs->vfs.dev, fs->sb.inodestart + blk);
+    icountblk(fs, blk, bp);
+    brelse(bp);
+  }
+  klog(KS_XV6FS, KL_INFO, "mount: disk %d has %d free blocks, %d free inodes",
+       fs->vfs.dev, fs->bfreemap.nfree, fs->imap.nifree);
+
+  xv6fs_begin_op(&fs->vfs);
+  writesb(fs);
+  xv6fs_end_op(&fs->vfs);
+}
+
+// Count what mounts without a usable summary left uncounted,
+// one file system at a time, so that the mount need not wait.
+static void
+fsscand(void)
+{
+  struct xv6fs_sb *fs;
+  int dev;
+
+  for(;;){
+    acquire(&scanlock);
+    fs = 0;
+    while(fs == 0){
+      for(dev = 1; dev <= NDISK && fs == 0; dev++)
+        if(fsdev[dev] && fsdev[dev]->scan)
+          fs = fsdev[dev];
+      if(fs == 0)
+        sleep(&scanlock, &scanlock);
+    }
+    fs->scan = 0;
+    release(&scanlock);
+    fsscan(fs);
+  }
+}
+
+
+
+static char zeros[BSIZE];   // what a hole reads as
+
+// Read data from inode. Blocks that were never written, the
+// holes of a sparse file, read as zeros without any I/O, and
+// an inline file is read from the inode itself, or from its
+// cached page.
+// Caller must hold ip->lock.
+// If user_dst==1, then dst is a user virtual address;
+// otherwise, dst is a kernel address.
+int
+xv6fs_readi(struct inode *ino, int user_dst, uint64 dst, uint off, uint n)
+{
+  struct ucursor uc;
+  char inl[INLINESIZE];
+  uint tot, m;
+  struct buf *bp;
+
+  if(off > ino->size || off + n < off) {
+    klog(KS_XV6FS, KL_DEBUG, "readi: inode %d off %d past size %d",
+         ino->inum, off, ino->size);
+    return 0;
+  }
+  if(off + n > ino->size)
+    n = ino->size - off;
+  if(isinline(XV6FS_I(ino))){
+    // a store through mmap() goes to the cached page, if
+    // there is one, not to addrs[].
+    memmove(inl, XV6FS_I(ino)->addrs, ino->size);
+    pcfetch(ino, 0, inl, ino->size);
+    if(either_copyout(user_dst, dst, inl + off, n) == -1)
+      return -1;
+    return n;
+  }
+  if(ino->type == T_FILE)
+    return pcread(ino, user_dst, dst, off, n);
+
+  // the cursor translates each user page once, not once
+  // per block.
+  ucinit(&uc, user_dst ? myproc()->pagetable : 0);
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    uint addr = bmap_lookup(XV6FS_I(ino), off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(addr == 0){
+      // a hole reads as zeros, and stays a hole.
+      if(copyoutc(&uc, dst, zeros + (off % BSIZE), m) == -1) {
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    bp = bread(ino->dev, addr);
+    if(copyoutc(&uc, dst, (char*)bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
       break;
@@ -490,45 +1518,255 @@ xv6fs_readi(struct inode *ino, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Sequential readahead.
+// A read that starts where the previous one ended (or in
+// the same block) is sequential. Each sequential read doubles
+// the window, from RAMIN up to RAMAX blocks, and starts reads
+// of the blocks in the window that are not yet requested;
+// the blocks of the current read are part of the window, so
+// they go to the disk together. Any other read resets it.
+// Caller must hold ip->lock.
+void
+xv6fs_readahead(struct inode *ino, struct file_ra_state *ra, uint off, uint n)
+{
+  uint first, last, bn, end, nblocks;
+  uint addrs[RAMAX];
+  int na;
+
+  if(n == 0 || off >= ino->size || isinline(XV6FS_I(ino)))
+    return;
+  if(off + n > ino->size)
+    n = ino->size - off;
+  first = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+
+  if(first != ra->next && first + 1 != ra->next){
+    // random access: start over.
+    ra->next = last + 1;
+    ra->size = 0;
+    ra->end = 0;
+    return;
+  }
+  ra->next = last + 1;
+  if(ra->size == 0)
+    ra->size = RAMIN;
+  else if(ra->size < RAMAX)
+    ra->size *= 2;
+  if(ra->size > RAMAX)
+    ra->size = RAMAX;
+
+  nblocks = (ino->size + BSIZE - 1) / BSIZE;
+  end = last + 1 + ra->size;
+  if(end > nblocks)
+    end = nblocks;
+  bn = ra->end > first ? ra->end : first;
+  if(ino->type == T_FILE){
+    // into the page cache, whole pages at a time.
+    end = (end + BPP - 1) / BPP * BPP;
+    if(end > bn + RAMAX)
+      end = (bn + RAMAX) / BPP * BPP;
+    if(bn < end)
+      pcreadahead(ino, bn / BPP, end / BPP);
+    if(end > ra->end)
+      ra->end = end;
+    return;
+  }
+  na = 0;
+  for(; bn < end && na < RAMAX; bn++){
+    if((addrs[na] = bmap_lookup(XV6FS_I(ino), bn)) == 0)
+      break;
+    na++;
+  }
+  ra->end = bn;
+  breadahead(ino->dev, addrs, na);
+}
+
+// Set blocks[] to the disk blocks of page idx of ino,
+// for the page cache. Caller must hold ip->lock.
+static void
+xv6fs_mappage(struct inode *ino, uint idx, uint *blocks)
+{
+  uint i, bn;
+
+  for(i = 0; i < BPP; i++){
+    bn = idx * BPP + i;
+    if(bn >= MAXFILE || isinline(XV6FS_I(ino)))
+      blocks[i] = 0;
+    else
+      blocks[i] = bmap_lookup(XV6FS_I(ino), bn);
+  }
+}
+
+// Fill page idx of an inline file for the page cache.
+// Caller must hold ip->lock, shared or not.
+static int
+xv6fs_fillpage(struct inode *ino, uint idx, char *data)
+{
+  struct xv6fs_inode *ip = XV6FS_I(ino);
+
+  if(!isinline(ip))
+    return 0;
+  if(idx == 0)
+    memmove(data, ip->addrs, ino->size);
+  return 1;
+}
+
+// Move inline ip's data to a block of its own, by way of the
+// page cache, which may hold a newer copy of it that was
+// stored to through mmap(). Returns 0, or -1 if the disk is
+// full, leaving ip inline.
+// Caller must hold ip->lock, in a transaction.
+static int
+uninline(struct xv6fs_inode *ip)
+{
+  struct inode *ino = &ip->vfs;
+  uint save[NDIRECT+2];
+  char *data;
+
+  data = 0;
+  if(ino->size > 0 && (data = pcget(ino, 0, 1)) == 0)
+    return -1;
+  memmove(save, ip->addrs, sizeof(save));
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->major &= ~DI_INLINE;
+  ino->dirty = 1;
+  if(data == 0)
+    return 0;
+  // the page cache writes the page whole: no zeroing.
+  bmap_range(ip, 0, 1, 0, MAXFILE);
+  if(bmap_lookup(ip, 0) == 0){
+    memmove(ip->addrs, save, sizeof(save));
+    ip->major |= DI_INLINE;
+    kfree(data);
+    return -1;
+  }
+  pcdirty(ino, 0, data);
+  kfree(data);
+  return 0;
+}
+
+// Allocate the missing blocks of page idx of ino up to its
+// end, for a page stored to through mmap().
+// Caller must hold ip->lock, in a transaction.
+static int
+xv6fs_allocpage(struct inode *ino, uint idx)
+{
+  struct xv6fs_inode *ip = XV6FS_I(ino);
+  uint bn, end;
+
+  if(isinline(ip) && uninline(ip) < 0)
+    return -1;
+  bn = idx * BPP;
+  end = (ino->size + BSIZE - 1) / BSIZE;
+  if(end > bn + BPP)
+    end = bn + BPP;
+  if(end > MAXFILE)
+    end = MAXFILE;
+  if(bn >= end)
+    return 0;
+  // the page cache writes the page whole: no zeroing.
+  bmap_range(ip, bn, end - bn, 0, MAXFILE);
+  if(ino->dirty)
+    xv6fs_iupdate(ino);
+  for(; bn < end; bn++)
+    if(bmap_lookup(ip, bn) == 0)
+      return -1;
+  return 0;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
-// there was an error of some kind.
+// there was an error of some kind. A regular file's inode is
+// left dirty for the caller's iupdate(). An inline file is
+// given a block when it grows past INLINESIZE.
 int
 xv6fs_writei(struct inode *ino, int user_src, uint64 src, uint off, uint n)
 {
+  struct xv6fs_inode *ip = XV6FS_I(ino);
+  struct ucursor uc;
   uint tot, m;
   struct buf *bp;
 
-  if(off > ino->size || off + n < off)
+  if(off + n < off || off + n > MAXFILE*BSIZE)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  // a file may be written past its end, which leaves a hole
+  // of unallocated blocks; a directory may not.
+  if(off > ino->size && ino->type != T_FILE)
     return -1;
 
+  if(isinline(ip) && off + n <= INLINESIZE){
+    // into the inode, and the page cache's copy, if any,
+    // which may hold stores through mmap() that addrs[]
+    // lacks: take those first.
+    pcfetch(ino, 0, (char*)ip->addrs, ino->size);
+    if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+      return -1;
+    pcupdate(ino, off, (char*)ip->addrs + off, n);
+    ino->dirty = 1;
+    tot = n;
+    off += n;
+    goto out;
+  }
+  if(isinline(ip) && uninline(ip) < 0)
+    return -1;
+
+  if(ino->type == T_FILE){
+    // the data goes to the page cache, which writes whole
+    // pages, so no new block needs zeroing. Write only as far
+    // as there are blocks.
+    if(n > 0)
+      bmap_range(XV6FS_I(ino), off/BSIZE, (off + n - 1)/BSIZE - off/BSIZE + 1,
+                 0, MAXFILE);
+    for(m = 0; m < n; m += BSIZE - (off + m) % BSIZE)
+      if(bmap_lookup(XV6FS_I(ino), (off + m)/BSIZE) == 0)
+        break;
+    tot = pcwrite(ino, user_src, src, off, min(m, n));
+    off += tot;
+    goto out;
+  }
+
+  // blocks off/BSIZE..(off+n-1)/BSIZE are written, and
+  // (off+BSIZE-1)/BSIZE..(off+n)/BSIZE-1 are written whole.
+  if(n > 0)
+    bmap_range(XV6FS_I(ino), off/BSIZE, (off + n - 1)/BSIZE - off/BSIZE + 1,
+               (off + BSIZE - 1)/BSIZE, (off + n)/BSIZE);
+
+  ucinit(&uc, user_src ? myproc()->pagetable : 0);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ino->private, off/BSIZE);
+    uint addr = bmap(XV6FS_I(ino), off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ino->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+    if(m == BSIZE)
+      bp = bnew(ino->dev, addr);  // no need to read what we overwrite
+    else
+      bp = bread(ino->dev, addr);
+    if(copyinc(&uc, (char*)bp->data + (off % BSIZE), src, m) == -1) {
+      // if bp came from bnew() and was not valid, it stays
+      // invalid, so the garbage is never seen.
       brelse(bp);
       break;
     }
-    bwrite(bp);
+    bp->valid = 1;
+    log_write(bp);
     brelse(bp);
   }
 
-  if(off > ino->size)
+out:
+  if(off > ino->size){
     ino->size = off;
+    ino->dirty = 1;
+  }
 
-  // write the i-node back to disk even if the size didn't change
-  // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
-  xv6fs_iupdate(ino);
+  // a file's writer calls iupdate() once it is done; the
+  // directory writes come from inside xv6fs, so write the
+  // inode now if the loop above grew it.
+  if(ino->type != T_FILE && ino->dirty)
+    xv6fs_iupdate(ino);
 
   return tot;
 }
@@ -541,53 +1779,253 @@ xv6fs_namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
-// If found, set *poff to byte offset of entry.
-struct dentry*
-xv6fs_dirlookup(struct inode *dp, const char *name)
+// Directory entries are read a block at a time. A directory
+// is either a plain array of xv6fs_dentry, scanned from the
+// start, or hashed (see struct dxroot in fs.h), in which case
+// only the chain of leaf blocks for the name's bucket is read.
+
+// offsets in a hashed directory of leaf[h] in the index,
+// and of the tail of leaf block fb.
+#define DXLEAFOFF(h)  (3*sizeof(struct xv6fs_dentry) + (h)*sizeof(ushort))
+#define DXTAILOFF(fb) ((fb)*BSIZE + NDXLEAF*sizeof(struct xv6fs_dentry))
+
+#define DF_NAME 0   // dirfind(): the entry called name
+#define DF_FREE 1   // a free entry
+#define DF_USED 2   // any used entry
+
+// Return a locked buf with file block fb of directory dp.
+static struct buf*
+dirblock(struct inode *dp, uint fb)
 {
-  #ifdef LINK
-    printf("entering dirlookup\n");
-    printf("looking for %s\n", name);
-  #endif
-  uint off;
-  struct xv6fs_dentry de;
+  uint addr;
+
+  if((addr = bmap_lookup(XV6FS_I(dp), fb)) == 0)
+    panic("dirblock: hole");
+  return bread(dp->dev, addr);
+}
+
+// Scan the entries in bytes [off, end) of directory dp, one
+// bread per block, for the first that matches how. Copies the
+// entry to *dep if dep is not 0.
+// Returns the entry's offset, or -1 if there is none.
+static int
+dirfind(struct inode *dp, int how, const char *name, uint off, uint end,
+        struct xv6fs_dentry *dep)
+{
+  struct buf *bp;
+  struct xv6fs_dentry *de;
+  int match, n;
+
+  bp = 0;
+  n = 0;
+  if(end > dp->size)
+    end = dp->size;
+  for(; off < end; off += sizeof(*de), n++){
+    if(bp == 0 || off % BSIZE == 0){
+      if(bp)
+        brelse(bp);
+      bp = dirblock(dp, off/BSIZE);
+    }
+    de = (struct xv6fs_dentry*)(bp->data + off%BSIZE);
+    if(how == DF_NAME)
+      match = de->inum != 0 && xv6fs_namecmp(name, de->name) == 0;
+    else if(how == DF_FREE)
+      match = de->inum == 0;
+    else
+      match = de->inum != 0;
+    if(match){
+      if(dep)
+        *dep = *de;
+      brelse(bp);
+      statadd(ST_DIRSCAN, n + 1);
+      return off;
+    }
+  }
+  if(bp)
+    brelse(bp);
+  statadd(ST_DIRSCAN, n);
+  return -1;
+}
+
+// Is dp a hashed directory? The answer is remembered
+// until the inode is read from disk again.
+static int
+dxdir(struct inode *dp)
+{
+  struct xv6fs_inode *ip = XV6FS_I(dp);
+  struct dxroot root;
+
+  if(ip->dx == 0){
+    ip->dx = 1;
+    if(dp->size >= BSIZE &&
+       xv6fs_readi(dp, 0, (uint64)&root, 0, sizeof(root)) == sizeof(root) &&
+       root.magic.inum == 0 &&
+       memcmp(root.magic.name, DXMAGIC, sizeof(DXMAGIC)) == 0)
+      ip->dx = 2;
+  }
+  return ip->dx == 2;
+}
+
+// File block of the first leaf of bucket h of hashed
+// directory dp, or 0.
+static uint
+dxfirst(struct inode *dp, uint h)
+{
+  ushort fb;
+
+  if(xv6fs_readi(dp, 0, (uint64)&fb, DXLEAFOFF(h), sizeof(fb)) != sizeof(fb))
+    panic("dxfirst");
+  return fb;
+}
+
+// File block of the leaf after leaf fb, or 0.
+static uint
+dxnext(struct inode *dp, uint fb)
+{
+  struct dxtail t;
+
+  if(xv6fs_readi(dp, 0, (uint64)&t, DXTAILOFF(fb), sizeof(t)) != sizeof(t))
+    panic("dxnext");
+  return t.next;
+}
+
+// Find the entry for name in dp.
+// Returns its offset and copies it to *dep, or returns -1.
+static int
+direntry(struct inode *dp, const char *name, struct xv6fs_dentry *dep)
+{
+  uint fb;
+  int off;
+
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
+  if(!dxdir(dp))
+    return dirfind(dp, DF_NAME, name, 0, dp->size, dep);
+
+  if(xv6fs_namecmp(name, ".") == 0 || xv6fs_namecmp(name, "..") == 0)
+    return dirfind(dp, DF_NAME, name, 0, 2*sizeof(*dep), dep);
+  for(fb = dxfirst(dp, dxhash(name)); fb != 0; fb = dxnext(dp, fb)){
+    off = dirfind(dp, DF_NAME, name, fb*BSIZE,
+                  fb*BSIZE + NDXLEAF*sizeof(*dep), dep);
+    if(off >= 0)
+      return off;
+  }
+  return -1;
+}
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    // printf("dirlookup: off = %d\n", off);
-    if(xv6fs_readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    #ifdef LINK
-    printf("dirlookup: name = %s\n", de.name);
-    #endif
-    if(de.inum == 0) {
-      // printf("dirlookup: de.inum == 0\n");
-      continue;
+// Look for a directory entry in a directory.
+// Returns its inode number, or 0 if there is none.
+static uint
+dirscan(struct inode *dp, const char *name)
+{
+  struct xv6fs_dentry de;
+
+  if(direntry(dp, name, &de) < 0)
+    return 0;
+  return de.inum;
+}
+
+// Find a free entry for name in hashed directory dp, adding
+// a leaf block at the end of dp if its bucket is full.
+// Returns the entry's offset, or -1 if out of disk space.
+static int
+dxfree(struct inode *dp, const char *name)
+{
+  uint h, fb, last, off;
+  int free;
+  ushort nfb;
+
+  h = dxhash(name);
+  last = 0;
+  for(fb = dxfirst(dp, h); fb != 0; fb = dxnext(dp, fb)){
+    free = dirfind(dp, DF_FREE, 0, fb*BSIZE,
+                   fb*BSIZE + NDXLEAF*sizeof(struct xv6fs_dentry), 0);
+    if(free >= 0)
+      return free;
+    last = fb;
+  }
+
+  // The new leaf is zeroed by the allocator, so writing
+  // its first entry leaves an empty tail.
+  // leaf[] and dxtail.next are ushorts.
+  if(dp->size / BSIZE > 0xffff)
+    return -1;
+  nfb = dp->size / BSIZE;
+  if(last)
+    off = DXTAILOFF(last) + 4;  // dxtail.next
+  else
+    off = DXLEAFOFF(h);
+  if(bmap(XV6FS_I(dp), nfb) == 0)
+    return -1;
+  dp->size = (nfb + 1) * BSIZE;
+  if(xv6fs_writei(dp, 0, (uint64)&nfb, off, sizeof(nfb)) != sizeof(nfb))
+    return -1;
+  return nfb * BSIZE;
+}
+
+// Copy the used entries of dp from *off on to user
+// address dst, a block at a time, while they fit in n bytes.
+static int
+xv6fs_getdents(struct inode *dp, uint *off, uint64 dst, int n)
+{
+  struct buf *bp;
+  struct xv6fs_dentry *de;
+  struct dirent d;
+  int tot;
+
+  tot = 0;
+  bp = 0;
+  for(; *off < dp->size && tot + sizeof(d) <= n; *off += sizeof(*de)){
+    if(bp == 0 || *off % BSIZE == 0){
+      if(bp)
+        brelse(bp);
+      bp = dirblock(dp, *off/BSIZE);
     }
-    if(xv6fs_namecmp(name, de.name) == 0){
-      // entry matches path element
-      struct dentry *dentry = kalloc();
-      struct inode *ino = xv6fs_geti(dp->dev, de.inum, 1);
-      ino->op = dp->op;
-      // printf("dirlookup: ino->op = %p\n", ino->op);
-      dentry->op = dp->op;
-      dentry->inode = ino;
-      dentry->parent = dp;
-      strncpy(dentry->name, name, DIRSIZ);
-      #ifdef REF
-        printf("dirlookup: I've found\n");
-      #endif
-      return dentry;
+    de = (struct xv6fs_dentry*)(bp->data + *off%BSIZE);
+    if(de->inum == 0)
+      continue;
+    d.inum = de->inum;
+    memmove(d.name, de->name, DIRSIZ);
+    if(either_copyout(1, dst + tot, &d, sizeof(d)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
     }
+    tot += sizeof(d);
   }
+  if(bp)
+    brelse(bp);
+  return tot;
+}
 
-  #ifdef REF
-    printf("dirlookup: not found\n");
-  #endif
+// is this directory empty?
+int xv6fs_isdirempty(struct inode *dir) {
+  // the index and tails of a hashed directory have inum 0.
+  return dirfind(dir, DF_USED, 0, 2*sizeof(struct xv6fs_dentry), dir->size, 0) < 0;
+}
 
-  return 0;
+// Look for a directory entry in a directory.
+// If found, return a dentry from dgetblank() whose inode
+// is referenced; the VFS dentry cache takes it over.
+struct dentry*
+xv6fs_dirlookup(struct inode *dp, const char *name)
+{
+  uint inum;
+  struct dentry *dentry;
+  struct inode *ino;
+
+  if((inum = dirscan(dp, name)) == 0)
+    return 0;
+
+  if((dentry = dgetblank()) == 0)
+    panic("dirlookup: no dentries");
+  ino = xv6fs_geti(dp->dev, inum, 1);
+  ino->op = dp->op;
+  dentry->op = dp->op;
+  dentry->inode = ino;
+  dentry->parent = dp;
+  strncpy(dentry->name, name, DIRSIZ);
+  return dentry;
 }
 
 int xv6fs_link(struct dentry *target) {
@@ -595,45 +2033,29 @@ int xv6fs_link(struct dentry *target) {
   struct xv6fs_dentry de;
   struct inode *dp = target->parent;
   struct inode *son = target->inode;
-  struct inode *ino = 0;
   char name[DIRSIZ];
   strncpy(name, target->name, DIRSIZ);
-  #ifdef LINK
-    printf("link: parent inode: %d\n", dp->inum);
-    printf("link: son inode: %d\n", son->inum);
-  #endif
-  struct dentry *dd = xv6fs_dirlookup(dp, name);
-  #ifdef LINK
-    printf("link: dd = %p\n", dd->name);
-  #endif
-  if (dd != 0 && (ino = dd->inode) != 0) {
-    iput(ino);
+  klog(KS_XV6FS, KL_DEBUG, "link: inode %d in dir %d", son->inum, dp->inum);
+  if (dirscan(dp, name) != 0) {
     return -1;
   }
 
-  #ifdef LINK
-    printf("link: file does not exist\n");
-  #endif
 
   // look for an empty dentry
-  for (off = 0; off < dp->size; off += sizeof(de)) {
-    if (xv6fs_readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
-      panic("dirlink read");
-    }
-    if (de.inum == 0) {
-      break;
-    }
+  if (dxdir(dp)) {
+    if ((off = dxfree(dp, name)) < 0)
+      return -1;
+  } else if ((off = dirfind(dp, DF_FREE, 0, 0, dp->size, 0)) < 0) {
+    off = dp->size;
   }
 
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = son->inum;
   if (xv6fs_writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
     return -1;
   }
 
-  #ifdef LINK
-    printf("link: link success\n");
-  #endif
 
   return 0;
 }
@@ -642,109 +2064,136 @@ int xv6fs_unlink(struct dentry *d) {
   // now that dirlookup can't change off, we have to do it manually
   struct xv6fs_dentry de;
   struct inode *dp = d->parent;
-  #ifdef REF
-    printf("unlink: parent inode: %d\n", dp->inum);
-  #endif
+  klog(KS_XV6FS, KL_DEBUG, "unlink: dir %d", dp->inum);
   char name[DIRSIZ];
   strncpy(name, d->name, DIRSIZ);
-  uint off = 0;
-  for (off = 0; off < dp->size; off += sizeof(de)) {
-    if (xv6fs_readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
-      panic("dirlink read in unlink");
-      return -1;
-    }
-    #ifdef REF
-      printf("name: %s\n", de.name);
-    #endif
-    if (xv6fs_namecmp(name, de.name) == 0) {
-      // panic("x");
-      memset(&de, 0, sizeof(de));
-      if (xv6fs_writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
-        panic("unlink write");
-        return -1;
-      }
-    }
+  int off;
+  if ((off = direntry(dp, name, &de)) < 0)
+    return 0;
+  memset(&de, 0, sizeof(de));
+  if (xv6fs_writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) {
+    panic("unlink write");
+    return -1;
   }
 
   return 0;
 }
 
+// Rename: see rename in vfs.h. A new name in the same plain
+// directory is written over the old one in place, and one
+// that replaces an entry takes over that entry; otherwise the
+// entry is added as link() does and the old one cleared.
+static int
+xv6fs_rename(struct dentry *old, struct dentry *new)
+{
+  struct inode *odp = old->parent, *ndp = new->parent;
+  struct inode *ip = old->inode;
+  struct xv6fs_dentry de;
+  struct dentry link;
+  int off, noff;
+
+  klog(KS_XV6FS, KL_DEBUG, "rename: inode %d from dir %d to dir %d",
+       ip->inum, odp->inum, ndp->inum);
+  if ((off = direntry(odp, old->name, &de)) < 0 || de.inum != ip->inum)
+    return -1;
+  if (new->inode) {
+    if ((noff = direntry(ndp, new->name, &de)) < 0)
+      return -1;
+    de.inum = ip->inum;
+    if (xv6fs_writei(ndp, 0, (uint64)&de, noff, sizeof(de)) != sizeof(de))
+      panic("rename write");
+  } else if (odp == ndp && !dxdir(odp)) {
+    memset(de.name, 0, DIRSIZ);
+    strncpy(de.name, new->name, DIRSIZ);
+    if (xv6fs_writei(odp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("rename write");
+    return 0;
+  } else {
+    // a new entry only ever goes into a free slot or a new
+    // block, so off still names the old one.
+    link = *new;
+    link.inode = ip;
+    if (xv6fs_link(&link) < 0)
+      return -1;
+  }
+
+  memset(&de, 0, sizeof(de));
+  if (xv6fs_writei(odp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("rename write");
+
+  if (ip->type == T_DIR && odp != ndp) {
+    if ((off = dirfind(ip, DF_NAME, "..", 0, 2*sizeof(de), &de)) < 0)
+      panic("rename: no ..");
+    de.inum = ndp->inum;
+    if (xv6fs_writei(ip, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("rename write");
+  }
+  return 0;
+}
 
 // create a file
 int xv6fs_create(struct inode *dir, struct dentry *target, short type, short major, short minor) {
   struct inode *ino = target->inode;
-  struct xv6fs_inode *ip = ino->private;
+  struct xv6fs_inode *ip = XV6FS_I(ino);
   ip->major = major;
   ip->minor = minor;
+  if(type == T_FILE)
+    ip->major = DI_INLINE;   // until it outgrows the inode
   return 0;
 }
 
+// Read ino's dinode from disk.
+static void
+iread(struct inode *ino)
+{
+  struct xv6fs_inode *ip = XV6FS_I(ino);
+  struct xv6fs_sb *fs = fsof(ino->dev);
+  struct buf *bp = bread(ino->dev, IBLOCK(ino->inum, fs->sb));
+  struct dinode *dip = (struct dinode*)bp->data + ino->inum%IPB;
+
+  ino->type = dip->type;
+  ino->nlink = dip->nlink;
+  ino->size = dip->size;
+  ip->major = dip->major;
+  ip->minor = dip->minor;
+  memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+  klog(KS_XV6FS, KL_DEBUG, "iread: inode %d type %d nlink %d",
+       ino->inum, ino->type, ino->nlink);
+  brelse(bp);
+  ip->daddr = 0;
+  ip->rlen = 0;
+  ip->dx = 0;
+  ino->valid = 1;
+}
+
 // get inode
 struct inode *xv6fs_geti(uint dev, uint inum, int inc_ref) {
   // printf("entering xv6fs_geti\n");
   struct inode *ino = iget(dev, inum);
+  ino->sb = &fsof(dev)->vfs;
   if (!inc_ref) {
     ino->ref--;
   }
-  #ifdef LINK
-    printf("geti: ref cnt for ino %d: %d\n", inum, ino->ref);
-  #endif
-  // printf("xv6fs_geti: ino->private = %p\n", ino->private);
-  if (ino->private == 0) { // first time, read from disk
-    struct xv6fs_inode *ip = kalloc();
-    memset(ip, 0, sizeof(*ip));
-    ino->private = ip;
-    struct buf *bp = bread(dev, IBLOCK(inum, sb));
-    struct dinode *dip = (struct dinode*)bp->data + inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    ip->dev = dev;
-    ino->type = ip->type;
-    ino->nlink = dip->nlink;
-    ino->size = dip->size;
-    ino->dev = dev;
-    ino->ref = 1;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    #ifdef REF
-      printf("dip: %p\n", dip);
-      printf("geti: ino: %d has type %d\n", inum, ino->type);
-      printf("geti: ino: %d has nlink %d\n", inum, ino->nlink);
-      printf("geti: ino: %d has address %p\n", inum, ip->addrs);
-    #endif
-    brelse(bp);
-  }
+  klog(KS_XV6FS, KL_DEBUG, "geti: inode %d ref %d", inum, ino->ref);
+  if (!ino->valid) // first time, read from disk
+    iread(ino);
 
   return ino;
 }
 
 void xv6fs_update_lock(struct inode *ino) {
-  struct xv6fs_inode *ip = kalloc();
-    memset(ip, 0, sizeof(*ip));
-    ino->private = ip;
-    struct buf *bp = bread(ino->dev, IBLOCK(ino->inum, sb));
-    struct dinode *dip = (struct dinode*)bp->data + ino->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    ip->dev = ino->dev;
-    ino->type = ip->type;
-    ino->nlink = dip->nlink;
-    ino->size = dip->size;
-    ino->dev = ino->dev;
-    ino->ref = 1;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    #ifdef REF
-      printf("dip: %p\n", dip);
-      printf("geti: ino: %d has type %d\n", inum, ino->type);
-      printf("geti: ino: %d has nlink %d\n", inum, ino->nlink);
-      printf("geti: ino: %d has address %p\n", inum, ip->addrs);
-    #endif
-    brelse(bp);
+  iread(ino);
+}
+
+// Write everything buffered for ip's device to disk.
+// All metadata updates go through the device's log, and its commit
+// also writes the dirty pages of file data, so there is
+// nothing file-specific to do.
+static int
+xv6fs_fsync(struct inode *ip)
+{
+  log_force(ip->dev);
+  return 0;
 }
 
 static struct filesystem_operations xv6fs_ops = {
@@ -755,19 +2204,29 @@ static struct filesystem_operations xv6fs_ops = {
   .release_inode = xv6fs_release_inode,
   .free_inode = xv6fs_free_inode,
   .trunc = xv6fs_itrunc,
+  .orphan = xv6fs_orphan,
   .open = xv6fs_open,
   .close = xv6fs_close,
   .read = xv6fs_readi,
+  .readahead = xv6fs_readahead,
+  .mappage = xv6fs_mappage,
+  .fillpage = xv6fs_fillpage,
+  .allocpage = xv6fs_allocpage,
   .write = xv6fs_writei,
   .create = xv6fs_create,
   .link = xv6fs_link,
   .unlink = xv6fs_unlink,
+  .rename = xv6fs_rename,
   .dirlookup = xv6fs_dirlookup,
   .release_dentry = xv6fs_release_dentry,
   .isdirempty = xv6fs_isdirempty,
   .init = xv6fs_fsinit,
   .geti = xv6fs_geti,
   .update_lock = xv6fs_update_lock,
+  .getdents = xv6fs_getdents,
+  .fsync = xv6fs_fsync,
+  .begin_op = xv6fs_begin_op,
+  .end_op = xv6fs_end_op,
 };
 
 
@@ -775,4 +2234,5 @@ static struct filesystem_operations xv6fs_ops = {
 struct filesystem_type xv6fs = {
   .type = "xv6fs",
   .op = &xv6fs_ops,
+  .inode_size = sizeof(struct xv6fs_inode),
 };
\ No newline at end of file
@@ -23,24 +23,43 @@ struct xv6fs_super_block {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size in bytes; must be BSIZE
+  uint orphan;       // First inode of the orphan list, or 0
+  uint nfree;        // Free blocks, as of the last commit
+  uint nifree;       // Free inodes, likewise
+  uint bcursor;      // Where the last block allocation ended
+  uint icursor;      // Where the last inode allocation ended
+  uint summary;      // FSSUMMARY if the four above are current
 };
 
 #define FSMAGIC 0x10203040
+#define FSSUMMARY 0x53554d31
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
-// On-disk inode structure
+// On-disk inode structure.
+// An unlinked inode whose blocks have yet to be freed is on
+// the orphan list, which the super block heads: its nlink
+// is 0, its type is kept so that it stays allocated, and
+// its size is the next inode on the list (0 for the last).
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEVICE only)
+  short major;          // Major device number (T_DEVICE), or DI_ flags
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses, or inline data
 };
 
+// A T_FILE with DI_INLINE set in major keeps its data, at
+// most INLINESIZE bytes, in addrs[] instead of in blocks.
+// The bytes of addrs[] past size are zero.
+#define DI_INLINE   0x1
+#define INLINESIZE  ((NDIRECT+2)*sizeof(uint))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -61,3 +80,44 @@ struct xv6fs_dentry {
   char name[DIRSIZ];
 };
 
+
+// Hashed directories, made by mkfs -x.
+//
+// The first block of a hashed directory holds ".", "..",
+// an entry with inum 0 and name DXMAGIC, and leaf[], which
+// maps each hash bucket of names to the file block of its
+// first leaf (0 if none). A leaf block holds NDXLEAF entries
+// and ends with a dxtail naming the bucket's next leaf.
+// The index and the tails look like free entries (inum 0)
+// to anything that reads the directory as a plain array
+// of xv6fs_dentry, such as ls.
+#define NDXBUCKET 32
+#define NDXLEAF   (BSIZE / sizeof(struct xv6fs_dentry) - 1)
+#define DXMAGIC   "\0DXHASH"
+
+struct dxroot {
+  struct xv6fs_dentry dot;
+  struct xv6fs_dentry dotdot;
+  struct xv6fs_dentry magic;
+  ushort leaf[NDXBUCKET];
+};
+
+struct dxtail {
+  ushort inum;             // 0
+  char zero[2];            // 0, so that no name matches
+  ushort next;             // file block of the next leaf, or 0
+  char unused[DIRSIZ-4];
+};
+
+// Hash bucket of a directory entry name.
+static inline uint
+dxhash(const char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDXBUCKET;
+}
@@ -0,0 +1,381 @@
+#include "types.h"
+#include "riscv.h"
+#include "kernel/defs.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+// Simple logging that allows concurrent FS system calls.
+//
+// A log transaction contains the updates of multiple FS system
+// calls. The logging system only commits when there are
+// no FS system calls active. Thus there is never
+// any reasoning required about whether a commit might
+// write an uncommitted system call's updates to disk.
+//
+// A system call should call xv6fs_begin_op()/xv6fs_end_op()
+// (through the VFS begin_op()/end_op()) to mark its start and
+// end. Usually begin_op() just increments the count of
+// in-progress FS system calls and returns. But if it thinks
+// the log is close to running out, it sleeps until the last
+// outstanding end_op() commits.
+//
+// Each mounted disk has its own log. The VFS begin_op()
+// starts an operation in the log of every mounted disk,
+// since a system call may reach any of them.
+//
+// Commits are delayed: end_op() leaves the transaction open
+// so that later system calls can join it, and a block that
+// they write again is absorbed into the one log slot. The
+// transaction commits when the log cannot admit another
+// system call, or when log_force() asks for it (fsync, and
+// the logflushd thread every LOGFLUSHTICKS).
+//
+// File data does not go through the log: it lives in the
+// page cache, and commit() has pcsync() write the dirty pages
+// before the commit record, so that the block pointers the
+// commit makes durable never show a file what a block's last
+// owner left there. A block freed in the transaction is not
+// allocated again until it commits (see bfreemap.held in
+// fs.c), so that those early writes only go to blocks that
+// the old state on the disk does not use.
+//
+// The log is a physical re-do log containing disk blocks.
+// The on-disk log format:
+//   header block, containing block #s for block A, B, C, ...
+//   block A
+//   block B
+//   block C
+//   ...
+// Log appends are synchronous.
+//
+// The log is as long as the super block says, up to the
+// LOGMAX blocks whose numbers fit in the header block.
+//
+// commit() also logs the super block if the free space
+// summary in it (xv6fs_summary()) is out of date, so the
+// summary always agrees with the bitmap and inode blocks on
+// the disk, crash or not. begin_op() keeps a log slot free
+// for it.
+
+#define LOGMAX (BSIZE / sizeof(int) - 1)
+
+// Contents of the header block, used for both the on-disk header block
+// and to keep track in memory of logged block# before commit.
+struct logheader {
+  int n;
+  int block[LOGMAX];
+};
+
+struct log {
+  struct spinlock lock;
+  int start;
+  int size;
+  int outstanding; // how many FS sys calls are executing.
+  int committing;  // in commit(), please wait.
+  int force;       // commit as soon as outstanding reaches 0.
+  uint seq;        // number of commits so far.
+  int dev;
+  int ready;       // recovered; log_force() may commit
+  struct logheader lh;
+  struct buf *bufs[LOGMAX];  // for commit(), too big for the stack
+};
+
+// Each mounted device has its own log, indexed by device number.
+static struct log logs[NDISK+1];
+
+static void recover_from_log(struct log*);
+static void commit(struct log*);
+
+void
+initlog(int dev, struct xv6fs_super_block *sb)
+{
+  struct log *log = &logs[dev];
+
+  if (sizeof(struct logheader) > BSIZE)
+    panic("initlog: too big logheader");
+
+  initlock(&log->lock, "log");
+  log->start = sb->logstart;
+  log->size = sb->nlog;
+  if(log->size > LOGMAX)
+    log->size = LOGMAX;
+  if(log->size < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  log->dev = dev;
+  recover_from_log(log);
+  log->ready = 1;
+}
+
+// Copy committed blocks from log to their home location.
+// The home blocks are written as one batch, sorted by
+// block number so that neighbours merge into one request.
+static void
+install_trans(struct log *log, int recovering)
+{
+  int tail, i;
+  struct buf *lbuf, **dbuf = log->bufs, *t;
+
+  for (tail = 0; tail < log->lh.n; tail++) {
+    dbuf[tail] = bread(log->dev, log->lh.block[tail]); // read dst
+    if(recovering){
+      lbuf = bread(log->dev, log->start+tail+1); // read log block
+      memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    for (i = tail; i > 0 && dbuf[i-1]->blockno > dbuf[i]->blockno; i--) {
+      t = dbuf[i];
+      dbuf[i] = dbuf[i-1];
+      dbuf[i-1] = t;
+    }
+  }
+  bwritev(dbuf, log->lh.n);  // write dst to disk
+  for (tail = 0; tail < log->lh.n; tail++) {
+    if(recovering == 0)
+      bunpin(dbuf[tail]);
+    brelse(dbuf[tail]);
+  }
+}
+
+// Read the log header from disk into the in-memory log header
+static void
+read_head(struct log *log)
+{
+  struct buf *buf = bread(log->dev, log->start);
+  struct logheader *lh = (struct logheader *) (buf->data);
+  int i;
+  log->lh.n = lh->n;
+  if(log->lh.n > log->size)
+    panic("read_head: log too long");
+  for (i = 0; i < log->lh.n; i++) {
+    log->lh.block[i] = lh->block[i];
+  }
+  brelse(buf);
+}
+
+// Write in-memory log header to disk.
+// This is the true point at which the
+// current transaction commits.
+static void
+write_head(struct log *log)
+{
+  struct buf *buf = bread(log->dev, log->start);
+  struct logheader *hb = (struct logheader *) (buf->data);
+  int i;
+  hb->n = log->lh.n;
+  for (i = 0; i < log->lh.n; i++) {
+    hb->block[i] = log->lh.block[i];
+  }
+  bwrite(buf);
+  brelse(buf);
+}
+
+static void
+recover_from_log(struct log *log)
+{
+  read_head(log);
+  install_trans(log, 1); // if committed, copy from log to disk
+  log->lh.n = 0;
+  write_head(log); // clear the log
+}
+
+// called at the start of each FS system call.
+void
+xv6fs_begin_op(struct super_block *s)
+{
+  struct log *log = &logs[s->dev];
+
+  acquire(&log->lock);
+  while(1){
+    if(log->committing){
+      sleep(log, &log->lock);
+    } else if(log->lh.n + 1 + (log->outstanding+1)*MAXOPBLOCKS > log->size){
+      // this op might exhaust log space; wait for commit.
+      sleep(log, &log->lock);
+    } else {
+      log->outstanding += 1;
+      release(&log->lock);
+      break;
+    }
+  }
+}
+
+// Commit the open transaction and wake up waiters.
+// Called with log->lock held, log->outstanding == 0 and
+// log->committing == 0; returns with log->lock held.
+static void
+commit_locked(struct log *log)
+{
+  log->committing = 1;
+  release(&log->lock);
+
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit(log);
+
+  acquire(&log->lock);
+  log->committing = 0;
+  log->force = 0;
+  log->seq++;
+  wakeup(log);
+}
+
+// called at the end of each FS system call.
+// commits if this was the last outstanding operation
+// and the log is full or a commit was asked for.
+void
+xv6fs_end_op(struct super_block *s)
+{
+  struct log *log = &logs[s->dev];
+
+  acquire(&log->lock);
+  log->outstanding -= 1;
+  if(log->committing)
+    panic("log->committing");
+  if(log->outstanding == 0 &&
+     (log->force || log->lh.n + 1 + MAXOPBLOCKS > log->size)){
+    commit_locked(log);
+  } else {
+    // begin_op() may be waiting for log space,
+    // and decrementing log->outstanding has decreased
+    // the amount of reserved space.
+    wakeup(log);
+  }
+  release(&log->lock);
+}
+
+// Commit every system call on device dev that has finished
+// so far, and wait until the commit is on disk.
+// Returns 0, or -1 if there is no log on dev.
+int
+log_force(int dev)
+{
+  struct log *log;
+  uint seq;
+
+  if(dev < 1 || dev > NDISK || !logs[dev].ready)
+    return -1;
+  log = &logs[dev];
+  acquire(&log->lock);
+  seq = log->seq;
+  while(log->seq == seq &&
+        (log->lh.n > 0 || log->committing || pcpending(log->dev))){
+    if(log->committing || log->outstanding > 0){
+      // the running commit, or the last end_op(),
+      // covers everything logged so far.
+      log->force = 1;
+      sleep(log, &log->lock);
+    } else {
+      commit_locked(log);
+    }
+  }
+  release(&log->lock);
+  return 0;
+}
+
+// Body of the logflushd kernel thread, which bounds how long
+// a finished system call's changes wait in an open
+// transaction before they reach the disk.
+void
+logflushd(void)
+{
+  int dev;
+
+  for(;;){
+    sleepticks(LOGFLUSHTICKS);
+    for(dev = 1; dev <= NDISK; dev++)
+      log_force(dev);
+  }
+}
+
+// Copy modified blocks from cache to log->
+// The log blocks are consecutive, so they go to the
+// disk in as few requests as the driver allows.
+static void
+write_log(struct log *log)
+{
+  int tail;
+  struct buf **to = log->bufs, *from;
+
+  for (tail = 0; tail < log->lh.n; tail++) {
+    to[tail] = bread(log->dev, log->start+tail+1); // log block
+    from = bread(log->dev, log->lh.block[tail]); // cache block
+    memmove(to[tail]->data, from->data, BSIZE);
+    brelse(from);
+  }
+  bwritev(to, log->lh.n);  // write the log
+  for (tail = 0; tail < log->lh.n; tail++)
+    brelse(to[tail]);
+}
+
+// Add b to the transaction, unless it is in it already.
+// Caller holds log->lock, or is commit().
+static void
+log_add(struct log *log, struct buf *b)
+{
+  int i;
+
+  for (i = 0; i < log->lh.n; i++) {
+    if (log->lh.block[i] == b->blockno)   // log absorption
+      break;
+  }
+  if (i == log->lh.n) {  // Add new block to log?
+    if (log->lh.n >= log->size)
+      panic("too big a transaction");
+    log->lh.block[i] = b->blockno;
+    bpin(b);
+    log->lh.n++;
+  }
+}
+
+// Bring the free space summary in the super block up to
+// date in the transaction.
+static void
+write_summary(struct log *log)
+{
+  struct buf *bp;
+
+  bp = bread(log->dev, 1);
+  if(xv6fs_summary(log->dev, (struct xv6fs_super_block*)bp->data))
+    log_add(log, bp);
+  brelse(bp);
+}
+
+static void
+commit(struct log *log)
+{
+  pcsync(log->dev);   // Write file data to its blocks first
+  if (log->lh.n > 0) {
+    xv6fs_commitfree(log->dev);
+    write_summary(log);
+    write_log(log);     // Write modified blocks from cache to log
+    write_head(log);    // Write header to disk -- the real commit
+    install_trans(log, 0); // Now install writes to home locations
+    log->lh.n = 0;
+    write_head(log);    // Erase the transaction from the log
+  }
+}
+
+// Caller has modified b->data and is done with the buffer.
+// Record the block number and pin in the cache by increasing refcnt.
+// commit()/write_log() will do the disk write.
+//
+// log_write() replaces bwrite(); a typical use is:
+//   bp = bread(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   brelse(bp)
+void
+log_write(struct buf *b)
+{
+  struct log *log = &logs[b->dev];
+
+  acquire(&log->lock);
+  if (log->outstanding < 1)
+    panic("log_write outside of trans");
+  log_add(log, b);
+  release(&log->lock);
+}
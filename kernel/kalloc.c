@@ -1,6 +1,19 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list and lock. A CPU whose
+// list runs empty steals a batch of pages from the others.
+//
+// Every page handed out has a reference count, so that it
+// can be shared, e.g. by the page cache and the processes
+// that map it. kalloc() sets it to one, kdup() adds one, and
+// kfree() drops one and frees the page when none are left.
+//
+// An idle CPU zeroes free pages ahead of time, up to NZERO of
+// them, and keeps them on a list of its own, for kzalloc().
+// They are free memory like the rest: kalloc() takes them
+// when there is nothing else.
 
 #include "types.h"
 #include "param.h"
@@ -8,6 +21,10 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "stats.h"
+
+#define KSTEAL 64   // most pages stolen at once
+#define NZERO  64   // zeroed pages each CPU keeps ready
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -18,15 +35,27 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  uint64 nfree;      // pages on freelist
+  uint64 nsteal;     // batches stolen by this CPU
+  uint64 nstolen;    // pages stolen by this CPU
+  struct run *zerolist;  // free pages that are all zeros
+  uint64 nzero;      // pages on zerolist
+} kmem[NCPU];
+
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+static int kref[PA2REF(PHYSTOP)];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +64,112 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kref[PA2REF(p)] = 1;
     kfree(p);
+  }
+}
+
+static void
+kmem_lock(struct kmem *k)
+{
+  int busy = lockheld(&k->lock);
+
+  acquire(&k->lock);
+  if(busy)
+    statinc(ST_KCONTEND);
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem *k;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
+  if((n = __sync_sub_and_fetch(&kref[PA2REF(pa)], 1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
 
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  k = &kmem[cpuid()];
+  kmem_lock(k);
+  r->next = k->freelist;
+  k->freelist = r;
+  k->nfree++;
+  release(&k->lock);
+  pop_off();
+}
+
+// Take up to half of another CPU's free pages, at most
+// KSTEAL, and put them on k's list. Only one kmem lock
+// is held at a time. Returns a page for the caller,
+// or 0 if every other list is empty.
+static struct run*
+ksteal(struct kmem *k)
+{
+  struct kmem *v;
+  struct run *head, *tail;
+  uint64 n, i;
+
+  for(v = kmem; v < kmem + NCPU; v++){
+    if(v == k || v->nfree == 0)
+      continue;
+    kmem_lock(v);
+    n = (v->nfree + 1) / 2;
+    if(n > KSTEAL)
+      n = KSTEAL;
+    head = tail = v->freelist;
+    for(i = 1; i < n; i++)
+      tail = tail->next;
+    if(head){
+      v->freelist = tail->next;
+      v->nfree -= n;
+    }
+    release(&v->lock);
+    if(head == 0)
+      continue;
+
+    kmem_lock(k);
+    k->nsteal++;
+    k->nstolen += n;
+    tail->next = k->freelist;
+    k->freelist = head->next;
+    k->nfree += n - 1;
+    release(&k->lock);
+    return head;
+  }
+  return 0;
+}
+
+// Take a page off k's zerolist, or return 0.
+static struct run*
+zpop(struct kmem *k)
+{
+  struct run *r;
+
+  if(k->nzero == 0)
+    return 0;
+  kmem_lock(k);
+  if((r = k->zerolist) != 0){
+    k->zerolist = r->next;
+    k->nzero--;
+  }
+  release(&k->lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +179,178 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *k;
+  int tried = 0;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+again:
+  push_off();
+  k = &kmem[cpuid()];
+  kmem_lock(k);
+  r = k->freelist;
+  if(r){
+    k->freelist = r->next;
+    k->nfree--;
+  }
+  release(&k->lock);
+  if(r == 0)
+    r = ksteal(k);
+  for(struct kmem *v = kmem; r == 0 && v < kmem + NCPU; v++)
+    r = zpop(v);
+  pop_off();
 
-  if(r)
+  // Out of memory: ask the buffer cache, the slab
+  // caches and the page cache to give some back.
+  if(r == 0 && !tried){
+    tried = 1;
+    if(bshrink() + slabshrink() + pcshrink() > 0)
+      goto again;
+  }
+
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    kref[PA2REF(r)] = 1;
+    statinc(ST_KALLOC);
+  }
+  return (void*)r;
+}
+
+// Allocate a page of zeros. Returns 0 if the memory
+// cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct run *r;
+
+  push_off();
+  r = zpop(&kmem[cpuid()]);
+  pop_off();
+  if(r){
+    r->next = 0;   // the only word that was not zero
+    kref[PA2REF(r)] = 1;
+    statinc(ST_KALLOC);
+    statinc(ST_KZERO);
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Zero a free page of this CPU for kzalloc(), if it has
+// fewer than NZERO. Called by the scheduler when there is
+// nothing to run, with interrupts off. Returns 1 if it
+// zeroed a page, or 0.
+int
+kzero(void)
+{
+  struct kmem *k = &kmem[cpuid()];
+  struct run *r;
+
+  if(k->nzero >= NZERO || k->nfree == 0)
+    return 0;
+  kmem_lock(k);
+  if((r = k->freelist) != 0){
+    k->freelist = r->next;
+    k->nfree--;
+  }
+  release(&k->lock);
+  if(r == 0)
+    return 0;
+
+  memset(r, 0, PGSIZE);
+
+  kmem_lock(k);
+  r->next = k->zerolist;
+  k->zerolist = r;
+  k->nzero++;
+  release(&k->lock);
+  return 1;
+}
+
+// Allocate n physically contiguous pages, for tables that
+// are sized at boot or at mount time. Looks for a run of n
+// pages that lie next to each other on one CPU's free list,
+// as freerange() leaves them. Returns the lowest page, or 0.
+// The pages are freed one by one with kfree().
+void *
+kallocn(int n)
+{
+  struct kmem *k;
+  struct run **link, **start, *r, *last;
+  int i, len;
+
+  if(n == 1)
+    return kalloc();
+  for(k = kmem; k < kmem + NCPU; k++){
+    kmem_lock(k);
+    len = 0;
+    last = 0;
+    start = 0;
+    for(link = &k->freelist; (r = *link) != 0; link = &r->next){
+      if(len > 0 && (char*)r == (char*)last - PGSIZE){
+        len++;
+      } else {
+        start = link;   // the run starts at r
+        len = 1;
+      }
+      last = r;
+      if(len == n){
+        // r is the lowest page of the run.
+        *start = r->next;
+        k->nfree -= n;
+        release(&k->lock);
+        for(i = 0; i < n; i++)
+          kref[PA2REF((char*)r + i*PGSIZE)] = 1;
+        memset((char*)r, 5, (uint64)n*PGSIZE);
+        return (void*)r;
+      }
+    }
+    release(&k->lock);
+  }
+  return 0;
+}
+
+// Add a reference to page pa, which kalloc() returned.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  __sync_fetch_and_add(&kref[PA2REF(pa)], 1);
+}
+
+// Number of references to page pa.
+int
+krefs(void *pa)
+{
+  return kref[PA2REF(pa)];
+}
+
+// Number of free pages, for callers that want
+// to leave memory for others.
+uint64
+kfreecount(void)
+{
+  uint64 n = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    n += kmem[i].nfree + kmem[i].nzero;
+  return n;
+}
+
+// Print each CPU's free list and counters; see procdump().
+void
+kprint(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    if(kmem[i].nfree == 0 && kmem[i].nzero == 0 && kmem[i].nsteal == 0)
+      continue;
+    printf("kmem cpu %d: %d free, %d zeroed, %d steals (%d pages)\n",
+           i, (int)kmem[i].nfree, (int)kmem[i].nzero,
+           (int)kmem[i].nsteal, (int)kmem[i].nstolen);
+  }
+  printf("kmem: %d contended\n", (int)statsum(ST_KCONTEND));
+}
@@ -0,0 +1,177 @@
+// Kernel log: a ring buffer of leveled messages, and the
+// klog device that shows it, for tracing that must not cost
+// console time when nobody is looking.
+//
+// Each subsystem has a level in kloglevel[]; klog() formats
+// and records a message only if its level is at most that,
+// and all levels start at 0, so nothing is logged until
+// somebody asks. Messages go to the ring, never to the
+// console; once it is full the newest ones overwrite the
+// oldest.
+//
+// Reading the klog device (major KLOG, /klog) gives the ring
+// as it was at the first read from offset 0, oldest message
+// first, one "<level>[ticks] subsystem: message" line each.
+// Writing "subsystem level", or "all level", to it sets the
+// level of those subsystems.
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "klog.h"
+#include "fs/xv6fs/file.h"
+
+#define KLOGSIZE 8192   // bytes of messages kept
+
+extern struct devsw devsw[];
+
+char kloglevel[NKLOG];
+
+static char *klognames[NKLOG] = {
+  [KS_VFS]     "vfs",
+  [KS_XV6FS]   "xv6fs",
+  [KS_SYSFILE] "sysfile",
+};
+
+static struct {
+  struct spinlock lock;
+  char buf[KLOGSIZE];
+  uint64 end;      // bytes ever logged; buf[end % KLOGSIZE] is next
+} ring;
+
+// The text of the klog device, copied out of the ring at
+// offset 0. A sleep lock, since copying it out may fault.
+static struct {
+  struct sleeplock lock;
+  char buf[KLOGSIZE];
+  int len;
+} snap;
+
+static int klogread(int, uint64, int, uint);
+static int klogwrite(int, uint64, int);
+
+void
+kloginit(void)
+{
+  initlock(&ring.lock, "klog");
+  initsleeplock(&snap.lock, "klogsnap");
+  devsw[KLOG].read = klogread;
+  devsw[KLOG].write = klogwrite;
+}
+
+// Called with ring.lock held.
+static void
+ringput(int c, void *arg)
+{
+  ring.buf[ring.end++ % KLOGSIZE] = c;
+}
+
+static void
+ringputs(char *s, ...)
+{
+  va_list ap;
+
+  va_start(ap, s);
+  vprintfmt(ringput, 0, s, ap);
+  va_end(ap);
+}
+
+// Record a message; see klog() in klog.h.
+void
+klogf(int sub, int lvl, char *fmt, ...)
+{
+  va_list ap;
+
+  acquire(&ring.lock);
+  ringputs("<%d>[%d] %s: ", lvl, ticks, klognames[sub]);
+  va_start(ap, fmt);
+  vprintfmt(ringput, 0, fmt, ap);
+  va_end(ap);
+  ringput('\n', 0);
+  release(&ring.lock);
+}
+
+// Copy the ring into snap.buf, oldest message first.
+// Called with snap.lock held.
+static void
+klogsnap(void)
+{
+  uint64 start;
+  int i;
+
+  acquire(&ring.lock);
+  start = ring.end > KLOGSIZE ? ring.end - KLOGSIZE : 0;
+  snap.len = ring.end - start;
+  for(i = 0; i < snap.len; i++)
+    snap.buf[i] = ring.buf[(start + i) % KLOGSIZE];
+  release(&ring.lock);
+
+  if(start > 0){
+    // the oldest message was partly overwritten.
+    for(i = 0; i < snap.len && snap.buf[i] != '\n'; i++)
+      ;
+    if(i < snap.len)
+      i++;
+    snap.len -= i;
+    memmove(snap.buf, snap.buf + i, snap.len);
+  }
+}
+
+static int
+klogread(int user_dst, uint64 dst, int n, uint off)
+{
+  int r;
+
+  acquiresleep(&snap.lock);
+  if(off == 0)
+    klogsnap();
+  r = 0;
+  if(off < snap.len){
+    r = snap.len - off < n ? snap.len - off : n;
+    if(either_copyout(user_dst, dst, snap.buf + off, r) < 0)
+      r = -1;
+  }
+  releasesleep(&snap.lock);
+  return r;
+}
+
+// Set the levels: "subsystem level" or "all level",
+// with level 0 to KL_DEBUG.
+static int
+klogwrite(int user_src, uint64 src, int n)
+{
+  char buf[32], *lvl;
+  int i, len;
+
+  if(n <= 0 || n >= sizeof(buf))
+    return -1;
+  if(either_copyin(buf, user_src, src, n) < 0)
+    return -1;
+  len = n;
+  while(len > 0 && (buf[len-1] == '\n' || buf[len-1] == ' '))
+    len--;
+  buf[len] = 0;
+  for(lvl = buf; *lvl && *lvl != ' '; lvl++)
+    ;
+  if(*lvl == 0)
+    return -1;
+  *lvl++ = 0;
+  if(lvl[0] < '0' || lvl[0] > '0' + KL_DEBUG || lvl[1] != 0)
+    return -1;
+
+  for(i = 0; i < NKLOG; i++)
+    if(strncmp(buf, "all", 4) == 0 || strncmp(buf, klognames[i], 16) == 0)
+      break;
+  if(i == NKLOG)
+    return -1;
+  for(i = 0; i < NKLOG; i++)
+    if(strncmp(buf, "all", 4) == 0 || strncmp(buf, klognames[i], 16) == 0)
+      kloglevel[i] = lvl[0] - '0';
+  return n;
+}
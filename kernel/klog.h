@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdarg.h>
+
+// Kernel log; see klog.c. klognames[] in klog.c must list
+// the subsystems in this order.
+enum {
+  KS_VFS,          // inode and dentry references (fs/fs.c)
+  KS_XV6FS,        // xv6fs inodes and directories
+  KS_SYSFILE,      // file system calls
+  NKLOG
+};
+
+// Levels, most severe first. A subsystem logs the messages
+// of levels up to its kloglevel[]; 0, the default, logs none.
+#define KL_ERR   1
+#define KL_WARN  2
+#define KL_INFO  3
+#define KL_DEBUG 4
+
+extern char kloglevel[NKLOG];
+
+// Log a message of subsystem sub at level lvl. Only
+// understands %d, %x, %p, %s, like printf(). A message that
+// is not logged costs a load and a branch, and its
+// arguments are not evaluated.
+#define klog(sub, lvl, ...) do { \
+    if((lvl) <= kloglevel[sub]) \
+      klogf((sub), (lvl), __VA_ARGS__); \
+  } while(0)
+
+void klogf(int, int, char*, ...);
+void vprintfmt(void (*)(int, void*), void*, char*, va_list);
@@ -0,0 +1,16 @@
+#pragma once
+
+// Lock counters per lock name, kept by a kernel built with
+// make LOCKSTAT=1; see lockstat() in spinlock.c.
+
+#define NLOCKSTAT 64   // lock names counted
+
+struct lockstat {
+  char name[16];
+  int sleep;           // 1 for sleep locks, 0 for spin locks
+  uint64 acquires;
+  uint64 contended;    // acquisitions that had to wait
+  uint64 waittime;     // r_time() ticks they spun, or slept
+  uint64 holdtime;     // ticks the locks were held, in total
+  uint64 maxhold;      // the longest of those holds
+};
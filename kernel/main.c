@@ -12,7 +12,6 @@ volatile static int started = 0;
 void
 main()
 {
-  printf("cpu id: %d\n", cpuid());
   if(cpuid() == 0){
     consoleinit();
     printfinit();
@@ -20,7 +19,9 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // small-object caches
     kvminit();       // create kernel page table
+    vdsoinit();      // the page every process may read
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
@@ -29,15 +30,18 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    pcinit();        // page cache
     fileinit();      // file table
+    statsinit();     // event counters
+    kloginit();      // kernel log
+    traceinit();     // tracepoints
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
   } else {
-    while(started == 0) {
-      printf("Luda Chen");
-    }
+    while(started == 0)
+      ;
     __sync_synchronize();
     printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
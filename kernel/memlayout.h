@@ -23,9 +23,11 @@
 #define UART0 0x10000000L
 #define UART0_IRQ 10
 
-// virtio mmio interface
+// virtio mmio interfaces, one page and one irq apart.
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+#define VIRTIO(n) (VIRTIO0 + (n)*0x1000L)
+#define VIRTIO_IRQ(n) (VIRTIO0_IRQ + (n))
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
@@ -64,6 +66,11 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions
+//   RING (struct ring, if the process called ringsetup())
+//   VDSO (struct vdso, read-only, shared by every process)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define VDSO (TRAPFRAME - PGSIZE)
+#define RING (VDSO - PGSIZE)
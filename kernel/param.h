@@ -2,15 +2,37 @@
 
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process without a table page
+#define MAXOFILE    512  // open files per process; a page of pointers
+#define NVMA         16  // mmap regions per process
+#define NINODE       50  // i-nodes kept in memory, at least (more may be in use)
+#define INODEFRAC    16  // one more cached i-node per INODEFRAC free pages
 #define NDENTRY     114  // maximum number of active directory entries
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define NDISK         2  // virtio disks; disk n is device n+1
+#define NTMPFS        4  // tmpfs mounts; devices NDISK+1 on
 #define MAXARG       32  // max exec arguments
+#define NIOV         16  // max buffers per readv/writev
+#ifndef PIPEPAGES
+#define PIPEPAGES     4  // pages in a pipe's buffer
+#endif
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#ifndef LOGSIZE
+#define LOGSIZE      (MAXOPBLOCKS*6)  // data blocks in the log mkfs makes
+#endif
+#define BCACHEFRAC   16  // disk block cache may use 1/BCACHEFRAC of memory
+#define NBUFINIT     (LOGSIZE*2+MAXOPBLOCKS)  // buffers allocated at boot
+#define BRESERVE     256  // free pages kalloc keeps before the cache grows
+#define LOGFLUSHTICKS 10  // ticks between forced commits of each log
+#define NBUCKET      13  // hash buckets in the disk block cache
+#define RAMIN         4  // first readahead window, in blocks
+#define RAMAX        32  // largest readahead window, in blocks
+#define FSSIZE       200000  // size of the file system mkfs makes, in KB
+#define TIMEHZ       10000000  // ticks per second of the time CSR in qemu
+#define TICKHZ       10    // uptime() and sleep() ticks per second
+#ifndef QUANTUM
+#define QUANTUM      100   // ms a process runs before others get a turn
+#endif
 #define MAXPATH      128   // maximum file path name
+#define NCWDUP         8   // ancestors of the cwd remembered for ".."
@@ -13,8 +13,10 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "klog.h"
 
 volatile int panicked = 0;
+volatile int panicking = 0;  // printing the panic message
 
 // lock to avoid interleaving concurrent printf's.
 static struct {
@@ -25,7 +27,7 @@ static struct {
 static char digits[] = "0123456789abcdef";
 
 static void
-printint(int xx, int base, int sign)
+printint(void (*put)(int, void*), void *arg, int xx, int base, int sign)
 {
   char buf[16];
   int i;
@@ -45,38 +47,30 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    put(buf[i], arg);
 }
 
 static void
-printptr(uint64 x)
+printptr(void (*put)(int, void*), void *arg, uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  put('0', arg);
+  put('x', arg);
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    put(digits[x >> (sizeof(uint64) * 8 - 4)], arg);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
+// Format fmt, handing each character to put(c, arg).
+// only understands %d, %x, %p, %s.
 void
-printf(char *fmt, ...)
+vprintfmt(void (*put)(int, void*), void *arg, char *fmt, va_list ap)
 {
-  va_list ap;
-  int i, c, locking;
+  int i, c;
   char *s;
 
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-
-  if (fmt == 0)
-    panic("null fmt");
-
-  va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      put(c, arg);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -84,31 +78,71 @@ printf(char *fmt, ...)
       break;
     switch(c){
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
+      printint(put, arg, va_arg(ap, int), 10, 1);
       break;
     case 'x':
-      printint(va_arg(ap, int), 16, 1);
+      printint(put, arg, va_arg(ap, int), 16, 1);
       break;
     case 'p':
-      printptr(va_arg(ap, uint64));
+      printptr(put, arg, va_arg(ap, uint64));
       break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        put(*s, arg);
       break;
     case '%':
-      consputc('%');
+      put('%', arg);
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      put('%', arg);
+      put(c, arg);
       break;
     }
   }
+}
+
+// printf() collects its output here, to hand it to the
+// console a line or a buffer at a time.
+struct pbuf {
+  char buf[64];
+  int n;
+};
+
+static void
+consput(int c, void *arg)
+{
+  struct pbuf *b = arg;
+
+  b->buf[b->n++] = c;
+  if(b->n == sizeof(b->buf) || c == '\n'){
+    consputs(b->buf, b->n);
+    b->n = 0;
+  }
+}
+
+// Print to the console. only understands %d, %x, %p, %s.
+void
+printf(char *fmt, ...)
+{
+  va_list ap;
+  int locking;
+  struct pbuf b;
+
+  locking = pr.locking;
+  if(locking)
+    acquire(&pr.lock);
+
+  if (fmt == 0)
+    panic("null fmt");
+
+  b.n = 0;
+  va_start(ap, fmt);
+  vprintfmt(consput, &b, fmt, ap);
   va_end(ap);
+  consputs(b.buf, b.n);
 
   if(locking)
     release(&pr.lock);
@@ -117,6 +151,7 @@ printf(char *fmt, ...)
 void
 panic(char *s)
 {
+  panicking = 1;
   pr.locking = 0;
   printf("panic: ");
   printf(s);
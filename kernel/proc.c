@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
 #include "fs/xv6fs/defs.h"
 #include "fs/defs.h"
 
@@ -14,11 +15,38 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Per-CPU queues of RUNNABLE processes. runnable() puts a
+// process on the queue of the CPU that made it runnable,
+// which is awake; a CPU whose own queue is empty takes the
+// first process of the longest other one. Idle CPUs take no
+// timer interrupts, so runnable() kicks one awake to look,
+// unless the CPU it runs on is about to. The queue's lock
+// protects its list and the processes' rqnext. Lock order:
+// p->lock, then a queue's lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head, *tail;
+  int n;
+} runq[NCPU];
+
+// Processes in sleep(), hashed by channel, so that wakeup()
+// looks only at the ones whose channels share its bucket.
+// A sleeper puts itself in and takes itself out; wakeup()
+// only changes states. Lock order: the lock passed to
+// sleep(), a bucket's lock, p->lock.
+#define NWAITQ 61
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
+static void runnable(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -53,6 +81,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -126,6 +158,7 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  fdreset(p);
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -160,13 +193,19 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  ringfree(p);
+  fdreset(p);
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
+  p->child = 0;
+  p->sibnext = p->sibprev = 0;
+  p->zombie = p->znext = 0;
   p->name[0] = 0;
+  p->kfn = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
@@ -204,6 +243,15 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // and the vdso page below that, which user code reads.
+  if(mappages(pagetable, VDSO, PGSIZE,
+              (uint64)vdsopage, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -214,6 +262,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, VDSO, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -250,12 +299,36 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
+  p->ncwdup = 0;
 
-  p->state = RUNNABLE;
+  runnable(p);
 
   release(&p->lock);
 }
 
+// Start a kernel thread that runs fn(), which must not return.
+// The thread has a process slot but never enters user space.
+// Return its pid, or -1 if there are no free procs.
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+
+  runnable(p);
+
+  release(&p->lock);
+  return pid;
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -266,9 +339,11 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // the pages are allocated when they are first touched;
+    // see uvmlazy().
+    if(sz + n > mmapbase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -281,7 +356,7 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
@@ -290,13 +365,24 @@ fork(void)
     return -1;
   }
 
-  // Copy user memory from parent to child.
+  // Room for the parent's file descriptors, and a copy of
+  // its user memory.
+  if(fdgrow(np, p->nofile) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  if(mmapfork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -305,10 +391,11 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+  fdcopy(p, np);
   np->cwd = idup(p->cwd);
+  memmove(np->cwdup, p->cwdup, sizeof(p->cwdup));
+  np->ncwdup = p->ncwdup;
+  np->cwdgen = p->cwdgen;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -318,27 +405,47 @@ fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->sibprev = 0;
+  np->sibnext = p->child;
+  if(p->child)
+    p->child->sibprev = np;
+  p->child = np;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runnable(np);
   release(&np->lock);
 
   return pid;
 }
 
-// Pass p's abandoned children to init.
+// Pass p's abandoned children to init, and the ones that
+// have exited to init's wait().
 // Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
-  struct proc *pp;
+  struct proc *pp, *last;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->child == 0)
+    return;
+  for(pp = last = p->child; pp; pp = pp->sibnext){
+    pp->parent = initproc;
+    last = pp;
+  }
+  last->sibnext = initproc->child;
+  if(initproc->child)
+    initproc->child->sibprev = last;
+  initproc->child = p->child;
+  p->child = 0;
+
+  if(p->zombie){
+    for(pp = p->zombie; pp->znext; pp = pp->znext)
+      ;
+    pp->znext = initproc->zombie;
+    initproc->zombie = p->zombie;
+    p->zombie = 0;
+    wakeup(initproc);
   }
 }
 
@@ -353,16 +460,17 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
+  // Unmap files, then close all open files.
+  mmapexit(p);
+  for(int fd = 0; fd < p->nofile; fd++){
+    struct file *f = fdremove(p, fd);
+    if(f)
       fileclose(f);
-      p->ofile[fd] = 0;
-    }
   }
 
+  begin_op();
   iput(p->cwd);
+  end_op();
   p->cwd = 0;
 
   acquire(&wait_lock);
@@ -371,6 +479,8 @@ exit(int status)
   reparent(p);
 
   // Parent might be sleeping in wait().
+  p->znext = p->parent->zombie;
+  p->parent->zombie = p;
   wakeup(p->parent);
   
   acquire(&p->lock);
@@ -391,40 +501,38 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
-          release(&pp->lock);
-          release(&wait_lock);
-          return pid;
-        }
+    if((pp = p->zombie) != 0){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      pid = pp->pid;
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                              sizeof(pp->xstate)) < 0) {
         release(&pp->lock);
+        release(&wait_lock);
+        return -1;
       }
+      p->zombie = pp->znext;
+      if(pp->sibprev)
+        pp->sibprev->sibnext = pp->sibnext;
+      else
+        p->child = pp->sibnext;
+      if(pp->sibnext)
+        pp->sibnext->sibprev = pp->sibprev;
+      freeproc(pp);
+      release(&pp->lock);
+      release(&wait_lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(p->child == 0 || killed(p)){
       release(&wait_lock);
       return -1;
     }
@@ -434,6 +542,109 @@ wait(uint64 addr)
   }
 }
 
+static void kickidle(void);
+
+// Make p RUNNABLE and put it at the end of this CPU's
+// run queue. Caller must hold p->lock.
+static void
+runnable(struct proc *p)
+{
+  struct runq *q = &runq[cpuid()];
+
+  p->state = RUNNABLE;
+  acquire(&q->lock);
+  p->rqnext = 0;
+  if(q->tail)
+    q->tail->rqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  q->n++;
+  release(&q->lock);
+  if(myproc() != 0 && myproc() != p)
+    kickidle();
+}
+
+// Kick an idle CPU, if there is one, to look at the
+// run queues.
+static void
+kickidle(void)
+{
+  struct cpu *c;
+
+  __sync_synchronize();
+  for(c = cpus; c < cpus + NCPU; c++){
+    if(c->idle){
+      timerkick(c - cpus);
+      return;
+    }
+  }
+}
+
+// Called at each timer interrupt. Returns 1 if the quantum of
+// the process running on this CPU is up and another process
+// on its queue is waiting, so that it should yield(). One
+// that has the CPU to itself just gets a new quantum. Sets
+// the timer for the next event either way.
+int
+quantum(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now;
+  int over;
+
+  if(c->proc == 0 || c->proc->state != RUNNING){
+    timerarm(0);
+    return 0;
+  }
+  over = 0;
+  now = r_time();
+  if(now >= c->qend){
+    over = runq[cpuid()].n > 0;
+    c->qend = now + QUANTUM * (TIMEHZ / 1000);
+  }
+  timerarm(c->qend);
+  return over;
+}
+
+// Take the first process off q, or return 0.
+static struct proc*
+runqpop(struct runq *q)
+{
+  struct proc *p;
+
+  acquire(&q->lock);
+  if((p = q->head) != 0){
+    q->head = p->rqnext;
+    if(q->head == 0)
+      q->tail = 0;
+    q->n--;
+  }
+  release(&q->lock);
+  return p;
+}
+
+// A process for CPU id to run: the first on its own queue,
+// or else one taken from the longest other queue. Or 0.
+static struct proc*
+runqget(int id)
+{
+  struct runq *q, *busiest;
+  struct proc *p;
+
+  if((p = runqpop(&runq[id])) != 0)
+    return p;
+  // the counts are read without the locks; a stale one
+  // only costs a look at an empty queue.
+  busiest = 0;
+  for(q = runq; q < runq + NCPU; q++)
+    if(q->n > 0 && (busiest == 0 || q->n > busiest->n))
+      busiest = q;
+  if(busiest == 0)
+    return 0;
+  return runqpop(busiest);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -451,24 +662,47 @@ scheduler(void)
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
+    intr_off();
+
+    if((p = runqget(cpuid())) == 0){
+      // Nothing to run: zero a page for kzalloc(), and look
+      // again, until there are enough.
+      if(kzero())
+        continue;
+      // Then wait for an interrupt, with the timer set only
+      // for the next sleepticks() deadline. wfi returns
+      // when one is pending even with interrupts off, so one
+      // that made a process runnable since runqget() is not
+      // missed; intr_on() then takes it. A process made
+      // runnable on another CPU before c->idle was set did
+      // not kick this one, so look once more after setting it.
+      timerarm(0);
+      c->idle = 1;
+      __sync_synchronize();
+      if((p = runqget(cpuid())) == 0)
+        asm volatile("wfi");
+      c->idle = 0;
+      if(p == 0)
+        continue;
+    }
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        // printf("running pid: %d\n", p->pid);
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      c->proc = p;
+      c->qend = r_time() + QUANTUM * (TIMEHZ / 1000);
+      timerarm(c->qend);
+      trace(TR_SWITCH, p->pid, 0);
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -505,7 +739,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runnable(p);
   sched();
   release(&p->lock);
 }
@@ -532,21 +766,50 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
+// The wait queue of chan.
+static struct waitq*
+chanq(void *chan)
+{
+  return &waitq[(uint64)chan / sizeof(uint64) % NWAITQ];
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *q = chanq(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we are in q and hold p->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks q->lock, then p->lock),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
+  p->qprev = 0;
+  p->qnext = q->head;
+  if(q->head)
+    q->head->qprev = p;
+  q->head = p;
+  release(&q->lock);
   release(lk);
 
   // Go to sleep.
@@ -557,9 +820,17 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+  acquire(&q->lock);
+  if(p->qprev)
+    p->qprev->qnext = p->qnext;
+  else
+    q->head = p->qnext;
+  if(p->qnext)
+    p->qnext->qprev = p->qprev;
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -568,17 +839,20 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *me = myproc();
+  struct waitq *q = chanq(chan);
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->qnext) {
+    if(p != me){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        runnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&q->lock);
 }
 
 // Kill the process with the given pid.
@@ -595,7 +869,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        runnable(p);
       }
       release(&p->lock);
       return 0;
@@ -682,4 +956,8 @@ procdump(void)
     printf("%d %s %s", p->pid, state, p->name);
     printf("\n");
   }
+  kprint();
+  bprint();
+  pcprint();
+  slabprint();
 }
@@ -31,6 +31,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 qend;                // r_time() when the process's quantum ends.
+  volatile int idle;          // In wfi, for runnable() to timerkick().
 };
 
 extern struct cpu cpus[NCPU];
@@ -88,6 +90,29 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region of the address space made by mmap(); see fs/mmap.c.
+struct vma {
+  uint64 addr;                 // first address
+  uint64 len;                  // bytes, a multiple of PGSIZE; 0 if unused
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // the mapped file, referenced
+  uint off;                    // file offset of addr
+  uint64 flen;                 // bytes from the file; zeros after
+  char image;                  // a segment of the program, below p->sz
+};
+
+// A buffer being copied to or from in pieces, in user memory
+// of pagetable or, if pagetable is 0, in the kernel; see
+// copyoutc(). Remembers the page it translated last, so that
+// the pieces walk the page table once per user page.
+struct ucursor {
+  pagetable_t pagetable;
+  uint64 va;                   // user page translated last, or 1
+  uint64 pa;                   // its physical address
+  char write;                  // translated for a store
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -98,9 +123,16 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  struct proc *rqnext;         // Next in a run queue; see runnable()
+  struct proc *qnext, *qprev;  // In a wait queue while in sleep()
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *child;          // First child
+  struct proc *sibnext;        // Parent's other children
+  struct proc *sibprev;
+  struct proc *zombie;         // Children that have exited, for wait()
+  struct proc *znext;          // Next in the parent's zombie list
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
@@ -108,7 +140,18 @@ struct proc {
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files: ofile0, or a page; see file.c
+  int nofile;                  // entries in ofile
+  uint64 fdmap[MAXOFILE/64];   // bit fd set if ofile[fd] is in use
+  struct file *ofile0[NOFILE]; // the first NOFILE open files
+  struct vma vma[NVMA];        // mmap() regions
   struct inode *cwd;           // Current directory
+  uint cwdup[NCWDUP];          // cwd's parent, its parent, ...; see cwdchain()
+  int ncwdup;                  // valid entries in cwdup
+  uint cwdgen;                 // directory moves before cwdup was made
+  int opmounts;                // file systems begin_op() started on
+  struct sleeplock *shared;    // sleep lock held shared, or 0
+  struct ring *ring;           // page mapped at RING, or 0; see ring.c
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Body of a kernel thread, else 0
 };
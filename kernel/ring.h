@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.h"
+
+// A submission and completion ring, a page that a process
+// shares with the kernel; see ring.c. The process fills in
+// sq[sqtail % NRING] and advances sqtail for each operation,
+// then has ringenter() run them, and finds their results in
+// cq[cqhead % NRING] on, in order, advancing cqhead.
+
+#define NRING 64   // entries in each queue; a power of 2
+
+#define RING_NOP    0
+#define RING_READ   1   // fd, addr, n, off
+#define RING_WRITE  2   // fd, addr, n, off
+#define RING_OPEN   3   // addr: path, n: mode
+#define RING_CLOSE  4   // fd
+#define RING_FSTAT  5   // fd, addr: struct stat
+#define RING_STAT   6   // addr: path, addr2: struct stat
+
+struct ringsqe {
+  int op;        // RING_*
+  int fd;
+  int n;         // bytes to move, or open()'s mode
+  int off;       // file offset to read or write at, or -1 for f's
+  uint64 addr;   // buffer, path, or struct stat
+  uint64 addr2;  // struct stat, for RING_STAT
+  uint64 data;   // the process's, copied to the completion
+};
+
+struct ringcqe {
+  uint64 data;   // from the submission
+  int res;       // what the system call would return
+  int unused;
+};
+
+struct ring {
+  uint sqhead;   // next submission the kernel runs
+  uint sqtail;   // where the process adds the next one
+  uint cqhead;   // next completion the process takes
+  uint cqtail;   // where the kernel adds the next one
+  struct ringsqe sq[NRING];
+  struct ringcqe cq[NRING];
+};
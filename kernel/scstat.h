@@ -0,0 +1,14 @@
+#pragma once
+
+// Per system call counters; see scstat() in syscall.c.
+
+#define NSCHIST 24   // latency buckets
+
+struct scstat {
+  uint64 count;          // calls that returned
+  uint64 time;           // r_time() ticks they took, in total
+  // hist[i] counts calls that took [2^i, 2^(i+1)) ticks
+  // (hist[0] also those that took 0); the last bucket
+  // also those that took longer.
+  uint64 hist[NSCHIST];
+};
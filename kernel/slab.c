@@ -0,0 +1,307 @@
+// Slab allocator for small kernel objects, layered on kalloc().
+//
+// A kmem_cache hands out objects of one size. It carves
+// kalloc() pages ("slabs") into objects and keeps a free
+// list per slab. Each slab starts with a struct slab header,
+// so kmem_cache_free() finds an object's slab by rounding
+// its address down to the page.
+//
+// Each CPU keeps a small stack of free objects per cache, so
+// most allocations and frees touch no shared lock. A CPU
+// whose stack is empty refills half of it from the slabs;
+// one whose stack is full gives half of it back. The stack's
+// own lock is only ever contended by slabshrink().
+//
+// A slab that becomes completely free goes back to kalloc(),
+// unless it is the cache's only free slab. When kalloc()
+// runs out of pages, slabshrink() empties the per-CPU stacks
+// and frees every unused slab.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKMEMCACHE 8   // number of caches
+#define NSLABCPU  16   // free objects cached per CPU
+
+struct run {
+  struct run *next;
+};
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;     // in the cache's partial or full list
+  struct slab *prev;
+  struct run *free;      // free objects in this slab
+  int inuse;             // objects handed out of this slab
+};
+
+struct kmem_cpu {
+  struct spinlock lock;
+  void *obj[NSLABCPU];
+  int n;
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;             // object size, rounded up to 8 bytes
+  int perslab;           // objects per slab
+  struct slab partial;   // slabs with free objects
+  struct slab full;      // slabs without
+  int nslab;             // slabs held
+  int inuse;             // objects out of slabs
+  struct kmem_cpu cpu[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NKMEMCACHE];
+  int n;
+} kmem_caches;
+
+void
+slabinit(void)
+{
+  initlock(&kmem_caches.lock, "kmem_caches");
+}
+
+static void
+slab_push(struct slab *head, struct slab *s)
+{
+  s->next = head->next;
+  s->prev = head;
+  head->next->prev = s;
+  head->next = s;
+}
+
+static void
+slab_remove(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Make a cache for objects of size bytes.
+// Caches live for the life of the kernel.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+  int i;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct run) || size > PGSIZE - sizeof(struct slab))
+    panic("kmem_cache_create: size");
+
+  acquire(&kmem_caches.lock);
+  if(kmem_caches.n == NKMEMCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &kmem_caches.cache[kmem_caches.n++];
+  release(&kmem_caches.lock);
+
+  initlock(&c->lock, name);
+  for(i = 0; i < NCPU; i++)
+    initlock(&c->cpu[i].lock, "kmem_cpu");
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  c->partial.next = c->partial.prev = &c->partial;
+  c->full.next = c->full.prev = &c->full;
+  return c;
+}
+
+// Take up to n objects out of c's slabs into obj[].
+// Allocates a new slab if there are no free objects.
+// Returns the number of objects taken.
+static int
+slab_take(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s;
+  struct run *r;
+  char *p;
+  int i, got;
+
+  acquire(&c->lock);
+  if(c->partial.next == &c->partial){
+    release(&c->lock);
+    if((s = (struct slab*)kalloc()) == 0)
+      return 0;
+    s->cache = c;
+    s->free = 0;
+    s->inuse = 0;
+    p = (char*)s + sizeof(struct slab);
+    for(i = 0; i < c->perslab; i++){
+      r = (struct run*)(p + i*c->size);
+      r->next = s->free;
+      s->free = r;
+    }
+    acquire(&c->lock);
+    slab_push(&c->partial, s);
+    c->nslab++;
+  }
+
+  got = 0;
+  while(got < n && (s = c->partial.next) != &c->partial){
+    while(got < n && s->free){
+      r = s->free;
+      s->free = r->next;
+      s->inuse++;
+      obj[got++] = r;
+    }
+    if(s->free == 0){
+      slab_remove(s);
+      slab_push(&c->full, s);
+    }
+  }
+  c->inuse += got;
+  release(&c->lock);
+  return got;
+}
+
+// Return n objects to their slabs.
+static void
+slab_give(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s, *freeslab;
+  struct run *r;
+  int i;
+
+  freeslab = 0;
+  acquire(&c->lock);
+  for(i = 0; i < n; i++){
+    r = (struct run*)obj[i];
+    s = (struct slab*)PGROUNDDOWN((uint64)r);
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->free == 0){
+      slab_remove(s);
+      slab_push(&c->partial, s);
+    }
+    r->next = s->free;
+    s->free = r;
+    s->inuse--;
+    if(s->inuse == 0 && freeslab == 0 &&
+       !(c->partial.next == s && s->next == &c->partial)){
+      // completely free, and not the only slab with room.
+      slab_remove(s);
+      c->nslab--;
+      freeslab = s;
+    }
+  }
+  c->inuse -= n;
+  release(&c->lock);
+
+  if(freeslab)
+    kfree(freeslab);
+}
+
+// Allocate an object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct kmem_cpu *kc;
+  void *obj[NSLABCPU/2];
+  int n;
+
+  // interrupts stay off so that we stay on this CPU.
+  push_off();
+  kc = &c->cpu[cpuid()];
+  acquire(&kc->lock);
+  if(kc->n == 0){
+    // slab_take() may call kalloc(), and so slabshrink(),
+    // which needs kc->lock.
+    release(&kc->lock);
+    n = slab_take(c, obj, NSLABCPU/2);
+    acquire(&kc->lock);
+    while(n > 0)
+      kc->obj[kc->n++] = obj[--n];
+  }
+  obj[0] = 0;
+  if(kc->n > 0)
+    obj[0] = kc->obj[--kc->n];
+  release(&kc->lock);
+  pop_off();
+  return obj[0];
+}
+
+// Free obj, which came from kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct kmem_cpu *kc;
+
+  push_off();
+  kc = &c->cpu[cpuid()];
+  acquire(&kc->lock);
+  if(kc->n == NSLABCPU){
+    kc->n -= NSLABCPU/2;
+    slab_give(c, kc->obj + kc->n, NSLABCPU/2);
+  }
+  kc->obj[kc->n++] = obj;
+  release(&kc->lock);
+  pop_off();
+}
+
+// Give every unused slab back to kalloc().
+// Called by kalloc() when it runs out of pages.
+// Returns the number of pages freed.
+int
+slabshrink(void)
+{
+  struct kmem_cache *c;
+  struct kmem_cpu *kc;
+  struct slab *s, *next, *freed;
+  int n;
+
+  n = 0;
+  for(c = kmem_caches.cache; c < kmem_caches.cache + kmem_caches.n; c++){
+    for(kc = c->cpu; kc < c->cpu + NCPU; kc++){
+      acquire(&kc->lock);
+      slab_give(c, kc->obj, kc->n);
+      kc->n = 0;
+      release(&kc->lock);
+    }
+
+    freed = 0;
+    acquire(&c->lock);
+    for(s = c->partial.next; s != &c->partial; s = next){
+      next = s->next;
+      if(s->inuse == 0){
+        slab_remove(s);
+        c->nslab--;
+        s->next = freed;
+        freed = s;
+      }
+    }
+    release(&c->lock);
+
+    for(; freed; freed = next){
+      next = freed->next;
+      kfree(freed);
+      n++;
+    }
+  }
+  return n;
+}
+
+// Print the utilization of every cache; see procdump().
+void
+slabprint(void)
+{
+  struct kmem_cache *c;
+  int i, cached;
+
+  for(c = kmem_caches.cache; c < kmem_caches.cache + kmem_caches.n; c++){
+    cached = 0;
+    for(i = 0; i < NCPU; i++)
+      cached += c->cpu[i].n;
+    printf("slab %s: %d/%d objects of %d bytes in use, %d cached per-cpu, %d pages\n",
+           c->name, c->inuse - cached, c->nslab * c->perslab, c->size,
+           cached, c->nslab);
+  }
+}
@@ -1,4 +1,14 @@
 // Sleeping locks
+//
+// An uncontended lock is taken and given back with one atomic
+// instruction each on lk->locked, without lk->lk. Only a
+// process that has to wait takes lk->lk, counts itself in
+// lk->wwait or lk->rwait, and sleeps; a release calls wakeup()
+// only if one of those is set. The counters are raised, and
+// lk->locked tested, under lk->lk, while a release stores
+// lk->locked before testing the counters, each with a fence
+// in between, so that either the waiter sees the lock free or
+// the release sees the waiter.
 
 #include "types.h"
 #include "riscv.h"
@@ -8,6 +18,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "lockstat.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -15,41 +26,148 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
+  lk->rwait = 0;
   lk->pid = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockclass(name, 1);
+#endif
+}
+
+// lk->locked has just been set to SL_EXCL.
+static void
+sleepheld(struct sleeplock *lk, uint64 t0)
+{
+  lk->pid = myproc()->pid;
+#ifdef LOCKSTAT
+  if(lk->stat){
+    lk->held = r_time();
+    lockacquired(lk->stat, t0 ? lk->held - t0 : 0);
+  }
+#endif
+}
+
+// Wake the processes waiting for lk, if there are any.
+static void
+sleepwake(struct sleeplock *lk)
+{
+  __sync_synchronize();
+  if(*(volatile int*)&lk->wwait || *(volatile int*)&lk->rwait){
+    acquire(&lk->lk);
+    wakeup(lk);
+    release(&lk->lk);
+  }
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 t0;
+
+  if(__sync_bool_compare_and_swap(&lk->locked, 0, SL_EXCL)){
+    sleepheld(lk, 0);
+    return;
+  }
+
   acquire(&lk->lk);
-  while (lk->locked) {
+  t0 = r_time();
+  lk->wwait++;
+  while (!__sync_bool_compare_and_swap(&lk->locked, 0, SL_EXCL)) {
     sleep(lk, &lk->lk);
   }
-  lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->wwait--;
   release(&lk->lk);
+  sleepheld(lk, t0);
+}
+
+// Acquire lk if no one holds it, without sleeping.
+// Returns 1 if lk was acquired, 0 otherwise.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  if(!__sync_bool_compare_and_swap(&lk->locked, 0, SL_EXCL))
+    return 0;
+  sleepheld(lk, 0);
+  return 1;
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
-  acquire(&lk->lk);
-  lk->locked = 0;
+#ifdef LOCKSTAT
+  if(lk->stat)
+    lockreleased(lk->stat, r_time() - lk->held);
+#endif
   lk->pid = 0;
-  wakeup(lk);
-  release(&lk->lk);
+  __sync_lock_release(&lk->locked);
+  sleepwake(lk);
 }
 
 int
 holdingsleep(struct sleeplock *lk)
 {
-  int r;
-  
+  return lk->locked == SL_EXCL && lk->pid == myproc()->pid;
+}
+
+// Shared mode, for holders that only read what lk protects:
+// any number of processes may hold lk shared at once, but
+// not together with an exclusive holder. New readers wait
+// while a writer does, so that a stream of readers cannot
+// starve it. A process holds at most one lock shared, which
+// p->shared records for holdingshared(). lk->readers only
+// changes under lk->lk, and with it lk->locked while it is
+// SL_SHARED.
+void
+acquireshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+
+  if(p->shared)
+    panic("acquireshared");
   acquire(&lk->lk);
-  r = lk->locked && (lk->pid == myproc()->pid);
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int waited = 0;
+#endif
+  lk->rwait++;
+  while (lk->wwait ||
+         (lk->locked != SL_SHARED &&
+          !__sync_bool_compare_and_swap(&lk->locked, 0, SL_SHARED))) {
+#ifdef LOCKSTAT
+    waited = 1;
+#endif
+    sleep(lk, &lk->lk);
+  }
+  lk->rwait--;
+  lk->readers++;
+  p->shared = lk;
+#ifdef LOCKSTAT
+  if(lk->stat)
+    lockacquired(lk->stat, waited ? r_time() - t0 : 0);
+#endif
   release(&lk->lk);
-  return r;
 }
 
+void
+releaseshared(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
 
+  if(p->shared != lk)
+    panic("releaseshared");
+  p->shared = 0;
+  acquire(&lk->lk);
+  if(--lk->readers == 0){
+    __sync_lock_release(&lk->locked);
+    if(lk->wwait || lk->rwait)
+      wakeup(lk);
+  }
+  release(&lk->lk);
+}
 
+int
+holdingshared(struct sleeplock *lk)
+{
+  return myproc()->shared == lk;
+}
@@ -3,13 +3,23 @@
 #include "types.h"
 #include "spinlock.h"
 
+#define SL_EXCL   1  // locked by acquiresleep()
+#define SL_SHARED 2  // locked by acquireshared()
+
 // Long-term locks for processes
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held? 0, SL_EXCL or SL_SHARED
   struct spinlock lk; // spinlock protecting this sleep lock
+  int readers;       // holders in shared mode
+  int wwait;         // acquiresleep() callers sleeping
+  int rwait;         // acquireshared() callers sleeping
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+#ifdef LOCKSTAT
+  struct lockstat *stat;  // counters for name, or 0
+  uint64 held;       // r_time() when acquired
+#endif
 };
 
@@ -1,4 +1,12 @@
 // Mutual exclusion spin locks.
+//
+// A ticket lock: acquire() takes the next ticket and waits
+// until owner reaches it, so the lock goes to the waiting
+// CPUs in the order they came. The waiters only read owner,
+// and between reads back off for longer the further back in
+// line they are, starting small and doubling up to
+// MAXBACKOFF, so a contended lock's cache line is not
+// written by every spin and read by every CPU in turn.
 
 #include "types.h"
 #include "param.h"
@@ -7,13 +15,20 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+#define MAXBACKOFF 64   // most delay loops per waiter ahead of us
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockclass(name, 0);
+#endif
 }
 
 // Acquire the lock.
@@ -21,16 +36,27 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, owner, backoff, i;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
+  //   amoadd.w a5, a5, (s1)
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+#ifdef LOCKSTAT
+  uint64 t0 = 0;
+  if(*(volatile uint*)&lk->owner != ticket)
+    t0 = r_time();
+#endif
+  backoff = 1;
+  while((owner = *(volatile uint*)&lk->owner) != ticket){
+    for(i = 0; i < backoff * (ticket - owner); i++)
+      asm volatile("nop");
+    if(backoff < MAXBACKOFF)
+      backoff <<= 1;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +66,12 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+#ifdef LOCKSTAT
+  if(lk->stat){
+    lk->held = r_time();
+    lockacquired(lk->stat, t0 ? lk->held - t0 : 0);
+  }
+#endif
 }
 
 // Release the lock.
@@ -49,6 +81,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  if(lk->stat)
+    lockreleased(lk->stat, r_time() - lk->held);
+#endif
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +95,12 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Hand the lock to the next ticket. Only the holder
+  // writes owner, so this need not be atomic, but it must be
+  // the one store of a volatile: the C standard implies that
+  // an assignment might be implemented with multiple store
+  // instructions.
+  *(volatile uint*)&lk->owner = lk->owner + 1;
 
   pop_off();
 }
@@ -77,7 +111,7 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lockheld(lk) && lk->cpu == mycpu());
   return r;
 }
 
@@ -108,3 +142,88 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Lock counters, with make LOCKSTAT=1.
+//
+// Locks of the same name share one struct lockstat, found
+// by lockclass() when the lock is initialized; the counters
+// are updated with atomic instructions, since the locks of a
+// name may be held on several CPUs at once. Counting costs
+// two reads of the time CSR and a few atomic adds per
+// acquire and release, which is why it is a build option.
+
+static struct {
+  struct spinlock lock;     // has no stat, so is not counted
+  struct lockstat stat[NLOCKSTAT];
+  int n;
+} lockstats;
+
+// The counters for locks called name (sleep locks if sleep
+// is set), or 0 if there is no room for another name.
+struct lockstat*
+lockclass(char *name, int sleep)
+{
+  struct lockstat *s;
+
+  acquire(&lockstats.lock);
+  for(s = lockstats.stat; s < lockstats.stat + lockstats.n; s++)
+    if(s->sleep == sleep && strncmp(s->name, name, sizeof(s->name)-1) == 0)
+      break;
+  if(s == lockstats.stat + lockstats.n){
+    if(lockstats.n < NLOCKSTAT){
+      safestrcpy(s->name, name, sizeof(s->name));
+      s->sleep = sleep;
+      lockstats.n++;
+    } else {
+      s = 0;
+    }
+  }
+  release(&lockstats.lock);
+  return s;
+}
+
+// A lock of s was acquired after waiting wait ticks.
+void
+lockacquired(struct lockstat *s, uint64 wait)
+{
+  __sync_fetch_and_add(&s->acquires, 1);
+  if(wait){
+    __sync_fetch_and_add(&s->contended, 1);
+    __sync_fetch_and_add(&s->waittime, wait);
+  }
+}
+
+// A lock of s was released after being held hold ticks.
+void
+lockreleased(struct lockstat *s, uint64 hold)
+{
+  uint64 old;
+
+  __sync_fetch_and_add(&s->holdtime, hold);
+  while((old = s->maxhold) < hold &&
+        __sync_val_compare_and_swap(&s->maxhold, old, hold) != old)
+    ;
+}
+
+// int lockstat(struct lockstat *buf, int n)
+// Copy the counters of up to n lock names to buf. Returns
+// the number of names counted, or -1 if the kernel does
+// not count.
+uint64
+sys_lockstat(void)
+{
+#ifdef LOCKSTAT
+  uint64 buf;
+  int n, i;
+
+  argaddr(0, &buf);
+  argint(1, &n);
+  for(i = 0; i < n && i < lockstats.n; i++)
+    if(copyout(myproc()->pagetable, buf + i*sizeof(struct lockstat),
+               (char*)&lockstats.stat[i], sizeof(struct lockstat)) < 0)
+      return -1;
+  return lockstats.n;
+#else
+  return -1;
+#endif
+}
@@ -2,12 +2,20 @@
 
 #include "types.h"
 
-// Mutual exclusion lock.
+// Mutual exclusion lock; see spinlock.c.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // the ticket acquire() hands out next
+  uint owner;        // the ticket that holds the lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+#ifdef LOCKSTAT
+  struct lockstat *stat;  // counters for name, or 0
+  uint64 held;       // r_time() when acquired
+#endif
 };
 
+
+// Whether some CPU holds lk, or waits for it.
+#define lockheld(lk) ((lk)->next != (lk)->owner)
@@ -13,3 +13,17 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// A directory entry, as returned by getdents().
+#define DIRENTSIZ 14
+
+struct dirent {
+  ushort inum;
+  char name[DIRENTSIZ];
+};
+
+// A buffer for readv() and writev().
+struct iovec {
+  void *iov_base;
+  int iov_len;
+};
@@ -0,0 +1,153 @@
+// Event counters, and the stats device that shows them.
+//
+// Each CPU counts events in its own array, with interrupts
+// off rather than a lock, so counting costs a few instructions
+// and no shared cache line. Readers add the arrays up without
+// locks; a sum may miss the events of the moment.
+//
+// Reading the stats device (major STATS, /stats) gives one
+// "name count" line per counter, as of the first read from
+// offset 0 of that output, so that cat sees an end of file.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "stats.h"
+#include "fs/xv6fs/file.h"
+
+extern struct devsw devsw[];
+
+static char *statsnames[NSTAT] = {
+  [ST_BHIT]       "bcache_hit",
+  [ST_BMISS]      "bcache_miss",
+  [ST_BEVICT]     "bcache_evict",
+  [ST_PCHIT]      "pcache_hit",
+  [ST_PCMISS]     "pcache_miss",
+  [ST_DREAD]      "disk_read",
+  [ST_DREADBLK]   "disk_read_blocks",
+  [ST_DREADTIME]  "disk_read_time",
+  [ST_DWRITE]     "disk_write",
+  [ST_DWRITEBLK]  "disk_write_blocks",
+  [ST_DWRITETIME] "disk_write_time",
+  [ST_DNOTIFY]    "disk_notify",
+  [ST_DINTR]      "disk_intr",
+  [ST_BALLOC]     "balloc",
+  [ST_BALLOCSCAN] "balloc_scan",
+  [ST_IALLOC]     "ialloc",
+  [ST_IALLOCSCAN] "ialloc_scan",
+  [ST_IWRITE]     "inode_write",
+  [ST_RECLAIM]    "inode_reclaim",
+  [ST_DLOOKUP]    "dirlookup",
+  [ST_DCACHEHIT]  "dirlookup_cached",
+  [ST_DIRSCAN]    "dirlookup_scan",
+  [ST_IGET]       "iget",
+  [ST_IGETSCAN]   "iget_scan",
+  [ST_KALLOC]     "kalloc",
+  [ST_KCONTEND]   "kalloc_contended",
+  [ST_KZERO]      "kalloc_prezeroed",
+  [ST_LAZY]       "sbrk_fault",
+  [ST_TIMER]      "timer_intr",
+};
+
+// a cache line per CPU, so that counting never
+// shares one with another CPU.
+static struct {
+  uint64 n[NSTAT];
+} __attribute__((aligned(64))) cpustats[NCPU];
+
+// The text of the stats device, built at offset 0. A sleep
+// lock, since copying it out may fault.
+static struct {
+  struct sleeplock lock;
+  char *buf;
+  int len;
+} snap;
+
+void
+statsinit(void)
+{
+  initsleeplock(&snap.lock, "stats");
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = 0;
+}
+
+// Add n to counter i of this CPU.
+void
+statadd(int i, uint64 n)
+{
+  push_off();
+  cpustats[cpuid()].n[i] += n;
+  pop_off();
+}
+
+void
+statinc(int i)
+{
+  statadd(i, 1);
+}
+
+// The total of counter i over all CPUs.
+uint64
+statsum(int i)
+{
+  uint64 n;
+  int c;
+
+  n = 0;
+  for(c = 0; c < NCPU; c++)
+    n += *(volatile uint64*)&cpustats[c].n[i];
+  return n;
+}
+
+// Append "name n\n" to buf, which holds *len of max bytes.
+static void
+statline(char *buf, int *len, int max, char *name, uint64 n)
+{
+  char num[20];
+  int i;
+
+  i = 0;
+  do {
+    num[i++] = '0' + n % 10;
+    n /= 10;
+  } while(n);
+  if(*len + strlen(name) + i + 2 > max)
+    return;
+  memmove(buf + *len, name, strlen(name));
+  *len += strlen(name);
+  buf[(*len)++] = ' ';
+  while(i > 0)
+    buf[(*len)++] = num[--i];
+  buf[(*len)++] = '\n';
+}
+
+// Read from the stats device: up to n bytes at offset off
+// of the counters' text.
+int
+statsread(int user_dst, uint64 dst, int n, uint off)
+{
+  int i, r;
+
+  acquiresleep(&snap.lock);
+  if(snap.buf == 0 && (snap.buf = kalloc()) == 0){
+    releasesleep(&snap.lock);
+    return -1;
+  }
+  if(off == 0){
+    snap.len = 0;
+    for(i = 0; i < NSTAT; i++)
+      statline(snap.buf, &snap.len, PGSIZE, statsnames[i], statsum(i));
+  }
+  r = 0;
+  if(off < snap.len){
+    r = snap.len - off < n ? snap.len - off : n;
+    if(either_copyout(user_dst, dst, snap.buf + off, r) < 0)
+      r = -1;
+  }
+  releasesleep(&snap.lock);
+  return r;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Event counters; see stats.c. statsnames[] in stats.c
+// must list them in this order.
+enum {
+  ST_BHIT,         // bread()s satisfied from the buffer cache
+  ST_BMISS,        // bread()s that went to the disk
+  ST_BEVICT,       // buffers recycled for another block
+  ST_PCHIT,        // page cache lookups that found the page
+  ST_PCMISS,       // and that did not
+  ST_DREAD,        // disk read requests
+  ST_DREADBLK,     // blocks they read
+  ST_DREADTIME,    // time from submit to completion, in r_time() units
+  ST_DWRITE,       // disk write requests
+  ST_DWRITEBLK,
+  ST_DWRITETIME,
+  ST_DNOTIFY,      // times the disk was told of new requests
+  ST_DINTR,        // disk interrupts
+  ST_BALLOC,       // block allocations
+  ST_BALLOCSCAN,   // free bitmap bits, or full bytes, examined by them
+  ST_IALLOC,       // inode allocations
+  ST_IALLOCSCAN,   // inode numbers they passed over to find one
+  ST_IWRITE,       // dinodes changed and logged by iupdate
+  ST_RECLAIM,      // orphans whose blocks ireclaimd freed
+  ST_DLOOKUP,      // dirlookup()s
+  ST_DCACHEHIT,    // answered by the dentry cache
+  ST_DIRSCAN,      // directory entries scanned, by lookups and links
+  ST_IGET,         // iget()s
+  ST_IGETSCAN,     // inode table entries examined by them
+  ST_KALLOC,       // pages allocated
+  ST_KCONTEND,     // free list locks found held
+  ST_KZERO,        // kzalloc()s that got a page zeroed while idle
+  ST_LAZY,         // heap pages allocated at their first touch
+  ST_TIMER,        // timer interrupts, on all CPUs
+  NSTAT
+};
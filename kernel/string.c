@@ -1,13 +1,29 @@
 #include "types.h"
 
+// The mem* functions work a 64-bit word at a time when their
+// pointers are equally aligned, eight words a time for the
+// pages and blocks that most calls are about, and bytes only
+// at the unaligned edges.
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && ((uint64)cdst & 7) != 0){
+    *cdst++ = c;
+    n--;
   }
+  w = (uchar)c * 0x0101010101010101UL;
+  for(wdst = (uint64*)cdst; n >= 64; n -= 64, wdst += 8){
+    wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+    wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+  }
+  for(; n >= 8; n -= 8)
+    *wdst++ = w;
+  for(cdst = (char*)wdst; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +34,15 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    while(n > 0 && ((uint64)s1 & 7) != 0 && *s1 == *s2)
+      n--, s1++, s2++;
+    if(((uint64)s1 & 7) == 0){
+      // the bytes loop below finds where the words differ.
+      while(n >= 8 && *(const uint64*)s1 == *(const uint64*)s2)
+        n -= 8, s1 += 8, s2 += 8;
+    }
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -41,11 +66,38 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      // d - s is a multiple of 8, so words do not overlap.
+      while(n > 0 && ((uint64)d & 7) != 0){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= 8; n -= 8){
+        d -= 8;
+        s -= 8;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      while(n > 0 && ((uint64)d & 7) != 0){
+        *d++ = *s++;
+        n--;
+      }
+      for(; n >= 64; n -= 64, d += 64, s += 64){
+        uint64 *wd = (uint64*)d;
+        const uint64 *ws = (const uint64*)s;
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= 8; n -= 8, d += 8, s += 8)
+        *(uint64*)d = *(const uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -60,6 +112,16 @@ memcpy(void *dst, const void *src, uint n)
 int
 strncmp(const char *p, const char *q, uint n)
 {
+  if((((uint64)p ^ (uint64)q) & 7) == 0){
+    while(n > 0 && ((uint64)p & 7) != 0 && *p && *p == *q)
+      n--, p++, q++;
+    // an aligned word does not cross into another page.
+    if(((uint64)p & 7) == 0){
+      while(n >= 8 && *(const uint64*)p == *(const uint64*)q &&
+            !HASZERO(*(const uint64*)p))
+        n -= 8, p += 8, q += 8;
+    }
+  }
   while(n > 0 && *p && *p == *q)
     n--, p++, q++;
   if(n == 0)
@@ -98,10 +160,15 @@ safestrcpy(char *s, const char *t, int n)
 int
 strlen(const char *s)
 {
-  int n;
-
-  for(n = 0; s[n]; n++)
-    ;
-  return n;
+  const char *p;
+
+  for(p = s; ((uint64)p & 7) != 0; p++)
+    if(*p == 0)
+      return p - s;
+  while(!HASZERO(*(const uint64*)p))
+    p += 8;
+  while(*p)
+    p++;
+  return p - s;
 }
 
@@ -6,6 +6,8 @@
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
+#include "trace.h"
+#include "scstat.h"
 
 // Fetch the uint64 at addr from the current process.
 int
@@ -101,6 +103,23 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_scstat(void);
+extern uint64 sys_nsec(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_ringsetup(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_rename(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,22 +145,96 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    = sys_link,
 [SYS_mkdir]   = sys_mkdir,
 [SYS_close]   = sys_close,
+[SYS_fsync]   = sys_fsync,
+[SYS_getdents] = sys_getdents,
+[SYS_pread]   = sys_pread,
+[SYS_pwrite]  = sys_pwrite,
+[SYS_readv]   = sys_readv,
+[SYS_writev]  = sys_writev,
+[SYS_lseek]   = sys_lseek,
+[SYS_mmap]    = sys_mmap,
+[SYS_munmap]  = sys_munmap,
+[SYS_sendfile] = sys_sendfile,
+[SYS_mount]   = sys_mount,
+[SYS_scstat]  = sys_scstat,
+[SYS_nsec]    = sys_nsec,
+[SYS_lockstat] = sys_lockstat,
+[SYS_ringsetup] = sys_ringsetup,
+[SYS_ringenter] = sys_ringenter,
+[SYS_rename]  = sys_rename,
 };
 
+// Each CPU counts the system calls that return on it, with
+// interrupts off rather than a lock.
+static struct {
+  struct scstat s[NELEM(syscalls)];
+} __attribute__((aligned(64))) scstats[NCPU];
+
+// Count a call of system call num that took t ticks.
+static void
+sccount(int num, uint64 t)
+{
+  struct scstat *s;
+  int i;
+
+  for(i = 0; i < NSCHIST-1 && (t >> (i+1)) != 0; i++)
+    ;
+  push_off();
+  s = &scstats[cpuid()].s[num];
+  s->count++;
+  s->time += t;
+  s->hist[i]++;
+  pop_off();
+}
+
 void
 syscall(void)
 {
   int num;
+  uint64 t0;
   struct proc *p = myproc();
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
+    trace(TR_SYSENTER, num, p->trapframe->a0);
+    t0 = r_time();
     p->trapframe->a0 = syscalls[num]();
+    sccount(num, r_time() - t0);
+    trace(TR_SYSEXIT, num, p->trapframe->a0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
     p->trapframe->a0 = -1;
   }
 }
+
+// int scstat(struct scstat *buf, int n)
+// Copy the counters of system calls 0 to n-1, added up over
+// the CPUs, to buf. Returns the number of system calls the
+// kernel has counters for, or -1.
+uint64
+sys_scstat(void)
+{
+  struct scstat s;
+  uint64 buf;
+  int n, num, c, i;
+
+  argaddr(0, &buf);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  for(num = 0; num < n && num < NELEM(syscalls); num++){
+    memset(&s, 0, sizeof(s));
+    for(c = 0; c < NCPU; c++){
+      s.count += scstats[c].s[num].count;
+      s.time += scstats[c].s[num].time;
+      for(i = 0; i < NSCHIST; i++)
+        s.hist[i] += scstats[c].s[num].hist[i];
+    }
+    if(copyout(myproc()->pagetable, buf + num*sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return NELEM(syscalls);
+}
@@ -22,3 +22,20 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fsync  22
+#define SYS_getdents 23
+#define SYS_pread  24
+#define SYS_pwrite 25
+#define SYS_readv  26
+#define SYS_writev 27
+#define SYS_lseek  28
+#define SYS_mmap   29
+#define SYS_munmap 30
+#define SYS_sendfile 31
+#define SYS_mount  32
+#define SYS_scstat 33
+#define SYS_nsec   34
+#define SYS_lockstat 35
+#define SYS_ringsetup 36
+#define SYS_ringenter 37
+#define SYS_rename 38
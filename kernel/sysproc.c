@@ -52,20 +52,9 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepticks(n);
 }
 
 uint64
@@ -77,15 +66,17 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+// return how many ticks, TICKHZ a second, have passed
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return r_time() / (TIMEHZ / TICKHZ);
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+// nanoseconds since boot, from the time CSR.
+uint64
+sys_nsec(void)
+{
+  return r_time() * (1000000000 / TIMEHZ);
 }
@@ -0,0 +1,172 @@
+// Tracepoints, and the trace device that drains them.
+//
+// trace() records an event with its r_time() and CPU in a
+// ring of the CPU it runs on. Only that CPU adds to its ring,
+// with interrupts off, so recording takes no lock; a record
+// is complete before head moves past it. A reader takes
+// records from behind tail, and a ring that is full drops
+// new records and counts them, which the reader sees as a
+// TR_LOST record.
+//
+// tracemask selects the events that are recorded, and is 0
+// at boot. Writing a mask in hex ("0" for none, "all"
+// for every event) to the trace device (major TRACE, /trace)
+// sets it; reading it drains whole struct tracerecs from
+// every CPU's ring.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "trace.h"
+#include "fs/xv6fs/file.h"
+
+#define NTRACE 1024   // records per CPU; a power of 2
+
+extern struct devsw devsw[];
+
+uint tracemask;
+
+static struct {
+  struct tracerec rec[NTRACE];
+  uint head;       // records ever added
+  uint tail;       // records ever taken
+  uint lost;       // records dropped
+  uint reported;   // of which TR_LOST records told
+} __attribute__((aligned(64))) tracebuf[NCPU];
+
+// One reader at a time; a sleep lock, since copying the
+// records out may fault.
+static struct sleeplock readlock;
+
+static int traceread(int, uint64, int, uint);
+static int tracewrite(int, uint64, int);
+
+void
+traceinit(void)
+{
+  initsleeplock(&readlock, "trace");
+  devsw[TRACE].read = traceread;
+  devsw[TRACE].write = tracewrite;
+}
+
+// Record an event; see trace() in trace.h.
+void
+tracerec(int ev, uint64 a, uint64 b)
+{
+  struct tracerec *r;
+  struct proc *p;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(tracebuf[id].head - tracebuf[id].tail == NTRACE){
+    tracebuf[id].lost++;
+  } else {
+    r = &tracebuf[id].rec[tracebuf[id].head % NTRACE];
+    r->time = r_time();
+    r->event = ev;
+    r->cpu = id;
+    p = mycpu()->proc;
+    r->pid = p ? p->pid : 0;
+    r->a = a;
+    r->b = b;
+    __sync_synchronize();
+    tracebuf[id].head++;
+  }
+  pop_off();
+}
+
+// The first 8 bytes of a path element, for TR_NAMEI.
+uint64
+tracename(char *name)
+{
+  uint64 v;
+  int i;
+
+  v = 0;
+  for(i = 0; i < 8 && name[i]; i++)
+    v |= (uint64)(uchar)name[i] << (8*i);
+  return v;
+}
+
+// Move up to n bytes of whole records to dst.
+static int
+traceread(int user_dst, uint64 dst, int n, uint off)
+{
+  struct tracerec lost;
+  int id, r;
+  uint nlost;
+
+  acquiresleep(&readlock);
+  r = 0;
+  for(id = 0; id < NCPU; id++){
+    nlost = tracebuf[id].lost - tracebuf[id].reported;
+    if(nlost > 0 && r + sizeof(lost) <= n){
+      lost.time = r_time();
+      lost.event = TR_LOST;
+      lost.cpu = id;
+      lost.pid = 0;
+      lost.a = nlost;
+      lost.b = 0;
+      if(either_copyout(user_dst, dst + r, &lost, sizeof(lost)) < 0)
+        goto bad;
+      tracebuf[id].reported += nlost;
+      r += sizeof(lost);
+    }
+    while(tracebuf[id].tail != tracebuf[id].head && r + sizeof(struct tracerec) <= n){
+      __sync_synchronize();
+      if(either_copyout(user_dst, dst + r,
+                        &tracebuf[id].rec[tracebuf[id].tail % NTRACE],
+                        sizeof(struct tracerec)) < 0)
+        goto bad;
+      __sync_synchronize();
+      tracebuf[id].tail++;
+      r += sizeof(struct tracerec);
+    }
+  }
+  releasesleep(&readlock);
+  return r;
+
+ bad:
+  releasesleep(&readlock);
+  return -1;
+}
+
+// Set tracemask: a hex number, or "all".
+static int
+tracewrite(int user_src, uint64 src, int n)
+{
+  char buf[16];
+  uint mask;
+  int i, c, len;
+
+  if(n <= 0 || n >= sizeof(buf))
+    return -1;
+  if(either_copyin(buf, user_src, src, n) < 0)
+    return -1;
+  len = n;
+  while(len > 0 && buf[len-1] == '\n')
+    len--;
+  if(len == 3 && strncmp(buf, "all", 3) == 0){
+    tracemask = (1 << NTREVENT) - 1;
+    return n;
+  }
+  if(len == 0)
+    return -1;
+  mask = 0;
+  for(i = 0; i < len; i++){
+    c = buf[i];
+    if(c >= '0' && c <= '9')
+      mask = mask*16 + c - '0';
+    else if(c >= 'a' && c <= 'f')
+      mask = mask*16 + c - 'a' + 10;
+    else
+      return -1;
+  }
+  tracemask = mask;
+  return n;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Trace events; see trace.c. What a and b of a record
+// hold depends on the event.
+enum {
+  TR_LOST,         // a: records this CPU dropped since the last TR_LOST
+  TR_BGET,         // a: dev, b: blockno
+  TR_BMISS,        // bread() went to the disk. a: dev, b: blockno
+  TR_DSUBMIT,      // disk request queued. a: dev<<32 | write, b: blockno<<16 | nblk
+  TR_DDONE,        // disk request complete. a: as TR_DSUBMIT, b: r_time() since submit
+  TR_ILOCK,        // ilock() waited. a: dev<<32 | inum, b: r_time() it waited
+  TR_NAMEI,        // path element. a: dev<<32 | dir inum, b: first 8 bytes of the name
+  TR_SWITCH,       // scheduler switches to a process. a: pid
+  TR_SYSENTER,     // a: system call number, b: first argument
+  TR_SYSEXIT,      // a: system call number, b: return value
+  NTREVENT
+};
+
+// One record, as the trace device returns them.
+struct tracerec {
+  uint64 time;     // r_time()
+  ushort event;
+  ushort cpu;
+  int pid;         // of the process on the CPU, or 0
+  uint64 a;
+  uint64 b;
+};
+
+// What "trace dump" writes ahead of the records.
+#define TRACEMAGIC 0x52545658   // "XVTR"
+struct tracehdr {
+  uint magic;
+  uint recsize;    // sizeof(struct tracerec)
+  uint64 hz;       // r_time() ticks per second
+};
+
+extern uint tracemask;
+
+// Whether event ev is being traced.
+#define tracing(ev) (tracemask & (1 << (ev)))
+
+// Record event ev. If it is not being traced, this costs a
+// load and a branch, and a and b are not evaluated.
+#define trace(ev, a, b) do { \
+    if(tracing(ev)) \
+      tracerec((ev), (a), (b)); \
+  } while(0)
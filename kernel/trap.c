@@ -5,9 +5,22 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
-
+#include "xv6_fcntl.h"
+#include "vdso.h"
+#include "stats.h"
+
+// Timers. There is no periodic tick: each hart's CLINT
+// mtimecmp is set for the next thing it must do, the end
+// of the running process's quantum or the earliest
+// sleepticks() deadline, whichever is sooner. A hart that
+// is idle and has no deadline to watch takes no timer
+// interrupts at all, and sleepticks() wakes up when its
+// time is up instead of at the next tick. ticks is
+// r_time() in TICKHZ units as of the last timer interrupt;
+// tickslock protects it and nextwake.
 struct spinlock tickslock;
 uint ticks;
+static uint64 nextwake = ~0ULL;  // earliest sleepticks() deadline
 
 extern char trampoline[], uservec[], userret[];
 
@@ -29,6 +42,17 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// The access that page fault scause was for.
+static int
+faultprot(uint64 scause)
+{
+  if(scause == 12)
+    return PROT_EXEC;
+  if(scause == 15)
+    return PROT_WRITE;
+  return PROT_READ;
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -67,6 +91,12 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 15 && uvmcow(p->pagetable, r_stval()) != 0){
+    // store to a copy-on-write page
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), faultprot(r_scause())) != 0){
+    // page fault in an mmap() region, the program image
+    // or the heap
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -160,18 +190,84 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// A timer interrupt: wake the sleepticks() callers whose
+// time is up.
 void
 clockintr()
 {
+  uint64 now;
+
+  statinc(ST_TIMER);
+  acquire(&tickslock);
+  now = r_time();
+  ticks = now / (TIMEHZ / TICKHZ);
+  vdsopage->ticks = ticks;
+  if(now >= nextwake){
+    nextwake = ~0ULL;
+    wakeup(&ticks);
+  }
+  release(&tickslock);
+}
+
+// Have this hart's timer interrupt at r_time() when.
+static void
+timerset(uint64 when)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// Set this hart's timer for its next event: the earliest
+// sleepticks() deadline, or qend, the end of the quantum
+// of the process it runs, if that is sooner (qend 0 if
+// none). nextwake is read without tickslock: a sleepticks()
+// that moved it closer then goes on to schedule on its own
+// hart, which sets its timer for it.
+void
+timerarm(uint64 qend)
+{
+  uint64 when;
+
+  when = nextwake;
+  if(qend != 0 && qend < when)
+    when = qend;
+  timerset(when);
+}
+
+// Interrupt hart id now, so that an idle one looks at the
+// run queues. Its timervec and devintr() then set its timer
+// for what it was waiting for.
+void
+timerkick(int id)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(id) = 0;
+}
+
+// Sleep until n ticks have passed, or the process is killed.
+// Returns 0, or -1 if killed.
+int
+sleepticks(int n)
+{
+  uint64 until;
+
+  until = r_time() + (uint64)(n > 0 ? n : 0) * (TIMEHZ / TICKHZ);
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  while(r_time() < until){
+    if(killed(myproc())){
+      release(&tickslock);
+      return -1;
+    }
+    if(until < nextwake)
+      nextwake = until;
+    sleep(&ticks, &tickslock);
+  }
   release(&tickslock);
+  return 0;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if timer interrupt that ended the running
+// process's quantum, so that it should yield(),
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -188,8 +284,8 @@ devintr()
 
     if(irq == UART0_IRQ){
       uartintr();
-    } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+    } else if(irq >= VIRTIO0_IRQ && irq < VIRTIO_IRQ(NDISK)){
+      virtio_disk_intr(irq - VIRTIO0_IRQ);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -203,17 +299,15 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // forwarded by timervec in kernelvec.S: this hart's next
+    // event, or a timerkick().
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    clockintr();
+    return quantum() ? 2 : 1;
   } else {
     return 0;
   }
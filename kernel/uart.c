@@ -34,13 +34,16 @@
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
 #define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+#define TX_FIFO 16            // bytes the transmit FIFO holds
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
-// the transmit output buffer.
+// the transmit output buffer. write() and kernel printf()
+// both append to it, and the transmit interrupt drains it,
+// TX_FIFO bytes at a time.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 4096
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
@@ -77,14 +80,14 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
-// UART to start sending if it isn't already.
-// blocks if the output buffer is full.
+// add the n bytes at s to the output buffer and tell
+// the UART to start sending if it isn't already.
+// blocks while the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
 // by write().
 void
-uartputc(int c)
+uartwrite(char *s, int n)
 {
   acquire(&uart_tx_lock);
 
@@ -92,22 +95,45 @@ uartputc(int c)
     for(;;)
       ;
   }
-  while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
-    // buffer is full.
-    // wait for uartstart() to open up space in the buffer.
-    sleep(&uart_tx_r, &uart_tx_lock);
+  while(n > 0){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full.
+      // wait for uartstart() to open up space in the buffer.
+      sleep(&uart_tx_r, &uart_tx_lock);
+    }
+    for(; n > 0 && uart_tx_w < uart_tx_r + UART_TX_BUF_SIZE; n--)
+      uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = *s++;
+    uartstart();
   }
-  uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
-  uart_tx_w += 1;
-  uartstart();
   release(&uart_tx_lock);
 }
 
+// add the n bytes at s to the output buffer without
+// sleeping, for kernel printf() and to echo characters.
+// if the buffer is full, it spins until the UART takes
+// enough of it, so it is safe with interrupts off.
+void
+uartputs(char *s, int n)
+{
+  acquire(&uart_tx_lock);
 
-// alternate version of uartputc() that doesn't 
-// use interrupts, for use by kernel printf() and
-// to echo characters. it spins waiting for the uart's
-// output register to be empty.
+  if(panicked){
+    for(;;)
+      ;
+  }
+  for(; n > 0; n--){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE)
+      uartstart();
+    uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = *s++;
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// alternate version of uartputs() that doesn't 
+// use the buffer or its lock, for panic(). it first
+// sends what is still buffered, then c, spinning
+// waiting for the uart's output register to be empty.
 void
 uartputc_sync(int c)
 {
@@ -118,6 +144,12 @@ uartputc_sync(int c)
       ;
   }
 
+  while(uart_tx_r != uart_tx_w){
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    WriteReg(THR, uart_tx_buf[uart_tx_r++ % UART_TX_BUF_SIZE]);
+  }
+
   // wait for Transmit Holding Empty to be set in LSR.
   while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
     ;
@@ -126,34 +158,31 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, fill its FIFO with them.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
-    uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
+  int i;
+
+  if(uart_tx_w == uart_tx_r){
+    // transmit buffer is empty.
+    return;
+  }
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART transmit FIFO is not empty yet.
+    // it will interrupt when it's ready for more.
+    return;
   }
+
+  for(i = 0; i < TX_FIFO && uart_tx_r != uart_tx_w; i++)
+    WriteReg(THR, uart_tx_buf[uart_tx_r++ % UART_TX_BUF_SIZE]);
+
+  // maybe uartwrite() is waiting for space in the buffer.
+  wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
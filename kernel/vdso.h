@@ -0,0 +1,10 @@
+#pragma once
+
+// The page mapped read-only at VDSO in every process, for
+// what user code may read without a system call; see
+// vdsoinit() in vm.c and clockns() in user/ulib.c.
+struct vdso {
+  uint64 timehz;      // ticks per second of the time CSR
+  uint64 nspertime;   // nanoseconds per tick of it
+  uint ticks;         // uptime() as of the last timer interrupt
+};
@@ -33,6 +33,11 @@
 #define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
 #define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
 #define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration
+
+// virtio-blk configuration, from the spec, as offsets from
+// VIRTIO_MMIO_CONFIG.
+#define VIRTIO_BLK_CONFIG_NUM_QUEUES	34 // uint16, with VIRTIO_BLK_F_MQ
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -51,7 +56,10 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 64
+
+// most data descriptors (blocks) in one request.
+#define MAXSEG 16
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -68,7 +76,7 @@ struct virtq_avail {
   uint16 flags; // always zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with EVENT_IDX: interrupt when used idx passes this
 };
 
 // one entry in the "used" ring, with which the
@@ -82,8 +90,15 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with EVENT_IDX: notify when avail idx passes this
 };
 
+// with EVENT_IDX, should moving an index from old to new
+// tell the other side, which asked to hear when it passes
+// event? from the spec.
+#define VRING_NEED_EVENT(event, new, old) \
+  ((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
+
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
 
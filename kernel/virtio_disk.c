@@ -1,8 +1,11 @@
 //
-// driver for qemu's virtio disk device.
+// driver for qemu's virtio disk devices.
 // uses qemu's mmio interface to virtio.
 //
-// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0,num-queues=N
+//
+// there may be up to NDISK disks, on buses 0, 1, ...; disk n
+// is device number n+1, so that b->dev picks the disk.
 //
 
 #include "types.h"
@@ -14,11 +17,26 @@
 #include "sleeplock.h"
 #include "buf.h"
 #include "virtio.h"
+#include "stats.h"
+#include "trace.h"
+
+// the address of virtio mmio register r of disk d.
+#define R(d, r) ((volatile uint32 *)(VIRTIO((d)->n) + (r)))
+
+// A disk has a virtqueue per CPU, or as many as the device
+// offers if that is fewer (VIRTIO_BLK_F_MQ); a CPU submits
+// on queue cpuid() % nvq. Each queue has its own lock and
+// descriptors, so that CPUs doing I/O do not take each
+// other's locks. The device has one interrupt for all of its
+// queues, and virtio_disk_intr() takes every request the
+// device has finished off each of them. With
+// VIRTIO_RING_F_EVENT_IDX, the driver tells the device only
+// about requests it has not already seen, and the device
+// interrupts only for the first completion the driver has
+// not seen yet, not for every one.
+struct vq {
+  struct spinlock lock;
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
-
-static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -45,119 +63,181 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
     char status;
+    char write;
+    int nblk;
+    uint64 start;   // r_time() at submit, for the latency counters
   } info[NUM];
 
+  // the buf whose data a descriptor points to, if any.
+  // a request may carry several bufs.
+  struct buf *bufs[NUM];
+
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
-  struct spinlock vdisk_lock;
-  
-} disk;
+};
 
-void
-virtio_disk_init(void)
+static struct disk {
+  struct vq vq[NCPU];
+  int nvq;       // queues in use
+  int eventidx;  // negotiated VIRTIO_RING_F_EVENT_IDX?
+
+  int n;        // which mmio interface
+  int present;  // did virtio_disk_init() find a disk there?
+} disk[NDISK];
+
+// Set up queue i of disk d.
+static void
+vq_init(struct disk *d, int i)
+{
+  struct vq *q = &d->vq[i];
+
+  initlock(&q->lock, "virtio_disk");
+  *R(d, VIRTIO_MMIO_QUEUE_SEL) = i;
+
+  // ensure the queue is not in use.
+  if(*R(d, VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio disk should not be ready");
+
+  // check maximum queue size.
+  uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+    panic("virtio disk has no queue");
+  if(max < NUM)
+    panic("virtio disk max queue too short");
+
+  // allocate and zero queue memory.
+  q->desc = kalloc();
+  q->avail = kalloc();
+  q->used = kalloc();
+  if(!q->desc || !q->avail || !q->used)
+    panic("virtio disk kalloc");
+  memset(q->desc, 0, PGSIZE);
+  memset(q->avail, 0, PGSIZE);
+  memset(q->used, 0, PGSIZE);
+
+  // set queue size.
+  *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+
+  // write physical addresses.
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)q->desc;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)q->desc >> 32;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)q->avail;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)q->avail >> 32;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)q->used;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)q->used >> 32;
+
+  // queue is ready.
+  *R(d, VIRTIO_MMIO_QUEUE_READY) = 0x1;
+
+  // all NUM descriptors start out unused.
+  for(int j = 0; j < NUM; j++)
+    q->free[j] = 1;
+}
+
+// Set up disk n, if qemu has one there.
+// Returns 0, or -1 if there is none.
+static int
+disk_init(struct disk *d, int n)
 {
   uint32 status = 0;
+  int i;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  d->n = n;
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 2 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(d, VIRTIO_MMIO_VERSION) != 2 ||
+     *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    return -1;
   }
-  
+
   // reset device
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set ACKNOWLEDGE status bit
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set DRIVER status bit
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // re-read status to ensure FEATURES_OK is set.
-  status = *R(VIRTIO_MMIO_STATUS);
+  status = *R(d, VIRTIO_MMIO_STATUS);
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-
-  // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
-    panic("virtio disk should not be ready");
-
-  // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
-    panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
+  // a queue per CPU, if the device has that many.
+  d->nvq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ)){
+    d->nvq = *(volatile uint16 *)(VIRTIO(n) + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUM_QUEUES);
+    if(d->nvq > NCPU)
+      d->nvq = NCPU;
+    if(d->nvq < 1)
+      d->nvq = 1;
+  }
+  d->eventidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+  for(i = 0; i < d->nvq; i++)
+    vq_init(d, i);
 
-  // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  // tell device we're completely ready.
+  status |= VIRTIO_CONFIG_S_DRIVER_OK;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
-  // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
+  // plic.c and trap.c arrange for interrupts from VIRTIO_IRQ(n).
+  d->present = 1;
+  return 0;
+}
 
-  // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+void
+virtio_disk_init(void)
+{
+  int n;
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+  for(n = 0; n < NDISK; n++){
+    if(disk_init(&disk[n], n) < 0 && n == 0)
+      panic("could not find virtio disk");
+  }
+}
 
-  // tell device we're completely ready.
-  status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+// The disk that holds device dev's blocks.
+static struct disk*
+devdisk(uint dev)
+{
+  if(dev < 1 || dev > NDISK || !disk[dev-1].present)
+    panic("virtio_disk: no such disk");
+  return &disk[dev-1];
+}
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+// Is there a disk for device dev?
+int
+virtio_disk_present(uint dev)
+{
+  return dev >= 1 && dev <= NDISK && disk[dev-1].present;
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *q)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -166,28 +246,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *q, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
+  wakeup(&q->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -195,46 +275,50 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(struct vq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Queue one request for n <= MAXSEG bufs holding
+// consecutive blocks on queue q of d. Caller holds q->lock.
+static void
+submit_locked(struct disk *d, struct vq *q, struct buf **bufs, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = bufs[0]->blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // data, one for a 1-byte status result. the data may be split
+  // over several descriptors, one per buf.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[MAXSEG+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(q, idx, n+2) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    // make sure the device knows about requests queued
+    // so far, since only their completion frees descriptors.
+    *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = q - d->vq;
+    statinc(ST_DNOTIFY);
+    sleep(&q->free[0], &q->lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -243,84 +327,192 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  q->desc[idx[0]].next = idx[1];
+
+  for(int i = 1; i <= n; i++){
+    struct buf *b = bufs[i-1];
+    q->desc[idx[i]].addr = (uint64) b->data;
+    q->desc[idx[i]].len = BSIZE;
+    if(write)
+      q->desc[idx[i]].flags = 0; // device reads b->data
+    else
+      q->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    q->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    q->desc[idx[i]].next = idx[i+1];
+
+    // record struct buf for virtio_disk_intr().
+    b->disk = 1;
+    b->vq = q - d->vq;
+    q->bufs[idx[i]] = b;
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  q->info[idx[0]].status = 0xff; // device writes 0 on success
+  q->info[idx[0]].write = write;
+  q->info[idx[0]].nblk = n;
+  q->info[idx[0]].start = r_time();
+  trace(TR_DSUBMIT, (uint64)bufs[0]->dev << 32 | write,
+        (uint64)bufs[0]->blockno << 16 | n);
+  q->desc[idx[n+1]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[n+1]].len = 1;
+  q->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  q->desc[idx[n+1]].next = 0;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  q->avail->ring[q->avail->idx % NUM] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  q->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
-
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// Queue requests to read or write the n bufs, which hold
+// consecutive blocks of one device, and return without
+// waiting for them.
+// The bufs go to the device in as few requests as MAXSEG
+// allows. virtio_disk_intr() clears b->disk and wakes up b
+// when b's request is done; each b stays locked by the
+// caller until then.
+void
+virtio_disk_submitv(struct buf **bufs, int n, int write)
+{
+  struct disk *d = devdisk(bufs[0]->dev);
+  struct vq *q;
+  uint16 old;
+  int m;
+
+  push_off();
+  q = &d->vq[cpuid() % d->nvq];
+  pop_off();
+
+  acquire(&q->lock);
+  old = q->avail->idx;
+  for(; n > 0; bufs += m, n -= m){
+    m = n < MAXSEG ? n : MAXSEG;
+    submit_locked(d, q, bufs, m, write);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  // with EVENT_IDX, the device says when it wants to hear of
+  // new requests; until then it is still working through the
+  // ring and will find these.
+  if(!d->eventidx || VRING_NEED_EVENT(q->used->avail_event, q->avail->idx, old)){
+    *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = q - d->vq; // value is queue number
+    statinc(ST_DNOTIFY);
+  }
 
-  release(&disk.vdisk_lock);
+  release(&q->lock);
 }
 
+// Queue a request to read or write b; see virtio_disk_submitv().
 void
-virtio_disk_intr()
+virtio_disk_submit(struct buf *b, int write)
 {
-  acquire(&disk.vdisk_lock);
+  virtio_disk_submitv(&b, 1, write);
+}
 
-  // the device won't raise another interrupt until we tell it
-  // we've seen this interrupt, which the following line does.
-  // this may race with the device writing new entries to
-  // the "used" ring, in which case we may process the new
-  // completion entries in this interrupt, and have nothing to do
-  // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+// Wait for a request queued by virtio_disk_submit() to finish.
+// A buf that is not in flight has nothing to wait for.
+void
+virtio_disk_wait(struct buf *b)
+{
+  struct disk *d;
+  struct vq *q;
+
+  if(b->disk == 0)
+    return;
+  d = devdisk(b->dev);
+  q = &d->vq[b->vq];
+  acquire(&q->lock);
+  while(b->disk == 1) {
+    sleep(b, &q->lock);
+  }
+  release(&q->lock);
+}
 
-  __sync_synchronize();
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write);
+  virtio_disk_wait(b);
+}
 
-  // the device increments disk.used->idx when it
+// Finish the requests that the device has put on q's used
+// ring. Caller holds q->lock.
+static void
+vq_done(struct disk *d, struct vq *q)
+{
+  // the device increments q->used->idx when it
   // adds an entry to the used ring.
 
-  while(disk.used_idx != disk.used->idx){
+  while(q->used_idx != q->used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = q->used->ring[q->used_idx % NUM].id;
 
-    if(disk.info[id].status != 0)
+    if(q->info[id].status != 0)
       panic("virtio_disk_intr status");
+    if(q->info[id].write){
+      statinc(ST_DWRITE);
+      statadd(ST_DWRITEBLK, q->info[id].nblk);
+      statadd(ST_DWRITETIME, r_time() - q->info[id].start);
+    } else {
+      statinc(ST_DREAD);
+      statadd(ST_DREADBLK, q->info[id].nblk);
+      statadd(ST_DREADTIME, r_time() - q->info[id].start);
+    }
+    trace(TR_DDONE, (uint64)q->bufs[q->desc[id].next]->dev << 32 | q->info[id].write,
+          r_time() - q->info[id].start);
+
+    for(int i = id; ; i = q->desc[i].next){
+      struct buf *b = q->bufs[i];
+      if(b){
+        q->bufs[i] = 0;
+        b->disk = 0;   // disk is done with buf
+        wakeup(b);
+      }
+      if(!(q->desc[i].flags & VRING_DESC_F_NEXT))
+        break;
+    }
+    free_chain(q, id);
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    q->used_idx += 1;
 
-    disk.used_idx += 1;
+    if(d->eventidx && q->used_idx == q->used->idx){
+      // interrupt for the next completion only. one that came
+      // before the device saw this would not interrupt, so
+      // look once more.
+      q->avail->used_event = q->used_idx;
+      __sync_synchronize();
+    }
   }
+}
+
+void
+virtio_disk_intr(int n)
+{
+  struct disk *d = &disk[n];
+  struct vq *q;
+
+  statinc(ST_DINTR);
+
+  // the device won't raise another interrupt until we tell it
+  // we've seen this interrupt, which the following line does.
+  // this may race with the device writing new entries to
+  // the "used" rings, in which case we may process the new
+  // completion entries in this interrupt, and have nothing to do
+  // in the next interrupt, which is harmless.
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
-  release(&disk.vdisk_lock);
+  __sync_synchronize();
+
+  // the interrupt does not say which queue; look at them all.
+  for(q = d->vq; q < d->vq + d->nvq; q++){
+    acquire(&q->lock);
+    vq_done(d, q);
+    release(&q->lock);
+  }
 }
@@ -4,6 +4,10 @@
 #include "elf.h"
 #include "riscv.h"
 #include "defs.h"
+#include "proc.h"
+#include "xv6_fcntl.h"
+#include "vdso.h"
+#include "stats.h"
 
 /*
  * the kernel's page table.
@@ -26,12 +30,15 @@ kvmmake(void)
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
-  // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  // virtio mmio disk interfaces
+  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, NDISK*PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT timer compare registers, for timerarm().
+  kvmmap(kpgtbl, CLINT_MTIMECMP(0), CLINT_MTIMECMP(0), PGSIZE, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -55,6 +62,19 @@ kvminit(void)
   kernel_pagetable = kvmmake();
 }
 
+struct vdso *vdsopage;
+
+// Make the page that proc_pagetable() maps at VDSO.
+void
+vdsoinit(void)
+{
+  if((vdsopage = (struct vdso*)kalloc()) == 0)
+    panic("vdsoinit");
+  memset(vdsopage, 0, PGSIZE);
+  vdsopage->timehz = TIMEHZ;
+  vdsopage->nspertime = 1000000000 / TIMEHZ;
+}
+
 // Switch h/w page table register to the kernel's page table,
 // and enable paging.
 void
@@ -83,22 +103,31 @@ kvminithart()
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// Like walk(), but return the address of the PTE at level
+// (2, 1 or 0) instead of the level-0 one.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int lvl, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > lvl; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        panic("walk: megapage");
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(lvl, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -127,11 +156,33 @@ walkaddr(pagetable_t pagetable, uint64 va)
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// each MPGSIZE-aligned stretch of it is mapped with one
+// level-1 leaf, a megapage, so that most of the direct
+// map takes a TLB entry per 2MB; the rest in pages.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+  pte_t *pte;
+
+  while(sz > 0){
+    if(va % MPGSIZE == 0 && pa % MPGSIZE == 0 && sz >= MPGSIZE){
+      if((pte = walklevel(kpgtbl, va, 1, 1)) == 0 || (*pte & PTE_V))
+        panic("kvmmap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      n = MPGSIZE;
+    } else {
+      // pages up to the next megapage boundary.
+      n = MPGSIZE - va % MPGSIZE;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -164,7 +215,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that are not mapped, such as those of
+// the program image that were never touched, are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -176,10 +228,8 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -196,10 +246,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -232,12 +281,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -247,6 +295,31 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Map a page of zeros at user address va of pagetable, which
+// lies in the heap but was never touched: sbrk() only moves
+// p->sz. Called by vmfault(). Returns the physical address of
+// the page, or 0 if it is mapped already or memory is short.
+uint64
+uvmlazy(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  // a valid PTE here is a page that may not be used,
+  // like the stack guard page.
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return 0;
+  if((mem = kzalloc()) == 0)
+    return 0;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return 0;
+  }
+  statinc(ST_LAZY);
+  return (uint64)mem;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -297,8 +370,10 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// The pages are not copied but shared: writable ones become
+// read-only and copy-on-write in both, so that the first
+// store to one makes a copy (see uvmcow()). Pages that are
+// not mapped stay so.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -307,20 +382,17 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    kdup((void*)pa);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0){
+      kfree((void*)pa);
       goto err;
     }
   }
@@ -331,6 +403,38 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Handle a store to user page va of pagetable that fork()
+// left copy-on-write: give the process a copy of the page,
+// or the page itself if nobody else uses it any more.
+// The caller must see that the TLB is flushed, as the
+// return to user space does.
+// Returns the physical address of the page, or 0 if it is
+// not a copy-on-write page or memory is short.
+uint64
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return 0;
+  pa = PTE2PA(*pte);
+  if(krefs((void*)pa) > 1){
+    if((mem = kalloc()) == 0)
+      return 0;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | PTE_FLAGS(*pte);
+    kfree((void*)pa);
+    pa = (uint64)mem;
+  }
+  *pte = (*pte & ~PTE_COW) | PTE_W;
+  return pa;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -344,18 +448,69 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
-// Copy from kernel to user.
-// Copy len bytes from src to virtual address dstva in a given page table.
+// The physical address of user page va0 of pagetable, for
+// a store if write is set: faults the page in, or copies it
+// if it is copy-on-write. Returns 0 if it cannot be used.
+static uint64
+uvmpage(pagetable_t pagetable, uint64 va0, int write)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va0 >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va0, 0);
+  if(write){
+    if(pte && (*pte & (PTE_V|PTE_U|PTE_W)) == (PTE_V|PTE_U|PTE_W))
+      return PTE2PA(*pte);
+    if((pa = uvmcow(pagetable, va0)) != 0)
+      return pa;
+    return vmfault(pagetable, va0, PROT_WRITE);
+  }
+  if(pte && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U))
+    return PTE2PA(*pte);
+  return vmfault(pagetable, va0, PROT_READ);
+}
+
+// Start cursor uc over memory of pagetable, or over kernel
+// memory if pagetable is 0.
+void
+ucinit(struct ucursor *uc, pagetable_t pagetable)
+{
+  uc->pagetable = pagetable;
+  uc->va = 1;
+  uc->write = 0;
+}
+
+// The physical address of user page va0 through uc, or 0.
+static uint64
+ucpage(struct ucursor *uc, uint64 va0, int write)
+{
+  if(uc->va != va0 || (write && !uc->write)){
+    if((uc->pa = uvmpage(uc->pagetable, va0, write)) == 0){
+      uc->va = 1;
+      return 0;
+    }
+    uc->va = va0;
+    uc->write = write;
+  }
+  return uc->pa;
+}
+
+// Copy len bytes from src to address dstva of cursor uc.
 // Return 0 on success, -1 on error.
 int
-copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+copyoutc(struct ucursor *uc, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uc->pagetable == 0){
+    memmove((void *)dstva, src, len);
+    return 0;
+  }
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = ucpage(uc, va0, 1)) == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
@@ -369,18 +524,20 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   return 0;
 }
 
-// Copy from user to kernel.
-// Copy len bytes to dst from virtual address srcva in a given page table.
+// Copy len bytes to dst from address srcva of cursor uc.
 // Return 0 on success, -1 on error.
 int
-copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+copyinc(struct ucursor *uc, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uc->pagetable == 0){
+    memmove(dst, (void *)srcva, len);
+    return 0;
+  }
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = ucpage(uc, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -394,6 +551,30 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Copy from kernel to user.
+// Copy len bytes from src to virtual address dstva in a given page table.
+// Return 0 on success, -1 on error.
+int
+copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  struct ucursor uc;
+
+  ucinit(&uc, pagetable);
+  return copyoutc(&uc, dstva, src, len);
+}
+
+// Copy from user to kernel.
+// Copy len bytes to dst from virtual address srcva in a given page table.
+// Return 0 on success, -1 on error.
+int
+copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  struct ucursor uc;
+
+  ucinit(&uc, pagetable);
+  return copyinc(&uc, dst, srcva, len);
+}
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -406,14 +587,29 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmpage(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
+    // a word at a time while no byte of it is 0, if p and dst
+    // can both be aligned.
+    if((((uint64)p ^ (uint64)dst) & 7) == 0){
+      while(n > 0 && ((uint64)p & 7) != 0 && *p != '\0'){
+        *dst++ = *p++;
+        --n;
+        --max;
+      }
+      while(n >= 8 && !HASZERO(*(uint64*)p)){
+        *(uint64*)dst = *(uint64*)p;
+        n -= 8;
+        max -= 8;
+        p += 8;
+        dst += 8;
+      }
+    }
     while(n > 0){
       if(*p == '\0'){
         *dst = '\0';
@@ -20,27 +20,42 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
+//
+// The image is built in memory and written with one write()
+// at the end; the unused tail of the disk is left as a hole.
+// Each file's data blocks are one contiguous run.
+
+uint fssize = FSSIZE * 1024 / BSIZE;  // -s: size of the image in blocks
+uint ninodes = NINODES; // -i: number of inodes
+int nbitmap;
+int ninodeblocks;
 int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
 struct xv6fs_super_block sb;
-char zeroes[BSIZE];
+char *img;    // the image, fssize blocks
 uint freeinode = 1;
 uint freeblock;
 
+// -x: lay out the root directory hashed (see struct dxroot).
+// It is built in dirimg and written out last.
+#define MAXDIR (NDIRECT + NINDIRECT)
+int dxroot;
+char dirimg[MAXDIR][BSIZE];
+uint dirblocks;
+
 
 void balloc(int);
-void wsect(uint, void*);
+char *sect(uint);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void iwrite(uint inum, char *p, uint n);
+void diradd(uint dirino, struct xv6fs_dentry *de);
+void wimage(void);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,17 +84,29 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, fd;
   uint rootino, inum, off;
   struct xv6fs_dentry de;
-  char buf[BSIZE];
   struct dinode din;
+  off_t size;
+  char *data;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(; argc > 1 && argv[1][0] == '-'; argv++, argc--){
+    if(strcmp(argv[1], "-x") == 0)
+      dxroot = 1;
+    else if(strcmp(argv[1], "-s") == 0 && argc > 2)
+      fssize = atoi(argv[2]), argv++, argc--;
+    else if(strcmp(argv[1], "-i") == 0 && argc > 2)
+      ninodes = atoi(argv[2]), argv++, argc--;
+    else
+      break;
+  }
+
+  if(argc < 2 || argv[1][0] == '-'){
+    fprintf(stderr, "Usage: mkfs [-x] [-s blocks] [-i inodes] fs.img files...\n");
     exit(1);
   }
 
@@ -91,42 +118,53 @@ main(int argc, char *argv[])
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
+  nbitmap = fssize/(BSIZE*8) + 1;
+  ninodeblocks = ninodes / IPB + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  if(fssize <= nmeta || ninodes < 2){
+    fprintf(stderr, "mkfs: %u blocks or %u inodes is too small\n", fssize, ninodes);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
+  if((img = calloc(fssize, BSIZE)) == 0)
+    die("calloc");
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
+  sb.orphan = xint(0);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
-  memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(sect(1), &sb, sizeof(sb));
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
+  if(dxroot){
+    struct dxroot *r = (struct dxroot*)dirimg[0];
+    memmove(r->magic.name, DXMAGIC, sizeof(DXMAGIC));
+    dirblocks = 1;
+  }
+
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  diradd(rootino, &de);
 
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  diradd(rootino, &de);
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -140,6 +178,8 @@ main(int argc, char *argv[])
 
     if((fd = open(argv[i], 0)) < 0)
       die(argv[i]);
+    if((size = lseek(fd, 0, SEEK_END)) < 0 || lseek(fd, 0, SEEK_SET) != 0)
+      die(argv[i]);
 
     // Skip leading _ in name when writing to file system.
     // The binaries are named _rm, _cat, etc. to keep the
@@ -153,77 +193,100 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    diradd(rootino, &de);
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    if((data = malloc(size + 1)) == 0)
+      die("malloc");
+    if(read(fd, data, size) != size)
+      die(argv[i]);
+    iwrite(inum, data, size);
+    free(data);
 
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(dxroot){
+    iappend(rootino, dirimg, dirblocks * BSIZE);
+  } else {
+    // fix size of root inode dir
+    rinode(rootino, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
+  // the free space summary, so that the kernel need not
+  // count the free blocks and inodes when it mounts this.
+  sb.nfree = xint(fssize - freeblock);
+  sb.nifree = xint(ninodes - freeinode);
+  sb.bcursor = xint(freeblock);
+  sb.icursor = xint(freeinode);
+  sb.summary = xint(FSSUMMARY);
+  memmove(sect(1), &sb, sizeof(sb));
+  wimage();
+
   exit(0);
 }
 
+// Block sec of the image.
+char*
+sect(uint sec)
+{
+  if(sec >= fssize){
+    fprintf(stderr, "mkfs: out of blocks; try a bigger -s\n");
+    exit(1);
+  }
+  return img + (size_t)sec * BSIZE;
+}
+
+// Write the image to fsfd: the blocks in use in one write(),
+// and the free ones as a hole.
 void
-wsect(uint sec, void *buf)
+wimage(void)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(write(fsfd, buf, BSIZE) != BSIZE)
-    die("write");
+  size_t n, off;
+  ssize_t r;
+
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0)
+    die("ftruncate");
+  n = (size_t)freeblock * BSIZE;
+  for(off = 0; off < n; off += r)
+    if((r = write(fsfd, img + off, n - off)) <= 0)
+      die("write");
 }
 
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  uint bn;
   struct dinode *dip;
 
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)sect(IBLOCK(inum, sb))) + (inum % IPB);
   *dip = *ip;
-  wsect(bn, buf);
 }
 
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  uint bn;
   struct dinode *dip;
 
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)sect(IBLOCK(inum, sb))) + (inum % IPB);
   *ip = *dip;
 }
 
-void
-rsect(uint sec, void *buf)
-{
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(read(fsfd, buf, BSIZE) != BSIZE)
-    die("read");
-}
-
 uint
 ialloc(ushort type)
 {
   uint inum = freeinode++;
   struct dinode din;
 
+  if(inum >= ninodes){
+    fprintf(stderr, "mkfs: out of inodes; try a bigger -i\n");
+    exit(1);
+  }
+
   bzero(&din, sizeof(din));
   din.type = xshort(type);
   din.nlink = xshort(1);
@@ -235,57 +298,68 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar *bm;
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
+  assert(used <= nbitmap*BSIZE*8);
+  // the bitmap blocks are consecutive in img.
+  bm = (uchar*)sect(xint(sb.bmapstart));
   for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    bm[i/8] = bm[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  printf("balloc: wrote bitmap blocks from sector %d\n", xint(sb.bmapstart));
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// The indirect block whose number is in *ind, allocating it
+// if that is 0. The image starts out zeroed, so a new block
+// reads as empty.
+uint*
+indblock(uint *ind)
+{
+  if(xint(*ind) == 0)
+    *ind = xint(freeblock++);
+  return (uint*)sect(xint(*ind));
+}
+
+// The entry that holds the number of block fbn of din,
+// allocating the indirect blocks on the way to it.
+uint*
+bslot(struct dinode *din, uint fbn)
+{
+  uint *a;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT)
+    return &din->addrs[fbn];
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT)
+    return &indblock(&din->addrs[NDIRECT])[fbn];
+  fbn -= NINDIRECT;
+  a = indblock(&din->addrs[NDIRECT+1]);
+  return &indblock(&a[fbn / NINDIRECT])[fbn % NINDIRECT];
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint *slot;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    slot = bslot(&din, fbn);
+    if(xint(*slot) == 0)
+      *slot = xint(freeblock++);
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    bcopy(p, sect(xint(*slot)) + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
@@ -294,6 +368,84 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Make the n bytes at p the contents of the empty file inum.
+// A file of up to INLINESIZE bytes lives in its inode.
+// Otherwise the data blocks are one contiguous run, and the
+// indirect blocks come after it, so that the kernel reads
+// the file ahead in few requests.
+void
+iwrite(uint inum, char *p, uint n)
+{
+  struct dinode din;
+  uint fbn, nb, first;
+
+  rinode(inum, &din);
+  assert(xint(din.size) == 0);
+  if(n <= INLINESIZE){
+    din.major = xshort(DI_INLINE);
+    memmove(din.addrs, p, n);
+    din.size = xint(n);
+    winode(inum, &din);
+    return;
+  }
+  nb = (n + BSIZE - 1) / BSIZE;
+  first = freeblock;
+  freeblock += nb;
+  if(nb > 0){
+    sect(freeblock - 1);  // check that the run fits
+    memmove(sect(first), p, n);
+  }
+  for(fbn = 0; fbn < nb; fbn++)
+    *bslot(&din, fbn) = xint(first + fbn);
+  din.size = xint(n);
+  winode(inum, &din);
+}
+
+// Add de to directory dirino; with -x, to the hashed
+// image of the root directory.
+void
+diradd(uint dirino, struct xv6fs_dentry *de)
+{
+  struct dxroot *r = (struct dxroot*)dirimg[0];
+  struct xv6fs_dentry *leaf;
+  struct dxtail *t;
+  ushort *link;
+  uint fb;
+  int i;
+
+  if(!dxroot){
+    iappend(dirino, de, sizeof(*de));
+    return;
+  }
+
+  if(strcmp(de->name, ".") == 0){
+    r->dot = *de;
+    return;
+  }
+  if(strcmp(de->name, "..") == 0){
+    r->dotdot = *de;
+    return;
+  }
+
+  link = &r->leaf[dxhash(de->name)];
+  while((fb = xshort(*link)) != 0){
+    leaf = (struct xv6fs_dentry*)dirimg[fb];
+    for(i = 0; i < NDXLEAF; i++){
+      if(leaf[i].inum == 0){
+        leaf[i] = *de;
+        return;
+      }
+    }
+    t = (struct dxtail*)&leaf[NDXLEAF];
+    link = &t->next;
+  }
+
+  assert(dirblocks < MAXDIR);
+  fb = dirblocks++;
+  *link = xshort(fb);
+  ((struct xv6fs_dentry*)dirimg[fb])[0] = *de;
+}
+
 void
 die(const char *s)
 {
@@ -0,0 +1,45 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/xv6_fcntl.h"
+
+// dmesg: print the kernel log.
+// dmesg subsystem|all level: set what it records.
+int
+main(int argc, char *argv[])
+{
+  char buf[512];
+  int fd, n;
+
+  if(argc != 1 && argc != 3){
+    fprintf(2, "Usage: dmesg [subsystem|all level]\n");
+    exit(1);
+  }
+
+  if(argc == 3){
+    if((fd = open("/klog", O_WRONLY)) < 0){
+      fprintf(2, "dmesg: cannot open /klog\n");
+      exit(1);
+    }
+    n = strlen(argv[1]);
+    memmove(buf, argv[1], n);
+    buf[n++] = ' ';
+    memmove(buf + n, argv[2], strlen(argv[2]));
+    n += strlen(argv[2]);
+    if(n > 30 || write(fd, buf, n) != n){
+      fprintf(2, "dmesg: cannot set %s to %s\n", argv[1], argv[2]);
+      exit(1);
+    }
+    close(fd);
+    exit(0);
+  }
+
+  if((fd = open("/klog", O_RDONLY)) < 0){
+    fprintf(2, "dmesg: cannot open /klog\n");
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    write(1, buf, n);
+  close(fd);
+  exit(0);
+}
@@ -0,0 +1,415 @@
+// fsbench: file system microbenchmarks.
+//
+//   fsbench [-p maxprocs] [test ...]
+//
+// Runs each test (all of them if none are named) with 1, 2,
+// ... maxprocs processes at once (NCPU by default), each on
+// files of its own in the current directory, and prints a
+// line per run:
+//
+//   test procs size ops ns ticks rate unit
+//
+// size is what the test was run with (the I/O size, the
+// path depth, the directory size), ops the operations of all
+// processes together, ns the clockns() from their start to the
+// last one's end, ticks the same in uptime(), and rate the
+// ops, or KB, per second.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/xv6_fcntl.h"
+
+#define FILESIZE (256*1024)  // bytes each process writes or reads
+#define NRAND    1000        // random reads per process
+#define NCREATE  50          // files each process creates and removes
+#define DEPTH    8           // directories in the deep path
+#define NOPEN    500         // opens of it per process
+#define NLIST    64          // entries in the listed directory
+#define NLISTING 50          // listings per process
+#define NEXEC    20          // execs per process
+#define PIPESIZE (512*1024)  // bytes through each process's pipe
+
+struct result {
+  uint64 ops;
+  uint64 bytes;   // moved, for the tests that give KB/s
+  uint64 end;     // clockns() when done
+};
+
+struct test {
+  char *name;
+  void (*run)(int, int, struct result*);
+  int sizes[4];   // 0-terminated; runs once with 0 if none
+};
+
+static char buf[65536];
+static int readyfd[2], gofd[2];
+
+// Called by a test when it is set up: wait for the others.
+static void
+start(void)
+{
+  char c = 0;
+
+  write(readyfd[1], &c, 1);
+  if(read(gofd[0], &c, 1) != 1){
+    fprintf(2, "fsbench: lost the start\n");
+    exit(1);
+  }
+}
+
+static void
+fail(char *what, char *name)
+{
+  fprintf(2, "fsbench: %s %s failed\n", what, name);
+  exit(1);
+}
+
+// Append n in decimal to s.
+static void
+addnum(char *s, int n)
+{
+  char num[12];
+  int i;
+
+  i = 0;
+  do {
+    num[i++] = '0' + n % 10;
+    n /= 10;
+  } while(n);
+  s += strlen(s);
+  while(i > 0)
+    *s++ = num[--i];
+  *s = 0;
+}
+
+// name = prefix, id and, if i >= 0, "." and i.
+static void
+mkname(char *name, char *prefix, int id, int i)
+{
+  strcpy(name, prefix);
+  addnum(name, id);
+  if(i >= 0){
+    strcpy(name + strlen(name), ".");
+    addnum(name, i);
+  }
+}
+
+static void
+mkfile(char *name, int size)
+{
+  int fd, n, m;
+
+  if((fd = open(name, O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+    fail("create", name);
+  memset(buf, 'f', sizeof(buf));
+  for(n = 0; n < size; n += m){
+    m = size - n < sizeof(buf) ? size - n : sizeof(buf);
+    if(write(fd, buf, m) != m)
+      fail("write", name);
+  }
+  close(fd);
+}
+
+static void
+seqwrite(int id, int size, struct result *r)
+{
+  char name[32];
+  int fd, n;
+
+  mkname(name, "fsbw", id, -1);
+  start();
+  if((fd = open(name, O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+    fail("create", name);
+  for(n = 0; n < FILESIZE; n += size){
+    if(write(fd, buf, size) != size)
+      fail("write", name);
+    r->ops++;
+  }
+  fsync(fd);
+  close(fd);
+  r->end = clockns();
+  r->bytes = FILESIZE;
+  unlink(name);
+}
+
+static void
+seqread(int id, int size, struct result *r)
+{
+  char name[32];
+  int fd, n;
+
+  mkname(name, "fsbr", id, -1);
+  mkfile(name, FILESIZE);
+  start();
+  if((fd = open(name, O_RDONLY)) < 0)
+    fail("open", name);
+  while((n = read(fd, buf, size)) > 0){
+    r->bytes += n;
+    r->ops++;
+  }
+  close(fd);
+  r->end = clockns();
+  unlink(name);
+}
+
+static void
+randread(int id, int size, struct result *r)
+{
+  char name[32];
+  uint x;
+  int fd, i;
+
+  mkname(name, "fsbx", id, -1);
+  mkfile(name, FILESIZE);
+  x = id * 2654435761u + 1;
+  start();
+  if((fd = open(name, O_RDONLY)) < 0)
+    fail("open", name);
+  for(i = 0; i < NRAND; i++){
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    if(pread(fd, buf, size, (x % (FILESIZE / size)) * size) != size)
+      fail("pread", name);
+    r->bytes += size;
+    r->ops++;
+  }
+  close(fd);
+  r->end = clockns();
+  unlink(name);
+}
+
+static void
+createunlink(int id, int size, struct result *r)
+{
+  char name[32];
+  int fd, i;
+
+  start();
+  for(i = 0; i < NCREATE; i++){
+    mkname(name, "fsbc", id, i);
+    if((fd = open(name, O_CREATE|O_WRONLY)) < 0)
+      fail("create", name);
+    close(fd);
+  }
+  for(i = 0; i < NCREATE; i++){
+    mkname(name, "fsbc", id, i);
+    if(unlink(name) < 0)
+      fail("unlink", name);
+  }
+  r->end = clockns();
+  r->ops = 2*NCREATE;
+}
+
+static void
+deepopen(int id, int size, struct result *r)
+{
+  char path[MAXPATH];
+  int fd, i, n;
+
+  mkname(path, "fsbd", id, -1);
+  for(i = 0; i < size; i++){
+    mkdir(path);
+    strcpy(path + strlen(path), "/d");
+  }
+  mkfile(path, 0);
+  start();
+  for(i = 0; i < NOPEN; i++){
+    if((fd = open(path, O_RDONLY)) < 0)
+      fail("open", path);
+    close(fd);
+  }
+  r->end = clockns();
+  r->ops = NOPEN;
+  for(i = size; i >= 0; i--){
+    unlink(path);
+    for(n = strlen(path); n > 0 && path[n] != '/'; n--)
+      ;
+    path[n] = 0;
+  }
+}
+
+static void
+listdir(int id, int size, struct result *r)
+{
+  struct dirent de[64];
+  char dir[32], name[64];
+  int fd, i;
+
+  mkname(dir, "fsbl", id, -1);
+  mkdir(dir);
+  for(i = 0; i < size; i++){
+    strcpy(name, dir);
+    mkname(name + strlen(name), "/f", id, i);
+    mkfile(name, 0);
+  }
+  start();
+  for(i = 0; i < NLISTING; i++){
+    if((fd = open(dir, O_RDONLY)) < 0)
+      fail("open", dir);
+    while(getdents(fd, de, sizeof(de)) > 0)
+      ;
+    close(fd);
+  }
+  r->end = clockns();
+  r->ops = NLISTING;
+  for(i = 0; i < size; i++){
+    strcpy(name, dir);
+    mkname(name + strlen(name), "/f", id, i);
+    unlink(name);
+  }
+  unlink(dir);
+}
+
+static void
+execlat(int id, int size, struct result *r)
+{
+  char *argv[] = { "fsbench", "-x", 0 };
+  int i, pid;
+
+  start();
+  for(i = 0; i < NEXEC; i++){
+    if((pid = fork()) < 0)
+      fail("fork", "");
+    if(pid == 0){
+      exec("/fsbench", argv);
+      fail("exec", "/fsbench");
+    }
+    wait(0);
+  }
+  r->end = clockns();
+  r->ops = NEXEC;
+}
+
+static void
+pipethru(int id, int size, struct result *r)
+{
+  int fds[2], n, pid;
+
+  if(pipe(fds) < 0)
+    fail("pipe", "");
+  if((pid = fork()) < 0)
+    fail("fork", "");
+  if(pid == 0){
+    close(fds[1]);
+    while(read(fds[0], buf, sizeof(buf)) > 0)
+      ;
+    exit(0);
+  }
+  close(fds[0]);
+  start();
+  for(n = 0; n < PIPESIZE; n += size){
+    if(write(fds[1], buf, size) != size)
+      fail("write", "pipe");
+    r->ops++;
+  }
+  close(fds[1]);
+  wait(0);
+  r->end = clockns();
+  r->bytes = PIPESIZE;
+}
+
+static struct test tests[] = {
+  { "seqwrite", seqwrite, { 512, 4096, 65536 } },
+  { "seqread", seqread, { 512, 4096, 65536 } },
+  { "randread", randread, { 1024 } },
+  { "create", createunlink, { 0 } },
+  { "deepopen", deepopen, { DEPTH } },
+  { "listdir", listdir, { NLIST } },
+  { "exec", execlat, { 0 } },
+  { "pipe", pipethru, { 4096 } },
+};
+
+// Run t with nproc processes and print the line.
+static void
+runtest(struct test *t, int size, int nproc)
+{
+  struct result r, tot;
+  int resfd[2], i;
+  uint64 t0, ticks0, ns;
+  char c;
+
+  if(pipe(readyfd) < 0 || pipe(gofd) < 0 || pipe(resfd) < 0)
+    fail("pipe", "");
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0)
+      fail("fork", "");
+    if(pid == 0){
+      close(resfd[0]);
+      memset(&r, 0, sizeof(r));
+      t->run(i, size, &r);
+      write(resfd[1], &r, sizeof(r));
+      exit(0);
+    }
+  }
+  close(resfd[1]);
+  for(i = 0; i < nproc; i++)
+    read(readyfd[0], &c, 1);
+  ticks0 = uptime();
+  t0 = clockns();
+  for(i = 0; i < nproc; i++)
+    write(gofd[1], &c, 1);
+
+  memset(&tot, 0, sizeof(tot));
+  for(i = 0; i < nproc; i++){
+    if(read(resfd[0], &r, sizeof(r)) != sizeof(r))
+      fail("run", t->name);
+    tot.ops += r.ops;
+    tot.bytes += r.bytes;
+    if(r.end > tot.end)
+      tot.end = r.end;
+  }
+  ticks0 = uptime() - ticks0;
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  close(resfd[0]);
+  close(readyfd[0]);
+  close(readyfd[1]);
+  close(gofd[0]);
+  close(gofd[1]);
+
+  ns = tot.end > t0 ? tot.end - t0 : 1;
+  printf("%s %d %d %l %l %l ", t->name, nproc, size, tot.ops, ns, ticks0);
+  if(tot.bytes)
+    printf("%l KB/s\n", tot.bytes / 1024 * 1000000000 / ns);
+  else
+    printf("%l ops/s\n", tot.ops * 1000000000 / ns);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct test *t;
+  int maxproc, i, p, j, any;
+
+  if(argc == 2 && strcmp(argv[1], "-x") == 0)
+    exit(0);   // the program execlat() runs
+
+  maxproc = NCPU;
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-p") == 0){
+    maxproc = atoi(argv[2]);
+    i = 3;
+  }
+  if(maxproc < 1 || maxproc > NCPU){
+    fprintf(2, "Usage: fsbench [-p maxprocs] [test ...]\n");
+    exit(1);
+  }
+
+  printf("# test procs size ops ns ticks rate unit\n");
+  for(t = tests; t < tests + sizeof(tests)/sizeof(tests[0]); t++){
+    any = i == argc;
+    for(j = i; j < argc; j++)
+      if(strcmp(argv[j], t->name) == 0)
+        any = 1;
+    if(!any)
+      continue;
+    for(j = 0; j == 0 || (j < 4 && t->sizes[j]); j++)
+      for(p = 1; p <= maxproc; p++)
+        runtest(t, t->sizes[j], p);
+  }
+  exit(0);
+}
@@ -1,6 +1,19 @@
 //
 // run random system calls in parallel forever.
 //
+//   grind -b [-p procs] [-t seconds] [-s seed] [-m op=weight,...]
+//
+// is a benchmark instead: procs processes (2 by default) each
+// run a random mix of the same operations for the given number
+// of seconds (10), from a random sequence that seed (1) fixes,
+// so that runs on different kernels can be compared. The mix
+// names ops[] below with weights, all 1 by default. For each
+// op, it prints a line
+//
+//   op count ops/s p50 p90 p99 max
+//
+// with the latencies in ns, from clockns(), and then the total.
+//
 
 #include "kernel/param.h"
 #include "kernel/types.h"
@@ -47,249 +60,266 @@ rand(void)
     return (do_rand(&rand_next));
 }
 
+#define NWHAT 23   // kinds of operation doop() does
+
+static int fd = -1;
+static char *break0;
+
+// Do operation what, 0 to NWHAT-1.
 void
-go(int which_child)
+doop(int what)
 {
-  int fd = -1;
   static char buf[999];
-  char *break0 = sbrk(0);
-  uint64 iters = 0;
 
+  if(what == 1){
+    close(open("grindir/../a", O_CREATE|O_RDWR));
+  } else if(what == 2){
+    close(open("grindir/../grindir/../b", O_CREATE|O_RDWR));
+  } else if(what == 3){
+    unlink("grindir/../a");
+  } else if(what == 4){
+    if(chdir("grindir") != 0){
+      printf("grind: chdir grindir failed\n");
+      exit(1);
+    }
+    unlink("../b");
+    chdir("/");
+  } else if(what == 5){
+    close(fd);
+    fd = open("/grindir/../a", O_CREATE|O_RDWR);
+  } else if(what == 6){
+    close(fd);
+    fd = open("/./grindir/./../b", O_CREATE|O_RDWR);
+  } else if(what == 7){
+    write(fd, buf, sizeof(buf));
+  } else if(what == 8){
+    read(fd, buf, sizeof(buf));
+  } else if(what == 9){
+    mkdir("grindir/../a");
+    close(open("a/../a/./a", O_CREATE|O_RDWR));
+    unlink("a/a");
+  } else if(what == 10){
+    mkdir("/../b");
+    close(open("grindir/../b/b", O_CREATE|O_RDWR));
+    unlink("b/b");
+  } else if(what == 11){
+    unlink("b");
+    link("../grindir/./../a", "../b");
+  } else if(what == 12){
+    unlink("../grindir/../a");
+    link(".././b", "/grindir/../a");
+  } else if(what == 13){
+    int pid = fork();
+    if(pid == 0){
+      exit(0);
+    } else if(pid < 0){
+      printf("grind: fork failed\n");
+      exit(1);
+    }
+    wait(0);
+  } else if(what == 14){
+    int pid = fork();
+    if(pid == 0){
+      fork();
+      fork();
+      exit(0);
+    } else if(pid < 0){
+      printf("grind: fork failed\n");
+      exit(1);
+    }
+    wait(0);
+  } else if(what == 15){
+    sbrk(6011);
+  } else if(what == 16){
+    if(sbrk(0) > break0)
+      sbrk(-(sbrk(0) - break0));
+  } else if(what == 17){
+    int pid = fork();
+    if(pid == 0){
+      close(open("a", O_CREATE|O_RDWR));
+      exit(0);
+    } else if(pid < 0){
+      printf("grind: fork failed\n");
+      exit(1);
+    }
+    if(chdir("../grindir/..") != 0){
+      printf("grind: chdir failed\n");
+      exit(1);
+    }
+    kill(pid);
+    wait(0);
+  } else if(what == 18){
+    int pid = fork();
+    if(pid == 0){
+      kill(getpid());
+      exit(0);
+    } else if(pid < 0){
+      printf("grind: fork failed\n");
+      exit(1);
+    }
+    wait(0);
+  } else if(what == 19){
+    int fds[2];
+    if(pipe(fds) < 0){
+      printf("grind: pipe failed\n");
+      exit(1);
+    }
+    int pid = fork();
+    if(pid == 0){
+      fork();
+      fork();
+      if(write(fds[1], "x", 1) != 1)
+        printf("grind: pipe write failed\n");
+      char c;
+      if(read(fds[0], &c, 1) != 1)
+        printf("grind: pipe read failed\n");
+      exit(0);
+    } else if(pid < 0){
+      printf("grind: fork failed\n");
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    wait(0);
+  } else if(what == 20){
+    int pid = fork();
+    if(pid == 0){
+      unlink("a");
+      mkdir("a");
+      chdir("a");
+      unlink("../a");
+      fd = open("x", O_CREATE|O_RDWR);
+      unlink("x");
+      exit(0);
+    } else if(pid < 0){
+      printf("grind: fork failed\n");
+      exit(1);
+    }
+    wait(0);
+  } else if(what == 21){
+    unlink("c");
+    // should always succeed. check that there are free i-nodes,
+    // file descriptors, blocks.
+    int fd1 = open("c", O_CREATE|O_RDWR);
+    if(fd1 < 0){
+      printf("grind: create c failed\n");
+      exit(1);
+    }
+    if(write(fd1, "x", 1) != 1){
+      printf("grind: write c failed\n");
+      exit(1);
+    }
+    struct stat st;
+    if(fstat(fd1, &st) != 0){
+      printf("grind: fstat failed\n");
+      exit(1);
+    }
+    if(st.size != 1){
+      printf("grind: fstat reports wrong size %d\n", (int)st.size);
+      exit(1);
+    }
+    if(st.ino > 200){
+      printf("grind: fstat reports crazy i-number %d\n", st.ino);
+      exit(1);
+    }
+    close(fd1);
+    unlink("c");
+  } else if(what == 22){
+    // echo hi | cat
+    int aa[2], bb[2];
+    if(pipe(aa) < 0){
+      fprintf(2, "grind: pipe failed\n");
+      exit(1);
+    }
+    if(pipe(bb) < 0){
+      fprintf(2, "grind: pipe failed\n");
+      exit(1);
+    }
+    int pid1 = fork();
+    if(pid1 == 0){
+      close(bb[0]);
+      close(bb[1]);
+      close(aa[0]);
+      close(1);
+      if(dup(aa[1]) != 1){
+        fprintf(2, "grind: dup failed\n");
+        exit(1);
+      }
+      close(aa[1]);
+      char *args[3] = { "echo", "hi", 0 };
+      exec("grindir/../echo", args);
+      fprintf(2, "grind: echo: not found\n");
+      exit(2);
+    } else if(pid1 < 0){
+      fprintf(2, "grind: fork failed\n");
+      exit(3);
+    }
+    int pid2 = fork();
+    if(pid2 == 0){
+      close(aa[1]);
+      close(bb[0]);
+      close(0);
+      if(dup(aa[0]) != 0){
+        fprintf(2, "grind: dup failed\n");
+        exit(4);
+      }
+      close(aa[0]);
+      close(1);
+      if(dup(bb[1]) != 1){
+        fprintf(2, "grind: dup failed\n");
+        exit(5);
+      }
+      close(bb[1]);
+      char *args[2] = { "cat", 0 };
+      exec("/cat", args);
+      fprintf(2, "grind: cat: not found\n");
+      exit(6);
+    } else if(pid2 < 0){
+      fprintf(2, "grind: fork failed\n");
+      exit(7);
+    }
+    close(aa[0]);
+    close(aa[1]);
+    close(bb[1]);
+    char buf[4] = { 0, 0, 0, 0 };
+    read(bb[0], buf+0, 1);
+    read(bb[0], buf+1, 1);
+    read(bb[0], buf+2, 1);
+    close(bb[0]);
+    int st1, st2;
+    wait(&st1);
+    wait(&st2);
+    if(st1 != 0 || st2 != 0 || strcmp(buf, "hi\n") != 0){
+      printf("grind: exec pipeline failed %d %d \"%s\"\n", st1, st2, buf);
+      exit(1);
+    }
+  }
+}
+
+// Make grindir, and start in /.
+void
+setup(void)
+{
+  break0 = sbrk(0);
   mkdir("grindir");
   if(chdir("grindir") != 0){
     printf("grind: chdir grindir failed\n");
     exit(1);
   }
   chdir("/");
-  
+}
+
+void
+go(int which_child)
+{
+  uint64 iters = 0;
+
+  setup();
   while(1){
     iters++;
     if((iters % 500) == 0)
       write(1, which_child?"B":"A", 1);
-    int what = rand() % 23;
-    if(what == 1){
-      close(open("grindir/../a", O_CREATE|O_RDWR));
-    } else if(what == 2){
-      close(open("grindir/../grindir/../b", O_CREATE|O_RDWR));
-    } else if(what == 3){
-      unlink("grindir/../a");
-    } else if(what == 4){
-      if(chdir("grindir") != 0){
-        printf("grind: chdir grindir failed\n");
-        exit(1);
-      }
-      unlink("../b");
-      chdir("/");
-    } else if(what == 5){
-      close(fd);
-      fd = open("/grindir/../a", O_CREATE|O_RDWR);
-    } else if(what == 6){
-      close(fd);
-      fd = open("/./grindir/./../b", O_CREATE|O_RDWR);
-    } else if(what == 7){
-      write(fd, buf, sizeof(buf));
-    } else if(what == 8){
-      read(fd, buf, sizeof(buf));
-    } else if(what == 9){
-      mkdir("grindir/../a");
-      close(open("a/../a/./a", O_CREATE|O_RDWR));
-      unlink("a/a");
-    } else if(what == 10){
-      mkdir("/../b");
-      close(open("grindir/../b/b", O_CREATE|O_RDWR));
-      unlink("b/b");
-    } else if(what == 11){
-      unlink("b");
-      link("../grindir/./../a", "../b");
-    } else if(what == 12){
-      unlink("../grindir/../a");
-      link(".././b", "/grindir/../a");
-    } else if(what == 13){
-      int pid = fork();
-      if(pid == 0){
-        exit(0);
-      } else if(pid < 0){
-        printf("grind: fork failed\n");
-        exit(1);
-      }
-      wait(0);
-    } else if(what == 14){
-      int pid = fork();
-      if(pid == 0){
-        fork();
-        fork();
-        exit(0);
-      } else if(pid < 0){
-        printf("grind: fork failed\n");
-        exit(1);
-      }
-      wait(0);
-    } else if(what == 15){
-      sbrk(6011);
-    } else if(what == 16){
-      if(sbrk(0) > break0)
-        sbrk(-(sbrk(0) - break0));
-    } else if(what == 17){
-      int pid = fork();
-      if(pid == 0){
-        close(open("a", O_CREATE|O_RDWR));
-        exit(0);
-      } else if(pid < 0){
-        printf("grind: fork failed\n");
-        exit(1);
-      }
-      if(chdir("../grindir/..") != 0){
-        printf("grind: chdir failed\n");
-        exit(1);
-      }
-      kill(pid);
-      wait(0);
-    } else if(what == 18){
-      int pid = fork();
-      if(pid == 0){
-        kill(getpid());
-        exit(0);
-      } else if(pid < 0){
-        printf("grind: fork failed\n");
-        exit(1);
-      }
-      wait(0);
-    } else if(what == 19){
-      int fds[2];
-      if(pipe(fds) < 0){
-        printf("grind: pipe failed\n");
-        exit(1);
-      }
-      int pid = fork();
-      if(pid == 0){
-        fork();
-        fork();
-        if(write(fds[1], "x", 1) != 1)
-          printf("grind: pipe write failed\n");
-        char c;
-        if(read(fds[0], &c, 1) != 1)
-          printf("grind: pipe read failed\n");
-        exit(0);
-      } else if(pid < 0){
-        printf("grind: fork failed\n");
-        exit(1);
-      }
-      close(fds[0]);
-      close(fds[1]);
-      wait(0);
-    } else if(what == 20){
-      int pid = fork();
-      if(pid == 0){
-        unlink("a");
-        mkdir("a");
-        chdir("a");
-        unlink("../a");
-        fd = open("x", O_CREATE|O_RDWR);
-        unlink("x");
-        exit(0);
-      } else if(pid < 0){
-        printf("grind: fork failed\n");
-        exit(1);
-      }
-      wait(0);
-    } else if(what == 21){
-      unlink("c");
-      // should always succeed. check that there are free i-nodes,
-      // file descriptors, blocks.
-      int fd1 = open("c", O_CREATE|O_RDWR);
-      if(fd1 < 0){
-        printf("grind: create c failed\n");
-        exit(1);
-      }
-      if(write(fd1, "x", 1) != 1){
-        printf("grind: write c failed\n");
-        exit(1);
-      }
-      struct stat st;
-      if(fstat(fd1, &st) != 0){
-        printf("grind: fstat failed\n");
-        exit(1);
-      }
-      if(st.size != 1){
-        printf("grind: fstat reports wrong size %d\n", (int)st.size);
-        exit(1);
-      }
-      if(st.ino > 200){
-        printf("grind: fstat reports crazy i-number %d\n", st.ino);
-        exit(1);
-      }
-      close(fd1);
-      unlink("c");
-    } else if(what == 22){
-      // echo hi | cat
-      int aa[2], bb[2];
-      if(pipe(aa) < 0){
-        fprintf(2, "grind: pipe failed\n");
-        exit(1);
-      }
-      if(pipe(bb) < 0){
-        fprintf(2, "grind: pipe failed\n");
-        exit(1);
-      }
-      int pid1 = fork();
-      if(pid1 == 0){
-        close(bb[0]);
-        close(bb[1]);
-        close(aa[0]);
-        close(1);
-        if(dup(aa[1]) != 1){
-          fprintf(2, "grind: dup failed\n");
-          exit(1);
-        }
-        close(aa[1]);
-        char *args[3] = { "echo", "hi", 0 };
-        exec("grindir/../echo", args);
-        fprintf(2, "grind: echo: not found\n");
-        exit(2);
-      } else if(pid1 < 0){
-        fprintf(2, "grind: fork failed\n");
-        exit(3);
-      }
-      int pid2 = fork();
-      if(pid2 == 0){
-        close(aa[1]);
-        close(bb[0]);
-        close(0);
-        if(dup(aa[0]) != 0){
-          fprintf(2, "grind: dup failed\n");
-          exit(4);
-        }
-        close(aa[0]);
-        close(1);
-        if(dup(bb[1]) != 1){
-          fprintf(2, "grind: dup failed\n");
-          exit(5);
-        }
-        close(bb[1]);
-        char *args[2] = { "cat", 0 };
-        exec("/cat", args);
-        fprintf(2, "grind: cat: not found\n");
-        exit(6);
-      } else if(pid2 < 0){
-        fprintf(2, "grind: fork failed\n");
-        exit(7);
-      }
-      close(aa[0]);
-      close(aa[1]);
-      close(bb[1]);
-      char buf[4] = { 0, 0, 0, 0 };
-      read(bb[0], buf+0, 1);
-      read(bb[0], buf+1, 1);
-      read(bb[0], buf+2, 1);
-      close(bb[0]);
-      int st1, st2;
-      wait(&st1);
-      wait(&st2);
-      if(st1 != 0 || st2 != 0 || strcmp(buf, "hi\n") != 0){
-        printf("grind: exec pipeline failed %d %d \"%s\"\n", st1, st2, buf);
-        exit(1);
-      }
-    }
+    doop(rand() % NWHAT);
   }
 }
 
@@ -333,9 +363,253 @@ iter()
   exit(0);
 }
 
+// The benchmark. The operations of doop() are grouped into
+// ops, which the mix weighs.
+struct op {
+  char *name;
+  int what[4];    // doop()s it is, 0-terminated
+  int weight;
+};
+
+static struct op ops[] = {
+  { "create", { 1, 2 } },
+  { "unlink", { 3, 4 } },
+  { "open",   { 5, 6 } },
+  { "write",  { 7 } },
+  { "read",   { 8 } },
+  { "mkdir",  { 9, 10 } },
+  { "link",   { 11, 12 } },
+  { "fork",   { 13, 14, 17, 18 } },
+  { "sbrk",   { 15, 16 } },
+  { "pipe",   { 19 } },
+  { "rmcwd",  { 20 } },
+  { "fstat",  { 21 } },
+  { "exec",   { 22 } },
+};
+#define NOP (sizeof(ops) / sizeof(ops[0]))
+
+// Latencies are counted in buckets an eighth of a power of
+// two wide: ns < 8 in bucket ns, and otherwise by the top four
+// bits of ns.
+#define NHIST (8 + 61*8)
+
+struct result {
+  uint64 n[NOP];
+  uint64 max[NOP];
+  uint64 hist[NOP][NHIST];
+};
+
+static struct result res, tot;
+
+static int
+bucket(uint64 ns)
+{
+  int b;
+
+  if(ns < 8)
+    return ns;
+  for(b = 3; b < 63 && (ns >> (b+1)) != 0; b++)
+    ;
+  return 8 + (b-3)*8 + ((ns >> (b-3)) & 7);
+}
+
+// The smallest latency in bucket i.
+static uint64
+bucketns(int i)
+{
+  if(i < 8)
+    return i;
+  return (uint64)(8 + (i-8) % 8) << ((i-8) / 8);
+}
+
+// The latency below which fraction pct/100 of op o's fall.
+static uint64
+percentile(struct result *r, int o, int pct)
+{
+  uint64 want, n;
+  int i;
+
+  want = (r->n[o] * pct + 99) / 100;
+  n = 0;
+  for(i = 0; i < NHIST; i++){
+    n += r->hist[o][i];
+    if(n >= want)
+      return bucketns(i);
+  }
+  return r->max[o];
+}
+
+// Body of benchmark process id: run the mix until end.
+static void
+worker(int id, uint64 seed, uint64 end, int resfd)
+{
+  int o, i, totw, n;
+  uint64 t0, t;
+
+  rand_next = seed * 2654435761u + id * 7177 + 1;
+  totw = 0;
+  for(o = 0; o < NOP; o++)
+    totw += ops[o].weight;
+  setup();
+  while((t0 = clockns()) < end){
+    n = rand() % totw;
+    for(o = 0; n >= ops[o].weight; o++)
+      n -= ops[o].weight;
+    for(i = 0; i < 4 && ops[o].what[i]; i++)
+      ;
+    doop(ops[o].what[rand() % i]);
+    t = clockns() - t0;
+    res.n[o]++;
+    res.hist[o][bucket(t)]++;
+    if(t > res.max[o])
+      res.max[o] = t;
+  }
+  if(write(resfd, &res, sizeof(res)) != sizeof(res)){
+    fprintf(2, "grind: worker %d: lost its results\n", id);
+    exit(1);
+  }
+  exit(0);
+}
+
+// Read exactly n bytes from fd. Returns 0, or -1.
+static int
+readall(int fd, void *p, int n)
+{
+  int m;
+
+  for(; n > 0; n -= m, p = (char*)p + m)
+    if((m = read(fd, p, n)) <= 0)
+      return -1;
+  return 0;
+}
+
+// Set the weights from mix, "op=weight,...". Returns 0,
+// or -1 if it names an op that does not exist.
+static int
+setmix(char *mix)
+{
+  char *name, *w, *next;
+  int o;
+
+  for(o = 0; o < NOP; o++)
+    ops[o].weight = 0;
+  for(name = mix; name && *name; name = next){
+    if((next = strchr(name, ',')) != 0)
+      *next++ = 0;
+    if((w = strchr(name, '=')) == 0)
+      return -1;
+    *w++ = 0;
+    for(o = 0; o < NOP && strcmp(ops[o].name, name) != 0; o++)
+      ;
+    if(o == NOP)
+      return -1;
+    ops[o].weight = atoi(w);
+  }
+  return 0;
+}
+
+static void
+benchusage(void)
+{
+  fprintf(2, "Usage: grind -b [-p procs] [-t seconds] [-s seed] [-m op=weight,...]\n");
+  exit(1);
+}
+
+static void
+bench(int argc, char *argv[])
+{
+  int nproc, secs, resfd[NPROC/8][2], i, o, j, w;
+  uint64 seed, start, end, ns, n;
+
+  nproc = 2;
+  secs = 10;
+  seed = 1;
+  for(o = 0; o < NOP; o++)
+    ops[o].weight = 1;
+  for(i = 2; i + 1 < argc; i += 2){
+    if(strcmp(argv[i], "-p") == 0)
+      nproc = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-t") == 0)
+      secs = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-s") == 0)
+      seed = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-m") == 0){
+      if(setmix(argv[i+1]) < 0)
+        benchusage();
+    } else
+      benchusage();
+  }
+  w = 0;
+  for(o = 0; o < NOP; o++)
+    w += ops[o].weight;
+  if(i != argc || nproc < 1 || nproc > NPROC / 8 || secs < 1 || w <= 0)
+    benchusage();
+
+  unlink("a");
+  unlink("b");
+  start = clockns();
+  end = start + (uint64)secs * 1000000000;
+  for(i = 0; i < nproc; i++){
+    // a pipe each, since the results are too big for one
+    // write() to a shared pipe to keep them together.
+    if(pipe(resfd[i]) < 0){
+      fprintf(2, "grind: pipe failed\n");
+      exit(1);
+    }
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "grind: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j <= i; j++)
+        close(resfd[j][0]);
+      worker(i, seed, end, resfd[i][1]);
+    }
+    close(resfd[i][1]);
+  }
+  for(i = 0; i < nproc; i++){
+    if(readall(resfd[i][0], &res, sizeof(res)) < 0){
+      fprintf(2, "grind: a worker failed\n");
+      exit(1);
+    }
+    for(o = 0; o < NOP; o++){
+      tot.n[o] += res.n[o];
+      if(res.max[o] > tot.max[o])
+        tot.max[o] = res.max[o];
+      for(j = 0; j < NHIST; j++)
+        tot.hist[o][j] += res.hist[o][j];
+    }
+    close(resfd[i][0]);
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  ns = clockns() - start;
+
+  printf("# grind procs %d seconds %d seed %l\n", nproc, secs, seed);
+  printf("# op count ops/s p50 p90 p99 max\n");
+  n = 0;
+  for(o = 0; o < NOP; o++){
+    if(tot.n[o] == 0)
+      continue;
+    n += tot.n[o];
+    printf("%s %l %l %l %l %l %l\n", ops[o].name, tot.n[o],
+           tot.n[o] * 1000000000 / ns, percentile(&tot, o, 50),
+           percentile(&tot, o, 90), percentile(&tot, o, 99), tot.max[o]);
+  }
+  printf("total %l %l\n", n, n * 1000000000 / ns);
+  exit(0);
+}
+
 int
-main()
+main(int argc, char *argv[])
 {
+  if(argc > 1){
+    if(strcmp(argv[1], "-b") != 0)
+      benchusage();
+    bench(argc, argv);
+  }
+
   while(1){
     int pid = fork();
     if(pid == 0){
@@ -13,13 +13,25 @@ char *argv[] = { "sh", 0 };
 int
 main(void)
 {
-  int pid, wpid;
+  int pid, wpid, fd;
   if(open("console", O_RDWR) < 0){
     mknod("console", CONSOLE, 0);
     open("console", O_RDWR);
   }
   dup(0);  // stdout
   dup(0);  // stderr
+  if((fd = open("stats", O_RDONLY)) < 0)
+    mknod("stats", STATS, 0);
+  else
+    close(fd);
+  if((fd = open("klog", O_RDONLY)) < 0)
+    mknod("klog", KLOG, 0);
+  else
+    close(fd);
+  if((fd = open("trace", O_RDONLY)) < 0)
+    mknod("trace", TRACE, 0);
+  else
+    close(fd);
 
   for(;;){
     pid = fork();
@@ -0,0 +1,75 @@
+// lockstat: show lock contention, from a kernel built with
+// make LOCKSTAT=1, most waited-for locks first.
+//
+//   lockstat             since boot
+//   lockstat cmd args    while cmd runs
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/lockstat.h"
+
+static struct lockstat before[NLOCKSTAT], after[NLOCKSTAT];
+
+static int
+snap(struct lockstat *s)
+{
+  int n;
+
+  if((n = lockstat(s, NLOCKSTAT)) < 0){
+    fprintf(2, "lockstat: the kernel does not count locks; build it with make LOCKSTAT=1\n");
+    exit(1);
+  }
+  return n < NLOCKSTAT ? n : NLOCKSTAT;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char done[NLOCKSTAT];
+  struct lockstat *a, *b;
+  int n, i, best, pid;
+  uint64 w, bestwait;
+
+  n = snap(before);
+  if(argc > 1){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+    n = snap(after);
+  } else {
+    memmove(after, before, sizeof(before));
+    memset(before, 0, sizeof(before));
+  }
+
+  printf("# name kind acquires contended waittime holdtime maxhold\n");
+  for(;;){
+    best = -1;
+    bestwait = 0;
+    for(i = 0; i < n; i++){
+      w = after[i].waittime - before[i].waittime;
+      if(!done[i] && after[i].acquires != before[i].acquires &&
+         (best < 0 || w > bestwait)){
+        best = i;
+        bestwait = w;
+      }
+    }
+    if(best < 0)
+      break;
+    done[best] = 1;
+    a = &after[best];
+    b = &before[best];
+    printf("%s %s %l %l %l %l %l\n", a->name, a->sleep ? "sleep" : "spin",
+           a->acquires - b->acquires, a->contended - b->contended,
+           a->waittime - b->waittime, a->holdtime - b->holdtime, a->maxhold);
+  }
+  exit(0);
+}
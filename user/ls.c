@@ -1,12 +1,14 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/ring.h"
 #include "user/user.h"
-#include "kernel/fs/xv6fs/fs.h"
+
+static struct ring *ring;   // from ringsetup(), or 0
 
 char*
 fmtname(char *path)
 {
-  static char buf[DIRSIZ+1];
+  static char buf[DIRENTSIZ+1];
   char *p;
 
   // Find first character after last slash.
@@ -15,19 +17,66 @@ fmtname(char *path)
   p++;
 
   // Return blank-padded name.
-  if(strlen(p) >= DIRSIZ)
+  if(strlen(p) >= DIRENTSIZ)
     return p;
   memmove(buf, p, strlen(p));
-  memset(buf+strlen(p), ' ', DIRSIZ-strlen(p));
+  memset(buf+strlen(p), ' ', DIRENTSIZ-strlen(p));
   return buf;
 }
 
+// Stat and print the n entries de of the directory whose path
+// is in buf, which has room for a name at p: with a single
+// ringenter() for all of them if there is a ring.
+void
+lsents(char *buf, char *p, struct dirent *de, int n)
+{
+  static char paths[NRING][512];
+  static struct stat sts[NRING];
+  struct ringsqe *e;
+  struct ringcqe *c;
+  struct stat st;
+  int i;
+
+  for(i = 0; i < n; i++){
+    memmove(p, de[i].name, DIRENTSIZ);
+    p[DIRENTSIZ] = 0;
+    if(ring == 0){
+      if(stat(buf, &st) < 0)
+        printf("ls: cannot stat %s\n", buf);
+      else
+        printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
+      continue;
+    }
+    strcpy(paths[i], buf);
+    e = &ring->sq[ring->sqtail % NRING];
+    e->op = RING_STAT;
+    e->addr = (uint64)paths[i];
+    e->addr2 = (uint64)&sts[i];
+    e->data = i;
+    ring->sqtail++;
+  }
+  if(ring == 0)
+    return;
+  if(ringenter(n) != n){
+    fprintf(2, "ls: ringenter failed\n");
+    exit(1);
+  }
+  while(ring->cqhead != ring->cqtail){
+    c = &ring->cq[ring->cqhead++ % NRING];
+    i = c->data;
+    if(c->res < 0)
+      printf("ls: cannot stat %s\n", paths[i]);
+    else
+      printf("%s %d %d %d\n", fmtname(paths[i]), sts[i].type, sts[i].ino, sts[i].size);
+  }
+}
+
 void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct xv6fs_dentry de;
+  int fd, n;
+  struct dirent de[NRING];
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -51,27 +100,16 @@ ls(char *path)
 
   case T_DIR:
     // printf("this is a directory\n");
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
+    if(strlen(path) + 1 + DIRENTSIZ + 1 > sizeof buf){
       printf("ls: path too long\n");
       break;
     }
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    // int res = read(fd, &de, sizeof(de));
-    // printf("res: %d\n", res);
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      // printf("dentry name: %s\n", de.name);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
-    }
+    // a directory block's worth of entries per call.
+    while((n = getdents(fd, de, sizeof(de))) > 0)
+      lsents(buf, p, de, n / sizeof(de[0]));
     break;
   }
   close(fd);
@@ -82,6 +120,9 @@ main(int argc, char *argv[])
 {
   int i;
 
+  // one system call per directory block, not three per entry.
+  if((ring = ringsetup()) == (struct ring*)-1)
+    ring = 0;
   if(argc < 2){
     ls(".");
     exit(0);
@@ -0,0 +1,19 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc != 3){
+    fprintf(2, "Usage: mount diskN|tmpfs dir\n");
+    exit(1);
+  }
+
+  if(mount(argv[1], argv[2]) < 0){
+    fprintf(2, "mount: cannot mount %s on %s\n", argv[1], argv[2]);
+    exit(1);
+  }
+
+  exit(0);
+}
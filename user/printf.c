@@ -1,3 +1,15 @@
+// Buffered standard I/O.
+//
+// printf() and fprintf() format into the buffer of a stream,
+// which is written when it fills, at the end of a line if the
+// stream is line-buffered (stdout), and at the end of the call
+// if it is unbuffered (stderr, and the other fds fprintf() is
+// given). Whatever is buffered is written before exit(), fork()
+// and exec() (see ulib.c), and before stdin is read, so that
+// it neither appears twice nor too late.
+//
+// getc() and gets() read stdin through its buffer.
+
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
@@ -6,14 +18,114 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+static FILE streams[4] = {
+  { 0, _IOFBF },
+  { 1, _IOLBF },
+  { 2, _IONBF },
+  { -1, _IONBF },  // any other fd, for one fprintf()
+};
+FILE *stdin = &streams[0];
+FILE *stdout = &streams[1];
+FILE *stderr = &streams[2];
+
+static void flushall(void);
+
+// Write out f's buffer. Returns 0, or -1 if write() failed,
+// in which case what was buffered is gone.
+int
+fflush(FILE *f)
+{
+  int i, n;
+
+  if(f == 0){
+    flushall();
+    return 0;
+  }
+  if(f == stdin)
+    return 0;
+  for(i = 0; i < f->n; i += n){
+    if((n = write(f->fd, f->buf + i, f->n - i)) <= 0){
+      f->n = 0;
+      return -1;
+    }
+  }
+  f->n = 0;
+  return 0;
+}
+
 static void
-putc(int fd, char c)
+flushall(void)
+{
+  fflush(stdout);
+  fflush(stderr);
+}
+
+// Set how f is buffered: _IONBF, _IOLBF or _IOFBF.
+void
+setvbuf(FILE *f, int mode)
+{
+  fflush(f);
+  f->mode = mode;
+}
+
+static void
+putc(FILE *f, char c)
+{
+  if(f->n == BUFSIZ)
+    fflush(f);
+  f->buf[f->n++] = c;
+  if(f->mode == _IOLBF && c == '\n')
+    fflush(f);
+  _stdflush = flushall;
+}
+
+// Read a character from f, or return -1 at the end of the
+// file or on an error.
+int
+getc(FILE *f)
+{
+  if(f->r == f->n){
+    // what is asked for may depend on what was said.
+    fflush(stdout);
+    f->r = 0;
+    if((f->n = read(f->fd, f->buf, BUFSIZ)) <= 0){
+      f->n = 0;
+      return -1;
+    }
+  }
+  return (uchar)f->buf[f->r++];
+}
+
+char*
+gets(char *buf, int max)
+{
+  int i, c;
+
+  for(i=0; i+1 < max; ){
+    if((c = getc(stdin)) < 0)
+      break;
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  return buf;
+}
+
+// The stream for output to fd.
+static FILE*
+stream(int fd)
 {
-  write(fd, &c, 1);
+  if(fd == 1)
+    return stdout;
+  if(fd == 2)
+    return stderr;
+  streams[3].fd = fd;
+  return &streams[3];
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(FILE *f, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,22 +147,23 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(f, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(FILE *f, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(f, '0');
+  putc(f, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(f, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+  FILE *f = stream(fd);
   char *s;
   int c, i, state;
 
@@ -61,37 +174,39 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(f, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(f, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(f, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(f, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(f, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(f, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(f, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(f, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(f, '%');
+        putc(f, c);
       }
       state = 0;
     }
   }
+  if(f->mode == _IONBF)
+    fflush(f);
 }
 
 void
@@ -0,0 +1,111 @@
+// scstat: show system call counts and latencies.
+//
+//   scstat             since boot
+//   scstat cmd args    of the calls made while cmd runs
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/syscall.h"
+#include "kernel/scstat.h"
+
+#define NSC 64
+
+static char *names[] = {
+  [SYS_fork]    "fork",
+  [SYS_exit]    "exit",
+  [SYS_wait]    "wait",
+  [SYS_pipe]    "pipe",
+  [SYS_read]    "read",
+  [SYS_kill]    "kill",
+  [SYS_exec]    "exec",
+  [SYS_fstat]   "fstat",
+  [SYS_chdir]   "chdir",
+  [SYS_dup]     "dup",
+  [SYS_getpid]  "getpid",
+  [SYS_sbrk]    "sbrk",
+  [SYS_sleep]   "sleep",
+  [SYS_uptime]  "uptime",
+  [SYS_open]    "open",
+  [SYS_write]   "write",
+  [SYS_mknod]   "mknod",
+  [SYS_unlink]  "unlink",
+  [SYS_link]    "link",
+  [SYS_mkdir]   "mkdir",
+  [SYS_close]   "close",
+  [SYS_fsync]   "fsync",
+  [SYS_getdents] "getdents",
+  [SYS_pread]   "pread",
+  [SYS_pwrite]  "pwrite",
+  [SYS_readv]   "readv",
+  [SYS_writev]  "writev",
+  [SYS_lseek]   "lseek",
+  [SYS_mmap]    "mmap",
+  [SYS_munmap]  "munmap",
+  [SYS_sendfile] "sendfile",
+  [SYS_mount]   "mount",
+  [SYS_scstat]  "scstat",
+  [SYS_nsec]    "nsec",
+  [SYS_lockstat] "lockstat",
+  [SYS_ringsetup] "ringsetup",
+  [SYS_ringenter] "ringenter",
+  [SYS_rename]  "rename",
+};
+
+static struct scstat before[NSC], after[NSC];
+
+static int
+snap(struct scstat *s)
+{
+  int n;
+
+  if((n = scstat(s, NSC)) < 0){
+    fprintf(2, "scstat: scstat failed\n");
+    exit(1);
+  }
+  return n < NSC ? n : NSC;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, num, i, pid;
+  struct scstat *a, *b;
+
+  n = snap(before);
+  if(argc > 1){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "scstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "scstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+    n = snap(after);
+  } else {
+    memmove(after, before, sizeof(before));
+    memset(before, 0, sizeof(before));
+  }
+
+  for(num = 1; num < n; num++){
+    a = &after[num];
+    b = &before[num];
+    if(a->count == b->count)
+      continue;
+    if(num < sizeof(names)/sizeof(names[0]) && names[num])
+      printf("%s", names[num]);
+    else
+      printf("syscall %d", num);
+    printf(": %l calls, %l ticks each\n", a->count - b->count,
+           (a->time - b->time) / (a->count - b->count));
+    for(i = 0; i < NSCHIST; i++)
+      if(a->hist[i] != b->hist[i])
+        printf("  %l-%l: %l\n", i ? 1L << i : 0L, (1L << (i+1)) - 1,
+               a->hist[i] - b->hist[i]);
+  }
+  exit(0);
+}
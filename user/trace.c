@@ -0,0 +1,143 @@
+// trace: control and drain the kernel's tracepoints.
+//
+//   trace on [mask]    record every event, or those in the hex mask
+//   trace off          stop recording
+//   trace dump file    drain the records into file
+//   trace print file   print a file that dump wrote
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/xv6_fcntl.h"
+#include "kernel/trace.h"
+
+static char *names[NTREVENT] = {
+  [TR_LOST]     "lost",
+  [TR_BGET]     "bget",
+  [TR_BMISS]    "bmiss",
+  [TR_DSUBMIT]  "dsubmit",
+  [TR_DDONE]    "ddone",
+  [TR_ILOCK]    "ilock",
+  [TR_NAMEI]    "namei",
+  [TR_SWITCH]   "switch",
+  [TR_SYSENTER] "sysenter",
+  [TR_SYSEXIT]  "sysexit",
+};
+
+static struct tracerec recs[64];
+
+static void
+usage(void)
+{
+  fprintf(2, "Usage: trace on [mask] | off | dump file | print file\n");
+  exit(1);
+}
+
+static void
+setmask(char *mask)
+{
+  int fd;
+
+  if((fd = open("/trace", O_WRONLY)) < 0){
+    fprintf(2, "trace: cannot open /trace\n");
+    exit(1);
+  }
+  if(write(fd, mask, strlen(mask)) != strlen(mask)){
+    fprintf(2, "trace: bad mask %s\n", mask);
+    exit(1);
+  }
+  close(fd);
+}
+
+static void
+dump(char *file)
+{
+  struct tracehdr h;
+  int fd, out, n;
+  uint64 tot;
+
+  if((fd = open("/trace", O_RDONLY)) < 0){
+    fprintf(2, "trace: cannot open /trace\n");
+    exit(1);
+  }
+  if((out = open(file, O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+    fprintf(2, "trace: cannot create %s\n", file);
+    exit(1);
+  }
+  h.magic = TRACEMAGIC;
+  h.recsize = sizeof(struct tracerec);
+  h.hz = TIMEHZ;
+  if(write(out, &h, sizeof(h)) != sizeof(h))
+    goto bad;
+  tot = 0;
+  while((n = read(fd, recs, sizeof(recs))) > 0){
+    if(write(out, recs, n) != n)
+      goto bad;
+    tot += n / sizeof(struct tracerec);
+  }
+  close(fd);
+  close(out);
+  printf("%l records\n", tot);
+  return;
+
+ bad:
+  fprintf(2, "trace: write %s failed\n", file);
+  exit(1);
+}
+
+static void
+print(char *file)
+{
+  struct tracehdr h;
+  struct tracerec *r;
+  char name[9];
+  int fd, n, i;
+
+  if((fd = open(file, O_RDONLY)) < 0){
+    fprintf(2, "trace: cannot open %s\n", file);
+    exit(1);
+  }
+  if(read(fd, &h, sizeof(h)) != sizeof(h) || h.magic != TRACEMAGIC ||
+     h.recsize != sizeof(struct tracerec)){
+    fprintf(2, "trace: %s is not a trace\n", file);
+    exit(1);
+  }
+  while((n = read(fd, recs, sizeof(recs))) > 0){
+    for(r = recs; r < recs + n / sizeof(struct tracerec); r++){
+      printf("%l cpu %d pid %d ", r->time, r->cpu, r->pid);
+      if(r->event >= NTREVENT){
+        printf("event %d\n", r->event);
+        continue;
+      }
+      printf("%s ", names[r->event]);
+      if(r->event == TR_NAMEI){
+        for(i = 0; i < 8; i++)
+          name[i] = r->b >> (8*i);
+        name[8] = 0;
+        printf("dev %d dir %d %s\n", (int)(r->a >> 32), (int)r->a, name);
+      } else {
+        printf("%l %l\n", r->a, r->b);
+      }
+    }
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 2)
+    usage();
+  if(strcmp(argv[1], "on") == 0 && argc <= 3)
+    setmask(argc == 3 ? argv[2] : "all");
+  else if(strcmp(argv[1], "off") == 0 && argc == 2)
+    setmask("0");
+  else if(strcmp(argv[1], "dump") == 0 && argc == 3)
+    dump(argv[2]);
+  else if(strcmp(argv[1], "print") == 0 && argc == 3)
+    print(argv[2]);
+  else
+    usage();
+  exit(0);
+}
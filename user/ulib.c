@@ -2,6 +2,14 @@
 #include "kernel/stat.h"
 #include "kernel/xv6_fcntl.h"
 #include "user/user.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
+
+// Writes out what printf() has buffered; printf.c sets it
+// once there is something, so that programs that do not use
+// printf() do not need it.
+void (*_stdflush)(void);
 
 //
 // wrapper so that it's OK if main() does not call exit().
@@ -14,6 +22,30 @@ _main()
   exit(0);
 }
 
+int
+exit(int status)
+{
+  if(_stdflush)
+    _stdflush();
+  _exit(status);
+}
+
+int
+fork(void)
+{
+  if(_stdflush)
+    _stdflush();
+  return _fork();
+}
+
+int
+exec(const char *path, char **argv)
+{
+  if(_stdflush)
+    _stdflush();
+  return _exec(path, argv);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -25,9 +57,22 @@ strcpy(char *s, const char *t)
   return os;
 }
 
+// The string and mem* functions work a 64-bit word at a time
+// where their pointers are equally aligned, as in the kernel's
+// string.c.
+
 int
 strcmp(const char *p, const char *q)
 {
+  if((((uint64)p ^ (uint64)q) & 7) == 0){
+    while(((uint64)p & 7) != 0 && *p && *p == *q)
+      p++, q++;
+    if(((uint64)p & 7) == 0){
+      while(*(const uint64*)p == *(const uint64*)q &&
+            !HASZERO(*(const uint64*)p))
+        p += 8, q += 8;
+    }
+  }
   while(*p && *p == *q)
     p++, q++;
   return (uchar)*p - (uchar)*q;
@@ -36,21 +81,37 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
-  int n;
-
-  for(n = 0; s[n]; n++)
-    ;
-  return n;
+  const char *p;
+
+  for(p = s; ((uint64)p & 7) != 0; p++)
+    if(*p == 0)
+      return p - s;
+  while(!HASZERO(*(const uint64*)p))
+    p += 8;
+  while(*p)
+    p++;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && ((uint64)cdst & 7) != 0){
+    *cdst++ = c;
+    n--;
   }
+  w = (uchar)c * 0x0101010101010101UL;
+  for(wdst = (uint64*)cdst; n >= 64; n -= 64, wdst += 8){
+    wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+    wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+  }
+  for(; n >= 8; n -= 8)
+    *wdst++ = w;
+  for(cdst = (char*)wdst; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
@@ -63,24 +124,6 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
@@ -115,11 +158,36 @@ memmove(void *vdst, const void *vsrc, int n)
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if((((uint64)src ^ (uint64)dst) & 7) == 0){
+      while(n > 0 && ((uint64)dst & 7) != 0){
+        *dst++ = *src++;
+        n--;
+      }
+      for(; n >= 64; n -= 64, dst += 64, src += 64){
+        uint64 *wd = (uint64*)dst;
+        const uint64 *ws = (const uint64*)src;
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= 8; n -= 8, dst += 8, src += 8)
+        *(uint64*)dst = *(const uint64*)src;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if((((uint64)src ^ (uint64)dst) & 7) == 0){
+      while(n > 0 && ((uint64)dst & 7) != 0){
+        *--dst = *--src;
+        n--;
+      }
+      for(; n >= 8; n -= 8){
+        dst -= 8;
+        src -= 8;
+        *(uint64*)dst = *(const uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -130,6 +198,14 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if((((uint64)p1 ^ (uint64)p2) & 7) == 0){
+    while(n > 0 && ((uint64)p1 & 7) != 0 && *p1 == *p2)
+      n--, p1++, p2++;
+    if(((uint64)p1 & 7) == 0){
+      while(n >= 8 && *(const uint64*)p1 == *(const uint64*)p2)
+        n -= 8, p1 += 8, p2 += 8;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -145,3 +221,14 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Nanoseconds since boot, as nsec() returns, but read from
+// the time CSR without a system call.
+uint64
+clockns(void)
+{
+  uint64 t;
+
+  asm volatile("rdtime %0" : "=r" (t));
+  return t * ((struct vdso*)VDSO)->nspertime;
+}
@@ -3,17 +3,22 @@
 #include "kernel/types.h"
 
 struct stat;
+struct dirent;
+struct iovec;
+struct scstat;
+struct lockstat;
+struct ring;
 
 // system calls
-int fork(void);
-int exit(int) __attribute__((noreturn));
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
 int read(int, void*, int);
 int close(int);
 int kill(int);
-int exec(const char*, char**);
+int _exec(const char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -26,16 +31,34 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fsync(int);
+int getdents(int, struct dirent*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int lseek(int, int, int);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int sendfile(int, int, int);
+int mount(const char*, const char*);
+int scstat(struct scstat*, int);
+uint64 nsec(void);
+int lockstat(struct lockstat*, int);
+struct ring *ringsetup(void);
+int ringenter(int);
+int rename(const char*, const char*);
 
 // ulib.c
+extern void (*_stdflush)(void);
+int fork(void);
+int exit(int) __attribute__((noreturn));
+int exec(const char*, char**);
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void fprintf(int, const char*, ...);
-void printf(const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
@@ -43,3 +66,27 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+uint64 clockns(void);
+
+// printf.c
+#define BUFSIZ 512
+#define _IONBF 0  // written at the end of each call
+#define _IOLBF 1  // written at the end of each line
+#define _IOFBF 2  // written when the buffer is full
+
+typedef struct {
+  int fd;
+  int mode;   // _IONBF, _IOLBF or _IOFBF
+  int r;      // next byte of buf to read
+  int n;      // bytes in buf
+  char buf[BUFSIZ];
+} FILE;
+
+extern FILE *stdin, *stdout, *stderr;
+
+void fprintf(int, const char*, ...);
+void printf(const char*, ...);
+int fflush(FILE*);
+void setvbuf(FILE*, int);
+int getc(FILE*);
+char* gets(char*, int max);
@@ -1,6 +1,7 @@
 #include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/ring.h"
 #include "user/user.h"
 #include "kernel/buf.h"
 #include "kernel/fs/xv6fs/fs.h"
@@ -8,6 +9,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/trace.h"
+#include "kernel/scstat.h"
+#include "kernel/vdso.h"
+#include "kernel/lockstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -343,12 +348,14 @@ truncate1(char *s)
 }
 
 // write to an open FD whose file has just been truncated.
-// this causes a write at an offset beyond the end of the file.
-// such writes fail on xv6 (unlike POSIX) but at least
-// they don't crash.
+// this causes a write at an offset beyond the end of the file,
+// which, as in POSIX, leaves a hole that reads as zeros.
 void
 truncate2(char *s)
 {
+  char buf[8];
+  struct stat st;
+
   unlink("truncfile");
 
   int fd1 = open("truncfile", O_CREATE|O_TRUNC|O_WRONLY);
@@ -357,10 +364,17 @@ truncate2(char *s)
   int fd2 = open("truncfile", O_TRUNC|O_WRONLY);
 
   int n = write(fd1, "x", 1);
-  if(n != -1){
-    printf("%s: write returned %d, expected -1\n", s, n);
+  if(n != 1){
+    printf("%s: write returned %d, expected 1\n", s, n);
+    exit(1);
+  }
+  int fd3 = open("truncfile", O_RDONLY);
+  if(fstat(fd3, &st) < 0 || st.size != 5 ||
+     read(fd3, buf, sizeof(buf)) != 5 || memcmp(buf, "\0\0\0\0x", 5) != 0){
+    printf("%s: hole does not read as zeros\n", s);
     exit(1);
   }
+  close(fd3);
 
   unlink("truncfile");
   close(fd1);
@@ -576,6 +590,489 @@ writetest(char *s)
   }
 }
 
+// fsync() writes a file's delayed writes to disk, and
+// reads see the data whether or not it has reached the disk.
+void
+fsynctest(char *s)
+{
+  int fd, i;
+  enum { N=20 };
+
+  fd = open("fsync", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsync failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, 'a' + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write %d failed\n", s, i);
+      exit(1);
+    }
+    if(i == N/2 && fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+
+  fd = open("fsync", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open fsync failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a' + i || buf[BSIZE-1] != 'a' + i){
+      printf("%s: read %d wrong\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("fsync");
+}
+
+// two descriptors read the same file sequentially, in
+// different chunk sizes, while readahead runs for both.
+void
+readahead(char *s)
+{
+  int fd, fd1, fd2, i, n1, n2;
+  enum { N=40 };
+  static char buf2[BSIZE];
+
+  fd = open("readahead", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create readahead failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd1 = open("readahead", O_RDONLY);
+  fd2 = open("readahead", O_RDONLY);
+  if(fd1 < 0 || fd2 < 0){
+    printf("%s: open readahead failed\n", s);
+    exit(1);
+  }
+  n1 = n2 = 0;
+  while(n1 < N*BSIZE || n2 < N*BSIZE){
+    if(n1 < N*BSIZE){
+      if(read(fd1, buf, 100) != 100 && n1 + 100 <= N*BSIZE){
+        printf("%s: read fd1 at %d failed\n", s, n1);
+        exit(1);
+      }
+      if(buf[0] != (char)(n1/BSIZE)){
+        printf("%s: fd1 wrong data at %d\n", s, n1);
+        exit(1);
+      }
+      n1 += 100;
+    }
+    if(n2 < N*BSIZE){
+      if(read(fd2, buf2, BSIZE) != BSIZE){
+        printf("%s: read fd2 at %d failed\n", s, n2);
+        exit(1);
+      }
+      if(buf2[0] != (char)(n2/BSIZE) || buf2[BSIZE-1] != (char)(n2/BSIZE)){
+        printf("%s: fd2 wrong data at %d\n", s, n2);
+        exit(1);
+      }
+      n2 += BSIZE;
+    }
+  }
+  close(fd1);
+  close(fd2);
+  unlink("readahead");
+}
+
+// lookups must see every link and unlink, even when
+// the answer was cached, negative or not.
+void
+dcache(char *s)
+{
+  int fd, i;
+
+  for(i = 0; i < 3; i++){
+    if(open("dc/a", O_RDONLY) >= 0){
+      printf("%s: dc/a exists before mkdir\n", s);
+      exit(1);
+    }
+    if(mkdir("dc") < 0){
+      printf("%s: mkdir dc failed\n", s);
+      exit(1);
+    }
+    if(open("dc/a", O_RDONLY) >= 0){
+      printf("%s: dc/a exists in new dir\n", s);
+      exit(1);
+    }
+    fd = open("dc/a", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create dc/a failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if((fd = open("dc/a", O_RDONLY)) < 0){
+      printf("%s: dc/a missing after create\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(link("dc/a", "dc/b") < 0 || (fd = open("dc/b", O_RDONLY)) < 0){
+      printf("%s: dc/b missing after link\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(unlink("dc/a") < 0 || open("dc/a", O_RDONLY) >= 0){
+      printf("%s: dc/a still there after unlink\n", s);
+      exit(1);
+    }
+    if(unlink("dc/b") < 0 || unlink("dc") < 0){
+      printf("%s: cleanup failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// getdents() must return each entry exactly once,
+// whatever the size of the buffer.
+void
+getdentstest(char *s)
+{
+  enum { N = 100 };
+  struct dirent de[5];
+  char name[8], seen[N];
+  int fd, i, k, m, n, dots, round;
+
+  if(mkdir("gd") < 0){
+    printf("%s: mkdir gd failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[0] = 'g';
+    name[1] = 'd';
+    name[2] = '/';
+    name[3] = 'f';
+    name[4] = '0' + i/10;
+    name[5] = '0' + i%10;
+    name[6] = 0;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  for(round = 0; round < 2; round++){
+    m = round == 0 ? sizeof(de[0]) : sizeof(de);
+    memset(seen, 0, sizeof(seen));
+    dots = 0;
+    if((fd = open("gd", O_RDONLY)) < 0){
+      printf("%s: open gd failed\n", s);
+      exit(1);
+    }
+    while((n = getdents(fd, de, m)) > 0){
+      if(n % sizeof(de[0]) != 0 || n > m){
+        printf("%s: getdents returned %d\n", s, n);
+        exit(1);
+      }
+      for(k = 0; k < n / sizeof(de[0]); k++){
+        if(strcmp(de[k].name, ".") == 0 || strcmp(de[k].name, "..") == 0){
+          dots++;
+          continue;
+        }
+        i = (de[k].name[1] - '0') * 10 + (de[k].name[2] - '0');
+        if(de[k].name[0] != 'f' || de[k].name[3] != 0 || i < 0 || i >= N || seen[i]++){
+          printf("%s: bad or duplicate entry %s\n", s, de[k].name);
+          exit(1);
+        }
+      }
+    }
+    close(fd);
+    if(n < 0 || dots != 2){
+      printf("%s: getdents failed, n %d dots %d\n", s, n, dots);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      if(!seen[i]){
+        printf("%s: entry f%d missing\n", s, i);
+        exit(1);
+      }
+    }
+  }
+
+  if((fd = open("gd/f00", O_RDONLY)) < 0 || getdents(fd, de, sizeof(de)) >= 0){
+    printf("%s: getdents on a file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("gd", O_RDONLY)) < 0 || getdents(fd, de, sizeof(de[0]) - 1) != -1){
+    printf("%s: getdents into a too small buffer did not fail\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i/10;
+    name[5] = '0' + i%10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("gd") < 0){
+    printf("%s: unlink gd failed\n", s);
+    exit(1);
+  }
+}
+
+// pread() and pwrite() use their own offset
+// and leave the file's alone.
+void
+preadtest(char *s)
+{
+  int fd, i;
+  char c;
+
+  fd = open("prw", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create prw failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 26; i++){
+    buf[i] = 'a' + i;
+  }
+  if(write(fd, buf, 26) != 26){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 3) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "!", 1) != 1){
+    printf("%s: write after pwrite failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 6, 1) != 6 || memcmp(buf, "bcXYf", 5) != 0){
+    printf("%s: pread got wrong data\n", s);
+    exit(1);
+  }
+  if(pread(fd, &c, 1, 26) != 1 || c != '!' || pread(fd, &c, 1, 27) != 0){
+    printf("%s: write after pwrite went to the wrong place\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("prw");
+}
+
+// readv() and writev() move through their buffers in order,
+// and stop at the end of the file.
+void
+iovtest(char *s)
+{
+  struct iovec iov[3];
+  char a[3], b[BSIZE+1], c[5];
+  int fd, i;
+
+  fd = open("iov", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iov failed\n", s);
+    exit(1);
+  }
+  memset(b, 'b', sizeof(b));
+  iov[0].iov_base = "aaa";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = "ccccc";
+  iov[2].iov_len = 5;
+  for(i = 0; i < 4; i++){
+    if(writev(fd, iov, 3) != 3 + sizeof(b) + 5){
+      printf("%s: writev failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("iov", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[1].iov_base = b;
+  iov[2].iov_base = c;
+  for(i = 0; i < 4; i++){
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    memset(c, 0, sizeof(c));
+    if(readv(fd, iov, 3) != 3 + sizeof(b) + 5 ||
+       memcmp(a, "aaa", 3) != 0 || b[0] != 'b' || b[BSIZE] != 'b' ||
+       memcmp(c, "ccccc", 5) != 0){
+      printf("%s: readv got wrong data\n", s);
+      exit(1);
+    }
+  }
+  if(readv(fd, iov, 3) != 0){
+    printf("%s: readv past end\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iov");
+}
+
+// lseek() moves the offset that read() and write() use.
+void
+lseektest(char *s)
+{
+  int fd;
+  char c;
+
+  fd = open("lseek", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create lseek failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "0123456789", 10) != 10){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 2, SEEK_SET) != 2 || read(fd, &c, 1) != 1 || c != '2'){
+    printf("%s: SEEK_SET went wrong\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 3, SEEK_CUR) != 6 || read(fd, &c, 1) != 1 || c != '6'){
+    printf("%s: SEEK_CUR went wrong\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -1, SEEK_END) != 9 || write(fd, "x", 1) != 1 ||
+     write(fd, "y", 1) != 1 || lseek(fd, 0, SEEK_END) != 11){
+    printf("%s: SEEK_END went wrong\n", s);
+    exit(1);
+  }
+  if(lseek(fd, -12, SEEK_END) != -1 || lseek(fd, 0, SEEK_CUR) != 11){
+    printf("%s: lseek to a negative offset\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("lseek");
+}
+
+// processes that append to one file through their
+// own descriptors must not overwrite each other.
+void
+appendtest(char *s)
+{
+  enum { NCHILD = 4, N = 50, SZ = 10 };
+  int fd, i, j, pid, xstatus, n[NCHILD];
+  char rec[SZ];
+
+  unlink("append");
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      fd = open("append", O_CREATE|O_WRONLY|O_APPEND);
+      if(fd < 0){
+        printf("%s: open append failed\n", s);
+        exit(1);
+      }
+      memset(rec, 'a' + i, SZ);
+      for(j = 0; j < N; j++){
+        if(write(fd, rec, SZ) != SZ){
+          printf("%s: append failed\n", s);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  fd = open("append", O_RDONLY);
+  memset(n, 0, sizeof(n));
+  while((i = read(fd, rec, SZ)) == SZ){
+    for(j = 1; j < SZ && rec[j] == rec[0]; j++)
+      ;
+    if(j < SZ || rec[0] < 'a' || rec[0] >= 'a' + NCHILD){
+      printf("%s: torn record\n", s);
+      exit(1);
+    }
+    n[rec[0] - 'a']++;
+  }
+  close(fd);
+  for(i = 0; i < NCHILD; i++){
+    if(n[i] != N){
+      printf("%s: child %d has %d records, not %d\n", s, i, n[i], N);
+      exit(1);
+    }
+  }
+  unlink("append");
+}
+
+// relative paths that climb out of a deep cwd with ".."
+// must land where a walk from the root would.
+void
+dotdot(char *s)
+{
+  int fd;
+
+  if(mkdir("dd0") < 0 || mkdir("dd0/dd1") < 0 || mkdir("dd0/dd1/dd2") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if(chdir("dd0/dd1/dd2") < 0){
+    printf("%s: chdir dd0/dd1/dd2 failed\n", s);
+    exit(1);
+  }
+  fd = open("../../f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create ../../f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("/dd0/f", O_RDONLY)) < 0){
+    printf("%s: ../../f is not /dd0/f\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("../../../dd0/dd1/../f", O_RDONLY)) < 0){
+    printf("%s: open ../../../dd0/dd1/../f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("../../dd1/dd2/../../f", O_RDONLY)) < 0){
+    printf("%s: open ../../dd1/dd2/../../f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(chdir("../..") < 0 || (fd = open("f", O_RDONLY)) < 0){
+    printf("%s: chdir ../.. went wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("f") < 0 || unlink("dd1/dd2") < 0 || unlink("dd1") < 0 ||
+     chdir("..") < 0 || unlink("dd0") < 0){
+    printf("%s: cleanup failed\n", s);
+    exit(1);
+  }
+}
+
 void
 writebig(char *s)
 {
@@ -597,138 +1094,1419 @@ writebig(char *s)
 
   close(fd);
 
-  fd = open("big", O_RDONLY);
-  if(fd < 0){
-    printf("%s: error: open big failed!\n", s);
+  fd = open("big", O_RDONLY);
+  if(fd < 0){
+    printf("%s: error: open big failed!\n", s);
+    exit(1);
+  }
+
+  n = 0;
+  for(;;){
+    i = read(fd, buf, BSIZE);
+    if(i == 0){
+      if(n == MAXFILE - 1){
+        printf("%s: read only %d blocks from big", s, n);
+        exit(1);
+      }
+      break;
+    } else if(i != BSIZE){
+      printf("%s: read failed %d\n", s, i);
+      exit(1);
+    }
+    if(((int*)buf)[0] != n){
+      printf("%s: read content of block %d is %d\n", s,
+             n, ((int*)buf)[0]);
+      exit(1);
+    }
+    n++;
+  }
+  close(fd);
+  if(unlink("big") < 0){
+    printf("%s: unlink big failed\n", s);
+    exit(1);
+  }
+}
+
+// many creates, followed by unlink test
+void
+createtest(char *s)
+{
+  int i, fd;
+  enum { N=52 };
+
+  char name[3];
+  name[0] = 'a';
+  name[2] = '\0';
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i;
+    fd = open(name, O_CREATE|O_RDWR);
+    close(fd);
+  }
+  name[0] = 'a';
+  name[2] = '\0';
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i;
+    unlink(name);
+  }
+}
+
+void dirtest(char *s)
+{
+  if(mkdir("dir0") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+
+  if(chdir("dir0") < 0){
+    printf("%s: chdir dir0 failed\n", s);
+    exit(1);
+  }
+
+  if(chdir("..") < 0){
+    printf("%s: chdir .. failed\n", s);
+    exit(1);
+  }
+
+  if(unlink("dir0") < 0){
+    printf("%s: unlink dir0 failed\n", s);
+    exit(1);
+  }
+}
+
+void
+exectest(char *s)
+{
+  int fd, xstatus, pid;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[3];
+
+  unlink("echo-ok");
+  pid = fork();
+  if(pid < 0) {
+     printf("%s: fork failed\n", s);
+     exit(1);
+  }
+  if(pid == 0) {
+    close(1);
+    fd = open("echo-ok", O_CREATE|O_WRONLY);
+    if(fd < 0) {
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    if(fd != 1) {
+      printf("%s: wrong fd\n", s);
+      exit(1);
+    }
+    if(exec("echo", echoargv) < 0){
+      printf("%s: exec echo failed\n", s);
+      exit(1);
+    }
+    // won't get to here
+  }
+  if (wait(&xstatus) != pid) {
+    printf("%s: wait failed!\n", s);
+  }
+  if(xstatus != 0)
+    exit(xstatus);
+
+  fd = open("echo-ok", O_RDONLY);
+  if(fd < 0) {
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if (read(fd, buf, 2) != 2) {
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  unlink("echo-ok");
+  if(buf[0] == 'O' && buf[1] == 'K')
+    exit(0);
+  else {
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+}
+
+// one write() much bigger than a pipe's buffer, read back in
+// pieces that do not line up with its pages.
+void
+pipebig(char *s)
+{
+  enum { N = 5*16384 + 777, CC = 4095 };
+  int fds[2], pid, xstatus, i, n, total;
+  char *b;
+
+  if((b = malloc(N)) == 0 || pipe(fds) != 0){
+    printf("%s: malloc or pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    b[i] = i % 251;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if(write(fds[1], b, N) != N){
+      printf("%s: write to pipe failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  memset(b, 0, N);
+  total = 0;
+  while((n = read(fds[0], b + total, total + CC > N ? N - total : CC)) > 0)
+    total += n;
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(total != N){
+    printf("%s: read %d bytes, not %d\n", s, total, N);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if((b[i] & 0xff) != i % 251){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  free(b);
+}
+
+// Two readers of an empty pipe, and then two writers of a
+// full one, can be killed, also the one waiting its turn.
+void
+pipekill(char *s)
+{
+  static char buf[4096];
+  int fds[2], pids[2], i, w;
+
+  for(w = 0; w < 2; w++){
+    if(pipe(fds) != 0){
+      printf("%s: pipe() failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < 2; i++){
+      if((pids[i] = fork()) < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pids[i] == 0){
+        if(w == 0)
+          read(fds[0], buf, sizeof(buf));
+        else
+          while(write(fds[1], buf, sizeof(buf)) > 0)
+            ;
+        exit(0);
+      }
+    }
+    sleep(5);    // until they all wait
+    kill(pids[0]);
+    kill(pids[1]);
+    for(i = 0; i < 2; i++){
+      if(wait(0) < 0){
+        printf("%s: wait failed\n", s);
+        exit(1);
+      }
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+
+// mount the second disk on /mnt, and check that paths
+// cross into it and back out through "..".
+void
+mounttest(char *s)
+{
+  struct stat st, st1, st2;
+  char buf[3];
+  int fd;
+
+  mkdir("/mnt");
+  if(mount("disk2", "/mnt") < 0 && (stat("/mnt", &st) < 0 || st.dev == ROOTDEV)){
+    // no second disk, e.g. under a different qemu command.
+    return;
+  }
+  if(stat("/mnt", &st) < 0 || st.dev == ROOTDEV || st.ino != ROOTINO){
+    printf("%s: /mnt is not the root of disk2\n", s);
+    exit(1);
+  }
+  if(mount("disk2", "/mnt") == 0 || mount("disk2", "/") == 0 || mount("disk99", "/mnt") == 0){
+    printf("%s: mount of a mounted or missing disk worked\n", s);
+    exit(1);
+  }
+
+  fd = open("/mnt/mountf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "abc", 3) != 3){
+    printf("%s: create /mnt/mountf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("/mnt/mountf", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 3) != 3 || memcmp(buf, "abc", 3) != 0 ||
+     fstat(fd, &st1) < 0 || st1.dev != st.dev){
+    printf("%s: read /mnt/mountf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(link("/mnt/mountf", "/mountlink") == 0){
+    printf("%s: link across disks worked\n", s);
+    exit(1);
+  }
+
+  if(stat("/mnt/..", &st1) < 0 || stat("/", &st2) < 0 ||
+     st1.dev != st2.dev || st1.ino != st2.ino){
+    printf("%s: /mnt/.. is not /\n", s);
+    exit(1);
+  }
+  if(chdir("/mnt") < 0 || stat("mountf", &st1) < 0 || stat("..", &st1) < 0 ||
+     st1.dev != st2.dev || st1.ino != st2.ino){
+    printf("%s: .. from the cwd /mnt is not /\n", s);
+    exit(1);
+  }
+  chdir("/");
+  if(unlink("/mnt/mountf") < 0){
+    printf("%s: unlink /mnt/mountf failed\n", s);
+    exit(1);
+  }
+}
+
+// mount a tmpfs, and use files and directories on it.
+void
+tmpfstest(char *s)
+{
+  enum { N = 2*4096 + 100 };
+  struct stat st, st1, st2;
+  static char buf[N];
+  int fd, i;
+
+  mkdir("/tmpfs");
+  if(mount("tmpfs", "/tmpfs") < 0 && (stat("/tmpfs", &st) < 0 || st.dev == ROOTDEV)){
+    printf("%s: mount tmpfs failed\n", s);
+    exit(1);
+  }
+  if(stat("/tmpfs", &st) < 0 || st.dev <= NDISK || st.ino != ROOTINO || st.type != T_DIR){
+    printf("%s: /tmpfs is not the root of a tmpfs\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++)
+    buf[i] = i % 251;
+  fd = open("/tmpfs/tf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: write /tmpfs/tf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  memset(buf, 0, N);
+  fd = open("/tmpfs/tf", O_RDONLY);
+  if(fd < 0 || read(fd, buf, N) != N || fstat(fd, &st1) < 0 ||
+     st1.dev != st.dev || st1.size != N){
+    printf("%s: read /tmpfs/tf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: /tmpfs/tf has wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  if(mkdir("/tmpfs/d") < 0 || link("/tmpfs/tf", "/tmpfs/d/tf2") < 0){
+    printf("%s: mkdir or link in tmpfs failed\n", s);
+    exit(1);
+  }
+  if(link("/tmpfs/tf", "/tmpfslink") == 0){
+    printf("%s: link out of tmpfs worked\n", s);
+    exit(1);
+  }
+  if(unlink("/tmpfs/tf") < 0 || open("/tmpfs/tf", O_RDONLY) >= 0){
+    printf("%s: unlink /tmpfs/tf failed\n", s);
+    exit(1);
+  }
+  if(stat("/tmpfs/d/tf2", &st1) < 0 || st1.size != N || st1.nlink != 1){
+    printf("%s: /tmpfs/d/tf2 went with /tmpfs/tf\n", s);
+    exit(1);
+  }
+  if(unlink("/tmpfs/d") == 0){
+    printf("%s: unlink of a non-empty tmpfs directory worked\n", s);
+    exit(1);
+  }
+  if(stat("/tmpfs/d/..", &st1) < 0 || st1.dev != st.dev || st1.ino != ROOTINO ||
+     stat("/tmpfs/..", &st1) < 0 || stat("/", &st2) < 0 ||
+     st1.dev != st2.dev || st1.ino != st2.ino){
+    printf("%s: .. in tmpfs is wrong\n", s);
+    exit(1);
+  }
+  if(unlink("/tmpfs/d/tf2") < 0 || unlink("/tmpfs/d") < 0){
+    printf("%s: unlink in tmpfs failed\n", s);
+    exit(1);
+  }
+}
+
+// the stats device reads as one "name count" line per
+// counter, and then ends.
+void
+statstest(char *s)
+{
+  static char buf[4096];
+  int fd, n, tot, i, found;
+
+  fd = open("/stats", O_RDWR);
+  if(fd < 0){
+    printf("%s: open /stats failed\n", s);
+    exit(1);
+  }
+  tot = 0;
+  while((n = read(fd, buf + tot, 7)) > 0 && tot + n < sizeof(buf) - 7)
+    tot += n;
+  if(write(fd, "x", 1) >= 0){
+    printf("%s: write to /stats worked\n", s);
+    exit(1);
+  }
+  close(fd);
+  found = 0;
+  for(i = 0; i + 8 <= tot; i++)
+    if(memcmp(buf + i, "\nkalloc ", 8) == 0 && buf[i+8] >= '1' && buf[i+8] <= '9')
+      found = 1;
+  if(n != 0 || memcmp(buf, "bcache_hit ", 11) != 0 || !found){
+    printf("%s: /stats does not end or lacks counters\n", s);
+    exit(1);
+  }
+}
+
+// The value of counter name in /stats, or -1.
+static int
+statget(char *name)
+{
+  static char buf[4096];
+  int fd, n, tot, i, len;
+
+  if((fd = open("/stats", O_RDONLY)) < 0)
+    return -1;
+  tot = 0;
+  while((n = read(fd, buf + tot, sizeof(buf) - 1 - tot)) > 0)
+    tot += n;
+  close(fd);
+  buf[tot] = 0;
+  len = strlen(name);
+  for(i = 0; i + len < tot; i++)
+    if((i == 0 || buf[i-1] == '\n') && memcmp(buf + i, name, len) == 0 && buf[i+len] == ' ')
+      return atoi(buf + i + len + 1);
+  return -1;
+}
+
+// overwriting a file's data leaves its inode on disk alone.
+void
+iwritetest(char *s)
+{
+  static char buf[8192];
+  int fd, i, n0, n1;
+
+  if((fd = open("iwrite", O_CREATE|O_RDWR)) < 0 ||
+     write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if((n0 = statget("inode_write")) < 0){
+    printf("%s: no inode_write counter\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 20; i++){
+    if(pwrite(fd, "abc", 3, i * 100) != 3){
+      printf("%s: pwrite failed\n", s);
+      exit(1);
+    }
+  }
+  n1 = statget("inode_write");
+  if(n1 != n0){
+    printf("%s: %d inode writes for 20 overwrites\n", s, n1 - n0);
+    exit(1);
+  }
+  close(fd);
+  unlink("iwrite");
+}
+
+// Queue submission e on ring r.
+static void
+ringput(struct ring *r, int op, int fd, uint64 addr, int n, int off, uint64 data)
+{
+  struct ringsqe *e = &r->sq[r->sqtail % NRING];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = addr;
+  e->addr2 = 0;
+  e->n = n;
+  e->off = off;
+  e->data = data;
+  r->sqtail++;
+}
+
+// file system calls through a submission ring, several to
+// a ringenter(), complete in order and as the calls would.
+void
+ringtest(char *s)
+{
+  static int want[] = { 5, 5, 0, 0, 0, -1 };
+  struct ring *r;
+  struct ringcqe *c;
+  struct stat st, st2;
+  char buf[8];
+  int fd, i, pid, xst;
+
+  if((r = ringsetup()) == (struct ring*)-1){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  ringput(r, RING_OPEN, 0, (uint64)"ringf", O_CREATE|O_RDWR, 0, 99);
+  if(ringenter(1) != 1 || r->cqtail - r->cqhead != 1 || r->cq[r->cqhead % NRING].data != 99){
+    printf("%s: open through the ring failed\n", s);
+    exit(1);
+  }
+  fd = r->cq[r->cqhead++ % NRING].res;
+  if(fd < 0){
+    printf("%s: ring open returned %d\n", s, fd);
+    exit(1);
+  }
+
+  memset(buf, 0, sizeof(buf));
+  ringput(r, RING_WRITE, fd, (uint64)"hello", 5, -1, 0);
+  ringput(r, RING_READ, fd, (uint64)buf, 5, 0, 1);
+  ringput(r, RING_FSTAT, fd, (uint64)&st, 0, 0, 2);
+  ringput(r, RING_CLOSE, fd, 0, 0, 0, 3);
+  ringput(r, RING_STAT, 0, (uint64)"ringf", 0, 0, 4);
+  r->sq[(r->sqtail - 1) % NRING].addr2 = (uint64)&st2;
+  ringput(r, RING_READ, fd, (uint64)buf, 5, 0, 5);   // closed by now
+  if(ringenter(100) != 6){
+    printf("%s: ringenter did not run all 6\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 6; i++){
+    c = &r->cq[r->cqhead++ % NRING];
+    if(c->data != i || c->res != want[i]){
+      printf("%s: completion %d: data %d res %d\n", s, i, (int)c->data, c->res);
+      exit(1);
+    }
+  }
+  if(memcmp(buf, "hello", 5) != 0 || st.size != 5 || st2.size != 5 || st.ino != st2.ino){
+    printf("%s: ring calls did the wrong thing\n", s);
+    exit(1);
+  }
+  if(r->cqhead != r->cqtail || r->sqhead != r->sqtail){
+    printf("%s: ring not drained\n", s);
+    exit(1);
+  }
+
+  // the ring is not inherited.
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(ringenter(1) == -1 ? 0 : 1);
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child used the parent's ring\n", s);
+    exit(1);
+  }
+  unlink("ringf");
+}
+
+// a process may have more than NOFILE open files, gets the
+// lowest free descriptor, and a fork child gets them all.
+void
+manyfdtest(char *s)
+{
+  enum { N = 100 };
+  int fd, first, i, pid, xst;
+
+  first = dup(0);
+  for(i = first + 1; i < first + N; i++){
+    if((fd = dup(0)) != i){
+      printf("%s: dup gave %d, not %d\n", s, fd, i);
+      exit(1);
+    }
+  }
+  close(first + 40);
+  close(first + 20);
+  if(dup(0) != first + 20 || dup(0) != first + 40){
+    printf("%s: dup did not reuse the lowest descriptor\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = first; i < first + N; i++)
+      if(close(i) != 0)
+        exit(1);
+    exit(dup(0) == first ? 0 : 1);
+  }
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child did not get the descriptors\n", s);
+    exit(1);
+  }
+  for(i = first; i < first + N; i++){
+    if(close(i) != 0){
+      printf("%s: close %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  if(close(first + N) == 0 || close(-1) == 0){
+    printf("%s: close of a free descriptor worked\n", s);
+    exit(1);
+  }
+}
+
+// printf() output that is buffered when a process forks or
+// exits is written once, in order, and in one write() per
+// line.
+void
+stdiotest(char *s)
+{
+  static struct scstat sc[SYS_write+1];
+  char buf[16];
+  int fd, n, pid, xst;
+  uint64 w;
+
+  unlink("stdio");
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    if(open("stdio", O_CREATE|O_WRONLY) != 1)
+      exit(1);
+    printf("a");
+    if((pid = fork()) < 0)
+      exit(1);
+    if(pid == 0){
+      printf("b");
+      exit(0);
+    }
+    wait(0);
+    scstat(sc, SYS_write+1);
+    w = sc[SYS_write].count;
+    printf("c%d%s\n", 42, "xyz");
+    scstat(sc, SYS_write+1);
+    if(sc[SYS_write].count != w + 1)
+      printf("too many writes\n");
+    printf("d");
+    exit(0);
+  }
+  wait(&xst);
+  if((fd = open("stdio", O_RDONLY)) < 0){
+    printf("%s: open stdio failed\n", s);
+    exit(1);
+  }
+  n = read(fd, buf, sizeof(buf)-1);
+  close(fd);
+  unlink("stdio");
+  buf[n < 0 ? 0 : n] = 0;
+  if(xst != 0 || strcmp(buf, "abc42xyz\nd") != 0){
+    printf("%s: wrote \"%s\"\n", s, buf);
+    exit(1);
+  }
+}
+
+// sbrk() allocates no memory until the pages are touched,
+// and then a page of zeros each.
+void
+lazysbrk(char *s)
+{
+  enum { BIG = 64*1024*1024 };
+  uint64 k, f;
+  char *a;
+  int i;
+
+  k = statget("kalloc");
+  f = statget("sbrk_fault");
+  if((a = sbrk(BIG)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(statget("kalloc") - k > 100){
+    printf("%s: sbrk allocated %d pages\n", s, (int)(statget("kalloc") - k));
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    if(a[i * (BIG/10)] != 0){
+      printf("%s: new heap is not zero\n", s);
+      exit(1);
+    }
+    a[i * (BIG/10) + 1] = i;
+  }
+  for(i = 0; i < 10; i++){
+    if(a[i * (BIG/10) + 1] != i){
+      printf("%s: lost a store\n", s);
+      exit(1);
+    }
+  }
+  if(statget("sbrk_fault") - f != 10){
+    printf("%s: %d faults, not 10\n", s, (int)(statget("sbrk_fault") - f));
+    exit(1);
+  }
+  if(sbrk(-BIG) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
+// rename() within a directory, over another file, and of
+// a directory to another parent, whose ".." follows it; and
+// the renames it must refuse.
+void
+renametest(char *s)
+{
+  struct stat st, st2;
+  char buf[4];
+  int fd;
+
+  unlink("rn.a");
+  unlink("rn.b");
+  if((fd = open("rn.a", O_CREATE|O_WRONLY)) < 0 || write(fd, "abc", 3) != 3){
+    printf("%s: create rn.a failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  stat("rn.a", &st);
+  if(rename("rn.a", "rn.b") != 0 || open("rn.a", O_RDONLY) >= 0 ||
+     stat("rn.b", &st2) != 0 || st2.ino != st.ino || st2.nlink != 1){
+    printf("%s: rename in the directory failed\n", s);
+    exit(1);
+  }
+  if((fd = open("rn.a", O_CREATE|O_WRONLY)) < 0){
+    printf("%s: create rn.a failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(rename("rn.b", "rn.a") != 0 || stat("rn.b", &st2) == 0 ||
+     (fd = open("rn.a", O_RDONLY)) < 0 || read(fd, buf, 3) != 3 ||
+     memcmp(buf, "abc", 3) != 0){
+    printf("%s: rename over a file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  mkdir("rn.d1");
+  mkdir("rn.d2");
+  mkdir("rn.d1/sub");
+  if(rename("rn.a", "rn.d1/sub/f") != 0 || rename("rn.d1/sub", "rn.d2/sub") != 0){
+    printf("%s: rename to another directory failed\n", s);
+    exit(1);
+  }
+  stat("rn.d2", &st);
+  if(stat("rn.d2/sub/..", &st2) != 0 || st2.ino != st.ino || st.nlink != 2 ||
+     stat("rn.d1", &st) != 0 || st.nlink != 1 ||
+     stat("rn.d2/sub/f", &st) != 0 || stat("rn.d1/sub", &st) == 0){
+    printf("%s: moved directory is wrong\n", s);
+    exit(1);
+  }
+  if(rename("rn.d2", "rn.d2/sub/x") == 0 || rename("rn.d1", "rn.d2") == 0 ||
+     rename("rn.d2/sub/f", "rn.d1") == 0 || rename("rn.d1", "rn.d2/sub/f") == 0 ||
+     rename("rn.nosuch", "rn.x") == 0 || rename("rn.d2/sub/f", "rn.d2/sub/..") == 0){
+    printf("%s: a bad rename worked\n", s);
+    exit(1);
+  }
+
+  // the cwd's ".." chain must follow a move of its parent.
+  if(rename("rn.d1", "rn.d2/sub/d1") != 0 || chdir("rn.d2/sub/d1") != 0 ||
+     rename("../../sub", "../../../rn.top") != 0 ||
+     stat("../../rn.top", &st) != 0 || stat("../../rn.d2/sub", &st) == 0 ||
+     chdir("../..") != 0){
+    printf("%s: rename of the cwd's parent failed\n", s);
+    exit(1);
+  }
+  unlink("rn.top/d1");
+  unlink("rn.top/f");
+  unlink("rn.top");
+  unlink("rn.d2");
+}
+
+// a mountpoint can't be renamed, renamed over, or unlinked.
+void
+renamemount(char *s)
+{
+  struct stat st, st1;
+
+  mkdir("/tmpfs");
+  if(mount("tmpfs", "/tmpfs") < 0 && (stat("/tmpfs", &st) < 0 || st.dev == ROOTDEV)){
+    printf("%s: mount tmpfs failed\n", s);
+    exit(1);
+  }
+  stat("/tmpfs", &st);
+  unlink("/rn.mnt");
+  if(mkdir("/rn.mnt") != 0){
+    printf("%s: mkdir /rn.mnt failed\n", s);
+    exit(1);
+  }
+  if(rename("/tmpfs", "/rn.x") == 0 || rename("/rn.mnt", "/tmpfs") == 0 ||
+     unlink("/tmpfs") == 0){
+    printf("%s: a mountpoint was renamed or removed\n", s);
+    exit(1);
+  }
+  if(stat("/tmpfs", &st1) < 0 || st1.dev != st.dev || st1.ino != ROOTINO ||
+     stat("/rn.mnt", &st1) < 0 || st1.dev != ROOTDEV){
+    printf("%s: mount is wrong after a refused rename\n", s);
+    exit(1);
+  }
+  unlink("/rn.mnt");
+}
+
+// a small file lives in its inode: writing it allocates no
+// block, and it reads back the same after growing out of the
+// inode, and through mmap(), which it can be stored through.
+void
+inlinetest(char *s)
+{
+  static char buf[200];
+  char *p;
+  int fd, i, b0;
+
+  if((b0 = statget("balloc")) < 0){
+    printf("%s: no balloc counter\n", s);
+    exit(1);
+  }
+  if((fd = open("inline", O_CREATE|O_RDWR)) < 0 ||
+     write(fd, "hello", 5) != 5 || pwrite(fd, "world", 5, 20) != 5){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(statget("balloc") != b0){
+    printf("%s: a 25-byte file took blocks\n", s);
+    exit(1);
+  }
+  if((fd = open("inline", O_RDONLY)) < 0 || read(fd, buf, sizeof(buf)) != 25 ||
+     memcmp(buf, "hello", 5) != 0 || memcmp(buf + 20, "world", 5) != 0 || buf[10] != 0){
+    printf("%s: read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if((fd = open("inline", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, 4096, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == (char*)-1 || memcmp(p, "hello", 5) != 0 || memcmp(p + 20, "world", 5) != 0){
+    printf("%s: mmap of inline file wrong\n", s);
+    exit(1);
+  }
+  munmap(p, 4096);
+
+  // stores through a shared mapping and write() see each other.
+  if((fd = open("inline", O_RDWR)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: writable mmap of inline file failed\n", s);
+    exit(1);
+  }
+  p[0] = 'H';
+  if(pread(fd, buf, 5, 0) != 5 || memcmp(buf, "Hello", 5) != 0){
+    printf("%s: read() missed a store through mmap\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "W", 1, 20) != 1 || p[20] != 'W' || p[0] != 'H'){
+    printf("%s: write() and mmap disagree\n", s);
+    exit(1);
+  }
+  munmap(p, 4096);
+  close(fd);
+  if((fd = open("inline", O_RDONLY)) < 0 || read(fd, buf, sizeof(buf)) != 25 ||
+     memcmp(buf, "Hello", 5) != 0 || memcmp(buf + 20, "World", 5) != 0){
+    printf("%s: stores through mmap lost\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if((fd = open("inline", O_RDWR)) < 0 || pwrite(fd, buf, sizeof(buf), 25) != sizeof(buf)){
+    printf("%s: grow failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  memset(buf, 0, sizeof(buf));
+  if((fd = open("inline", O_RDONLY)) < 0 || read(fd, buf, 30) != 30 ||
+     memcmp(buf, "Hello", 5) != 0 || memcmp(buf + 20, "Worldabcde", 10) != 0){
+    printf("%s: grown file read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("inline");
+}
+
+// unlinking a large file leaves its blocks to ireclaimd,
+// which frees them soon after.
+void
+reclaimtest(char *s)
+{
+  static char buf[8192];
+  int fd, i, n0, t;
+
+  if((n0 = statget("inode_reclaim")) < 0){
+    printf("%s: no inode_reclaim counter\n", s);
+    exit(1);
+  }
+  if((fd = open("reclaim", O_CREATE|O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 40; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(unlink("reclaim") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  if(open("reclaim", O_RDONLY) >= 0){
+    printf("%s: unlinked file still there\n", s);
+    exit(1);
+  }
+  for(t = 0; statget("inode_reclaim") == n0; t++){
+    if(t > 100){
+      printf("%s: blocks of unlinked file never freed\n", s);
+      exit(1);
+    }
+    sleep(1);
+  }
+}
+
+// turn on a subsystem of the kernel log, and find what
+// a system call logged in /klog.
+void
+klogtest(char *s)
+{
+  static char buf[8192];
+  int fd, n, tot, i, found;
+
+  fd = open("/klog", O_RDWR);
+  if(fd < 0){
+    printf("%s: open /klog failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "nosuch 1", 8) >= 0 || write(fd, "vfs 9", 5) >= 0){
+    printf("%s: bad /klog setting worked\n", s);
+    exit(1);
+  }
+  if(write(fd, "sysfile 4", 9) != 9){
+    printf("%s: cannot set sysfile level\n", s);
+    exit(1);
+  }
+  close(open("klogf", O_CREATE|O_RDWR));
+  unlink("klogf");
+  write(fd, "sysfile 0", 9);
+  close(fd);
+
+  fd = open("/klog", O_RDONLY);
+  tot = 0;
+  while((n = read(fd, buf + tot, sizeof(buf) - tot)) > 0)
+    tot += n;
+  close(fd);
+  found = 0;
+  for(i = 0; i + 22 <= tot; i++)
+    if(memcmp(buf + i, "sysfile: create: klogf", 22) == 0)
+      found = 1;
+  if(!found){
+    printf("%s: create not in /klog\n", s);
+    exit(1);
+  }
+}
+
+// trace system call entries, and find ours among the
+// records drained from /trace.
+void
+tracetest(char *s)
+{
+  static struct tracerec recs[128];
+  char mask[8];
+  int fd, n, i, found, pid;
+
+  fd = open("/trace", O_RDWR);
+  if(fd < 0){
+    printf("%s: open /trace failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "xyz", 3) >= 0){
+    printf("%s: bad mask worked\n", s);
+    exit(1);
+  }
+  while(read(fd, recs, sizeof(recs)) > 0)
+    ;
+  // 1 << TR_SYSENTER, in hex
+  mask[0] = "0123456789abcdef"[(1 << (TR_SYSENTER % 4))];
+  for(i = 1; i <= TR_SYSENTER / 4; i++)
+    mask[i] = '0';
+  mask[i] = 0;
+  if(write(fd, mask, i) != i){
+    printf("%s: cannot set mask\n", s);
+    exit(1);
+  }
+  pid = getpid();
+  write(fd, "0", 1);
+
+  found = 0;
+  while((n = read(fd, recs, sizeof(recs))) > 0){
+    if(n % sizeof(struct tracerec) != 0){
+      printf("%s: partial record\n", s);
+      exit(1);
+    }
+    for(i = 0; i < n / sizeof(struct tracerec); i++)
+      if(recs[i].event == TR_SYSENTER && recs[i].a == SYS_getpid && recs[i].pid == pid)
+        found = 1;
+  }
+  close(fd);
+  if(!found){
+    printf("%s: getpid not traced\n", s);
+    exit(1);
+  }
+}
+
+// the getpid() counters grow by the calls we make, and
+// the histogram adds up to the count.
+void
+scstattest(char *s)
+{
+  static struct scstat a[SYS_scstat+1], b[SYS_scstat+1];
+  uint64 tot;
+  int i, n;
+
+  if((n = scstat(a, SYS_scstat+1)) <= SYS_scstat){
+    printf("%s: scstat returned %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++)
+    getpid();
+  scstat(b, SYS_scstat+1);
+  tot = 0;
+  for(i = 0; i < NSCHIST; i++)
+    tot += b[SYS_getpid].hist[i];
+  if(b[SYS_getpid].count < a[SYS_getpid].count + 10 || tot != b[SYS_getpid].count){
+    printf("%s: getpid counters wrong\n", s);
+    exit(1);
+  }
+  if(scstat(a, -1) >= 0){
+    printf("%s: scstat(-1) worked\n", s);
+    exit(1);
+  }
+}
+
+// nsec() never goes back, and a clock tick shows in it.
+void
+nsectest(char *s)
+{
+  uint64 t0, t1, t;
+  int i;
+
+  t0 = t = nsec();
+  for(i = 0; i < 1000; i++){
+    t1 = nsec();
+    if(t1 < t){
+      printf("%s: nsec went back\n", s);
+      exit(1);
+    }
+    t = t1;
+  }
+  sleep(1);
+  t1 = nsec();
+  if(t1 - t0 < 1000000){
+    printf("%s: sleep(1) took %l ns\n", s, t1 - t0);
+    exit(1);
+  }
+}
+
+// clockns() agrees with nsec(), and the vdso page can be
+// read but not written.
+void
+vdsotest(char *s)
+{
+  uint64 a, b, c;
+  int pid, xstatus;
+
+  a = clockns();
+  b = nsec();
+  c = clockns();
+  if(a > b || b > c){
+    printf("%s: clockns %l %l around nsec %l\n", s, a, c, b);
+    exit(1);
+  }
+  if(((struct vdso*)VDSO)->ticks > uptime()){
+    printf("%s: vdso ticks ahead of uptime\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    ((struct vdso*)VDSO)->ticks = 0;
+    printf("%s: wrote the vdso page\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    exit(1);
+}
+
+// sleep() lasts as long as asked, and the CPUs take few timer
+// interrupts meanwhile, where a periodic tick would have been
+// 20 on each.
+void
+ticklesstest(char *s)
+{
+  uint64 t0, t1;
+  int n0, n1;
+
+  n0 = statget("timer_intr");
+  t0 = nsec();
+  sleep(20);
+  t1 = nsec();
+  n1 = statget("timer_intr");
+  if(n0 < 0 || n1 < 0){
+    printf("%s: no timer_intr counter\n", s);
+    exit(1);
+  }
+  if(t1 - t0 < 2000000000){
+    printf("%s: sleep(20) took %l ns\n", s, t1 - t0);
+    exit(1);
+  }
+  if(n1 - n0 >= 20){
+    printf("%s: %d timer interrupts in sleep(20)\n", s, n1 - n0);
+    exit(1);
+  }
+}
+
+// if the kernel counts locks, the inode table's was used.
+void
+lockstattest(char *s)
+{
+  static struct lockstat ls[NLOCKSTAT];
+  int n, i;
+
+  if((n = lockstat(ls, NLOCKSTAT)) < 0)
+    return;   // built without LOCKSTAT
+  if(n > NLOCKSTAT)
+    n = NLOCKSTAT;
+  for(i = 0; i < n; i++)
+    if(strcmp(ls[i].name, "itable") == 0 && !ls[i].sleep)
+      break;
+  if(i == n || ls[i].acquires == 0 || ls[i].contended > ls[i].acquires){
+    printf("%s: no sensible itable counters\n", s);
+    exit(1);
+  }
+}
+
+// Writes far past the end of a file leave holes, which read
+// as zeros, and can be stored to through mmap().
+void
+sparsetest(char *s)
+{
+  enum { OFF = 200*1024 };
+  static char buf[8192];
+  struct stat st;
+  char *p;
+  int fd, i, n;
+
+  unlink("sparse");
+  if((fd = open("sparse", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "a", 1, 10) != 1 || pwrite(fd, "z", 1, OFF) != 1){
+    printf("%s: write past the end failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != OFF + 1){
+    printf("%s: size %d, expected %d\n", s, (int)st.size, OFF + 1);
+    exit(1);
+  }
+  for(i = 0; i < OFF; i += sizeof(buf)){
+    memset(buf, 'x', sizeof(buf));
+    if(pread(fd, buf, sizeof(buf), i) != sizeof(buf)){
+      printf("%s: pread at %d failed\n", s, i);
+      exit(1);
+    }
+    if(i == 0 && buf[10] == 'a')
+      buf[10] = 0;
+    for(n = 0; n < sizeof(buf); n++)
+      if(buf[n] != 0)
+        break;
+    if(n != sizeof(buf)){
+      printf("%s: hole at %d does not read as zeros\n", s, i + n);
+      exit(1);
+    }
+  }
+  if(pread(fd, buf, 2, OFF) != 1 || buf[0] != 'z'){
+    printf("%s: last byte lost\n", s);
+    exit(1);
+  }
+
+  // a store through mmap() gives a hole page its blocks.
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 100*1024);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 0){
+    printf("%s: mapped hole is not zero\n", s);
+    exit(1);
+  }
+  p[7] = 'm';
+  munmap(p, 4096);
+  fsync(fd);
+  if(pread(fd, buf, 8, 100*1024) != 8 || buf[7] != 'm'){
+    printf("%s: store to a mapped hole lost\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sparse");
+}
+
+// A file whose last page is only partly backed by blocks,
+// and a sparse one, read back after memory pressure has
+// pushed their pages out of the page cache.
+void
+pagetailtest(char *s)
+{
+  enum { N = 1500, OFF = 9000 };
+  static char buf[N];
+  char *m1, *m2;
+  int fd, i, pid, xstatus;
+
+  unlink("pagetail");
+  unlink("pagehole");
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 23;
+  if((fd = open("pagetail", O_CREATE|O_RDWR)) < 0 ||
+     write(fd, buf, N) != N){
+    printf("%s: write pagetail failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("pagehole", O_CREATE|O_RDWR)) < 0 ||
+     pwrite(fd, "h", 1, OFF) != 1){
+    printf("%s: write pagehole failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // use up memory so that kalloc() drops clean cached pages.
+  if((pid = fork()) == 0){
+    m1 = 0;
+    while((m2 = malloc(10001)) != 0){
+      *(char**)m2 = m1;
+      m1 = m2;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+
+  memset(buf, 0, N);
+  if((fd = open("pagetail", O_RDONLY)) < 0 || read(fd, buf, N) != N){
+    printf("%s: read pagetail failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++)
+    if(buf[i] != 'a' + i % 23){
+      printf("%s: pagetail byte %d wrong\n", s, i);
+      exit(1);
+    }
+
+  if((fd = open("pagehole", O_RDONLY)) < 0){
+    printf("%s: open pagehole failed\n", s);
     exit(1);
   }
-
-  n = 0;
-  for(;;){
-    i = read(fd, buf, BSIZE);
-    if(i == 0){
-      if(n == MAXFILE - 1){
-        printf("%s: read only %d blocks from big", s, n);
-        exit(1);
-      }
-      break;
-    } else if(i != BSIZE){
-      printf("%s: read failed %d\n", s, i);
+  for(i = 0; i < OFF; i += N){
+    memset(buf, 'x', N);
+    if(read(fd, buf, N) != N){
+      printf("%s: read pagehole at %d failed\n", s, i);
       exit(1);
     }
-    if(((int*)buf)[0] != n){
-      printf("%s: read content of block %d is %d\n", s,
-             n, ((int*)buf)[0]);
+    if(buf[0] != 0 || buf[N-1] != 0){
+      printf("%s: hole at %d does not read as zeros\n", s, i);
       exit(1);
     }
-    n++;
   }
-  close(fd);
-  if(unlink("big") < 0){
-    printf("%s: unlink big failed\n", s);
+  if(read(fd, buf, N) != 1 || buf[0] != 'h'){
+    printf("%s: last byte of pagehole lost\n", s);
     exit(1);
   }
+  close(fd);
+  unlink("pagetail");
+  unlink("pagehole");
 }
 
-// many creates, followed by unlink test
+// Processes reading one file, and looking up names in one
+// directory, at the same time, through open files of their own.
 void
-createtest(char *s)
+sharedreadtest(char *s)
 {
-  int i, fd;
-  enum { N=52 };
-
-  char name[3];
-  name[0] = 'a';
-  name[2] = '\0';
-  for(i = 0; i < N; i++){
-    name[1] = '0' + i;
-    fd = open(name, O_CREATE|O_RDWR);
-    close(fd);
-  }
-  name[0] = 'a';
-  name[2] = '\0';
-  for(i = 0; i < N; i++){
-    name[1] = '0' + i;
-    unlink(name);
-  }
-}
+  enum { N = 16*4096 + 100, NCHILD = 4 };
+  static char buf[N];
+  char name[16];
+  int fd, i, j, n, pid, xstatus;
 
-void dirtest(char *s)
-{
-  if(mkdir("dir0") < 0){
+  if(mkdir("shrd") < 0){
     printf("%s: mkdir failed\n", s);
     exit(1);
   }
-
-  if(chdir("dir0") < 0){
-    printf("%s: chdir dir0 failed\n", s);
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 23;
+  fd = open("shrd/f", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: create shrd/f failed\n", s);
     exit(1);
   }
+  close(fd);
 
-  if(chdir("..") < 0){
-    printf("%s: chdir .. failed\n", s);
-    exit(1);
+  for(i = 0; i < NCHILD; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < 10; j++){
+        if((fd = open("shrd/f", O_RDONLY)) < 0){
+          printf("%s: open shrd/f failed\n", s);
+          exit(1);
+        }
+        memset(buf, 0, N);
+        for(n = 0; n < N; n += i + 1000)
+          if(read(fd, buf + n, i + 1000) <= 0)
+            break;
+        close(fd);
+        for(n = 0; n < N; n++)
+          if(buf[n] != 'a' + n % 23)
+            break;
+        if(n != N){
+          printf("%s: byte %d of shrd/f is wrong\n", s, n);
+          exit(1);
+        }
+        strcpy(name, "shrd/x");
+        name[5] = 'a' + j;
+        if(open(name, O_RDONLY) >= 0){
+          printf("%s: opened %s\n", s, name);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
   }
-
-  if(unlink("dir0") < 0){
-    printf("%s: unlink dir0 failed\n", s);
-    exit(1);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
   }
+  unlink("shrd/f");
+  unlink("shrd");
 }
 
+// sendfile() from a file to a pipe and to another file.
 void
-exectest(char *s)
+sendfiletest(char *s)
 {
-  int fd, xstatus, pid;
-  char *echoargv[] = { "echo", "OK", 0 };
-  char buf[3];
+  enum { N = 3*4096 + 100 };
+  int fd, fd2, fds[2], pid, xstatus, i, n, tot;
+  static char buf[N];
 
-  unlink("echo-ok");
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 23;
+  fd = open("sendf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: create sendf failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
   pid = fork();
-  if(pid < 0) {
-     printf("%s: fork failed\n", s);
-     exit(1);
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
   }
-  if(pid == 0) {
-    close(1);
-    fd = open("echo-ok", O_CREATE|O_WRONLY);
-    if(fd < 0) {
-      printf("%s: create failed\n", s);
-      exit(1);
-    }
-    if(fd != 1) {
-      printf("%s: wrong fd\n", s);
-      exit(1);
-    }
-    if(exec("echo", echoargv) < 0){
-      printf("%s: exec echo failed\n", s);
+  if(pid == 0){
+    close(fds[1]);
+    tot = 0;
+    while((n = read(fds[0], buf + tot, N - tot)) > 0)
+      tot += n;
+    for(i = 0; i < N; i++)
+      if(buf[i] != 'a' + i % 23)
+        break;
+    if(tot != N || i != N){
+      printf("%s: pipe got %d bytes, %d right\n", s, tot, i);
       exit(1);
     }
-    // won't get to here
+    exit(0);
   }
-  if (wait(&xstatus) != pid) {
-    printf("%s: wait failed!\n", s);
+  close(fds[0]);
+  lseek(fd, 0, SEEK_SET);
+  if((n = sendfile(fds[1], fd, N + 10)) != N){
+    printf("%s: sendfile to a pipe returned %d\n", s, n);
+    exit(1);
   }
+  close(fds[1]);
+  wait(&xstatus);
   if(xstatus != 0)
-    exit(xstatus);
+    exit(1);
+  if(sendfile(fds[0], fd, 1) != -1 || sendfile(1, fds[0], 1) != -1){
+    printf("%s: sendfile on a closed fd worked\n", s);
+    exit(1);
+  }
 
-  fd = open("echo-ok", O_RDONLY);
-  if(fd < 0) {
-    printf("%s: open failed\n", s);
+  fd2 = open("sendf2", O_CREATE|O_RDWR);
+  if(fd2 < 0){
+    printf("%s: create sendf2 failed\n", s);
     exit(1);
   }
-  if (read(fd, buf, 2) != 2) {
-    printf("%s: read failed\n", s);
+  if(sendfile(fd2, fd, N) != 0){
+    printf("%s: sendfile at the end of the file copied data\n", s);
     exit(1);
   }
-  unlink("echo-ok");
-  if(buf[0] == 'O' && buf[1] == 'K')
-    exit(0);
-  else {
-    printf("%s: wrong output\n", s);
+  lseek(fd, 100, SEEK_SET);
+  if((n = sendfile(fd2, fd, N)) != N - 100){
+    printf("%s: sendfile to a file returned %d\n", s, n);
     exit(1);
   }
-
+  memset(buf, 0, N);
+  if(pread(fd2, buf, N, 0) != N - 100){
+    printf("%s: sendf2 has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N - 100; i++){
+    if(buf[i] != 'a' + (i + 100) % 23){
+      printf("%s: sendf2 is wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(fd2);
+  unlink("sendf");
+  unlink("sendf2");
 }
 
 // simple fork and pipe read/write
@@ -1994,6 +3772,207 @@ forktest(char *s)
   }
 }
 
+// mmap() a file: private pages are private, shared
+// pages reach the file, and a fork child sees the pages.
+void
+mmaptest(char *s)
+{
+  enum { SZ = 2*PGSIZE + PGSIZE/2 };
+  int fd, i, pid, xstatus;
+  char *p, c;
+
+  fd = open("mmap", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    c = 'A' + i % 23;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  // private: the file must not change.
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(p[i] != 'A' + i % 23){
+      printf("%s: mapped byte %d is %d\n", s, i, p[i]);
+      exit(1);
+    }
+  }
+  // the page past the end of the file reads as 0.
+  if(p[SZ] != 0 || p[3*PGSIZE-1] != 0){
+    printf("%s: tail of the last page is not zero\n", s);
+    exit(1);
+  }
+  p[0] = 'x';
+  if(munmap(p, SZ) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, &c, 1, 0) != 1 || c != 'A'){
+    printf("%s: private store reached the file\n", s);
+    exit(1);
+  }
+
+  // shared, with the descriptor closed: stores reach the file
+  // at munmap, and write() can copy out of a page that
+  // has not been touched yet.
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  fd = open("mmap2", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, p + PGSIZE, 10) != 10){
+    printf("%s: write from a mapped page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmap2");
+  p[1] = 'y';
+  p[SZ-1] = 'z';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[1] != 'y' || p[2*PGSIZE] != 'A' + (2*PGSIZE) % 23)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw the wrong pages\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) < 0 || munmap(p + PGSIZE, SZ - PGSIZE) < 0){
+    printf("%s: munmap of the pieces failed\n", s);
+    exit(1);
+  }
+  fd = open("mmap", O_RDONLY);
+  if(pread(fd, &c, 1, 1) != 1 || c != 'y' ||
+     pread(fd, &c, 1, SZ-1) != 1 || c != 'z'){
+    printf("%s: shared stores did not reach the file\n", s);
+    exit(1);
+  }
+
+  // no writable shared mapping of a read-only descriptor.
+  if(mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("%s: mmap shared writable of O_RDONLY succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmap");
+}
+
+// a shared mapping, read() and write() all see one copy
+// of the file's pages, before any munmap().
+void
+mmapcoherent(char *s)
+{
+  int fd, pid, xstatus;
+  char *p, buf[4];
+
+  fd = open("mmapco", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "abcd", 4) != 4){
+    printf("%s: create mmapco failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 'x';
+  if(pread(fd, buf, 1, 0) != 1 || buf[0] != 'x'){
+    printf("%s: read() did not see a store\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "y", 1, 1) != 1 || p[1] != 'y'){
+    printf("%s: the mapping did not see a write()\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[2] = 'z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[2] != 'z'){
+    printf("%s: parent did not see the child's store\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 4, 0) != 4 || memcmp(buf, "xyzd", 4) != 0){
+    printf("%s: file has the wrong contents\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapco");
+}
+
+// fork() of a process that uses more than half of memory
+// must share the pages rather than copy them; a store by
+// either side must not show in the other.
+void
+cowfork(char *s)
+{
+  uint64 sz = (PHYSTOP - KERNBASE) / 3 * 2;
+  int pid, xstatus;
+  char *a, *p;
+
+  a = sbrk(sz);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, sz);
+    exit(1);
+  }
+  for(p = a; p < a + sz; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + sz; p += PGSIZE){
+      if(*(uint64*)p != (uint64)p){
+        printf("%s: child sees the wrong data\n", s);
+        exit(1);
+      }
+      *(uint64*)p = 0;
+    }
+    exit(0);
+  }
+  for(p = a; p < a + sz / 2; p += PGSIZE)
+    *(uint64*)(p + 8) = 1;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  for(p = a; p < a + sz; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: parent sees the child's store\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-sz);
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2590,11 +4569,45 @@ struct test {
   {iputtest, "iput"},
   {opentest, "opentest"},
   {writetest, "writetest"},
+  {fsynctest, "fsynctest"},
+  {readahead, "readahead"},
+  {dcache, "dcache"},
+  {getdentstest, "getdents"},
+  {dotdot, "dotdot"},
+  {preadtest, "pread"},
+  {iovtest, "iov"},
+  {lseektest, "lseek"},
+  {appendtest, "append"},
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipebig, "pipebig"},
+  {pipekill, "pipekill"},
+  {sendfiletest, "sendfile"},
+  {mounttest, "mount"},
+  {tmpfstest, "tmpfs"},
+  {statstest, "stats"},
+  {klogtest, "klog"},
+  {tracetest, "trace"},
+  {scstattest, "scstat"},
+  {nsectest, "nsec"},
+  {vdsotest, "vdso"},
+  {ticklesstest, "tickless"},
+  {lockstattest, "lockstat"},
+  {sharedreadtest, "sharedread"},
+  {sparsetest, "sparse"},
+  {iwritetest, "iwrite"},
+  {reclaimtest, "reclaim"},
+  {inlinetest, "inline"},
+  {ringtest, "ring"},
+  {manyfdtest, "manyfd"},
+  {stdiotest, "stdio"},
+  {lazysbrk, "lazysbrk"},
+  {renametest, "rename"},
+  {renamemount, "renamemount"},
+  {pagetailtest, "pagetail"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2635,6 +4648,9 @@ struct test {
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
+  {mmaptest, "mmap"},
+  {mmapcoherent, "mmapcoherent"},
+  {cowfork, "cowfork"},
   {badarg, "badarg" },
 
   { 0, 0},
@@ -2649,6 +4665,15 @@ struct test fstests1[] = {
   {iputtest, "iput"},
   {opentest, "opentest"},
   {writetest, "writetest"},
+  {fsynctest, "fsynctest"},
+  {readahead, "readahead"},
+  {dcache, "dcache"},
+  {getdentstest, "getdents"},
+  {dotdot, "dotdot"},
+  {preadtest, "pread"},
+  {iovtest, "iov"},
+  {lseektest, "lseek"},
+  {appendtest, "append"},
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
@@ -6,24 +6,43 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry(name) makes name() for SYS_name; entry(stub, name) makes
+# stub() for it instead, for the calls that ulib.c wraps.
 sub entry {
     my $name = shift;
+    my $sys = shift || $name;
     print ".global $name\n";
     print "${name}:\n";
-    print " li a7, SYS_${name}\n";
+    print " li a7, SYS_${sys}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("_fork", "fork");
+entry("_exit", "exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
 entry("close");
+entry("fsync");
+entry("getdents");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("lseek");
+entry("mmap");
+entry("munmap");
+entry("sendfile");
+entry("mount");
+entry("scstat");
+entry("nsec");
+entry("lockstat");
+entry("ringsetup");
+entry("ringenter");
 entry("kill");
-entry("exec");
+entry("_exec", "exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -36,3 +55,4 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("rename");